@@ -58,9 +58,13 @@
 /* LCD HW settings */
 /* LCDPort contains 4-bit data D0 to D3*/
 /* LCDPort must be assigned to the chosen port */
+#ifndef LCDPort
 #define LCDPort GPIOB
+#endif
 /* Pins E and RS of LCD must be assigned to LCDControlPort*/
+#ifndef LCDControlPort
 #define LCDControlPort GPIOC
+#endif
 /* Define port where LCD Power is connected */
 #define LCDPwrPort GPIOE
 /* LCD Power Supply pin is assigned to Px5 */
@@ -69,8 +73,32 @@
 #define LCD_Enable GPIO_PIN_1
 /* LCD RS pin is assigned to Px2 */
 #define LCD_RS GPIO_PIN_2
+/* Set LCD_BUSY_FLAG to 1 if the R/W pin of the LCD is connected: instead of waiting the worst
+ * case execution time, the busy flag is read after every byte (fixed delays otherwise) */
+#ifndef LCD_BUSY_FLAG
+#define LCD_BUSY_FLAG 0
+#endif
+/* LCD R/W pin is assigned to Px3 */
+#define LCD_RW GPIO_PIN_3
 /* HD44780 CGRAM address start */
 #define CGRAM_address_start 0x40
+/* Display size (characters) */
+#define LCD_ROWS 4
+#define LCD_COLS 16
+/* Character of the display ROM (A00) that is completely filled */
+#define LCD_FULL_BLOCK 0xFF
+/* Glyph ids for LCD_GLYPH(): partial bar graph characters (1-4 columns filled), ids from
+ * LCD_GLYPH_USER on are free for the application */
+#define LCD_GLYPH_BAR_1 0x00
+#define LCD_GLYPH_BAR_4 0x03
+#define LCD_GLYPH_USER 0x10
+#define LCD_GLYPH_NONE 0xFFFF
+/* Fraction bits of the fixed-point values printed with %T (DS18B20 temperatures: 1/16 degree) */
+#define LCD_FIXED_FRACTION_BITS 4
+/* Number of bytes (commands or characters) that can wait to be sent */
+#define LCD_QUEUE_LENGTH 64
+/* Preemption priority of the timer interrupt (TIM6) sending the queued bytes */
+#define LCD_IRQ_PRIORITY 3
 
 /* Exported constants --------------------------------------------------------*/
 /* Exported macros ------------------------------------------------------------*/
@@ -81,6 +109,7 @@
  * @{
  */
 void LCD_LOAD_CGRAM(char tab[], uint8_t charnum);
+uint8_t LCD_GLYPH(uint16_t id, const char bitmap[8]);
 void LCD_PWRON(void);
 void LCD_PWROFF(void);
 void LCD_INIT(void);
@@ -96,6 +125,19 @@ void LCD_DISP_ON(void);
 void LCD_DISP_OFF(void);
 void LCD_LOCATE(uint8_t row, uint8_t column);
 void LCD_printf(const char *fmt, ...);
+void LCD_WAIT(void);
+uint8_t LCD_BUSY(void);
+void LCD_IRQHandler(void);
+
+void LCD_FB_CLEAR(void);
+void LCD_FB_LOCATE(uint8_t row, uint8_t column);
+void LCD_FB_printchar(unsigned char ascode);
+void LCD_FB_printstring(const char *text);
+void LCD_FB_printf(const char *fmt, ...);
+void LCD_FB_BAR(uint8_t row, uint8_t column, uint8_t width, uint16_t value,
+		uint16_t max);
+uint16_t LCD_FB_FLUSH(void);
+void LCD_FB_INVALIDATE(void);
 
 #endif /* __HD44780_H */
 
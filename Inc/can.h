@@ -54,7 +54,20 @@
 extern CAN_HandleTypeDef hcan;
 
 /* USER CODE BEGIN Private defines */
+/* Bit rate set by MX_CAN_Init() (can be changed with can_set_bitrate() at runtime) */
+#define CAN_BITRATE				500000
+/* Sample point in 1/1000 of the bit time (87.5% as recommended by CANopen) */
+#define CAN_SAMPLE_POINT		875
+/* Time can_set_bitrate() waits for entering or leaving the initialization mode (as the HAL) */
+#define CAN_INIT_TIMEOUT_US		10000
 
+/* Bit timing: length of the segments in time quanta (TQ) and prescaler of the CAN clock */
+typedef struct {
+	uint16_t prescaler;	// 1..1024
+	uint8_t bs1;		// 1..16 TQ
+	uint8_t bs2;		// 1..8 TQ
+	uint8_t sjw;		// 1..4 TQ
+} CAN_Bit_Timing;
 /* USER CODE END Private defines */
 
 extern void _Error_Handler(char *, int);
@@ -62,6 +75,9 @@ extern void _Error_Handler(char *, int);
 void MX_CAN_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+int can_bit_timing(uint32_t clock, uint32_t bitrate, uint16_t sample_point,
+		CAN_Bit_Timing *timing);
+int can_set_bitrate(uint32_t bitrate);
 
 /* USER CODE END Prototypes */
 
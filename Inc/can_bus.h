@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * @file    can_bus.h
+ * @brief  Interrupt driven CAN transmit and receive queues
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef CAN_BUS_H_
+#define CAN_BUS_H_
+
+#include "stm32f3xx_hal.h"
+
+/** Number of frames the transmit queue holds (power of two) */
+#define CAN_BUS_TX_QUEUE_LENGTH		16
+/** Number of frames the receive queue holds (power of two) */
+#define CAN_BUS_RX_QUEUE_LENGTH		32
+
+/** Preemption priority of the CAN interrupts (transmit and both receive FIFOs) */
+#define CAN_BUS_IRQ_PRIORITY		2
+
+/* Flags of #CAN_Bus_Frame */
+#define CAN_BUS_FLAG_EXT			0x01	// 29 bit identifier (11 bit otherwise)
+#define CAN_BUS_FLAG_RTR			0x02	// remote frame
+
+/**
+ * A CAN frame as it is queued for sending or has been received.
+ */
+typedef struct {
+	uint32_t id;		// 11 or 29 bit identifier
+	uint8_t flags;		// CAN_BUS_FLAG_*
+	uint8_t dlc;		// number of data bytes (0..8)
+	uint8_t filter;		// received frames: index of the filter that matched (FMI)
+	uint8_t fifo;		// received frames: FIFO the frame was received in (0 or 1)
+	uint8_t data[8];
+} CAN_Bus_Frame;
+
+/**
+ * Counters of frames lost on the receive side, per FIFO.
+ */
+typedef struct {
+	uint32_t overrun[2];	// frames lost in the hardware FIFO (FOVR)
+	uint32_t dropped[2];	// frames dropped because the receive queue was full
+} CAN_Bus_Counters;
+
+void can_bus_init(void);
+int can_bus_send(const CAN_Bus_Frame *frame);
+int can_bus_receive(CAN_Bus_Frame *frame);
+uint16_t can_bus_tx_pending(void);
+uint16_t can_bus_rx_pending(void);
+const CAN_Bus_Counters *can_bus_counters(void);
+
+void can_bus_tx_irq_handler(void);
+void can_bus_rx_irq_handler(uint8_t fifo);
+
+#endif /* CAN_BUS_H_ */
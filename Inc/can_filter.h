@@ -0,0 +1,31 @@
+/**
+ ******************************************************************************
+ * @file    can_filter.h
+ * @brief  Packs the CAN identifiers the modules subscribe to into the bxCAN filter banks
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef CAN_FILTER_H_
+#define CAN_FILTER_H_
+
+#include "stm32f3xx_hal.h"
+#include "can_bus.h"
+
+/** Number of filter banks of the bxCAN */
+#define CAN_FILTER_BANKS				14
+
+/** Number of entries of the subscription table (a range can take several entries) */
+#define CAN_FILTER_MAX_SUBSCRIPTIONS	32
+
+/* Priorities of a subscription: the FIFO the frames are received in */
+#define CAN_FILTER_HIGH					0	// FIFO0
+#define CAN_FILTER_LOW					1	// FIFO1
+
+void can_filter_clear(void);
+int can_filter_subscribe(uint32_t id, uint8_t flags, uint8_t priority);
+int can_filter_subscribe_range(uint32_t first, uint32_t last, uint8_t flags,
+		uint8_t priority);
+int can_filter_apply(void);
+
+#endif /* CAN_FILTER_H_ */
@@ -0,0 +1,74 @@
+/**
+ ******************************************************************************
+ * @file    can_stats.h
+ * @brief  CAN bus load, transmit latency and error statistics
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef CAN_STATS_H_
+#define CAN_STATS_H_
+
+#include "can_bus.h"
+#include "profile.h"
+
+/** Number of priority classes the transmit latency is recorded for (see CAN_STATS_CLASS()) */
+#define CAN_STATS_CLASSES			4
+/** Priority class of an identifier: the two most significant identifier bits (0 = highest) */
+#define CAN_STATS_CLASS(id, flags)	(((flags) & CAN_BUS_FLAG_EXT) ? ((id) >> 27) & 0x03 : ((id) >> 9) & 0x03)
+
+/** Number of latency histogram buckets */
+#define CAN_STATS_BUCKETS			10
+/** Upper limit of the first bucket in us, every further bucket doubles it (the last is open) */
+#define CAN_STATS_BUCKET_US			64
+
+/** CAN identifiers of the statistics frames (next to #TELEMETRY_CAN_ID) */
+#define CAN_STATS_CAN_ID_RATES		0x181
+#define CAN_STATS_CAN_ID_EVENTS		0x182
+#define CAN_STATS_CAN_ID_LATENCY	0x183
+/** Number of frames encoded by can_stats_encode() */
+#define CAN_STATS_FRAMES			3
+
+/**
+ * Bus statistics. The totals count since can_stats_reset(), the rates are those of the
+ * interval before the last can_stats_sample().
+ */
+typedef struct {
+	// totals
+	uint32_t tx_frames;
+	uint32_t rx_frames;
+	uint32_t tx_bits;				// estimated, without stuff bits
+	uint32_t rx_bits;
+	uint32_t arbitration_lost;		// frames that lost arbitration at least once before being sent
+	uint32_t tx_errors;				// frames that saw a transmit error before being sent
+	uint32_t bus_off;				// bus-off events
+	uint32_t latency[CAN_STATS_CLASSES][CAN_STATS_BUCKETS];	// queued until sent
+	uint32_t latency_max[CAN_STATS_CLASSES];				// in us
+
+	// rates and error counters at the last can_stats_sample()
+	uint16_t tx_fps;				// frames per second
+	uint16_t rx_fps;
+	uint32_t bps;					// bits per second (both directions)
+	uint16_t load;					// bus load in 1/1000 of the bit rate
+	uint8_t tec;					// transmit error counter
+	uint8_t rec;					// receive error counter
+} CAN_Stats;
+
+void can_stats_init(void);
+void can_stats_reset(void);
+void can_stats_sample(void);
+const CAN_Stats *can_stats(void);
+uint16_t can_stats_frame_bits(uint8_t flags, uint8_t dlc);
+
+void can_stats_tx(uint32_t id, uint8_t flags, uint8_t dlc, uint32_t cycles,
+		uint32_t status);
+void can_stats_rx(const CAN_Bus_Frame *frame);
+void can_stats_sce_irq_handler(void);
+
+void can_stats_encode(CAN_Bus_Frame frames[CAN_STATS_FRAMES]);
+uint8_t can_stats_send(void);
+#if PROFILE_ENABLED
+void can_stats_dump(void);
+#endif
+
+#endif /* CAN_STATS_H_ */
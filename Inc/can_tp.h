@@ -0,0 +1,77 @@
+/**
+ ******************************************************************************
+ * @file    can_tp.h
+ * @brief  Segmented transfer of long messages over CAN (ISO-TP style)
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef CAN_TP_H_
+#define CAN_TP_H_
+
+#include "stm32f3xx_hal.h"
+#include "can_bus.h"
+
+/** Longest message (12 bit length of the first frame) */
+#define CAN_TP_MAX_LENGTH		4095
+
+/** Time to wait for a flow control frame (sender) or the next consecutive frame (receiver) */
+#define CAN_TP_TIMEOUT_MS		1000
+
+/** Number of consecutive frames the receiver accepts before the next flow control (0: all) */
+#ifndef CAN_TP_BLOCK_SIZE
+#define CAN_TP_BLOCK_SIZE		0
+#endif
+/** Minimum separation time the receiver requests (STmin: 0..0x7F ms, 0xF1..0xF9 100..900us) */
+#ifndef CAN_TP_STMIN
+#define CAN_TP_STMIN			0
+#endif
+
+typedef enum {
+	CAN_TP_IDLE,		// nothing to do / no message
+	CAN_TP_BUSY,		// transfer in progress
+	CAN_TP_DONE,		// message sent / complete message received
+	CAN_TP_ERROR		// timeout, sequence error or overflow, the transfer was aborted
+} CAN_TP_State;
+
+/**
+ * One endpoint of a segmented transfer, sending on \p tx_id and receiving on \p rx_id.
+ * Sending and receiving are independent of each other.
+ */
+typedef struct {
+	uint32_t tx_id;
+	uint32_t rx_id;
+
+	// sending
+	CAN_TP_State tx_state;
+	const uint8_t *tx_data;
+	uint16_t tx_len;
+	uint16_t tx_pos;			// bytes sent so far
+	uint8_t tx_sn;				// sequence number of the next consecutive frame
+	uint8_t tx_wait_fc;			// waiting for a flow control frame
+	uint8_t tx_block_left;		// consecutive frames left before the next flow control (0: no limit)
+	uint32_t tx_stmin_us;		// separation time requested by the receiver
+	uint64_t tx_next;			// timing_cycles() at which the next consecutive frame may be sent
+	uint32_t tx_timeout;		// HAL_GetTick() at which waiting for flow control fails
+
+	// receiving
+	CAN_TP_State rx_state;
+	uint8_t *rx_buffer;
+	uint16_t rx_size;
+	uint16_t rx_len;
+	uint16_t rx_pos;			// bytes received so far
+	uint8_t rx_sn;				// sequence number of the next consecutive frame
+	uint8_t rx_block_left;		// consecutive frames left before the next flow control
+	uint8_t rx_fc;				// flow control frame to be sent (flow status + 1, 0 for none)
+	uint32_t rx_timeout;		// HAL_GetTick() at which waiting for a consecutive frame fails
+} CAN_TP_Context;
+
+void can_tp_init(CAN_TP_Context *tp, uint32_t tx_id, uint32_t rx_id,
+		uint8_t *rx_buffer, uint16_t rx_size);
+int can_tp_send(CAN_TP_Context *tp, const uint8_t *data, uint16_t len);
+void can_tp_on_frame(CAN_TP_Context *tp, const CAN_Bus_Frame *frame);
+void can_tp_poll(CAN_TP_Context *tp);
+CAN_TP_State can_tp_tx_state(CAN_TP_Context *tp);
+CAN_TP_State can_tp_receive(CAN_TP_Context *tp, uint16_t *len);
+
+#endif /* CAN_TP_H_ */
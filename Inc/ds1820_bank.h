@@ -8,10 +8,9 @@
 #ifndef DS1820_BANK_H_
 #define DS1820_BANK_H_
 
-#include <stdlib.h>
-#include <math.h>
 #include "stm32f3xx_hal.h"
 #include "tm_stm32_ds18b20.h"
+#include "onewire_port.h"
 
 /**
  * Will be called by ds1820_bank_update_temperature() (or ds1820_bank_update_temperature()) if no
@@ -23,6 +22,12 @@
  */
 #define DS1820_BANK_SENSOR_ERROR(i)
 
+/**
+ * Number of slots a #DS1820_Bank_Context has room for (at most one per pin of a port). The slots
+ * are part of the context, so this determines its size. No heap memory is used by the bank.
+ */
+#define DS1820_BANK_SLOTS				16
+
 /**
  * The amount of times a slot asks its sensor for the temperature and fails before it requests the
  * ROM. Until then, the temperature will not be modified if there is a problem with the connection.
@@ -36,6 +41,40 @@
 /** Make ds1820_bank_check_rom() request a new ROM even if there is already an old one registered */
 #define DS1820_BANK_REQUEST_NEW_ROM		1
 
+/**
+ * Address the sensors with SKIP ROM instead of MATCH ROM. Every slot holds exactly one sensor, so
+ * there is no need to send its ROM number (64 bit slots) in every transaction. The ROM numbers
+ * are verified by ds1820_bank_verify_roms() every #DS1820_BANK_ROM_CHECK_INTERVAL conversion
+ * requests instead. A slot is only searched again (SEARCH ROM) while it has no valid ROM or after
+ * more than #DS1820_BANK_MAX_ERROR_COUNT failed readings.
+ * Set this to 0 to select the sensors by MATCH ROM.
+ */
+#define DS1820_BANK_SKIP_ROM			1
+
+/**
+ * Number of conversion requests between two ROM verifications (see ds1820_bank_verify_roms()).
+ * Slots that are converting at that time are verified with one of the next requests.
+ */
+#define DS1820_BANK_ROM_CHECK_INTERVAL	60
+
+/**
+ * Resolution used by a DS18B20 slot while its temperature is stable (see
+ * ds1820_bank_request_precision()). DS18S20 sensors always convert with 9 bit.
+ */
+#define DS1820_BANK_RESOLUTION_LOW		TM_DS18B20_Resolution_9bits
+/** Resolution used by a DS18B20 slot while its temperature changes fast or precision is requested */
+#define DS1820_BANK_RESOLUTION_HIGH		TM_DS18B20_Resolution_12bits
+
+/**
+ * Rate of change (in 1/16 degC per second) above which a DS18B20 slot switches to
+ * #DS1820_BANK_RESOLUTION_HIGH. The change between two consecutive readings is divided by the
+ * time between them, so the threshold does not depend on how often the slot is read. The
+ * default is one step of the 9 bit resolution per second.
+ */
+#define DS1820_BANK_FAST_CHANGE			8
+/** Number of consecutive readings without a fast change before a slot drops back to #DS1820_BANK_RESOLUTION_LOW */
+#define DS1820_BANK_STABLE_READINGS		16
+
 /**
  * The connectivity state of the sensor. Note that this only describes the state of the ROM,
  * not if the sensor is actually delivering valid temperature values.
@@ -45,32 +84,64 @@ typedef enum {
 } DS1820_ROM_State;
 
 /**
- * A struct to hold the data for each slot.
+ * Layout of the packed state byte of every slot (\p state of #DS1820_Bank_Context):
+ * bits 0..1 hold the #DS1820_ROM_State, bit 2 is set while a conversion is running and bits 3..7
+ * count the consecutive errors (saturating at #DS1820_BANK_STATE_ERROR_MAX).
  */
-typedef struct {
-	TM_OneWire_t onewire;	// connection details + ROM number
-	float temperature;		// read temperature
-	DS1820_ROM_State rom_state;		// connectivity state (ROM number)
-	uint8_t error_count;	// number of consecutive errors
-} DS1820_Bank_Slot;
+#define DS1820_BANK_STATE_ROM_MASK		0x03
+#define DS1820_BANK_STATE_CONVERTING	0x04
+#define DS1820_BANK_STATE_ERROR_SHIFT	3
+#define DS1820_BANK_STATE_ERROR_MAX		0x1F
+
+/**
+ * Layout of the packed resolution byte of every slot (\p adapt of #DS1820_Bank_Context):
+ * bits 0..1 hold the resolution of a DS18B20 minus 9, bit 2 is set if precision is requested and
+ * bits 3..7 count the consecutive readings without a fast change.
+ */
+#define DS1820_BANK_ADAPT_RESOLUTION_MASK	0x03
+#define DS1820_BANK_ADAPT_PRECISE		0x04
+#define DS1820_BANK_ADAPT_STABLE_SHIFT	3
+
+/**
+ * Bytes every slot takes in #DS1820_Bank_Context: temperature (2), ROM number (8), state (1),
+ * resolution state (1) and due time (4). The arrays are packed without padding, so a bank takes
+ * this per slot plus the port and the counters.
+ */
+#define DS1820_BANK_SLOT_BYTES			16
+
+/** The #DS1820_ROM_State of slot \p i */
+#define DS1820_BANK_ROM_STATE(ctx, i)	((DS1820_ROM_State) ((ctx)->state[i] & DS1820_BANK_STATE_ROM_MASK))
 
 /**
  * The context to hold the data for a whole bank of sensors. Those sensors are are at the same
  * GPIO port (e.g. #GPIOA, #GPIOB, ..., #GPIOF) on \p n pins starting from Px0 up to Px(n-1).
+ * The data of the slots is kept in one array per member, indexed by slot number (the
+ * temperatures of all slots are one contiguous array). The storage is supplied by the caller,
+ * preferably as a static variable.
  */
 typedef struct {
-	size_t n;
-	DS1820_Bank_Slot* slots;
+	uint8_t n;				// number of slots
+	uint16_t conversions;	// conversion requests since the last ROM verification
+	uint16_t unverified;	// mask of the slots whose ROM verification is due, see ds1820_bank_verify_roms()
+	TM_OneWire_t port;		// the port and the mask of all slots, driven in parallel (see onewire_port.h)
+	int16_t temperature[DS1820_BANK_SLOTS];	// read temperature in 1/16 degC or #TM_DS18B20_TEMP_INVALID
+	uint8_t rom[DS1820_BANK_SLOTS][8];		// ROM number of the sensor
+	uint8_t state[DS1820_BANK_SLOTS];		// packed state, see #DS1820_BANK_STATE_ROM_MASK
+	uint8_t adapt[DS1820_BANK_SLOTS];		// packed resolution state, see #DS1820_BANK_ADAPT_RESOLUTION_MASK
+	uint32_t due[DS1820_BANK_SLOTS];		// HAL_GetTick() at which ds1820_bank_poll() handles the slot again
 } DS1820_Bank_Context;
 
 
-int ds1820_bank_init(DS1820_Bank_Context *ctx, size_t n, GPIO_TypeDef *GPIOx);
-void ds1820_bank_deinit(DS1820_Bank_Context *ctx);
+int ds1820_bank_init(DS1820_Bank_Context *ctx, uint8_t n, GPIO_TypeDef *GPIOx);
 int ds1820_bank_check_rom(DS1820_Bank_Context *ctx, uint8_t i,
 		uint8_t request_new_rom);
+int ds1820_bank_verify_roms(DS1820_Bank_Context *ctx);
 int ds1820_bank_start_conversion(DS1820_Bank_Context *ctx, uint8_t i);
 int ds1820_bank_start_conversions(DS1820_Bank_Context *ctx);
 int ds1820_bank_update_temperature(DS1820_Bank_Context *ctx, uint32_t i);
 int ds1820_bank_update_temperatures(DS1820_Bank_Context *ctx);
+uint16_t ds1820_bank_poll(DS1820_Bank_Context *ctx);
+void ds1820_bank_request_precision(DS1820_Bank_Context *ctx, uint8_t i,
+		uint8_t precise);
 
 #endif /* DS1820_BANK_H_ */
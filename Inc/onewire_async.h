@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * @file    onewire_async.h
+ * @brief  Non-blocking onewire transactions driven by a timer interrupt
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef ONEWIRE_ASYNC_H_
+#define ONEWIRE_ASYNC_H_
+
+#include "stm32f3xx_hal.h"
+#include "tm_stm32_onewire.h"
+
+/** Number of transactions that can wait in the queue (in addition to the running one) */
+#define ONEWIRE_ASYNC_QUEUE_LENGTH		8
+
+/** Preemption priority of the timer interrupt driving the bit slots */
+#define ONEWIRE_ASYNC_IRQ_PRIORITY		1
+
+/**
+ * The state of a transaction. A transaction is finished as soon as its state is not
+ * #ONEWIRE_ASYNC_PENDING any more.
+ */
+typedef enum {
+	ONEWIRE_ASYNC_PENDING, ONEWIRE_ASYNC_DONE, ONEWIRE_ASYNC_NO_PRESENCE
+} OneWire_Async_State;
+
+typedef struct OneWire_Async_Transaction OneWire_Async_Transaction;
+
+/**
+ * Called from the timer interrupt as soon as a transaction is finished.
+ */
+typedef void (*OneWire_Async_Callback)(OneWire_Async_Transaction *transaction);
+
+/**
+ * A complete onewire transaction: reset, ROM selection, command, bytes to write and bytes to
+ * read. The struct has to stay valid until the transaction is finished.
+ *
+ * Only transactions run on the engine, the bit level TM_OneWire_* calls (reset, bits, ROM
+ * search) still busy-wait and must not be mixed with queued transactions on the same bus.
+ */
+struct OneWire_Async_Transaction {
+	TM_OneWire_t *onewire;		// GPIO bus to talk to (USART buses are not accepted)
+	const uint8_t *rom;			// ROM to select (MATCH ROM) or NULL to address all (SKIP ROM)
+	uint8_t command;			// command sent after the ROM selection
+	const uint8_t *tx;			// bytes written after the command (may be NULL)
+	uint8_t tx_len;
+	uint8_t *rx;				// destination for the bytes read afterwards (may be NULL)
+	uint8_t rx_len;
+	OneWire_Async_Callback callback;	// may be NULL
+	volatile OneWire_Async_State state;
+};
+
+void onewire_async_init(void);
+int onewire_async_submit(OneWire_Async_Transaction *transaction);
+OneWire_Async_State onewire_async_transfer(
+		OneWire_Async_Transaction *transaction);
+int onewire_async_busy(void);
+uint16_t onewire_async_step(void);
+void onewire_async_irq_handler(void);
+
+#endif /* ONEWIRE_ASYNC_H_ */
@@ -0,0 +1,30 @@
+/**
+ ******************************************************************************
+ * @file    onewire_port.h
+ * @brief  Port-parallel onewire engine (one independent onewire bus on every pin of a port)
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef ONEWIRE_PORT_H_
+#define ONEWIRE_PORT_H_
+
+#include "stm32f3xx_hal.h"
+#include "tm_stm32_onewire.h"
+
+/**
+ * Number of pins of one GPIO port. Arrays passed to the onewire_port_*() functions are indexed
+ * by pin number (Px0 ... Px15), so they always have to provide this many entries.
+ */
+#define ONEWIRE_PORT_PINS		16
+
+void onewire_port_init(TM_OneWire_t *port, GPIO_TypeDef *GPIOx, uint16_t pins);
+uint16_t onewire_port_reset(TM_OneWire_t *port);
+void onewire_port_write_byte(TM_OneWire_t *port, uint8_t byte);
+void onewire_port_write_bytes(TM_OneWire_t *port,
+		const uint8_t bytes[ONEWIRE_PORT_PINS]);
+uint16_t onewire_port_read_bit(TM_OneWire_t *port);
+void onewire_port_read_bytes(TM_OneWire_t *port,
+		uint8_t bytes[ONEWIRE_PORT_PINS]);
+
+#endif /* ONEWIRE_PORT_H_ */
@@ -0,0 +1,40 @@
+/**
+ ******************************************************************************
+ * @file    onewire_uart.h
+ * @brief  Onewire bus on a half-duplex USART, bit slots transferred by DMA
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef ONEWIRE_UART_H_
+#define ONEWIRE_UART_H_
+
+#include "stm32f3xx_hal.h"
+
+/** Baud rate used for the reset pulse (one frame of 0xF0 lasts ~1ms) */
+#define ONEWIRE_UART_BAUD_RESET		9600
+/** Baud rate used for the bit slots (one frame lasts ~87us) */
+#define ONEWIRE_UART_BAUD_DATA		115200
+
+/** Maximum number of bytes per DMA transfer (a whole DS18x20 scratchpad) */
+#define ONEWIRE_UART_MAX_BYTES		9
+
+/** Frame sent for a 1 bit or a read slot. It is received unchanged if the line stays high. */
+#define ONEWIRE_UART_SLOT_1			0xFF
+/** Frame sent for a 0 bit (holds the line low for the whole slot) */
+#define ONEWIRE_UART_SLOT_0			0x00
+/** Frame sent for the reset pulse. It is received unchanged if there is no presence pulse. */
+#define ONEWIRE_UART_RESET			0xF0
+
+void onewire_uart_encode(const uint8_t *bytes, uint8_t len, uint8_t *slots);
+void onewire_uart_decode(const uint8_t *slots, uint8_t len, uint8_t *bytes);
+
+void onewire_uart_init(USART_TypeDef *USARTx);
+uint8_t onewire_uart_reset(USART_TypeDef *USARTx);
+uint8_t onewire_uart_bit(USART_TypeDef *USARTx, uint8_t bit);
+uint8_t onewire_uart_write_bytes(USART_TypeDef *USARTx, const uint8_t *bytes,
+		uint8_t len);
+uint8_t onewire_uart_read_bytes(USART_TypeDef *USARTx, uint8_t *bytes,
+		uint8_t len);
+
+#endif /* ONEWIRE_UART_H_ */
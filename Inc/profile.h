@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * @file    profile.h
+ * @brief  Cycle counting profiler for the blocking hot paths
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include <stdint.h>
+
+/** Set to 1 to record the profiling zones, otherwise all PROFILE_* macros compile to nothing */
+#ifndef PROFILE_ENABLED
+#define PROFILE_ENABLED			0
+#endif
+
+/*
+ * Set PROFILE_HOST to 1 to build the module on a host: the zones are timed with clock_gettime()
+ * (converted to cycles at #PROFILE_HOST_CLOCK) and the dump is written to stdout.
+ */
+#ifndef PROFILE_HOST
+#define PROFILE_HOST			0
+#endif
+
+/** Clock the host timestamps are converted to, so the results compare to the target */
+#define PROFILE_HOST_CLOCK		48000000
+
+/**
+ * The profiling zones. Every zone gets one entry of the statistics table.
+ */
+typedef enum {
+	PROFILE_ONEWIRE,		// onewire transactions of the sensor bank
+	PROFILE_LCD,			// LCD_QUEUE() of a command or character (enqueue only)
+	PROFILE_CAN_TX,			// can_bus_send() (enqueue only)
+	PROFILE_USART_TX,		// USART transmit
+	PROFILE_ZONES
+} Profile_Zone;
+
+/**
+ * Statistics of one zone, all times in cycles.
+ */
+typedef struct {
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+} Profile_Stats;
+
+#if PROFILE_ENABLED
+
+#if PROFILE_HOST
+#define PROFILE_NOW()			profile_host_cycles()
+#else
+#include "timing.h"
+#define PROFILE_NOW()			((uint32_t) TIMING_CYCCNT)
+#endif
+
+/** Starts timing \p zone (a #Profile_Zone), has to be followed by PROFILE_END() in the same block */
+#define PROFILE_BEGIN(zone)		uint32_t profile_start_##zone = PROFILE_NOW()
+/** Stops timing \p zone and adds the elapsed cycles to its statistics */
+#define PROFILE_END(zone)		profile_record((zone), PROFILE_NOW() - profile_start_##zone)
+
+void profile_record(Profile_Zone zone, uint32_t cycles);
+const Profile_Stats *profile_stats(Profile_Zone zone);
+void profile_reset(void);
+void profile_dump(void);
+void profile_print(const char *line);
+char *profile_number(char *pos, uint32_t value, uint8_t width);
+#if PROFILE_HOST
+uint32_t profile_host_cycles(void);
+#endif
+
+#else
+
+#define PROFILE_BEGIN(zone)
+#define PROFILE_END(zone)		((void) 0)
+
+#endif
+
+#endif /* PROFILE_H_ */
@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * @file    telemetry.h
+ * @brief  Packs the temperatures of a ds1820_bank into as few CAN frames as possible
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include "ds1820_bank.h"
+#include "can_bus.h"
+
+/** CAN identifier of the telemetry frames (the slot group is part of the payload) */
+#define TELEMETRY_CAN_ID			0x180
+
+/** Number of temperatures packed into one frame (12 bits each after the 2 header bytes) */
+#define TELEMETRY_SLOTS_PER_FRAME	4
+/** Maximum number of frames needed for a whole bank */
+#define TELEMETRY_MAX_FRAMES		((DS1820_BANK_SLOTS + TELEMETRY_SLOTS_PER_FRAME - 1) / TELEMETRY_SLOTS_PER_FRAME)
+
+/** Offset added to the temperatures (1/16 degC), so -55 degC..200 degC fit into 12 bits unsigned */
+#define TELEMETRY_OFFSET			(-55 * 16)
+#define TELEMETRY_VALUE_MAX			0x0FFF
+
+/**
+ * State of the encoder: sequence number and the values sent last (for the delta mode).
+ */
+typedef struct {
+	uint8_t seq;
+	int16_t sent[DS1820_BANK_SLOTS];	// last 12 bit value sent or #TM_DS18B20_TEMP_INVALID
+	uint8_t sent_groups;				// frames sent at least once (bit per group)
+} Telemetry_Encoder;
+
+void telemetry_init(Telemetry_Encoder *enc);
+uint8_t telemetry_encode(const Telemetry_Encoder *enc, const DS1820_Bank_Context *ctx,
+		uint8_t delta, CAN_Bus_Frame frames[TELEMETRY_MAX_FRAMES]);
+void telemetry_commit(Telemetry_Encoder *enc, const CAN_Bus_Frame *frame);
+uint8_t telemetry_send(Telemetry_Encoder *enc, const DS1820_Bank_Context *ctx,
+		uint8_t delta);
+int telemetry_decode(const uint8_t *data, uint8_t dlc, uint8_t *seq,
+		int16_t temperatures[DS1820_BANK_SLOTS], uint16_t *valid);
+
+#endif /* TELEMETRY_H_ */
@@ -8,13 +8,32 @@
 #ifndef TIMING_H_
 #define TIMING_H_
 
+#include <stdint.h>
 #include "stm32f3xx.h"
 
+/*
+ * Source of the 32 bit cycle counter. By default this is the DWT cycle counter of the core.
+ * It can be defined to something else (e.g. a plain variable on a host) to drive the timebase
+ * without the hardware, the DWT is not touched then.
+ */
+#ifndef TIMING_CYCCNT
+#define TIMING_CYCCNT		(DWT->CYCCNT)
+#define TIMING_DWT			1
+#else
+#define TIMING_DWT			0
+#endif
+
 
 void timing_init(void);
+void timing_update_clock(void);
 
 void timing_delay_us(unsigned int us);
 
+uint64_t timing_cycles(void);
+uint64_t timing_now_us(void);
+uint64_t timing_deadline_us(uint32_t us);
+int timing_deadline_reached(uint64_t deadline);
+
 /* see also stm32f3xx_hal.h for timing with ms-ticks
  * void HAL_Delay(__IO uint32_t Delay);
  * uint32_t HAL_GetTick(void);
@@ -70,7 +70,7 @@
 <b>Minimal Example</b>:
 char buf[6];
 TM_OneWire_t ow;
-float temp1 = 0;
+int16_t temp1 = 0;
 TM_OneWire_Init(&ow, GPIOB, GPIO_PIN_4);
 while (1) {
 	TM_OneWire_First(&ow);
@@ -78,7 +78,7 @@ while (1) {
 	while (!TM_DS18B20_AllDone(&ow))
 		;
 	if (TM_DS18S20_Read(&ow, ow.ROM_NO, &temp1) == TM_DS18B20_SUCCESS) {
-		sprintf(buf, "%2.1f\n", temp1);
+		sprintf(buf, "%2.1f\n", TM_DS18B20_TEMP_TO_FLOAT(temp1));
 		HAL_USART_Transmit(&husart1, (uint8_t*) buf, 6, 1000);
 	} else {
 		//error management
@@ -110,10 +110,10 @@ while (1) {
 
 /* DS18B20 read temperature command */
 #define DS18B20_CMD_CONVERTTEMP			0x44 	/* Convert temperature */
-#define DS18B20_DECIMAL_STEPS_12BIT		0.0625
-#define DS18B20_DECIMAL_STEPS_11BIT		0.125
-#define DS18B20_DECIMAL_STEPS_10BIT		0.25
-#define DS18B20_DECIMAL_STEPS_9BIT		0.5
+
+/* Maximum time of a temperature conversion in ms (DS18B20: 94, 188, 375 or 750 for 9 to 12 bits) */
+#define DS18S20_CONVERSION_TIME_MS				750
+#define DS18B20_CONVERSION_TIME_MS(resolution)	((750 >> (12 - (resolution))) + 1)
 
 /* Bits locations for resolution */
 #define DS18B20_RESOLUTION_R1			6
@@ -133,8 +133,21 @@ while (1) {
 #define TM_DS18B20_ERR_NO_CONVERSION_YET		8
 
 
-#define TM_DS18B20_DATA0_DEFAULT				0xAA
-#define TM_DS18B20_DATA1_DEFAULT				0x00
+/* Power-on value of the temperature register (85 degC), read if no conversion was done yet */
+#define TM_DS18S20_DATA0_DEFAULT				0xAA
+#define TM_DS18S20_DATA1_DEFAULT				0x00
+#define TM_DS18B20_DATA0_DEFAULT				0x50
+#define TM_DS18B20_DATA1_DEFAULT				0x05
+
+/* Temperatures are signed fixed-point values in 1/16 degC (the format of the DS18B20 temperature register) */
+#define TM_DS18B20_TEMP_FRACTION_BITS			4
+/* Marks a temperature that could not be read, lies outside the range of the sensors */
+#define TM_DS18B20_TEMP_INVALID					INT16_MIN
+
+/* Conversions for presentation only, results are undefined for TM_DS18B20_TEMP_INVALID */
+#define TM_DS18B20_TEMP_TO_FLOAT(t)				((float) (t) / (1 << TM_DS18B20_TEMP_FRACTION_BITS))
+#define TM_DS18B20_TEMP_TO_CENTI(t)				(((int32_t) (t) * 100) / (1 << TM_DS18B20_TEMP_FRACTION_BITS))
+#define TM_DS18B20_TEMP_FROM_DEGREES(d)			((int16_t) ((d) * (1 << TM_DS18B20_TEMP_FRACTION_BITS)))
 
 
 /**
@@ -219,7 +232,7 @@ uint8_t TM_DS18B20_IsBusy(TM_OneWire_t* OneWire);
  * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t working structure (OneWire channel)
  * @param  *ROM: Pointer to first byte of ROM address for desired DS12S80 device.
  *         Entire ROM address is 8-bytes long
- * @param  *destination: Pointer to float variable to store temperature
+ * @param  *destination: Pointer to variable to store temperature (1/16 degC)
  * @retval Temperature status:
  *            - TM_DS18B20_ERR_WRONG_DEVICE_FAMILY: Device is not DS18S20
  *            - TM_DS18B20_ERR_BUSY_CONVERTING: conversion is not done yet
@@ -227,14 +240,14 @@ uint8_t TM_DS18B20_IsBusy(TM_OneWire_t* OneWire);
  *			  - TM_DS18B20_ERR_NO_CONVERSION_YET: there was no conversion requested yet, -> TM_DS18S20_Start
  *            - TM_DS18B20_SUCCESS: Temperature is read OK
  */
-uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWireStruct, uint8_t* ROM, float* destination);
+uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWireStruct, uint8_t* ROM, int16_t* destination);
 
 /**
  * @brief  Reads temperature from DS18B20
  * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t working structure (OneWire channel)
  * @param  *ROM: Pointer to first byte of ROM address for desired DS12B80 device.
  *         Entire ROM address is 8-bytes long
- * @param  *destination: Pointer to float variable to store temperature
+ * @param  *destination: Pointer to variable to store temperature (1/16 degC)
  * @retval Temperature status:
  *            - TM_DS18B20_ERR_WRONG_DEVICE_FAMILY: Device is not DS18S20
  *            - TM_DS18B20_ERR_BUSY_CONVERTING: conversion is not done yet
@@ -242,7 +255,29 @@ uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWireStruct, uint8_t* ROM, float* destin
  *			  - TM_DS18B20_ERR_NO_CONVERSION_YET: there was no conversion requested yet, -> TM_DS18S20_Start
  *            - TM_DS18B20_SUCCESS: Temperature is read OK
  */
-uint8_t TM_DS18B20_Read(TM_OneWire_t* OneWireStruct, uint8_t* ROM, float* destination);
+uint8_t TM_DS18B20_Read(TM_OneWire_t* OneWireStruct, uint8_t* ROM, int16_t* destination);
+
+/**
+ * @brief  Decodes a scratchpad read from a DS18S20 (without any bus traffic)
+ * @param  *data: Pointer to the 9 bytes of the scratchpad (including CRC)
+ * @param  *destination: Pointer to variable to store temperature (1/16 degC)
+ * @retval Temperature status:
+ *            - TM_DS18B20_ERR_CRC_INVALID: CRC failed
+ *			  - TM_DS18B20_ERR_NO_CONVERSION_YET: there was no conversion requested yet, -> TM_DS18S20_Start
+ *            - TM_DS18B20_SUCCESS: Temperature is decoded OK
+ */
+uint8_t TM_DS18S20_Decode(uint8_t* data, int16_t* destination);
+
+/**
+ * @brief  Decodes a scratchpad read from a DS18B20 (without any bus traffic)
+ * @param  *data: Pointer to the 9 bytes of the scratchpad (including CRC)
+ * @param  *destination: Pointer to variable to store temperature (1/16 degC)
+ * @retval Temperature status:
+ *            - TM_DS18B20_ERR_CRC_INVALID: CRC failed
+ *			  - TM_DS18B20_ERR_NO_CONVERSION_YET: there was no conversion requested yet, -> TM_DS18B20_Start
+ *            - TM_DS18B20_SUCCESS: Temperature is decoded OK
+ */
+uint8_t TM_DS18B20_Decode(uint8_t* data, int16_t* destination);
 
 /**
  * @brief  Gets resolution for temperature conversion from DS18B20 device (DS18B20 EXCLUSIVE!)
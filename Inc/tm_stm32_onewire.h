@@ -81,12 +81,26 @@ extern "C" {
 /* OneWire delay */
 #define ONEWIRE_DELAY(x)				timing_delay_us(x)
 
-/* Pin settings */
-#define ONEWIRE_LOW(structure)			HAL_GPIO_WritePin((structure)->GPIOx, (structure)->GPIO_Pin, 0)
-#define ONEWIRE_HIGH(structure)			HAL_GPIO_WritePin((structure)->GPIOx, (structure)->GPIO_Pin, 1)
-#define ONEWIRE_INPUT(structure)		TM_GPIO_SetPinAsInput((structure)->GPIOx, (structure)->GPIO_Pin)
-#define ONEWIRE_OUTPUT(structure)		TM_GPIO_SetPinAsOutput((structure)->GPIOx, (structure)->GPIO_Pin)
-#define ONEWIRE_READ(structure)			HAL_GPIO_ReadPin((structure)->GPIOx, (structure)->GPIO_Pin)
+/*
+ * Open drain mode: the pin stays an open drain output all the time. The line is pulled low by
+ * writing BRR and released by writing BSRR (the external pull-up takes over), every edge is a
+ * single register write. Otherwise, the pin is switched between output (low) and input in MODER.
+ */
+#ifndef ONEWIRE_OPEN_DRAIN
+#define ONEWIRE_OPEN_DRAIN				1
+#endif
+
+/* Pin settings, direct register accesses (MODER_Output is set by TM_OneWire_Init) */
+#define ONEWIRE_LOW(structure)			((structure)->GPIOx->BRR = (structure)->GPIO_Pin)
+#define ONEWIRE_HIGH(structure)			((structure)->GPIOx->BSRR = (structure)->GPIO_Pin)
+#if ONEWIRE_OPEN_DRAIN
+#define ONEWIRE_INPUT(structure)		ONEWIRE_HIGH(structure)
+#define ONEWIRE_OUTPUT(structure)		((void) (structure))
+#else
+#define ONEWIRE_INPUT(structure)		((structure)->GPIOx->MODER &= ~(structure)->MODER_Output)
+#define ONEWIRE_OUTPUT(structure)		((structure)->GPIOx->MODER |= (structure)->MODER_Output)
+#endif
+#define ONEWIRE_READ(structure)			(((structure)->GPIOx->IDR & (structure)->GPIO_Pin) != 0)
 
 
 /* OneWire commands */
@@ -100,6 +114,16 @@ extern "C" {
 #define ONEWIRE_CMD_MATCHROM			0x55
 #define ONEWIRE_CMD_SKIPROM				0xCC
 
+/* CRC8 implementations, see TM_OneWire_CRC8() */
+#define ONEWIRE_CRC8_BITWISE			0	/*!< Bit by bit, no table */
+#define ONEWIRE_CRC8_NIBBLE				1	/*!< Two 16-byte tables, one lookup per nibble */
+#define ONEWIRE_CRC8_TABLE				2	/*!< 256-byte table in flash, one lookup per byte */
+
+/* CRC8 implementation used, can be overridden by the build settings */
+#ifndef ONEWIRE_CRC8
+#define ONEWIRE_CRC8					ONEWIRE_CRC8_TABLE
+#endif
+
 /**
  * @}
  */
@@ -121,6 +145,8 @@ typedef struct {
 	uint8_t LastFamilyDiscrepancy; /*!< Search private */
 	uint8_t LastDeviceFlag; /*!< Search private */
 	uint8_t ROM_NO[8]; /*!< 8-bytes address of last search device */
+	USART_TypeDef* USARTx; /*!< USART the bus is connected to (see onewire_uart.h) or NULL if GPIOx/GPIO_Pin is used */
+	uint32_t MODER_Output; /*!< MODER bits switching GPIO_Pin to output, see TM_OneWire_ModerOutput() */
 } TM_OneWire_t;
 
 /**
@@ -155,10 +181,31 @@ void TM_GPIO_SetPinAsOutput(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin);
 void TM_OneWire_Init(TM_OneWire_t* OneWireStruct, GPIO_TypeDef* GPIOx,
 		uint16_t GPIO_Pin);
 
+/**
+ * @brief  Calculates the MODER bits that switch pins to general purpose output mode
+ * @note   Has to be stored in MODER_Output whenever GPIO_Pin of a @ref TM_OneWire_t is changed
+ * @param  GPIO_Pin: Mask of the pins
+ * @retval MODER bits (01b for every pin set in GPIO_Pin)
+ */
+uint32_t TM_OneWire_ModerOutput(uint16_t GPIO_Pin);
+
+/**
+ * @brief  Initializes OneWire bus on a half-duplex USART (see onewire_uart.h)
+ * @note   USART pins and clocks have to be configured beforehand, e.g. with MX_USART2_OneWire_Init()
+ * @note   The functions block until the DMA transfer is done. If it does not finish in time, the reset
+ *         reports no presence and reads return 1 bits
+ * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t empty working onewire structure
+ * @param  *USARTx: USART the onewire bus is connected to (USART1, USART2 or USART3)
+ * @retval None
+ */
+void TM_OneWire_InitUSART(TM_OneWire_t* OneWireStruct, USART_TypeDef* USARTx);
+
 /**
  * @brief  Resets OneWire bus
  * 
  * @note   Sends reset command for OneWire
+ * @note   This and the other bit level functions busy-wait through the slots, the
+ *         non-blocking transactions of onewire_async.h don't use them
  * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t working onewire structure
  * @retval None
  */
@@ -171,6 +218,16 @@ uint8_t TM_OneWire_Reset(TM_OneWire_t* OneWireStruct);
  */
 uint8_t TM_OneWire_ReadByte(TM_OneWire_t* OneWireStruct);
 
+/**
+ * @brief  Reads multiple bytes from one wire bus
+ * @note   On a USART bus, up to ONEWIRE_UART_MAX_BYTES bytes are read in one DMA transfer
+ * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t working onewire structure
+ * @param  *bytes: Pointer to destination for the bytes read
+ * @param  len: Number of bytes to read
+ * @retval None
+ */
+void TM_OneWire_ReadBytes(TM_OneWire_t* OneWireStruct, uint8_t* bytes, uint8_t len);
+
 /**
  * @brief  Writes byte to bus
  * @param  *OneWireStruct: Pointer to @ref TM_OneWire_t working onewire structure
@@ -277,6 +334,7 @@ void TM_OneWire_SelectWithPointer(TM_OneWire_t* OneWireStruct, uint8_t* ROM);
 
 /**
  * @brief  Calculates 8-bit CRC for 1-wire devices
+ * @note   Implementation is selected with ONEWIRE_CRC8, all variants give the same result
  * @param  *addr: Pointer to 8-bit array of data to calculate CRC
  * @param  len: Number of bytes to check
  *
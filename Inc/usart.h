@@ -62,6 +62,7 @@ extern void _Error_Handler(char *, int);
 void MX_USART1_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+void MX_USART2_OneWire_Init(void);
 
 /* USER CODE END Prototypes */
 
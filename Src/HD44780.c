@@ -24,7 +24,9 @@
  */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "HD44780.h"
+#include "profile.h"
 
 /** @addtogroup STM8S_StdPeriph_Driver
  * @{
@@ -34,17 +36,65 @@
 #define Delay(ms)						HAL_Delay(ms)
 #define GPIO_WriteLow(port, pin)		HAL_GPIO_WritePin(port, pin, 0)
 #define GPIO_WriteHigh(port, pin)		HAL_GPIO_WritePin(port, pin, 1)
-#define GPIO_Write(port, bitmask)		{port->ODR = bitmask;}
-#define GPIO_ReadOutputData(port)		(port->IDR)
+/* Sets D0-D3 to the lower nibble of data, leaves the other pins of LCDPort alone */
+#define GPIO_WriteNibble(port, data)	((port)->BSRR = ((data) & 0x0F) | ((~(data) & 0x0F) << 16))
+
+/* Queue entries: data byte in the lower 8 bits and the flags below */
+#define LCD_QUEUE_RS		0x100	// character (RS high), command otherwise
+#define LCD_QUEUE_SLOW		0x200	// clear display / return home (1.52ms execution time)
+/* Execution times in us */
+#define LCD_EXEC_TIME		40
+#define LCD_EXEC_TIME_SLOW	1600
+/* Time between two busy flag reads in us, the reads are given up after the worst case */
+#define LCD_POLL_INTERVAL	5
+#define LCD_POLL_MAX		(LCD_EXEC_TIME_SLOW / LCD_POLL_INTERVAL)
+
+/* Steps of sending a queued byte (and reading the busy flag afterwards) */
+enum {
+	LCD_PHASE_HIGH_NIBBLE,
+	LCD_PHASE_HIGH_LATCH,
+	LCD_PHASE_LOW_NIBBLE,
+	LCD_PHASE_LOW_LATCH,
+	LCD_PHASE_POLL_HIGH,
+	LCD_PHASE_POLL_SAMPLE,
+	LCD_PHASE_POLL_LOW,
+	LCD_PHASE_POLL_DONE
+};
 
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
-uint8_t LCD_cursor_col_count = 16;
-uint8_t LCD_cursor_row_count = 4;
+uint8_t LCD_cursor_col_count = LCD_COLS;
+uint8_t LCD_cursor_row_count = LCD_ROWS;
 uint8_t LCD_cursor_col = 0;		// x 	(0 is leftmost)
 uint8_t LCD_cursor_row = 0;		// y 	(0 is uppermost)
 
+/* Shadow framebuffer: LCD_FB_* functions draw into LCD_fb, LCD_FB_FLUSH() sends the cells that
+ * differ from LCD_shown (the content of the display) */
+static uint8_t LCD_fb[LCD_ROWS][LCD_COLS];
+static uint8_t LCD_shown[LCD_ROWS][LCD_COLS];
+static uint8_t LCD_fb_col = 0;
+static uint8_t LCD_fb_row = 0;
+
+/* Bytes waiting to be sent by LCD_IRQHandler() */
+static volatile uint16_t LCD_queue[LCD_QUEUE_LENGTH];
+static volatile uint8_t LCD_queue_head = 0;	// next entry to send
+static volatile uint8_t LCD_queue_tail = 0;	// next free entry
+static volatile uint8_t LCD_running = 0;	// timer is running
+static uint16_t LCD_entry;					// entry currently sent
+static uint8_t LCD_phase = LCD_PHASE_HIGH_NIBBLE;	// step done next
+static uint8_t LCD_poll = 0;				// busy flag can be read (4-bit mode set)
+#if LCD_BUSY_FLAG
+static uint8_t LCD_busy;					// busy flag read last
+static uint16_t LCD_polls;					// number of busy flag reads for LCD_entry
+#endif
+
+/* CGRAM glyph cache: id of the glyph stored in every slot and the time it was requested last */
+static uint16_t LCD_glyph_id[8];
+static uint16_t LCD_glyph_used[8];
+static uint16_t LCD_glyph_clock = 0;
+
 /* Private function prototypes -----------------------------------------------*/
+static void LCD_QUEUE(uint16_t entry);
 #if defined(_RAISONANCE_)
 /* Do not remove for Raisonance compiler */
 void dummy(void)
@@ -77,8 +127,55 @@ void LCD_LOAD_CGRAM(char tab[8], uint8_t slot) {
 	/* Each character contains 8 definition values (one for each pixel row)*/
 	for (index = 0; index < 8; index++) {
 		/* Store values in LCD*/
-		LCD_printchar(tab[index]);
-		Delay(1);
+		LCD_QUEUE(tab[index] | LCD_QUEUE_RS);
+	}
+
+	/* The address counter points to CGRAM now, LCD_LOCATE() is needed before printing */
+	LCD_cursor_col = LCD_COLS;
+}
+
+/**
+ * @brief  Request a glyph from the CGRAM cache. The 8 CGRAM slots hold the glyphs requested
+ *         last, a glyph is only uploaded if it is not in the cache yet (replacing the least
+ *         recently requested one). Request every glyph on each redraw, so the glyphs on
+ *         screen are never the ones replaced. The cursor has to be set with LCD_LOCATE()
+ *         after a glyph was uploaded.
+ * @param  Id of the glyph (LCD_GLYPH_BAR_x or LCD_GLYPH_USER and above)
+ * @param  Pixel rows of the glyph (only used for uploading)
+ * @retval Character code (0-7) to print the glyph with
+ */
+uint8_t LCD_GLYPH(uint16_t id, const char bitmap[8]) {
+	uint8_t slot = 0;
+
+	for (uint8_t i = 0; i < 8; i++) {
+		if (LCD_glyph_id[i] == id) {
+			LCD_glyph_used[i] = ++LCD_glyph_clock;
+			return i;
+		}
+
+		if ((uint16_t) (LCD_glyph_clock - LCD_glyph_used[i])
+				> (uint16_t) (LCD_glyph_clock - LCD_glyph_used[slot])) {
+			slot = i;
+		}
+	}
+
+	LCD_LOAD_CGRAM((char *) bitmap, slot);
+	LCD_glyph_id[slot] = id;
+	LCD_glyph_used[slot] = ++LCD_glyph_clock;
+
+	return slot;
+}
+
+/**
+ * @brief  Forget the content of all CGRAM slots (after the LCD was powered up)
+ * @param  None
+ * @param  None
+ * @retval None
+ */
+static void LCD_GLYPH_RESET(void) {
+	for (uint8_t i = 0; i < 8; i++) {
+		LCD_glyph_id[i] = LCD_GLYPH_NONE;
+		LCD_glyph_used[i] = LCD_glyph_clock;
 	}
 }
 
@@ -103,32 +200,205 @@ void LCD_PWROFF(void) {
 }
 
 /**
- * @brief  Activate Enable Pin from LCD module
+ * @brief  Start the timer to call LCD_IRQHandler() after a given time
+ * @param  Time in us (at least 2, shorter times are extended)
+ * @param  None
+ * @retval None
+ */
+static void LCD_SCHEDULE(uint16_t us) {
+	// the counter does not run with ARR 0, so 1us would stop the queue
+	TIM6->ARR = (us > 1 ? us : 2) - 1;
+	TIM6->CR1 |= TIM_CR1_CEN;
+}
+
+/**
+ * @brief  Initialize TIM6 for sending the queue (1MHz counter clock, one-pulse mode, update
+ *         interrupt)
  * @param  None
  * @param  None
  * @retval None
  */
-void LCD_ENABLE(void) {
-	GPIO_WriteHigh(LCDControlPort, LCD_Enable);
-	Delay(2);
-	GPIO_WriteLow(LCDControlPort, LCD_Enable);
+static void LCD_TIMER_INIT(void) {
+	uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+	// the timers run at twice the APB1 clock if APB1 is divided
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) {
+		clock *= 2;
+	}
+
+	__HAL_RCC_TIM6_CLK_ENABLE();
+
+	TIM6->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+	TIM6->PSC = clock / 1000000 - 1;
+	TIM6->EGR = TIM_EGR_UG;	// load the prescaler
+	TIM6->SR = 0;
+	TIM6->DIER = TIM_DIER_UIE;
+
+	HAL_NVIC_SetPriority(TIM6_DAC_IRQn, LCD_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TIM6_DAC_IRQn);
+}
+
+/**
+ * @brief  Append a byte to the queue and start sending if the queue was idle. Waits while the
+ *         queue is full, so the order of the bytes is always kept.
+ * @param  Queue entry (byte and LCD_QUEUE_* flags)
+ * @param  None
+ * @retval None
+ */
+static void LCD_QUEUE(uint16_t entry) {
+	uint8_t next = (LCD_queue_tail + 1) % LCD_QUEUE_LENGTH;
+
+	while (next == LCD_queue_head)
+		;
+
+	LCD_queue[LCD_queue_tail] = entry;
+	LCD_queue_tail = next;
+
+	if (!LCD_running) {
+		LCD_running = 1;
+		LCD_SCHEDULE(1);
+	}
 }
 
 /**
- * @brief  Command data sent to LCD module
+ * @brief  Send the queued bytes, one nibble write or enable edge per call. Has to be called
+ *         from TIM6_DAC_IRQHandler(). After every byte, either the busy flag is polled
+ *         (LCD_BUSY_FLAG) or the worst case execution time is waited.
+ * @param  None
+ * @param  None
+ * @retval None
+ */
+void LCD_IRQHandler(void) {
+	TIM6->SR = 0;
+
+	switch (LCD_phase) {
+	case LCD_PHASE_HIGH_NIBBLE:
+		if (LCD_queue_head == LCD_queue_tail) {
+			LCD_running = 0;
+			return;
+		}
+
+		LCD_entry = LCD_queue[LCD_queue_head];
+		LCD_queue_head = (LCD_queue_head + 1) % LCD_QUEUE_LENGTH;
+
+		LCDControlPort->BSRR =
+				(LCD_entry & LCD_QUEUE_RS) ? LCD_RS : (uint32_t) LCD_RS << 16;
+		GPIO_WriteNibble(LCDPort, LCD_entry >> 4);
+		LCDControlPort->BSRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_HIGH_LATCH;
+		LCD_SCHEDULE(1);
+		break;
+
+	case LCD_PHASE_HIGH_LATCH:
+		LCDControlPort->BRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_LOW_NIBBLE;
+		LCD_SCHEDULE(1);
+		break;
+
+	case LCD_PHASE_LOW_NIBBLE:
+		GPIO_WriteNibble(LCDPort, LCD_entry);
+		LCDControlPort->BSRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_LOW_LATCH;
+		LCD_SCHEDULE(1);
+		break;
+
+	case LCD_PHASE_LOW_LATCH:
+		// the byte is latched on the falling edge, wait until it is executed
+		LCDControlPort->BRR = LCD_Enable;
+#if LCD_BUSY_FLAG
+		if (LCD_poll) {
+			// read the busy flag: D0-D3 inputs, RS low, R/W high
+			LCDPort->MODER &= ~(uint32_t) 0xFF;
+			LCDControlPort->BSRR = ((uint32_t) LCD_RS << 16) | LCD_RW;
+			LCD_polls = 0;
+			LCD_phase = LCD_PHASE_POLL_HIGH;
+			LCD_SCHEDULE(1);
+			break;
+		}
+#endif
+		LCD_phase = LCD_PHASE_HIGH_NIBBLE;
+		LCD_SCHEDULE(
+				(LCD_entry & LCD_QUEUE_SLOW) ? LCD_EXEC_TIME_SLOW : LCD_EXEC_TIME);
+		break;
+
+#if LCD_BUSY_FLAG
+	case LCD_PHASE_POLL_HIGH:
+		LCDControlPort->BSRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_POLL_SAMPLE;
+		LCD_SCHEDULE(1);
+		break;
+
+	case LCD_PHASE_POLL_SAMPLE:
+		// the busy flag is D7, the highest bit of the first nibble
+		LCD_busy = (LCDPort->IDR & GPIO_PIN_3) != 0;
+		LCDControlPort->BRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_POLL_LOW;
+		LCD_SCHEDULE(1);
+		break;
+
+	case LCD_PHASE_POLL_LOW:
+		// the second nibble (address counter) has to be clocked out, too
+		LCDControlPort->BSRR = LCD_Enable;
+		LCD_phase = LCD_PHASE_POLL_DONE;
+		LCD_SCHEDULE(1);
+		break;
+
+	default:
+		LCDControlPort->BRR = LCD_Enable;
+
+		if (LCD_busy && ++LCD_polls < LCD_POLL_MAX) {
+			LCD_phase = LCD_PHASE_POLL_HIGH;
+			LCD_SCHEDULE(LCD_POLL_INTERVAL);
+			break;
+		}
+
+		// ready (or given up after the worst case execution time), back to writing
+		LCDControlPort->BRR = LCD_RW;
+		LCDPort->MODER |= 0x55;
+		LCD_phase = LCD_PHASE_HIGH_NIBBLE;
+		LCD_SCHEDULE(1);
+		break;
+#else
+	default:
+		break;
+#endif
+	}
+}
+
+/**
+ * @brief  Wait until every queued byte has been sent and executed
+ * @param  None
+ * @param  None
+ * @retval None
+ */
+void LCD_WAIT(void) {
+	while (LCD_running)
+		;
+}
+
+/**
+ * @brief  Check whether there are bytes left to be sent
+ * @param  None
+ * @param  None
+ * @retval 1 if the queue is still being sent, 0 otherwise
+ */
+uint8_t LCD_BUSY(void) {
+	return LCD_running;
+}
+
+/**
+ * @brief  Command data sent to LCD module (queued, returns immediately)
  * @param  command value to be sent
  * @param  None
  * @retval None
  */
 void LCD_CMD(unsigned char cmd_data) {
-	GPIO_WriteLow(LCDControlPort, LCD_RS);
-	GPIO_Write(LCDPort,
-			(GPIO_ReadOutputData(LCDPort) & 0xF0) | ((cmd_data >> 4) & 0x0F));
-	LCD_ENABLE();
-	GPIO_Write(LCDPort,
-			(GPIO_ReadOutputData(LCDPort) & 0xF0) | (cmd_data & 0x0F));
-	LCD_ENABLE();
-	Delay(2);
+	PROFILE_BEGIN(PROFILE_LCD);
+
+	// clear display (0x01) and return home (0x02, 0x03) take much longer than the others
+	LCD_QUEUE(cmd_data | ((cmd_data & 0xFC) ? 0 : LCD_QUEUE_SLOW));
+
+	PROFILE_END(PROFILE_LCD);
 }
 
 /**
@@ -149,6 +419,9 @@ void LCD_INIT(void) {
 
 	/* Configure LCDPort E output push-pull low LCD Enable Pin*/
 	GPIO_InitStruct.Pin = LCD_RS | LCD_Enable;
+#if LCD_BUSY_FLAG
+	GPIO_InitStruct.Pin |= LCD_RW;
+#endif
 	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
 	GPIO_InitStruct.Pull = GPIO_PULLDOWN;
 	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
@@ -161,13 +434,23 @@ void LCD_INIT(void) {
 	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
 	HAL_GPIO_Init(LCDPwrPort, &GPIO_InitStruct);
 
-	GPIO_WriteHigh(LCDControlPort, LCD_Enable);
+	LCD_TIMER_INIT();
+
+	GPIO_WriteLow(LCDControlPort, LCD_Enable);
 	GPIO_WriteLow(LCDControlPort, LCD_RS);
+#if LCD_BUSY_FLAG
+	GPIO_WriteLow(LCDControlPort, LCD_RW);
+#endif
+	LCD_poll = 0;
 	//Initialization of HD44780-based LCD (4-bit HW)
 	LCD_CMD(0x33);
+	LCD_WAIT();
 	Delay(4);
 	LCD_CMD(0x32);
+	LCD_WAIT();
 	Delay(4);
+	// 4-bit mode is set, from now on the busy flag can be read
+	LCD_poll = 1;
 	//Function Set 4-bit mode
 	LCD_CMD(0x28);
 	//Display On/Off Control
@@ -175,6 +458,8 @@ void LCD_INIT(void) {
 	//Entry mode set
 	LCD_CMD(0x06);
 	LCD_CLEAR_DISPLAY();
+	LCD_FB_CLEAR();
+	LCD_GLYPH_RESET();
 	//Minimum delay to wait before driving LCD module
 	Delay(200);
 }
@@ -190,13 +475,11 @@ void LCD_printchar(unsigned char ascode) {
 		return;
 	}
 
-	GPIO_WriteHigh(LCDControlPort, LCD_RS);
-	GPIO_Write(LCDPort,
-			(GPIO_ReadOutputData(LCDPort) & 0xF0) | ((ascode >> 4) & 0x0F));
-	LCD_ENABLE();
-	GPIO_Write(LCDPort, (GPIO_ReadOutputData(LCDPort) & 0xF0) | (ascode & 0x0F));
-	LCD_ENABLE();
-	Delay(2);
+	PROFILE_BEGIN(PROFILE_LCD);
+
+	LCD_QUEUE(ascode | LCD_QUEUE_RS);
+
+	PROFILE_END(PROFILE_LCD);
 
 	LCD_cursor_col++;
 }
@@ -226,7 +509,11 @@ void LCD_printstring(unsigned char *text) {
  */
 void LCD_CLEAR_DISPLAY(void) {
 	LCD_CMD(0x01);
-	Delay(2);
+
+	// the display is blank and the cursor is at home
+	memset(LCD_shown, ' ', sizeof(LCD_shown));
+	LCD_cursor_row = 0;
+	LCD_cursor_col = 0;
 }
 
 /**
@@ -247,7 +534,6 @@ void LCD_2ndROW(void) {
  */
 void LCD_HOME(void) {
 	LCD_CMD(0x02);
-	Delay(2);
 }
 
 /**
@@ -327,29 +613,393 @@ void LCD_LOCATE(uint8_t row, uint8_t column) {
 }
 
 /**
- * @brief  lcd printf function
+ * @brief  Write one character of LCD_printf() to the display
+ * @param  Character ('\n' moves to the next row, the CGRAM characters 0-7 of LCD_GLYPH() are
+ *         printed, other control characters are dropped)
+ * @param  None
+ * @retval None
+ */
+static void LCD_PUTC(unsigned char c) {
+	if (c == '\n') {
+		LCD_LOCATE(LCD_cursor_row + 1, 0);
+	} else if ((c < 0x08) || ((c > 0x1F) && (c < 0x80))) {
+		LCD_printchar(c);
+	}
+}
+
+/**
+ * @brief  Write one character of LCD_FB_printf() to the framebuffer
+ * @param  Character ('\n' moves to the next row)
+ * @param  None
+ * @retval None
+ */
+static void LCD_FB_PUTC(unsigned char c) {
+	if (c == '\n') {
+		LCD_FB_LOCATE(LCD_fb_row + 1, 0);
+	} else {
+		LCD_FB_printchar(c);
+	}
+}
+
+/**
+ * @brief  Convert an unsigned number to digits
+ * @param  Number to be converted
+ * @param  Base (10 or 16)
+ * @param  Use upper case hex digits if non-zero
+ * @param  Destination for the digits (at least 10 characters, not terminated)
+ * @retval Number of digits written
+ */
+static uint8_t LCD_DIGITS(uint32_t value, uint8_t base, uint8_t upper,
+		char *digits) {
+	const char *symbols = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+	char reversed[10];
+	uint8_t n = 0;
+
+	do {
+		reversed[n++] = symbols[value % base];
+		value /= base;
+	} while (value);
+
+	for (uint8_t i = 0; i < n; i++) {
+		digits[i] = reversed[n - 1 - i];
+	}
+
+	return n;
+}
+
+/**
+ * @brief  Convert a fixed-point value with LCD_FIXED_FRACTION_BITS fraction bits to decimal
+ *         digits, rounded to the given number of decimals
+ * @param  Value to be converted
+ * @param  Number of decimals (0-4)
+ * @param  Destination for the characters (at least 16 characters, not terminated)
+ * @retval Number of characters written
+ */
+static uint8_t LCD_FIXED(int32_t value, uint8_t decimals, char *digits) {
+	static const uint16_t scale[] = { 1, 10, 100, 1000, 10000 };
+	uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+	uint32_t integer, fraction;
+	uint8_t n = 0;
+
+	if (decimals > 4) {
+		decimals = 4;
+	}
+
+	// the fraction bits are scaled on their own, magnitude * 10000 would overflow
+	integer = magnitude >> LCD_FIXED_FRACTION_BITS;
+	fraction = ((magnitude & ((1 << LCD_FIXED_FRACTION_BITS) - 1)) * scale[decimals]
+			+ (1 << (LCD_FIXED_FRACTION_BITS - 1))) >> LCD_FIXED_FRACTION_BITS;
+	if (fraction == scale[decimals]) {
+		// rounded up to the next integer
+		integer++;
+		fraction = 0;
+	}
+
+	if (value < 0 && (integer || fraction)) {
+		digits[n++] = '-';
+	}
+
+	n += LCD_DIGITS(integer, 10, 0, &digits[n]);
+
+	if (decimals) {
+		digits[n++] = '.';
+		for (uint8_t i = decimals; i > 0; i--) {
+			digits[n++] = '0' + (fraction / scale[i - 1]) % 10;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @brief  Small printf for the display. Supported conversions: %d %i %u %x %X %c %s %% and
+ *         %T (fixed-point value with LCD_FIXED_FRACTION_BITS fraction bits, like the DS18B20
+ *         temperatures, the precision gives the decimals, default 1). Flags '-' (left
+ *         alignment) and '0' (zero padding) and a field width are supported, widths are
+ *         limited to LCD_COLS. %c passes the CGRAM characters 0-7 (see LCD_GLYPH()). No
+ *         buffer is used and no floating point is needed.
+ * @param  Function writing a single character
+ * @param  Format string
+ * @param  Arguments
+ * @retval None
+ */
+static void LCD_FORMAT(void (*putc)(unsigned char), const char *fmt,
+		va_list args) {
+	while (*fmt) {
+		char field[16];
+		const char *text = field;
+		uint8_t left = 0, zero = 0, width = 0, precision = 1, length = 0;
+
+		if (*fmt != '%') {
+			putc(*fmt++);
+			continue;
+		}
+		fmt++;
+
+		for (;; fmt++) {
+			if (*fmt == '-') {
+				left = 1;
+			} else if (*fmt == '0') {
+				zero = 1;
+			} else {
+				break;
+			}
+		}
+		while (*fmt >= '0' && *fmt <= '9') {
+			width = width * 10 + (*fmt++ - '0');
+			if (width > LCD_COLS) {
+				width = LCD_COLS;
+			}
+		}
+		if (*fmt == '.') {
+			precision = 0;
+			fmt++;
+			while (*fmt >= '0' && *fmt <= '9') {
+				precision = precision * 10 + (*fmt++ - '0');
+				if (precision > 4) {
+					precision = 4;
+				}
+			}
+		}
+
+		switch (*fmt) {
+		case 'd':
+		case 'i': {
+			int32_t value = va_arg(args, int);
+			uint32_t magnitude = value < 0 ? -(uint32_t) value : (uint32_t) value;
+
+			if (value < 0) {
+				field[length++] = '-';
+			}
+			length += LCD_DIGITS(magnitude, 10, 0, &field[length]);
+			break;
+		}
+		case 'u':
+			length = LCD_DIGITS(va_arg(args, unsigned int), 10, 0, field);
+			break;
+		case 'x':
+		case 'X':
+			length = LCD_DIGITS(va_arg(args, unsigned int), 16, *fmt == 'X',
+					field);
+			break;
+		case 'T':
+			length = LCD_FIXED(va_arg(args, int), precision, field);
+			break;
+		case 'c':
+			field[length++] = va_arg(args, int);
+			break;
+		case 's':
+			text = va_arg(args, const char *);
+			while (text[length] && length < LCD_COLS) {
+				length++;
+			}
+			break;
+		case '\0':
+			return;
+		default:	// "%%" and unsupported conversions are printed as they are
+			field[length++] = *fmt;
+			break;
+		}
+		fmt++;
+
+		if (left) {
+			zero = 0;
+		}
+
+		// zero padding goes after the sign
+		if (zero && length && text == field && field[0] == '-') {
+			putc('-');
+			text++;
+			length--;
+			if (width) {
+				width--;
+			}
+		}
+
+		for (uint8_t i = length; !left && i < width; i++) {
+			putc(zero ? '0' : ' ');
+		}
+		for (uint8_t i = 0; i < length; i++) {
+			putc(text[i]);
+		}
+		for (uint8_t i = length; left && i < width; i++) {
+			putc(' ');
+		}
+	}
+}
+
+/**
+ * @brief  lcd printf function (see LCD_FORMAT() for the supported formats)
  * @param  string with standard defined formats
  * @param
  * @retval None
  */
 void LCD_printf(const char *fmt, ...) {
-	int32_t i;
-	uint32_t text_size, letter;
-	static char text_buffer[32];
 	va_list args;
 
 	va_start(args, fmt);
-	text_size = vsprintf(text_buffer, fmt, args);
+	LCD_FORMAT(LCD_PUTC, fmt, args);
+	va_end(args);
+}
+
+/**
+ * @brief  printf into the framebuffer (see LCD_FORMAT() for the supported formats)
+ * @param  string with standard defined formats
+ * @param
+ * @retval None
+ */
+void LCD_FB_printf(const char *fmt, ...) {
+	va_list args;
+
+	va_start(args, fmt);
+	LCD_FORMAT(LCD_FB_PUTC, fmt, args);
+	va_end(args);
+}
+
+/**
+ * @brief  Clear the framebuffer (fill it with spaces) and set its cursor home
+ * @param  None
+ * @param  None
+ * @retval None
+ */
+void LCD_FB_CLEAR(void) {
+	memset(LCD_fb, ' ', sizeof(LCD_fb));
+	LCD_fb_row = 0;
+	LCD_fb_col = 0;
+}
+
+/**
+ * @brief  Set the framebuffer cursor (nothing is sent to the display)
+ * @param  Row Number (0-3)
+ * @param  Column Number (0-15)
+ * @retval None
+ */
+void LCD_FB_LOCATE(uint8_t row, uint8_t column) {
+	if (row >= LCD_ROWS || column >= LCD_COLS) {
+		return;
+	}
+
+	LCD_fb_row = row;
+	LCD_fb_col = column;
+}
+
+/**
+ * @brief  Draw a character into the framebuffer at its cursor
+ * @param  Ascii value of character (characters beyond the end of the row are dropped)
+ * @param  None
+ * @retval None
+ */
+void LCD_FB_printchar(unsigned char ascode) {
+	if (LCD_fb_col >= LCD_COLS) {
+		return;
+	}
+
+	LCD_fb[LCD_fb_row][LCD_fb_col++] = ascode;
+}
+
+/**
+ * @brief  Draw a characters string into the framebuffer
+ * @param  Text to be drawn (terminated by '\0', '\n' moves to the next row)
+ * @param  None
+ * @retval None
+ */
+void LCD_FB_printstring(const char *text) {
+	while (*text) {
+		if (*text == '\n') {
+			LCD_FB_LOCATE(LCD_fb_row + 1, 0);
+			text++;
+		} else {
+			LCD_FB_printchar(*text++);
+		}
+	}
+}
 
-	// Process the string
-	for (i = 0; i < text_size; i++) {
-		letter = text_buffer[i];
+/**
+ * @brief  Draw a horizontal bar graph into the framebuffer (5 steps per character, the
+ *         partial character is taken from the CGRAM glyph cache)
+ * @param  Row Number (0-3)
+ * @param  Column Number (0-15) of the left end
+ * @param  Width in characters (clipped at the end of the row)
+ * @param  Value to be shown (0 - max)
+ * @param  Value of a completely filled bar
+ * @retval None
+ */
+void LCD_FB_BAR(uint8_t row, uint8_t column, uint8_t width, uint16_t value,
+		uint16_t max) {
+	static const char columns[4][8] = {
+		{ 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 },	// 1 column  |
+		{ 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18 },	// 2 columns ||
+		{ 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c },	// 3 columns |||
+		{ 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e },	// 4 columns ||||
+	};
+	uint16_t filled;
+
+	if (row >= LCD_ROWS || column >= LCD_COLS || !max) {
+		return;
+	}
+	if (width > LCD_COLS - column) {
+		width = LCD_COLS - column;
+	}
+	if (value > max) {
+		value = max;
+	}
+
+	filled = (uint32_t) value * width * 5 / max;
+
+	for (uint8_t i = 0; i < width; i++, filled = filled > 5 ? filled - 5 : 0) {
+		if (filled >= 5) {
+			LCD_fb[row][column + i] = LCD_FULL_BLOCK;
+		} else if (filled) {
+			LCD_fb[row][column + i] = LCD_GLYPH(LCD_GLYPH_BAR_1 + filled - 1,
+					columns[filled - 1]);
+		} else {
+			LCD_fb[row][column + i] = ' ';
+		}
+	}
+}
 
-		if (letter == '\n')
-			LCD_LOCATE(LCD_cursor_row + 1, 0);
-		else {
-			if ((letter > 0x1F) && (letter < 0x80))
-				LCD_printchar(letter);
+/**
+ * @brief  Send the framebuffer to the display. Only the cells that changed since the last flush
+ *         are written, the cursor is only moved where a run of changed cells begins.
+ * @param  None
+ * @param  None
+ * @retval Number of bus writes (characters and cursor commands)
+ */
+uint16_t LCD_FB_FLUSH(void) {
+	uint16_t writes = 0;
+
+	for (uint8_t row = 0; row < LCD_ROWS; row++) {
+		for (uint8_t col = 0; col < LCD_COLS; col++) {
+			if (LCD_fb[row][col] == LCD_shown[row][col]) {
+				continue;
+			}
+
+			// the display cursor advances by itself after every character
+			if (LCD_cursor_row != row || LCD_cursor_col != col) {
+				LCD_LOCATE(row, col);
+				writes++;
+			}
+
+			LCD_printchar(LCD_fb[row][col]);
+			LCD_shown[row][col] = LCD_fb[row][col];
+			writes++;
+		}
+	}
+
+	return writes;
+}
+
+/**
+ * @brief  Mark every cell as changed, so the next LCD_FB_FLUSH() repaints the whole display
+ *         (needed after writing to the display without the framebuffer)
+ * @param  None
+ * @param  None
+ * @retval None
+ */
+void LCD_FB_INVALIDATE(void) {
+	for (uint8_t row = 0; row < LCD_ROWS; row++) {
+		for (uint8_t col = 0; col < LCD_COLS; col++) {
+			LCD_shown[row][col] = ~LCD_fb[row][col];
 		}
 	}
 }
@@ -40,25 +40,165 @@
 /* Includes ------------------------------------------------------------------*/
 #include "can.h"
 
+#include <stdlib.h>
 #include "gpio.h"
+#include "timing.h"
 
 CAN_HandleTypeDef hcan;
 
+/**
+ * Calculates the bit timing for a bit rate. A bit consists of the sync segment (1 TQ), BS1 and
+ * BS2, the bit is sampled between BS1 and BS2. The solution with the sample point closest to
+ * \p sample_point is chosen, among equally close ones the one with the most TQ per bit (the
+ * finest resynchronization). SJW is as long as possible (up to BS2 and 4 TQ).
+ * @param clock CAN clock (PCLK1) in Hz
+ * @param bitrate Bit rate in bit/s
+ * @param sample_point Sample point in 1/1000 of the bit time
+ * @param timing Destination for the bit timing
+ * @return
+ * - 0 if the bit rate can't be derived exactly from \p clock
+ * - 1 if \p timing is valid
+ */
+int can_bit_timing(uint32_t clock, uint32_t bitrate, uint16_t sample_point,
+		CAN_Bit_Timing *timing) {
+	uint16_t best_error = UINT16_MAX;
+
+	if (!bitrate) {
+		return 0;
+	}
+
+	for (uint8_t tq = 1 + 16 + 8; tq >= 1 + 1 + 1; tq--) {
+		uint32_t prescaler;
+		int16_t bs1;
+		uint8_t bs2;
+		uint16_t error;
+
+		if (clock % (bitrate * tq)) {
+			continue;
+		}
+		prescaler = clock / (bitrate * tq);
+		if (prescaler < 1 || prescaler > 1024) {
+			continue;
+		}
+
+		// sample point (1 + BS1) / TQ, rounded to the nearest TQ
+		bs1 = ((uint32_t) sample_point * tq + 500) / 1000 - 1;
+		if (bs1 > 16) {
+			bs1 = 16;
+		}
+		if (bs1 > tq - 2) {
+			bs1 = tq - 2;
+		}
+		if (bs1 < 1) {
+			bs1 = 1;
+		}
+		bs2 = tq - 1 - bs1;
+		if (bs2 > 8) {
+			continue;
+		}
+
+		error = abs((int32_t) (1 + bs1) * 1000 / tq - sample_point);
+		if (error < best_error) {
+			best_error = error;
+			timing->prescaler = prescaler;
+			timing->bs1 = bs1;
+			timing->bs2 = bs2;
+			timing->sjw = bs2 < 4 ? bs2 : 4;
+		}
+	}
+
+	return best_error != UINT16_MAX;
+}
+
+/**
+ * Waits until INAK (initialization mode) has the state \p inak.
+ * @return
+ * - 0 if it didn't within #CAN_INIT_TIMEOUT_US
+ * - 1 otherwise
+ */
+static int can_wait_init(uint32_t inak) {
+	uint64_t deadline = timing_deadline_us(CAN_INIT_TIMEOUT_US);
+
+	while ((CAN->MSR & CAN_MSR_INAK) != inak) {
+		if (timing_deadline_reached(deadline)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**
+ * Changes the bit rate at runtime (the CAN is in initialization mode in between, so frames
+ * being sent or received are lost). The sample point is #CAN_SAMPLE_POINT. The timing is also
+ * written to hcan.Init, so a later HAL_CAN_Init() keeps it.
+ *
+ * The CAN only leaves the initialization mode after 11 recessive bits, so on a bus that is
+ * never recessive (e.g. the transceiver is disconnected) the waits time out.
+ * @param bitrate Bit rate in bit/s (up to 1Mbit/s)
+ * @return
+ * - 0 if the bit rate can't be derived from PCLK1 (nothing was changed)
+ * - 1 if the bit rate was set
+ * - -1 if the initialization mode wasn't acknowledged within #CAN_INIT_TIMEOUT_US. If it
+ *   couldn't be entered, nothing was changed. If it couldn't be left, the new bit rate is set
+ *   and the CAN joins the bus as soon as it sees it recessive.
+ */
+int can_set_bitrate(uint32_t bitrate) {
+	CAN_Bit_Timing timing;
+	uint32_t btr;
+
+	if (bitrate > 1000000
+			|| !can_bit_timing(HAL_RCC_GetPCLK1Freq(), bitrate,
+					CAN_SAMPLE_POINT, &timing)) {
+		return 0;
+	}
+
+	CAN->MCR |= CAN_MCR_INRQ;
+	if (!can_wait_init(CAN_MSR_INAK)) {
+		CAN->MCR &= ~CAN_MCR_INRQ;
+		return -1;
+	}
+
+	hcan.Init.Prescaler = timing.prescaler;
+	hcan.Init.SJW = (uint32_t) (timing.sjw - 1) << CAN_BTR_SJW_Pos;
+	hcan.Init.BS1 = (uint32_t) (timing.bs1 - 1) << CAN_BTR_TS1_Pos;
+	hcan.Init.BS2 = (uint32_t) (timing.bs2 - 1) << CAN_BTR_TS2_Pos;
+
+	btr = CAN->BTR & (CAN_BTR_LBKM | CAN_BTR_SILM);
+	btr |= hcan.Init.SJW | hcan.Init.BS1 | hcan.Init.BS2;
+	btr |= timing.prescaler - 1;
+	CAN->BTR = btr;
+
+	CAN->MCR &= ~CAN_MCR_INRQ;
+	if (!can_wait_init(0)) {
+		return -1;
+	}
+
+	return 1;
+}
+
 /* CAN init function */
 void MX_CAN_Init(void) {
+	CAN_Bit_Timing timing;
+
 	//refer to http://www.diller-technologies.de/stm32.html#can
+	if (!can_bit_timing(HAL_RCC_GetPCLK1Freq(), CAN_BITRATE, CAN_SAMPLE_POINT,
+			&timing)) {
+		_Error_Handler(__FILE__, __LINE__);
+	}
+
 	hcan.Instance = CAN;
-	hcan.Init.Prescaler = 16;
+	hcan.Init.Prescaler = timing.prescaler;
 	hcan.Init.Mode = CAN_MODE_NORMAL;
-	hcan.Init.SJW = CAN_SJW_1TQ;
-	hcan.Init.BS1 = CAN_BS1_1TQ;
-	hcan.Init.BS2 = CAN_BS2_1TQ;
+	hcan.Init.SJW = (uint32_t) (timing.sjw - 1) << CAN_BTR_SJW_Pos;
+	hcan.Init.BS1 = (uint32_t) (timing.bs1 - 1) << CAN_BTR_TS1_Pos;
+	hcan.Init.BS2 = (uint32_t) (timing.bs2 - 1) << CAN_BTR_TS2_Pos;
 	hcan.Init.TTCM = DISABLE; // time triggered communication mode (tx and rx timestamps)
 	hcan.Init.ABOM = DISABLE;			// automatic bus-off management
 	hcan.Init.AWUM = DISABLE;// automatic wakeup mode (how to exit sleep mode)
 	hcan.Init.NART = DISABLE;		// no automatic retransmission (on tx error)
 	hcan.Init.RFLM = DISABLE;// receive FIFO locked mode (if new msgs are kept)
-	hcan.Init.TXFP = DISABLE;// transmit FIFO priority (if id or chronological)
+	hcan.Init.TXFP = ENABLE;// transmit FIFO priority (if id or chronological)
 	if (HAL_CAN_Init(&hcan) != HAL_OK) {
 		_Error_Handler(__FILE__, __LINE__);
 	}
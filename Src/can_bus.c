@@ -0,0 +1,271 @@
+/**
+ ******************************************************************************
+ * @file    can_bus.c
+ * @brief  Interrupt driven CAN transmit and receive queues
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * HAL_CAN_Transmit() and HAL_CAN_Receive() busy-wait for the bus, and frames received while
+ * the CPU is busy elsewhere are lost as soon as the 3 message FIFO slots are full. This module
+ * decouples the application from the bus by two ring buffers:
+ * - can_bus_send() appends a frame to the transmit queue. The transmit interrupt moves queued
+ *   frames into every free transmit mailbox (all three are used, in chronological order).
+ * - The FIFO0 and FIFO1 interrupts move received frames into the receive queue, which is
+ *   emptied with can_bus_receive().
+ *
+ * Each ring buffer has exactly one producer and one consumer, so the indices are only ever
+ * written by one side and no locking is needed (the two receive interrupts share a priority and
+ * can't preempt each other). Only the refill of the mailboxes from the application side runs
+ * with interrupts disabled, since the transmit interrupt does the same.
+ *
+ * Every frame sent or received is reported to can_stats, together with the time it spent
+ * between can_bus_send() and the end of its transmission.
+ *
+ * The peripheral has to be set up by MX_CAN_Init() beforehand, everything else is done at
+ * register level.
+ *
+ ******************************************************************************
+ */
+
+#include "can_bus.h"
+#include "can_stats.h"
+#include "timing.h"
+
+static CAN_Bus_Frame tx_queue[CAN_BUS_TX_QUEUE_LENGTH];
+static uint32_t tx_queued[CAN_BUS_TX_QUEUE_LENGTH];	// cycle counter at can_bus_send()
+static volatile uint16_t tx_head = 0;	// next frame to move into a mailbox (interrupt)
+static volatile uint16_t tx_tail = 0;	// next free entry (application)
+
+static CAN_Bus_Frame rx_queue[CAN_BUS_RX_QUEUE_LENGTH];
+static volatile uint16_t rx_head = 0;	// next frame to hand out (application)
+static volatile uint16_t rx_tail = 0;	// next free entry (interrupts)
+
+static CAN_Bus_Counters counters;
+
+/* the frame in each transmit mailbox, reported to can_stats when it is finished */
+static struct {
+	uint32_t id;
+	uint8_t flags;
+	uint8_t dlc;
+	uint32_t queued;
+} mailboxes[3];
+
+_Static_assert((CAN_BUS_TX_QUEUE_LENGTH & (CAN_BUS_TX_QUEUE_LENGTH - 1)) == 0,
+		"CAN_BUS_TX_QUEUE_LENGTH has to be a power of two");
+_Static_assert((CAN_BUS_RX_QUEUE_LENGTH & (CAN_BUS_RX_QUEUE_LENGTH - 1)) == 0,
+		"CAN_BUS_RX_QUEUE_LENGTH has to be a power of two");
+
+/**
+ * Moves queued frames into the free transmit mailboxes until either the mailboxes are full or
+ * the transmit queue is empty. Must not be interrupted by the transmit interrupt.
+ */
+static void can_bus_fill_mailboxes(void) {
+	while ((CAN->TSR & CAN_TSR_TME) && tx_head != tx_tail) {
+		uint16_t index = tx_head & (CAN_BUS_TX_QUEUE_LENGTH - 1);
+		const CAN_Bus_Frame *frame = &tx_queue[index];
+		uint8_t mailbox = (CAN->TSR & CAN_TSR_CODE) >> CAN_TSR_CODE_Pos;
+		CAN_TxMailBox_TypeDef *mb = &CAN->sTxMailBox[mailbox];
+		uint32_t tir;
+
+		if (frame->flags & CAN_BUS_FLAG_EXT) {
+			tir = (frame->id << CAN_TI0R_EXID_Pos) | CAN_TI0R_IDE;
+		} else {
+			tir = frame->id << CAN_TI0R_STID_Pos;
+		}
+		if (frame->flags & CAN_BUS_FLAG_RTR) {
+			tir |= CAN_TI0R_RTR;
+		}
+
+		mb->TIR = tir;
+		mb->TDTR = frame->dlc & CAN_TDT0R_DLC;
+		mb->TDLR = frame->data[0] | (frame->data[1] << 8)
+				| (frame->data[2] << 16) | ((uint32_t) frame->data[3] << 24);
+		mb->TDHR = frame->data[4] | (frame->data[5] << 8)
+				| (frame->data[6] << 16) | ((uint32_t) frame->data[7] << 24);
+		mailboxes[mailbox].id = frame->id;
+		mailboxes[mailbox].flags = frame->flags;
+		mailboxes[mailbox].dlc = frame->dlc;
+		mailboxes[mailbox].queued = tx_queued[index];
+
+		mb->TIR = tir | CAN_TI0R_TXRQ;
+
+		tx_head++;
+	}
+}
+
+/**
+ * Configures the transmit and receive interrupts and the statistics (can_stats_init()). The
+ * frames are sent in the order they are queued (TXFP, set by MX_CAN_Init()). Call this once after
+ * MX_CAN_Init().
+ */
+void can_bus_init(void) {
+	tx_head = tx_tail = 0;
+	rx_head = rx_tail = 0;
+
+	// accept everything in FIFO0 (filter bank 0, 32 bit mask 0) until can_filter_apply() is used
+	CAN->FMR |= CAN_FMR_FINIT;
+	CAN->FA1R &= ~CAN_FA1R_FACT0;
+	CAN->FS1R |= CAN_FS1R_FSC0;
+	CAN->FM1R &= ~CAN_FM1R_FBM0;
+	CAN->FFA1R &= ~CAN_FFA1R_FFA0;
+	CAN->sFilterRegister[0].FR1 = 0;
+	CAN->sFilterRegister[0].FR2 = 0;
+	CAN->FA1R |= CAN_FA1R_FACT0;
+	CAN->FMR &= ~CAN_FMR_FINIT;
+
+	CAN->IER |= CAN_IER_TMEIE | CAN_IER_FMPIE0 | CAN_IER_FOVIE0
+			| CAN_IER_FMPIE1 | CAN_IER_FOVIE1;
+
+	HAL_NVIC_SetPriority(USB_HP_CAN_TX_IRQn, CAN_BUS_IRQ_PRIORITY, 0);
+	HAL_NVIC_SetPriority(USB_LP_CAN_RX0_IRQn, CAN_BUS_IRQ_PRIORITY, 0);
+	HAL_NVIC_SetPriority(CAN_RX1_IRQn, CAN_BUS_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(USB_HP_CAN_TX_IRQn);
+	HAL_NVIC_EnableIRQ(USB_LP_CAN_RX0_IRQn);
+	HAL_NVIC_EnableIRQ(CAN_RX1_IRQn);
+
+	can_stats_init();
+}
+
+/**
+ * Queues a frame for sending. If a transmit mailbox is free, the frame is handed to the
+ * hardware right away.
+ * @param frame Frame to be sent (copied)
+ * @return
+ * - 0 if the transmit queue is full
+ * - 1 if the frame got queued
+ */
+int can_bus_send(const CAN_Bus_Frame *frame) {
+	uint32_t primask;
+
+	if ((uint16_t) (tx_tail - tx_head) == CAN_BUS_TX_QUEUE_LENGTH) {
+		return 0;
+	}
+
+	tx_queue[tx_tail & (CAN_BUS_TX_QUEUE_LENGTH - 1)] = *frame;
+	tx_queued[tx_tail & (CAN_BUS_TX_QUEUE_LENGTH - 1)] = TIMING_CYCCNT;
+	__DMB();	// the frame has to be complete before the interrupt can see it
+	tx_tail++;
+
+	primask = __get_PRIMASK();
+	__disable_irq();
+	can_bus_fill_mailboxes();
+	__set_PRIMASK(primask);
+
+	return 1;
+}
+
+/**
+ * Takes the oldest frame from the receive queue.
+ * @param frame Destination for the frame
+ * @return
+ * - 0 if there is no frame
+ * - 1 if a frame was copied to \p frame
+ */
+int can_bus_receive(CAN_Bus_Frame *frame) {
+	if (rx_head == rx_tail) {
+		return 0;
+	}
+
+	*frame = rx_queue[rx_head & (CAN_BUS_RX_QUEUE_LENGTH - 1)];
+	__DMB();	// the entry has to be read before the interrupt may overwrite it
+	rx_head++;
+
+	return 1;
+}
+
+/**
+ * @return Number of frames waiting in the transmit queue (not counting the mailboxes)
+ */
+uint16_t can_bus_tx_pending(void) {
+	return tx_tail - tx_head;
+}
+
+/**
+ * @return Number of frames waiting in the receive queue
+ */
+uint16_t can_bus_rx_pending(void) {
+	return rx_tail - rx_head;
+}
+
+/**
+ * @return Counters of the frames lost on the receive side
+ */
+const CAN_Bus_Counters *can_bus_counters(void) {
+	return &counters;
+}
+
+/**
+ * Has to be called from USB_HP_CAN_TX_IRQHandler().
+ */
+void can_bus_tx_irq_handler(void) {
+	uint32_t tsr = CAN->TSR;
+	uint32_t now = TIMING_CYCCNT;
+
+	for (int mailbox = 0; mailbox < 3; mailbox++) {
+		// RQCP, TXOK, ALST and TERR of every mailbox are 8 bits apart
+		uint32_t status = tsr >> (8 * mailbox);
+
+		if (status & CAN_TSR_RQCP0) {
+			can_stats_tx(mailboxes[mailbox].id, mailboxes[mailbox].flags,
+					mailboxes[mailbox].dlc, now - mailboxes[mailbox].queued,
+					status);
+		}
+	}
+
+	// acknowledge the finished requests (whether successful or not)
+	CAN->TSR = tsr & (CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2);
+
+	can_bus_fill_mailboxes();
+}
+
+/**
+ * Has to be called from USB_LP_CAN_RX0_IRQHandler() (\p fifo 0) and CAN_RX1_IRQHandler()
+ * (\p fifo 1).
+ * @param fifo Receive FIFO that raised the interrupt
+ */
+void can_bus_rx_irq_handler(uint8_t fifo) {
+	volatile uint32_t *rfr = fifo ? &CAN->RF1R : &CAN->RF0R;
+	CAN_FIFOMailBox_TypeDef *mb = &CAN->sFIFOMailBox[fifo];
+
+	if (*rfr & CAN_RF0R_FOVR0) {
+		counters.overrun[fifo]++;
+		*rfr = CAN_RF0R_FOVR0 | CAN_RF0R_FULL0;
+	}
+
+	while (*rfr & CAN_RF0R_FMP0) {
+		if ((uint16_t) (rx_tail - rx_head) == CAN_BUS_RX_QUEUE_LENGTH) {
+			counters.dropped[fifo]++;
+		} else {
+			CAN_Bus_Frame *frame = &rx_queue[rx_tail
+					& (CAN_BUS_RX_QUEUE_LENGTH - 1)];
+			uint32_t rir = mb->RIR;
+			uint32_t rdtr = mb->RDTR;
+			uint32_t rdlr = mb->RDLR;
+			uint32_t rdhr = mb->RDHR;
+
+			if (rir & CAN_RI0R_IDE) {
+				frame->id = rir >> CAN_RI0R_EXID_Pos;
+				frame->flags = CAN_BUS_FLAG_EXT;
+			} else {
+				frame->id = rir >> CAN_RI0R_STID_Pos;
+				frame->flags = 0;
+			}
+			if (rir & CAN_RI0R_RTR) {
+				frame->flags |= CAN_BUS_FLAG_RTR;
+			}
+			frame->dlc = rdtr & CAN_RDT0R_DLC;
+			frame->filter = (rdtr & CAN_RDT0R_FMI) >> CAN_RDT0R_FMI_Pos;
+			frame->fifo = fifo;
+			for (int i = 0; i < 4; i++) {
+				frame->data[i] = rdlr >> (8 * i);
+				frame->data[4 + i] = rdhr >> (8 * i);
+			}
+			can_stats_rx(frame);
+
+			__DMB();	// the frame has to be complete before the application can see it
+			rx_tail++;
+		}
+
+		*rfr = CAN_RF0R_RFOM0;	// release the FIFO slot
+	}
+}
@@ -0,0 +1,276 @@
+/**
+ ******************************************************************************
+ * @file    can_filter.c
+ * @brief  Packs the CAN identifiers the modules subscribe to into the bxCAN filter banks
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Every module registers the identifiers it consumes with can_filter_subscribe() (a single
+ * identifier) or can_filter_subscribe_range() (split into aligned blocks, one id/mask pair
+ * each). can_filter_apply() then programs the filter banks, so the hardware drops every other
+ * frame before it costs any CPU time.
+ *
+ * The subscriptions are packed into as few banks as possible:
+ * - single standard identifiers: 16 bit list mode, 4 per bank
+ * - standard blocks: 16 bit mask mode, 2 per bank
+ * - single extended identifiers: 32 bit list mode, 2 per bank
+ * - extended blocks: 32 bit mask mode, 1 per bank
+ * Subscriptions of #CAN_FILTER_HIGH go to banks assigned to FIFO0, #CAN_FILTER_LOW to FIFO1,
+ * so frequent low priority traffic can't overrun the FIFO of the important frames. Unused
+ * slots of a bank repeat its last entry. Only data frames are accepted.
+ *
+ ******************************************************************************
+ */
+
+#include "can_filter.h"
+
+/* Kinds of filter entries, in the order they are packed */
+enum {
+	CAN_FILTER_LIST16, CAN_FILTER_MASK16, CAN_FILTER_LIST32, CAN_FILTER_MASK32, CAN_FILTER_KINDS
+};
+
+/* Number of entries of each kind that fit into one bank */
+static const uint8_t per_bank[CAN_FILTER_KINDS] = { 4, 2, 2, 1 };
+
+/* Filter register bits (16 bit and 32 bit scale) */
+#define CAN_FILTER16_RTR		0x0010
+#define CAN_FILTER16_IDE		0x0008
+#define CAN_FILTER32_IDE		0x00000004
+#define CAN_FILTER32_RTR		0x00000002
+
+#define CAN_FILTER_STD_MASK		0x7FF
+#define CAN_FILTER_EXT_MASK		0x1FFFFFFF
+
+typedef struct {
+	uint32_t id;
+	uint32_t mask;		// bits of the identifier that have to match
+	uint8_t flags;		// CAN_BUS_FLAG_EXT
+	uint8_t fifo;
+} CAN_Filter_Subscription;
+
+static CAN_Filter_Subscription subscriptions[CAN_FILTER_MAX_SUBSCRIPTIONS];
+static uint8_t subscription_count = 0;
+
+/**
+ * Removes all subscriptions (can_filter_apply() then blocks every frame).
+ */
+void can_filter_clear(void) {
+	subscription_count = 0;
+}
+
+/**
+ * Adds an entry to the subscription table.
+ * @return
+ * - 0 if the table is full
+ * - 1 if the entry was added
+ */
+static int can_filter_add(uint32_t id, uint32_t mask, uint8_t flags,
+		uint8_t priority) {
+	if (subscription_count == CAN_FILTER_MAX_SUBSCRIPTIONS) {
+		return 0;
+	}
+
+	subscriptions[subscription_count].id = id & mask;
+	subscriptions[subscription_count].mask = mask;
+	subscriptions[subscription_count].flags = flags & CAN_BUS_FLAG_EXT;
+	subscriptions[subscription_count].fifo = priority ? 1 : 0;
+	subscription_count++;
+
+	return 1;
+}
+
+/**
+ * Subscribes to a single identifier. Takes effect with can_filter_apply().
+ * @param id Standard or extended identifier
+ * @param flags #CAN_BUS_FLAG_EXT for an extended identifier
+ * @param priority #CAN_FILTER_HIGH or #CAN_FILTER_LOW
+ * @return
+ * - 0 if the subscription table is full
+ * - 1 if the identifier was added
+ */
+int can_filter_subscribe(uint32_t id, uint8_t flags, uint8_t priority) {
+	uint32_t mask =
+			(flags & CAN_BUS_FLAG_EXT) ? CAN_FILTER_EXT_MASK : CAN_FILTER_STD_MASK;
+
+	return can_filter_add(id, mask, flags, priority);
+}
+
+/**
+ * Subscribes to all identifiers from \p first to \p last. The range is split into blocks whose
+ * size is a power of two and that are aligned to their size, so every block is matched by one
+ * id/mask pair. Takes effect with can_filter_apply().
+ * @param first First identifier of the range
+ * @param last Last identifier of the range
+ * @param flags #CAN_BUS_FLAG_EXT for extended identifiers
+ * @param priority #CAN_FILTER_HIGH or #CAN_FILTER_LOW
+ * @return
+ * - 0 if the subscription table is full (the blocks added so far are kept)
+ * - 1 if the whole range was added
+ */
+int can_filter_subscribe_range(uint32_t first, uint32_t last, uint8_t flags,
+		uint8_t priority) {
+	uint32_t all =
+			(flags & CAN_BUS_FLAG_EXT) ? CAN_FILTER_EXT_MASK : CAN_FILTER_STD_MASK;
+
+	if (last > all) {
+		last = all;
+	}
+
+	while (first <= last) {
+		uint32_t size = 1;
+
+		// grow the block while it stays aligned and inside the range
+		while (size <= all && !(first & size) && first + 2 * size - 1 <= last) {
+			size *= 2;
+		}
+
+		if (!can_filter_add(first, all & ~(size - 1), flags, priority)) {
+			return 0;
+		}
+
+		if (first + size - 1 >= last) {
+			break;
+		}
+		first += size;
+	}
+
+	return 1;
+}
+
+/**
+ * Returns the kind of filter entry a subscription is packed into.
+ */
+static uint8_t can_filter_kind(const CAN_Filter_Subscription *s) {
+	if (s->flags & CAN_BUS_FLAG_EXT) {
+		return s->mask == CAN_FILTER_EXT_MASK ?
+				CAN_FILTER_LIST32 : CAN_FILTER_MASK32;
+	} else {
+		return s->mask == CAN_FILTER_STD_MASK ?
+				CAN_FILTER_LIST16 : CAN_FILTER_MASK16;
+	}
+}
+
+/**
+ * Calculates the register value(s) of a subscription: for 16 bit kinds the identifier in the
+ * lower and the mask in the upper half of \p value, for 32 bit kinds identifier in \p value
+ * and mask in \p mask. Only data frames with a matching IDE bit pass.
+ */
+static void can_filter_words(const CAN_Filter_Subscription *s, uint32_t *value,
+		uint32_t *mask) {
+	if (s->flags & CAN_BUS_FLAG_EXT) {
+		*value = (s->id << 3) | CAN_FILTER32_IDE;
+		*mask = (s->mask << 3) | CAN_FILTER32_IDE | CAN_FILTER32_RTR;
+	} else {
+		*value = (s->id << 5)
+				| (((s->mask << 5) | CAN_FILTER16_RTR | CAN_FILTER16_IDE) << 16);
+		*mask = 0;
+	}
+}
+
+/**
+ * Programs the filter banks with the current subscriptions. If they don't fit into the
+ * #CAN_FILTER_BANKS banks, the filters are left unchanged.
+ * @return
+ * - 0 if the subscriptions need more than #CAN_FILTER_BANKS banks
+ * - 1 if the filters were programmed
+ */
+int can_filter_apply(void) {
+	uint32_t fr[CAN_FILTER_BANKS][2];
+	uint32_t scale32 = 0, list = 0, fifo1 = 0;
+	uint8_t banks = 0;
+
+	for (uint8_t fifo = 0; fifo < 2; fifo++) {
+		for (uint8_t kind = 0; kind < CAN_FILTER_KINDS; kind++) {
+			uint16_t half[4];	// 16 bit entries of the current bank
+			uint32_t word[2];	// 32 bit entries of the current bank
+			uint8_t n = 0;
+
+			for (uint8_t i = 0; i <= subscription_count; i++) {
+				const CAN_Filter_Subscription *s = &subscriptions[i];
+				uint32_t value, mask;
+
+				if (i < subscription_count) {
+					if (s->fifo != fifo || can_filter_kind(s) != kind) {
+						continue;
+					}
+
+					can_filter_words(s, &value, &mask);
+
+					switch (kind) {
+					case CAN_FILTER_LIST16:
+						half[n] = value;
+						break;
+					case CAN_FILTER_MASK16:
+						half[2 * n] = value;
+						half[2 * n + 1] = value >> 16;
+						break;
+					case CAN_FILTER_LIST32:
+						word[n] = value;
+						break;
+					default:
+						word[0] = value;
+						word[1] = mask;
+						break;
+					}
+					n++;
+
+					if (n < per_bank[kind]) {
+						continue;
+					}
+				} else if (!n) {
+					break;
+				}
+
+				// the bank is full (or the last one of this kind): fill up and store it
+				if (banks == CAN_FILTER_BANKS) {
+					return 0;
+				}
+
+				for (; n < per_bank[kind]; n++) {
+					if (kind == CAN_FILTER_LIST16) {
+						half[n] = half[n - 1];
+					} else if (kind == CAN_FILTER_MASK16) {
+						half[2 * n] = half[2 * n - 2];
+						half[2 * n + 1] = half[2 * n - 1];
+					} else {
+						word[n] = word[n - 1];
+					}
+				}
+
+				if (kind == CAN_FILTER_LIST16 || kind == CAN_FILTER_MASK16) {
+					fr[banks][0] = half[0] | ((uint32_t) half[1] << 16);
+					fr[banks][1] = half[2] | ((uint32_t) half[3] << 16);
+				} else {
+					fr[banks][0] = word[0];
+					fr[banks][1] = word[1];
+					scale32 |= 1 << banks;
+				}
+				if (kind == CAN_FILTER_LIST16 || kind == CAN_FILTER_LIST32) {
+					list |= 1 << banks;
+				}
+				if (fifo) {
+					fifo1 |= 1 << banks;
+				}
+
+				banks++;
+				n = 0;
+			}
+		}
+	}
+
+	CAN->FMR |= CAN_FMR_FINIT;
+	CAN->FA1R = 0;
+
+	CAN->FS1R = scale32;
+	CAN->FM1R = list;
+	CAN->FFA1R = fifo1;
+	for (uint8_t i = 0; i < banks; i++) {
+		CAN->sFilterRegister[i].FR1 = fr[i][0];
+		CAN->sFilterRegister[i].FR2 = fr[i][1];
+	}
+
+	CAN->FA1R = (1 << banks) - 1;
+	CAN->FMR &= ~CAN_FMR_FINIT;
+
+	return 1;
+}
@@ -0,0 +1,319 @@
+/**
+ ******************************************************************************
+ * @file    can_stats.c
+ * @brief  CAN bus load, transmit latency and error statistics
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The interrupts of can_bus report every frame sent or received:
+ * - can_stats_tx() gets the time from can_bus_send() until the mailbox reported the frame as
+ *   sent and the mailbox status (arbitration lost, transmit error). The latency goes into a
+ *   histogram per priority class (see CAN_STATS_CLASS()) with logarithmic buckets.
+ * - can_stats_rx() counts the received frames.
+ * - The status change interrupt (can_stats_sce_irq_handler()) counts the bus-off events. With
+ *   ABOM disabled (see MX_CAN_Init()) the node stays off until it is initialized again.
+ *
+ * The number of bits per frame is estimated from the DLC without stuff bits, so the bus load
+ * is a lower bound (stuffing adds up to 20 %). Only the frames sent and the frames passing the
+ * acceptance filters are seen, so the bus load covers the whole bus only as long as the
+ * filters accept everything.
+ *
+ * can_stats_sample() has to be called periodically (e.g. once per second): it turns the totals
+ * into rates and reads the error counters (TEC/REC). The results are exported as CAN frames
+ * (can_stats_send(), next to the telemetry frames) and, with #PROFILE_ENABLED, as a table over
+ * USART1 (can_stats_dump()):
+ *
+ * | identifier                | bytes 0..1     | bytes 2..3     | bytes 4..5     | bytes 6..7       |
+ * |---------------------------|----------------|----------------|----------------|------------------|
+ * | #CAN_STATS_CAN_ID_RATES   | load (1/1000)  | tx frames/s    | rx frames/s    | TEC, REC         |
+ * | #CAN_STATS_CAN_ID_EVENTS  | overruns FIFO0 | overruns FIFO1 | bus-off events | arbitration lost |
+ * | #CAN_STATS_CAN_ID_LATENCY | max. class 0   | max. class 1   | max. class 2   | max. class 3     |
+ *
+ * All values are 16 bit, LSB first. Counters are sent modulo 2^16, latencies in us (saturated).
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "can_stats.h"
+
+static CAN_Stats stats;
+static uint8_t bus_off_last = 0;	// BOFF at the last status change interrupt
+
+/* totals at the last can_stats_sample() */
+static uint32_t sample_tick;
+static uint32_t sample_tx_frames;
+static uint32_t sample_rx_frames;
+static uint32_t sample_bits;
+
+/**
+ * Clears the statistics and enables the bus-off interrupt. Called by can_bus_init().
+ */
+void can_stats_init(void) {
+	can_stats_reset();
+	bus_off_last = (CAN->ESR & CAN_ESR_BOFF) != 0;
+
+	CAN->IER |= CAN_IER_ERRIE | CAN_IER_BOFIE;
+
+	HAL_NVIC_SetPriority(CAN_SCE_IRQn, CAN_BUS_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(CAN_SCE_IRQn);
+}
+
+/**
+ * Clears all totals and starts a new sampling interval.
+ */
+void can_stats_reset(void) {
+	uint32_t primask = __get_PRIMASK();
+
+	__disable_irq();
+	memset(&stats, 0, sizeof(stats));
+	__set_PRIMASK(primask);
+
+	sample_tick = HAL_GetTick();
+	sample_tx_frames = 0;
+	sample_rx_frames = 0;
+	sample_bits = 0;
+}
+
+/**
+ * Calculates the bit rate the peripheral is set to from the bit timing register.
+ */
+static uint32_t can_stats_bitrate(void) {
+	uint32_t btr = CAN->BTR;
+	uint32_t tq = 3 + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos)
+			+ ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos);
+
+	return HAL_RCC_GetPCLK1Freq() / (((btr & CAN_BTR_BRP) + 1) * tq);
+}
+
+/**
+ * Calculates the rates of the interval since the last call and reads the error counters.
+ * Call this periodically, the rates are the more accurate the longer the interval is.
+ */
+void can_stats_sample(void) {
+	uint32_t now = HAL_GetTick();
+	uint32_t ms = now - sample_tick;
+	uint32_t tx_frames = stats.tx_frames;
+	uint32_t rx_frames = stats.rx_frames;
+	uint32_t bits = stats.tx_bits + stats.rx_bits;
+	uint32_t esr = CAN->ESR;
+
+	if (ms) {
+		uint32_t bitrate = can_stats_bitrate();
+
+		stats.tx_fps = (uint64_t) (tx_frames - sample_tx_frames) * 1000 / ms;
+		stats.rx_fps = (uint64_t) (rx_frames - sample_rx_frames) * 1000 / ms;
+		stats.bps = (uint64_t) (bits - sample_bits) * 1000 / ms;
+		stats.load = bitrate ? (uint64_t) stats.bps * 1000 / bitrate : 0;
+	}
+
+	stats.tec = (esr & CAN_ESR_TEC) >> CAN_ESR_TEC_Pos;
+	stats.rec = (esr & CAN_ESR_REC) >> CAN_ESR_REC_Pos;
+
+	sample_tick = now;
+	sample_tx_frames = tx_frames;
+	sample_rx_frames = rx_frames;
+	sample_bits = bits;
+}
+
+/**
+ * @return Statistics (updated by the interrupts and can_stats_sample())
+ */
+const CAN_Stats *can_stats(void) {
+	return &stats;
+}
+
+/**
+ * Estimates the number of bits a frame takes on the bus: start of frame, arbitration and
+ * control field, data, CRC, delimiters, ACK, end of frame and interframe space. Stuff bits are
+ * not included.
+ * @param flags CAN_BUS_FLAG_* of the frame
+ * @param dlc Number of data bytes
+ * @return Number of bits
+ */
+uint16_t can_stats_frame_bits(uint8_t flags, uint8_t dlc) {
+	uint16_t bits = (flags & CAN_BUS_FLAG_EXT) ? 67 : 47;
+
+	// remote frames carry no data
+	if (!(flags & CAN_BUS_FLAG_RTR)) {
+		bits += 8 * dlc;
+	}
+
+	return bits;
+}
+
+/**
+ * Records a finished transmit request. Called by can_bus_tx_irq_handler().
+ * @param id Identifier of the frame
+ * @param flags CAN_BUS_FLAG_* of the frame
+ * @param dlc Number of data bytes
+ * @param cycles Cycles from can_bus_send() until the request finished
+ * @param status TSR bits of the mailbox (shifted to the positions of mailbox 0)
+ */
+void can_stats_tx(uint32_t id, uint8_t flags, uint8_t dlc, uint32_t cycles,
+		uint32_t status) {
+	uint8_t class = CAN_STATS_CLASS(id, flags);
+	uint32_t us = cycles / (SystemCoreClock / 1000000);
+	uint32_t limit = CAN_STATS_BUCKET_US;
+	uint8_t bucket = 0;
+
+	// the flags are kept through the automatic retransmissions
+	if (status & CAN_TSR_ALST0) {
+		stats.arbitration_lost++;
+	}
+	if (status & CAN_TSR_TERR0) {
+		stats.tx_errors++;
+	}
+	if (!(status & CAN_TSR_TXOK0)) {
+		return;
+	}
+
+	while (bucket < CAN_STATS_BUCKETS - 1 && us >= limit) {
+		limit <<= 1;
+		bucket++;
+	}
+
+	stats.latency[class][bucket]++;
+	if (us > stats.latency_max[class]) {
+		stats.latency_max[class] = us;
+	}
+
+	stats.tx_frames++;
+	stats.tx_bits += can_stats_frame_bits(flags, dlc);
+}
+
+/**
+ * Records a received frame. Called by can_bus_rx_irq_handler().
+ * @param frame Frame received
+ */
+void can_stats_rx(const CAN_Bus_Frame *frame) {
+	stats.rx_frames++;
+	stats.rx_bits += can_stats_frame_bits(frame->flags, frame->dlc);
+}
+
+/**
+ * Has to be called from CAN_SCE_IRQHandler().
+ */
+void can_stats_sce_irq_handler(void) {
+	uint8_t bus_off = (CAN->ESR & CAN_ESR_BOFF) != 0;
+
+	// ERRIE passes every error condition enabled in IER to this interrupt, BOFIE is the only
+	// one enabled here. The interrupt can still come while the node stays in bus-off (another
+	// source enabled, ERRI set again), so only the transition into bus-off is counted.
+	if (bus_off && !bus_off_last) {
+		stats.bus_off++;
+	}
+	bus_off_last = bus_off;
+
+	CAN->MSR = CAN_MSR_ERRI;
+}
+
+/**
+ * Stores \p value in \p data (LSB first).
+ */
+static void can_stats_put(uint8_t *data, uint32_t value) {
+	data[0] = value;
+	data[1] = value >> 8;
+}
+
+/**
+ * Encodes the current statistics into the frames described above.
+ * @param frames Destination for #CAN_STATS_FRAMES frames
+ */
+void can_stats_encode(CAN_Bus_Frame frames[CAN_STATS_FRAMES]) {
+	const CAN_Bus_Counters *counters = can_bus_counters();
+	static const uint16_t ids[CAN_STATS_FRAMES] = { CAN_STATS_CAN_ID_RATES,
+			CAN_STATS_CAN_ID_EVENTS, CAN_STATS_CAN_ID_LATENCY };
+
+	for (int i = 0; i < CAN_STATS_FRAMES; i++) {
+		frames[i].id = ids[i];
+		frames[i].flags = 0;
+		frames[i].dlc = 8;
+	}
+
+	can_stats_put(&frames[0].data[0], stats.load);
+	can_stats_put(&frames[0].data[2], stats.tx_fps);
+	can_stats_put(&frames[0].data[4], stats.rx_fps);
+	frames[0].data[6] = stats.tec;
+	frames[0].data[7] = stats.rec;
+
+	can_stats_put(&frames[1].data[0], counters->overrun[0]);
+	can_stats_put(&frames[1].data[2], counters->overrun[1]);
+	can_stats_put(&frames[1].data[4], stats.bus_off);
+	can_stats_put(&frames[1].data[6], stats.arbitration_lost);
+
+	for (int i = 0; i < CAN_STATS_CLASSES; i++) {
+		uint32_t max = stats.latency_max[i];
+
+		can_stats_put(&frames[2].data[2 * i], max > 0xFFFF ? 0xFFFF : max);
+	}
+}
+
+/**
+ * Encodes the current statistics and queues the frames with can_bus_send().
+ * @return Number of frames queued
+ */
+uint8_t can_stats_send(void) {
+	CAN_Bus_Frame frames[CAN_STATS_FRAMES];
+	uint8_t queued = 0;
+
+	can_stats_encode(frames);
+
+	for (int i = 0; i < CAN_STATS_FRAMES; i++) {
+		queued += can_bus_send(&frames[i]);
+	}
+
+	return queued;
+}
+
+#if PROFILE_ENABLED
+/**
+ * Prints the rates, the event counters and the latency histograms (one line per priority class,
+ * the columns are headed by the upper limit of the bucket in us) over USART1.
+ */
+void can_stats_dump(void) {
+	const CAN_Bus_Counters *counters = can_bus_counters();
+	char line[128];
+	char *pos;
+
+	profile_print("can   tx/s   rx/s    bit/s  load  tec  rec\n");
+	pos = profile_number(line, stats.tx_fps, 9);
+	pos = profile_number(pos, stats.rx_fps, 6);
+	pos = profile_number(pos, stats.bps, 8);
+	pos = profile_number(pos, stats.load, 5);
+	pos = profile_number(pos, stats.tec, 4);
+	pos = profile_number(pos, stats.rec, 4);
+	strcpy(pos, "\n");
+	profile_print(line);
+
+	profile_print("    arb_lost tx_err bus_off  ovr0  ovr1 drop0 drop1\n");
+	pos = profile_number(line, stats.arbitration_lost, 11);
+	pos = profile_number(pos, stats.tx_errors, 6);
+	pos = profile_number(pos, stats.bus_off, 7);
+	pos = profile_number(pos, counters->overrun[0], 5);
+	pos = profile_number(pos, counters->overrun[1], 5);
+	pos = profile_number(pos, counters->dropped[0], 5);
+	pos = profile_number(pos, counters->dropped[1], 5);
+	strcpy(pos, "\n");
+	profile_print(line);
+
+	strcpy(line, "class");
+	pos = line + 5;
+	for (int b = 0; b < CAN_STATS_BUCKETS - 1; b++) {
+		pos = profile_number(pos, CAN_STATS_BUCKET_US << b, 6);
+	}
+	strcpy(pos, "   more      max\n");
+	profile_print(line);
+
+	// at most 5 + 11 * (CAN_STATS_BUCKETS + 1) + 2 characters
+	for (int i = 0; i < CAN_STATS_CLASSES; i++) {
+		pos = profile_number(line, i, 4);
+		for (int b = 0; b < CAN_STATS_BUCKETS; b++) {
+			pos = profile_number(pos, stats.latency[i][b], 6);
+		}
+		pos = profile_number(pos, stats.latency_max[i], 8);
+		strcpy(pos, "\n");
+		profile_print(line);
+	}
+}
+#endif
@@ -0,0 +1,373 @@
+/**
+ ******************************************************************************
+ * @file    can_tp.c
+ * @brief  Segmented transfer of long messages over CAN (ISO-TP style)
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Messages of up to #CAN_TP_MAX_LENGTH bytes (history, configuration, logs) are split into
+ * frames carrying a protocol control byte (PCI) in front of the payload:
+ * - single frame (0x0L): messages of up to 7 bytes
+ * - first frame (0x1L LL): 12 bit length and the first 6 bytes
+ * - consecutive frame (0x2N): 7 more bytes, N counts 1..15, 0, 1...
+ * - flow control (0x3S BS ST): sent by the receiver after the first frame and after every
+ *   block of BS consecutive frames. S is 0 (continue), 1 (wait) or 2 (overflow), ST is the
+ *   minimum separation time between two consecutive frames.
+ *
+ * Nothing blocks: can_tp_send() starts a transfer, can_tp_poll() (called from the main loop)
+ * queues the consecutive frames as fast as the receiver allows and the transmit queue of
+ * can_bus.c has room, and frames received on \p rx_id are handed to can_tp_on_frame():
+ *
+ * @code
+ * while (can_bus_receive(&frame)) {
+ *     if (frame.id == tp.rx_id) {
+ *         can_tp_on_frame(&tp, &frame);
+ *     }
+ * }
+ * can_tp_poll(&tp);
+ * @endcode
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "can_tp.h"
+#include "timing.h"
+
+/* Frame types (upper nibble of the PCI) */
+#define CAN_TP_SF			0x00
+#define CAN_TP_FF			0x10
+#define CAN_TP_CF			0x20
+#define CAN_TP_FC			0x30
+
+/* Flow status of a flow control frame */
+#define CAN_TP_FC_CTS		0
+#define CAN_TP_FC_WAIT		1
+#define CAN_TP_FC_OVERFLOW	2
+
+/**
+ * Initializes an endpoint.
+ * @param tp Endpoint
+ * @param tx_id CAN identifier of the frames sent
+ * @param rx_id CAN identifier of the frames received
+ * @param rx_buffer Destination for received messages
+ * @param rx_size Size of \p rx_buffer (longer messages are refused with an overflow)
+ */
+void can_tp_init(CAN_TP_Context *tp, uint32_t tx_id, uint32_t rx_id,
+		uint8_t *rx_buffer, uint16_t rx_size) {
+	memset(tp, 0, sizeof(*tp));
+
+	tp->tx_id = tx_id;
+	tp->rx_id = rx_id;
+	tp->rx_buffer = rx_buffer;
+	tp->rx_size = rx_size;
+	tp->tx_state = CAN_TP_IDLE;
+	tp->rx_state = CAN_TP_IDLE;
+}
+
+/**
+ * Converts the STmin byte of a flow control frame to us.
+ */
+static uint32_t can_tp_stmin_us(uint8_t stmin) {
+	if (stmin <= 0x7F) {
+		return stmin * 1000;
+	}
+	if (stmin >= 0xF1 && stmin <= 0xF9) {
+		return (stmin - 0xF0) * 100;
+	}
+
+	// reserved values are treated as the longest time
+	return 0x7F * 1000;
+}
+
+/**
+ * Queues a frame with \p len bytes of \p data on \p tp->tx_id.
+ * @return
+ * - 0 if the transmit queue is full
+ * - 1 if the frame got queued
+ */
+static int can_tp_frame(CAN_TP_Context *tp, const uint8_t *data, uint8_t len) {
+	CAN_Bus_Frame frame;
+
+	frame.id = tp->tx_id;
+	frame.flags = 0;
+	frame.dlc = len;
+	memcpy(frame.data, data, len);
+
+	return can_bus_send(&frame);
+}
+
+/**
+ * Starts sending a message. The message is sent by can_tp_poll(), \p data has to stay valid
+ * until can_tp_tx_state() is not #CAN_TP_BUSY any more.
+ * @param tp Endpoint
+ * @param data Message
+ * @param len Length of the message (1..#CAN_TP_MAX_LENGTH)
+ * @return
+ * - 0 if a transfer is in progress, the length is invalid or the transmit queue is full
+ * - 1 if the transfer was started
+ */
+int can_tp_send(CAN_TP_Context *tp, const uint8_t *data, uint16_t len) {
+	uint8_t buf[8];
+
+	if (tp->tx_state == CAN_TP_BUSY || !len || len > CAN_TP_MAX_LENGTH) {
+		return 0;
+	}
+
+	if (len <= 7) {
+		buf[0] = CAN_TP_SF | len;
+		memcpy(&buf[1], data, len);
+		if (!can_tp_frame(tp, buf, 1 + len)) {
+			return 0;
+		}
+
+		tp->tx_state = CAN_TP_DONE;
+		return 1;
+	}
+
+	buf[0] = CAN_TP_FF | (len >> 8);
+	buf[1] = len;
+	memcpy(&buf[2], data, 6);
+	if (!can_tp_frame(tp, buf, 8)) {
+		return 0;
+	}
+
+	tp->tx_data = data;
+	tp->tx_len = len;
+	tp->tx_pos = 6;
+	tp->tx_sn = 1;
+	tp->tx_wait_fc = 1;
+	tp->tx_timeout = HAL_GetTick() + CAN_TP_TIMEOUT_MS;
+	tp->tx_state = CAN_TP_BUSY;
+
+	return 1;
+}
+
+/**
+ * Handles a flow control frame for the running transfer.
+ */
+static void can_tp_on_fc(CAN_TP_Context *tp, const CAN_Bus_Frame *frame) {
+	if (tp->tx_state != CAN_TP_BUSY || !tp->tx_wait_fc || frame->dlc < 3) {
+		return;
+	}
+
+	switch (frame->data[0] & 0x0F) {
+	case CAN_TP_FC_CTS:
+		tp->tx_wait_fc = 0;
+		tp->tx_block_left = frame->data[1];
+		tp->tx_stmin_us = can_tp_stmin_us(frame->data[2]);
+		tp->tx_next = timing_cycles();
+		break;
+
+	case CAN_TP_FC_WAIT:
+		tp->tx_timeout = HAL_GetTick() + CAN_TP_TIMEOUT_MS;
+		break;
+
+	default:
+		tp->tx_state = CAN_TP_ERROR;
+		break;
+	}
+}
+
+/**
+ * Handles a single, first or consecutive frame of a message being received.
+ */
+static void can_tp_on_data(CAN_TP_Context *tp, const CAN_Bus_Frame *frame) {
+	uint8_t pci = frame->data[0];
+	uint16_t len;
+
+	// a complete message stays in rx_buffer until can_tp_receive() collected it
+	if (tp->rx_state == CAN_TP_DONE && (pci & 0xF0) != CAN_TP_CF) {
+		if ((pci & 0xF0) == CAN_TP_FF) {
+			tp->rx_fc = 1 + CAN_TP_FC_OVERFLOW;
+		}
+		return;
+	}
+
+	switch (pci & 0xF0) {
+	case CAN_TP_SF:
+		len = pci & 0x0F;
+		if (!len || len > 7 || len + 1 > frame->dlc || len > tp->rx_size) {
+			return;
+		}
+
+		memcpy(tp->rx_buffer, &frame->data[1], len);
+		tp->rx_len = len;
+		tp->rx_state = CAN_TP_DONE;
+		break;
+
+	case CAN_TP_FF:
+		len = ((pci & 0x0F) << 8) | frame->data[1];
+		if (frame->dlc < 8 || len <= 7) {
+			return;
+		}
+		if (len > tp->rx_size) {
+			tp->rx_fc = 1 + CAN_TP_FC_OVERFLOW;
+			tp->rx_state = CAN_TP_ERROR;
+			return;
+		}
+
+		memcpy(tp->rx_buffer, &frame->data[2], 6);
+		tp->rx_len = len;
+		tp->rx_pos = 6;
+		tp->rx_sn = 1;
+		tp->rx_block_left = CAN_TP_BLOCK_SIZE;
+		tp->rx_fc = 1 + CAN_TP_FC_CTS;
+		tp->rx_timeout = HAL_GetTick() + CAN_TP_TIMEOUT_MS;
+		tp->rx_state = CAN_TP_BUSY;
+		break;
+
+	case CAN_TP_CF: {
+		uint16_t n;
+
+		if (tp->rx_state != CAN_TP_BUSY) {
+			return;
+		}
+		if ((pci & 0x0F) != tp->rx_sn) {
+			tp->rx_state = CAN_TP_ERROR;
+			return;
+		}
+
+		n = tp->rx_len - tp->rx_pos;
+		if (n > 7) {
+			n = 7;
+		}
+		if (n + 1 > frame->dlc) {
+			tp->rx_state = CAN_TP_ERROR;
+			return;
+		}
+
+		memcpy(&tp->rx_buffer[tp->rx_pos], &frame->data[1], n);
+		tp->rx_pos += n;
+		tp->rx_sn = (tp->rx_sn + 1) & 0x0F;
+		tp->rx_timeout = HAL_GetTick() + CAN_TP_TIMEOUT_MS;
+
+		if (tp->rx_pos == tp->rx_len) {
+			tp->rx_state = CAN_TP_DONE;
+		} else if (CAN_TP_BLOCK_SIZE && !--tp->rx_block_left) {
+			tp->rx_block_left = CAN_TP_BLOCK_SIZE;
+			tp->rx_fc = 1 + CAN_TP_FC_CTS;
+		}
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+/**
+ * Handles a frame received on \p tp->rx_id.
+ * @param tp Endpoint
+ * @param frame Received frame
+ */
+void can_tp_on_frame(CAN_TP_Context *tp, const CAN_Bus_Frame *frame) {
+	if (!frame->dlc || (frame->flags & CAN_BUS_FLAG_RTR)) {
+		return;
+	}
+
+	if ((frame->data[0] & 0xF0) == CAN_TP_FC) {
+		can_tp_on_fc(tp, frame);
+	} else {
+		can_tp_on_data(tp, frame);
+	}
+
+	can_tp_poll(tp);
+}
+
+/**
+ * Sends pending flow control frames and the consecutive frames that are due, and checks the
+ * timeouts. Call this as often as possible.
+ * @param tp Endpoint
+ */
+void can_tp_poll(CAN_TP_Context *tp) {
+	uint32_t now = HAL_GetTick();
+
+	// receiving
+	if (tp->rx_fc) {
+		uint8_t fc[3] = { CAN_TP_FC | (tp->rx_fc - 1), CAN_TP_BLOCK_SIZE,
+				CAN_TP_STMIN };
+
+		if (can_tp_frame(tp, fc, 3)) {
+			tp->rx_fc = 0;
+		}
+	}
+	if (tp->rx_state == CAN_TP_BUSY && (int32_t) (now - tp->rx_timeout) >= 0) {
+		tp->rx_state = CAN_TP_ERROR;
+	}
+
+	// sending
+	if (tp->tx_state != CAN_TP_BUSY) {
+		return;
+	}
+
+	if (tp->tx_wait_fc) {
+		if ((int32_t) (now - tp->tx_timeout) >= 0) {
+			tp->tx_state = CAN_TP_ERROR;
+		}
+		return;
+	}
+
+	while (timing_cycles() >= tp->tx_next) {
+		uint8_t buf[8];
+		uint16_t n = tp->tx_len - tp->tx_pos;
+
+		if (n > 7) {
+			n = 7;
+		}
+
+		buf[0] = CAN_TP_CF | tp->tx_sn;
+		memcpy(&buf[1], &tp->tx_data[tp->tx_pos], n);
+		if (!can_tp_frame(tp, buf, 1 + n)) {
+			return;	// transmit queue full, try again with the next poll
+		}
+
+		tp->tx_pos += n;
+		tp->tx_sn = (tp->tx_sn + 1) & 0x0F;
+
+		if (tp->tx_pos == tp->tx_len) {
+			tp->tx_state = CAN_TP_DONE;
+			return;
+		}
+
+		if (tp->tx_block_left && !--tp->tx_block_left) {
+			tp->tx_wait_fc = 1;
+			tp->tx_timeout = now + CAN_TP_TIMEOUT_MS;
+			return;
+		}
+
+		if (tp->tx_stmin_us) {
+			tp->tx_next = timing_deadline_us(tp->tx_stmin_us);
+		}
+	}
+}
+
+/**
+ * @param tp Endpoint
+ * @return State of the message sent last
+ */
+CAN_TP_State can_tp_tx_state(CAN_TP_Context *tp) {
+	return tp->tx_state;
+}
+
+/**
+ * Checks for a received message. A complete (#CAN_TP_DONE) or failed (#CAN_TP_ERROR) message
+ * is only reported once, afterwards the endpoint is ready for the next one. Until a complete
+ * message is collected, single frames are ignored and first frames are refused with an
+ * overflow, so it can't be overwritten.
+ * @param tp Endpoint
+ * @param len Destination for the length of a complete message (in \p rx_buffer)
+ * @return State of the message being received
+ */
+CAN_TP_State can_tp_receive(CAN_TP_Context *tp, uint16_t *len) {
+	CAN_TP_State state = tp->rx_state;
+
+	if (state == CAN_TP_DONE) {
+		*len = tp->rx_len;
+	}
+	if (state == CAN_TP_DONE || state == CAN_TP_ERROR) {
+		tp->rx_state = CAN_TP_IDLE;
+	}
+
+	return state;
+}
@@ -12,13 +12,35 @@
  * @author  MemAllox
  ******************************************************************************
  *
- * This module supports connecting one <b>DS1820</b> (or DS18S20) temperature sensor on one pin each.
+ * This module supports connecting one <b>DS1820</b> (or DS18S20, DS18B20) temperature sensor on one pin each.
  * One whole GPIO port (like #GPIOA, #GPIOB, ..., #GPIOF) is dedicated to reading the sensors.
  * Each pin is a <b>slot</b> for exactly one sensor. Do not connect multiple sensors to one pin!
  * Also, don't forget the pull-up resistor (4.7k to Vcc).
  *
+ * ds1820_bank_start_conversions() and ds1820_bank_update_temperatures() talk to all slots at
+ * once using the port-parallel onewire engine (see onewire_port.c), so refreshing the whole bank
+ * takes as long as refreshing a single slot. Only the ROM search is done slot by slot.
+ *
+ * The slots share the port, so #DS1820_Bank_Context keeps one port and an array per slot
+ * member instead of a full onewire struct per slot. The onewire search state is only needed
+ * while a ROM is searched and lives on the stack.
+ *
+ * As there is only one sensor per slot, the sensors are addressed by SKIP ROM (see
+ * #DS1820_BANK_SKIP_ROM). The ROM numbers are only read back from time to time by
+ * ds1820_bank_verify_roms() to notice a replaced sensor.
+ *
+ * ds1820_bank_poll() keeps the bank sampling on its own: it knows when the conversion of each
+ * slot is finished, reads the slot right away and starts the next conversion, so there is no
+ * need to wait for the conversions.
+ *
+ * DS18B20 sensors convert with #DS1820_BANK_RESOLUTION_LOW (94ms per conversion) as long as their
+ * temperature is stable and switch to #DS1820_BANK_RESOLUTION_HIGH if it changes fast or if
+ * ds1820_bank_request_precision() asks for it. The resolution is only written to the scratchpad,
+ * not to the EEPROM of the sensor.
+ *
  * Error management is strict in this library. That means, if a sensor does not respond in the
- * expected way, the temperature will be set to NaN. The address of each sensor is called
+ * expected way, the temperature will be set to #TM_DS18B20_TEMP_INVALID. Temperatures are kept
+ * in 1/16 degC (see TM_DS18B20_TEMP_TO_FLOAT() for presentation). The address of each sensor is called
  * <b>ROM number</b>. In case of connectivity problems, the module will automatically ask for an
  * (eventually new) ROM number. If there is no sensor responding properly, the #DS1820_ROM_State
  * will be set accordingly.
@@ -26,56 +48,119 @@
  ******************************************************************************
  */
 
+#include <stddef.h>
 #include "ds1820_bank.h"
+#include "profile.h"
+
+_Static_assert(DS1820_BANK_SLOTS <= ONEWIRE_PORT_PINS,
+		"a bank can't have more slots than a port has pins");
+_Static_assert(DS1820_BANK_MAX_ERROR_COUNT < DS1820_BANK_STATE_ERROR_MAX,
+		"the error count saturates below DS1820_BANK_MAX_ERROR_COUNT");
+_Static_assert(DS1820_BANK_STABLE_READINGS < (0xFF >> DS1820_BANK_ADAPT_STABLE_SHIFT),
+		"DS1820_BANK_STABLE_READINGS does not fit into the packed resolution state");
+// footprint: the counters and the port, followed by the slot arrays without any padding
+_Static_assert(offsetof(DS1820_Bank_Context, port) <= 8
+		&& offsetof(DS1820_Bank_Context, temperature)
+				== offsetof(DS1820_Bank_Context, port) + sizeof(TM_OneWire_t)
+		&& sizeof(DS1820_Bank_Context) == offsetof(DS1820_Bank_Context, temperature)
+				+ DS1820_BANK_SLOT_BYTES * DS1820_BANK_SLOTS,
+		"DS1820_Bank_Context grew, check the RAM usage of the bank");
+
+static void ds1820_bank_set_rom_state(DS1820_Bank_Context *ctx, uint32_t i,
+		DS1820_ROM_State rom_state) {
+	ctx->state[i] = (ctx->state[i] & ~DS1820_BANK_STATE_ROM_MASK) | rom_state;
+}
+
+static uint8_t ds1820_bank_error_count(DS1820_Bank_Context *ctx, uint32_t i) {
+	return ctx->state[i] >> DS1820_BANK_STATE_ERROR_SHIFT;
+}
+
+static void ds1820_bank_set_error_count(DS1820_Bank_Context *ctx, uint32_t i,
+		uint8_t error_count) {
+	ctx->state[i] = (ctx->state[i] & ~(0xFF << DS1820_BANK_STATE_ERROR_SHIFT))
+			| (error_count << DS1820_BANK_STATE_ERROR_SHIFT);
+}
+
+static void ds1820_bank_set_converting(DS1820_Bank_Context *ctx, uint32_t i,
+		int converting) {
+	if (converting) {
+		ctx->state[i] |= DS1820_BANK_STATE_CONVERTING;
+	} else {
+		ctx->state[i] &= ~DS1820_BANK_STATE_CONVERTING;
+	}
+}
+
+static uint8_t ds1820_bank_resolution(DS1820_Bank_Context *ctx, uint32_t i) {
+	return (ctx->adapt[i] & DS1820_BANK_ADAPT_RESOLUTION_MASK) + 9;
+}
+
+/**
+ * Stores the resolution of a DS18B20 slot, keeping the other bits of \p ctx->adapt[i].
+ */
+static void ds1820_bank_set_resolution(DS1820_Bank_Context *ctx, uint32_t i,
+		uint8_t resolution) {
+	ctx->adapt[i] = (ctx->adapt[i] & ~DS1820_BANK_ADAPT_RESOLUTION_MASK)
+			| (resolution - 9);
+}
+
+/**
+ * Fills in a temporary onewire struct to talk to a single slot with the TM onewire library
+ * (e.g. to search its ROM). Only the ROM number is taken from the context, the search state
+ * is not kept.
+ */
+static void ds1820_bank_onewire(DS1820_Bank_Context *ctx, uint32_t i,
+		TM_OneWire_t *onewire) {
+	*onewire = ctx->port;
+	onewire->GPIO_Pin = 1 << i;
+	onewire->MODER_Output = TM_OneWire_ModerOutput(1 << i);
+	memcpy(onewire->ROM_NO, ctx->rom[i], 8);
+}
 
 /**
  * Initializes the DS1820_Bank_Context and configures the GPIO registers.
  * The first \p pins of \p GPIOx will be slots to connect a DS1820 to.
  * Internally calls ds1820_bank_check_rom() to obtain all sensors' ROM numbers.
- * Call ds1820_bank_deinit() to free the allocated memory.
- * @param ctx Context for the DS1820 sensor slots
- * @param n Number of slots on port \p GPIOx beginning with Px0 up to Px(n-1)
+ * @param ctx Context for the DS1820 sensor slots (no memory is allocated)
+ * @param n Number of slots on port \p GPIOx beginning with Px0 up to Px(n-1), at most
+ * #DS1820_BANK_SLOTS
  * @param GPIOx Port that holds the pins (like #GPIOA, #GPIOB, ..., #GPIOF)
  * @return
- * - 0 if no memory could be allocated or if there is no sensor available at at least one slot
+ * - 0 if there is no sensor available at at least one slot
  * - 1 if every slot yielded a proper ROM number
  */
-int ds1820_bank_init(DS1820_Bank_Context *ctx, size_t n, GPIO_TypeDef *GPIOx) {
-	if (n > 16) {
-		n = 16;
-	}
-
-	ctx->slots = malloc(sizeof(DS1820_Bank_Slot) * n);
+int ds1820_bank_init(DS1820_Bank_Context *ctx, uint8_t n, GPIO_TypeDef *GPIOx) {
+	int success = 1;
 
-	if (!(ctx->slots)) {
-		return 0;
+	if (n > DS1820_BANK_SLOTS) {
+		n = DS1820_BANK_SLOTS;
 	}
 
 	ctx->n = n;
+	ctx->conversions = 0;
+	ctx->unverified = 0;
+
+	// initialize the GPIOs, releases all lines
+	onewire_port_init(&(ctx->port), GPIOx, (1 << n) - 1);
 
 	for (int i = 0; i < n; i++) {
-		// initialize the GPIOs and the onewire structs
-		TM_OneWire_Init(&(ctx->slots[i].onewire), GPIOx, 1 << i);
-		ctx->slots[i].rom_state = DS1820_STATE_UNKNOWN_ROM;
-		ctx->slots[i].error_count = 0;
-		ctx->slots[i].temperature = NAN;
-		ds1820_bank_check_rom(ctx, i, DS1820_BANK_REQUEST_NEW_ROM);
-	}
+		ctx->state[i] = DS1820_STATE_UNKNOWN_ROM;
+		ctx->adapt[i] = 0;
+		ds1820_bank_set_resolution(ctx, i, TM_DS18B20_Resolution_12bits);
+		ctx->temperature[i] = TM_DS18B20_TEMP_INVALID;
+		ctx->due[i] = HAL_GetTick();
+		memset(ctx->rom[i], 0, 8);
 
-	return 1;
-}
+		if (!ds1820_bank_check_rom(ctx, i, DS1820_BANK_REQUEST_NEW_ROM)) {
+			success = 0;
+		}
+	}
 
-/**
- * Frees the memory allocated in ds1820_bank_init()
- * @param ctx
- */
-void ds1820_bank_deinit(DS1820_Bank_Context *ctx) {
-	free(ctx->slots);
+	return success;
 }
 
 /**
  * Checks if a ROM number is registered for a specific slot. If not, the slot will be asked for
- * a present sensor (or to be more precise its ROM number). The \p ctx->slots[i].rom_state will
+ * a present sensor (or to be more precise its ROM number). The state of \p ctx->state[i] will
  * be set to either #DS1820_STATE_OK if a sensor answere with its ROM number or #DS1820_STATE_ABSENT
  * if there is no sensor. If one sets \p request_new_rom to #DS1820_BANK_REQUEST_NEW_ROM, the slot
  * will be asked for its ROM code even if a valid ROM code is registered. (Valid in this context means,
@@ -92,19 +177,26 @@ int ds1820_bank_check_rom(DS1820_Bank_Context *ctx, uint8_t i,
 		uint8_t request_new_rom) {
 	// if there is a problem with the rom
 	if (request_new_rom == DS1820_BANK_REQUEST_NEW_ROM
-			|| ctx->slots[i].rom_state
-					== DS1820_STATE_UNKNOWN_ROM|| ctx->slots[i].rom_state == DS1820_STATE_ABSENT
-					|| ctx->slots[i].error_count >= DS1820_BANK_MAX_ERROR_COUNT) {
-		// ask for rom again (eventually sets the rom no)
-		int success = TM_OneWire_First(&(ctx->slots[i].onewire));
+			|| DS1820_BANK_ROM_STATE(ctx, i) == DS1820_STATE_UNKNOWN_ROM
+			|| DS1820_BANK_ROM_STATE(ctx, i) == DS1820_STATE_ABSENT
+			|| ds1820_bank_error_count(ctx, i) > DS1820_BANK_MAX_ERROR_COUNT) {
+		// ask for rom again (eventually sets the rom no), the search state is not needed afterwards
+		TM_OneWire_t onewire;
+		ds1820_bank_onewire(ctx, i, &onewire);
+		int success = TM_OneWire_First(&onewire);
 
 		if (success) {
-			ctx->slots[i].rom_state = DS1820_STATE_OK;
+			// the resolution of a new sensor is unknown until its scratchpad is read
+			if (memcmp(ctx->rom[i], onewire.ROM_NO, 8) != 0) {
+				memcpy(ctx->rom[i], onewire.ROM_NO, 8);
+				ds1820_bank_set_resolution(ctx, i, TM_DS18B20_Resolution_12bits);
+			}
+			ds1820_bank_set_rom_state(ctx, i, DS1820_STATE_OK);
 			return 1; // got a rom
 		}
 
 		// no answer
-		ctx->slots[i].rom_state = DS1820_STATE_ABSENT;
+		ds1820_bank_set_rom_state(ctx, i, DS1820_STATE_ABSENT);
 		return 0;
 	}
 
@@ -112,6 +204,364 @@ int ds1820_bank_check_rom(DS1820_Bank_Context *ctx, uint8_t i,
 	return 1;
 }
 
+/**
+ * Reads the ROM numbers of the slots in \p slots with a registered ROM that are not converting
+ * at once (READ ROM) and compares them to the registered ones. A slot that answers with another
+ * valid ROM number (the sensor was replaced) takes over the new one, a slot without a valid
+ * answer gets #DS1820_STATE_UNKNOWN_ROM and will be searched again by ds1820_bank_check_rom().
+ * The reset would disturb a running conversion, so converting slots are left out.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param slots Mask of the slots to verify
+ * @param success Set to 0 if a slot did not answer with a valid ROM number
+ * @return Mask of the slots that were left out because they are converting
+ */
+static uint16_t ds1820_bank_verify_slots(DS1820_Bank_Context *ctx,
+		uint16_t slots, int *success) {
+	uint16_t pins = 0;
+	uint16_t converting = 0;
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (!(slots & (1 << i))
+				|| DS1820_BANK_ROM_STATE(ctx, i) != DS1820_STATE_OK) {
+			continue;
+		}
+
+		if (ctx->state[i] & DS1820_BANK_STATE_CONVERTING) {
+			converting |= 1 << i;
+		} else {
+			pins |= 1 << i;
+		}
+	}
+
+	if (!pins) {
+		return converting;
+	}
+
+	TM_OneWire_t port = ctx->port;
+	port.GPIO_Pin = pins;
+
+	uint8_t rom[ONEWIRE_PORT_PINS][8];
+	uint8_t bytes[ONEWIRE_PORT_PINS];
+
+	uint16_t present = onewire_port_reset(&port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_READROM);
+
+	for (int j = 0; j < 8; j++) {
+		onewire_port_read_bytes(&port, bytes);
+
+		for (int i = 0; i < ctx->n; i++) {
+			rom[i][j] = bytes[i];
+		}
+	}
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (!(pins & (1 << i))) {
+			continue;
+		}
+
+		// a line stuck low reads as all zeros, which has a valid CRC
+		if (!(present & (1 << i)) || rom[i][0] == 0
+				|| TM_OneWire_CRC8(rom[i], 7) != rom[i][7]) {
+			ds1820_bank_set_rom_state(ctx, i, DS1820_STATE_UNKNOWN_ROM);
+			*success = 0;
+		} else if (memcmp(rom[i], ctx->rom[i], 8) != 0) {
+			// another sensor was connected to the slot
+			memcpy(ctx->rom[i], rom[i], 8);
+			ds1820_bank_set_error_count(ctx, i, 0);
+			ds1820_bank_set_resolution(ctx, i, TM_DS18B20_Resolution_12bits);
+		}
+	}
+
+	return converting;
+}
+
+/**
+ * Verifies the ROM numbers of all slots with a registered ROM (see ds1820_bank_verify_slots()).
+ * Slots that are converting are not disturbed, their verification stays due and is done by
+ * one of the next conversion requests.
+ * Called automatically every #DS1820_BANK_ROM_CHECK_INTERVAL conversion requests.
+ * @param ctx Context for the DS1820 sensor slots
+ * @return
+ * - 0 if at least one slot did not answer with a valid ROM number
+ * - 1 if every slot verified answered with a valid ROM number
+ */
+int ds1820_bank_verify_roms(DS1820_Bank_Context *ctx) {
+	int success = 1;
+
+	ctx->conversions = 0;
+	ctx->unverified = ds1820_bank_verify_slots(ctx, (1 << ctx->n) - 1,
+			&success);
+
+	return success;
+}
+
+/**
+ * Counts a conversion request and verifies the ROM numbers if it is due. Slots that were
+ * converting at that time are verified by the next requests, as soon as they are not converting.
+ * @param ctx Context for the DS1820 sensor slots
+ */
+static void ds1820_bank_count_conversion(DS1820_Bank_Context *ctx) {
+#if DS1820_BANK_SKIP_ROM
+	int success = 1;
+
+	if (++(ctx->conversions) >= DS1820_BANK_ROM_CHECK_INTERVAL) {
+		ds1820_bank_verify_roms(ctx);
+	} else if (ctx->unverified) {
+		ctx->unverified = ds1820_bank_verify_slots(ctx, ctx->unverified,
+				&success);
+	}
+#endif
+}
+
+/**
+ * Selects the sensor of a single slot, either by SKIP ROM or by MATCH ROM
+ * (see #DS1820_BANK_SKIP_ROM).
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @param onewire Onewire struct of the slot (see ds1820_bank_onewire())
+ */
+static void ds1820_bank_select_slot(DS1820_Bank_Context *ctx, uint8_t i,
+		TM_OneWire_t *onewire) {
+#if DS1820_BANK_SKIP_ROM
+	TM_OneWire_WriteByte(onewire, ONEWIRE_CMD_SKIPROM);
+#else
+	TM_OneWire_SelectWithPointer(onewire, ctx->rom[i]);
+#endif
+}
+
+/**
+ * Selects the sensors of every slot of \p port, either by SKIP ROM or by MATCH ROM with each slot's
+ * own ROM number (see #DS1820_BANK_SKIP_ROM).
+ * @param ctx Context for the DS1820 sensor slots
+ * @param port Port-parallel onewire struct holding the mask of the slots to be selected
+ */
+static void ds1820_bank_select(DS1820_Bank_Context *ctx, TM_OneWire_t *port) {
+#if DS1820_BANK_SKIP_ROM
+	onewire_port_write_byte(port, ONEWIRE_CMD_SKIPROM);
+#else
+	uint8_t bytes[ONEWIRE_PORT_PINS] = { 0 };
+
+	onewire_port_write_byte(port, ONEWIRE_CMD_MATCHROM);
+
+	for (int j = 0; j < 8; j++) {
+		for (int i = 0; i < ctx->n; i++) {
+			bytes[i] = ctx->rom[i][j];
+		}
+
+		onewire_port_write_bytes(port, bytes);
+	}
+#endif
+}
+
+/**
+ * Makes sure a slot has a ROM before its temperature is read. If the error count is exceeded,
+ * a new ROM is requested. If no ROM can be aquired, \p ctx->temperature[i] will be set to
+ * #TM_DS18B20_TEMP_INVALID and #DS1820_BANK_SENSOR_ERROR(i) will be called.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @return
+ * - 0 if there is no ROM (the temperature can't be read)
+ * - 1 if the temperature can be read
+ */
+static int ds1820_bank_prepare_read(DS1820_Bank_Context *ctx, uint32_t i) {
+	// if error_count exceeded ask for (eventually new) rom, otherwise only when existing rom is invalid
+	uint8_t request_new_rom =
+			ds1820_bank_error_count(ctx, i) > DS1820_BANK_MAX_ERROR_COUNT ?
+					DS1820_BANK_REQUEST_NEW_ROM : DS1820_BANK_KEEP_OLD_ROM;
+
+	if (!ds1820_bank_check_rom(ctx, i, request_new_rom)) {
+		// error reading rom
+		ctx->temperature[i] = TM_DS18B20_TEMP_INVALID;
+		DS1820_BANK_SENSOR_ERROR(i);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Stores the outcome of reading a slot's temperature and keeps track of the errors
+ * (see ds1820_bank_update_temperature()).
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @param status Status returned by the DS18x20 library (#TM_DS18B20_SUCCESS on success)
+ * @param temperature Temperature read in 1/16 degC (only used if \p status is #TM_DS18B20_SUCCESS)
+ * @return
+ * - 0 if no temperature could be aquired
+ * - 1 if the temperature got updated by a newer value
+ */
+static int ds1820_bank_store_result(DS1820_Bank_Context *ctx, uint32_t i,
+		uint8_t status, int16_t temperature) {
+	if (status != TM_DS18B20_SUCCESS) {
+		// error reading temperature
+		uint8_t error_count = ds1820_bank_error_count(ctx, i);
+
+		if (error_count < DS1820_BANK_STATE_ERROR_MAX) {
+			ds1820_bank_set_error_count(ctx, i, ++error_count);
+		}
+
+		if (error_count > DS1820_BANK_MAX_ERROR_COUNT) {
+			// rom is available, but temperature keeps being invalid
+			ctx->temperature[i] = TM_DS18B20_TEMP_INVALID;
+			DS1820_BANK_SENSOR_ERROR(i);
+		} else {
+			// error, but keep temperature until sensor is unreachable or error_count reaches maximum
+		}
+
+		return 0;
+	}
+
+	// no error
+	ctx->temperature[i] = temperature;
+	ds1820_bank_set_error_count(ctx, i, 0);
+	return 1;
+}
+
+/**
+ * @return
+ * - 0 if \p ROM belongs to a device the bank can't read
+ * - 1 if \p ROM belongs to a DS18S20 or DS18B20
+ */
+static int ds1820_bank_is_sensor(uint8_t *ROM) {
+	return TM_DS18S20_Is(ROM) || TM_DS18B20_Is(ROM);
+}
+
+/**
+ * Decodes the scratchpad of a slot according to the family of its sensor.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @param data The 9 bytes of the scratchpad
+ * @param temperature Destination for the temperature in 1/16 degC
+ * @return Status returned by the DS18x20 library (#TM_DS18B20_SUCCESS on success)
+ */
+static uint8_t ds1820_bank_decode(DS1820_Bank_Context *ctx, uint32_t i,
+		uint8_t *data, int16_t *temperature) {
+	if (TM_DS18B20_Is(ctx->rom[i])) {
+		return TM_DS18B20_Decode(data, temperature);
+	}
+
+	return TM_DS18S20_Decode(data, temperature);
+}
+
+/**
+ * Returns the time the sensor of a slot needs for a temperature conversion.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @return Conversion time in ms
+ */
+static uint32_t ds1820_bank_conversion_time(DS1820_Bank_Context *ctx,
+		uint32_t i) {
+	if (TM_DS18B20_Is(ctx->rom[i])) {
+		return DS18B20_CONVERSION_TIME_MS(ds1820_bank_resolution(ctx, i));
+	}
+
+	return DS18S20_CONVERSION_TIME_MS;
+}
+
+/**
+ * Chooses the resolution of a DS18B20 slot after its temperature got updated:
+ * #DS1820_BANK_RESOLUTION_HIGH if precision is requested or if the temperature changes faster
+ * than #DS1820_BANK_FAST_CHANGE, #DS1820_BANK_RESOLUTION_LOW after #DS1820_BANK_STABLE_READINGS
+ * readings without such a change. Has to be called before the next conversion of the slot is
+ * started.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @param previous Temperature before the update
+ * @param data The scratchpad just read, the configuration register (data[4]) is set to the
+ * new resolution
+ * @return
+ * - 0 if the resolution stays the same
+ * - 1 if TH, TL and the configuration register (data[2..4]) have to be written to the scratchpad
+ */
+static int ds1820_bank_adapt_resolution(DS1820_Bank_Context *ctx, uint32_t i,
+		int16_t previous, uint8_t *data) {
+	int32_t change = ctx->temperature[i] - previous;
+	// the previous reading was taken right before the conversion just read was started
+	uint32_t elapsed = HAL_GetTick()
+			- (ctx->due[i] - ds1820_bank_conversion_time(ctx, i));
+	uint8_t stable_count = ctx->adapt[i] >> DS1820_BANK_ADAPT_STABLE_SHIFT;
+	uint8_t current;
+	uint8_t resolution;
+
+	if (!TM_DS18B20_Is(ctx->rom[i])) {
+		return 0;
+	}
+
+	current = ((data[4] & 0x60) >> 5) + 9;
+
+	// change per second
+	change = change * 1000 / (int32_t) (elapsed ? elapsed : 1);
+
+	if ((ctx->adapt[i] & DS1820_BANK_ADAPT_PRECISE)
+			|| (previous != TM_DS18B20_TEMP_INVALID
+					&& (change > DS1820_BANK_FAST_CHANGE
+							|| change < -DS1820_BANK_FAST_CHANGE))) {
+		stable_count = 0;
+		resolution = DS1820_BANK_RESOLUTION_HIGH;
+	} else if (stable_count < DS1820_BANK_STABLE_READINGS) {
+		stable_count++;
+		resolution = current;
+	} else {
+		resolution = DS1820_BANK_RESOLUTION_LOW;
+	}
+
+	ctx->adapt[i] = (ctx->adapt[i] & DS1820_BANK_ADAPT_PRECISE)
+			| (stable_count << DS1820_BANK_ADAPT_STABLE_SHIFT);
+	ds1820_bank_set_resolution(ctx, i, resolution);
+
+	if (resolution == current) {
+		return 0;
+	}
+
+	data[4] = (data[4] & ~0x60) | ((resolution - 9) << 5);
+	return 1;
+}
+
+/**
+ * Writes TH, TL and the configuration register (data[2..4] of each slot's scratchpad) to all
+ * slots in \p slots at once. The values are not copied to the EEPROM of the sensors.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param slots Mask of the slots to write
+ * @param data Scratchpad of every slot, indexed by slot number
+ */
+static void ds1820_bank_write_scratchpads(DS1820_Bank_Context *ctx,
+		uint16_t slots, uint8_t data[ONEWIRE_PORT_PINS][9]) {
+	uint8_t bytes[ONEWIRE_PORT_PINS] = { 0 };
+	TM_OneWire_t port = ctx->port;
+	port.GPIO_Pin = slots;
+
+	onewire_port_reset(&port);
+	ds1820_bank_select(ctx, &port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_WSCRATCHPAD);
+
+	for (int j = 2; j < 5; j++) {
+		for (int i = 0; i < ctx->n; i++) {
+			bytes[i] = data[i][j];
+		}
+
+		onewire_port_write_bytes(&port, bytes);
+	}
+
+	onewire_port_reset(&port);
+}
+
+/**
+ * Sets the precision needed from a slot (e.g. by a control loop). While \p precise is set, a
+ * DS18B20 converts with #DS1820_BANK_RESOLUTION_HIGH, otherwise the resolution follows the rate
+ * of change of the temperature. Takes effect after the next reading of the slot.
+ * @param ctx Context for the DS1820 sensor slots
+ * @param i Number of the slot (Pxi of GPIOx)
+ * @param precise 1 to request #DS1820_BANK_RESOLUTION_HIGH, 0 to let the bank decide
+ */
+void ds1820_bank_request_precision(DS1820_Bank_Context *ctx, uint8_t i,
+		uint8_t precise) {
+	if (precise) {
+		ctx->adapt[i] |= DS1820_BANK_ADAPT_PRECISE;
+	} else {
+		ctx->adapt[i] &= ~DS1820_BANK_ADAPT_PRECISE;
+	}
+}
+
 /**
  * Request a slot for a <b>temperature conversion</b>. That means (if the sensor is functioning)
  * that the sensor will start measuring the temperature. About 700ms later, the temperature can
@@ -123,33 +573,93 @@ int ds1820_bank_check_rom(DS1820_Bank_Context *ctx, uint8_t i,
  * @param ctx Context for the DS1820 sensor slots
  * @param i Number of the slot (Pxi of GPIOx)
  * @return
- * - 0 if there was no valid ROM and there is no sensor available
+ * - 0 if there was no valid ROM and there is no sensor available (or it is no DS1820)
  * - 1 if there is a valid ROM
  */
 int ds1820_bank_start_conversion(DS1820_Bank_Context *ctx, uint8_t i) {
-	if (!ds1820_bank_check_rom(ctx, i, DS1820_BANK_KEEP_OLD_ROM)) {
+	TM_OneWire_t onewire;
+
+	ds1820_bank_count_conversion(ctx);
+
+	if (!ds1820_bank_check_rom(ctx, i, DS1820_BANK_KEEP_OLD_ROM)
+			|| !ds1820_bank_is_sensor(ctx->rom[i])) {
 		return 0; // critical!
 	}
 
-	return TM_DS18S20_Start(&(ctx->slots[i].onewire),
-			ctx->slots[i].onewire.ROM_NO);
+	ds1820_bank_onewire(ctx, i, &onewire);
+	TM_OneWire_Reset(&onewire);
+	ds1820_bank_select_slot(ctx, i, &onewire);
+	TM_OneWire_WriteByte(&onewire, DS18B20_CMD_CONVERTTEMP);
+
+	ds1820_bank_set_converting(ctx, i, 1);
+	ctx->due[i] = HAL_GetTick() + 1 + ds1820_bank_conversion_time(ctx, i);
+
+	return 1;
 }
 
 /**
- * Calls ds1820_bank_start_conversion() for every slot.
+ * Sends the reset, the ROM selection and the conversion command to all slots in \p slots with a
+ * valid ROM at once and schedules the slots for ds1820_bank_poll().
+ * @param ctx Context for the DS1820 sensor slots
+ * @param slots Mask of the slots to start
+ * @return Mask of the slots that started a conversion
+ */
+static uint16_t ds1820_bank_start_slots(DS1820_Bank_Context *ctx,
+		uint16_t slots) {
+	uint32_t now;
+	uint16_t pins = 0;
+
+	ds1820_bank_count_conversion(ctx);
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (!(slots & (1 << i))) {
+			continue;
+		}
+
+		if (ds1820_bank_check_rom(ctx, i, DS1820_BANK_KEEP_OLD_ROM)
+				&& ds1820_bank_is_sensor(ctx->rom[i])) {
+			pins |= 1 << i;
+			ds1820_bank_set_converting(ctx, i, 1);
+		} else {
+			ds1820_bank_set_converting(ctx, i, 0);
+		}
+	}
+
+	if (pins) {
+		TM_OneWire_t port = ctx->port;
+		port.GPIO_Pin = pins;
+
+		onewire_port_reset(&port);
+		ds1820_bank_select(ctx, &port);
+		onewire_port_write_byte(&port, DS18B20_CMD_CONVERTTEMP);
+	}
+
+	// the conversions run from now on (the ROM searches above take several ms), the tick may
+	// still count the ms the command was sent in
+	now = HAL_GetTick() + 1;
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (slots & (1 << i)) {
+			// slots without a sensor are retried after the same time
+			ctx->due[i] = now + ds1820_bank_conversion_time(ctx, i);
+		}
+	}
+
+	return pins;
+}
+
+/**
+ * Does the same as ds1820_bank_start_conversion() for every slot, but sends the reset, the
+ * ROM selection and the conversion command to all slots with a valid ROM at once.
  * @param ctx Context for the DS1820 sensor slots
  * @return
  * - 0 if there was no valid ROM and no sensor available for at least one slot
  * - 1 if every slot has a valid ROM
  */
 int ds1820_bank_start_conversions(DS1820_Bank_Context *ctx) {
-	int succcess = 1;
-
-	for (int i = 0; i < ctx->n; i++) {
-		succcess &= ds1820_bank_start_conversion(ctx, i);
-	}
+	uint16_t slots = (1 << ctx->n) - 1;
 
-	return succcess;
+	return ds1820_bank_start_slots(ctx, slots) == slots;
 }
 
 /**
@@ -157,12 +667,13 @@ int ds1820_bank_start_conversions(DS1820_Bank_Context *ctx) {
  * by calling ds1820_bank_start_conversion() or ds1820_bank_start_conversions(). <b>If one does not
  * await the finish of the conversion (after ca. 700ms), an error will occur!</b> This function
  * calls ds1820_bank_check_rom() internally so if there is no valid ROM, it will try to receive one.
- * If no ROM can be aquired, 0 will be returned, \p ctx->slots[i].temperature will be set to #NAN and
+ * If no ROM can be aquired, 0 will be returned, \p ctx->temperature[i] will be set to
+ * #TM_DS18B20_TEMP_INVALID and
  * #DS1820_BANK_SENSOR_ERROR(i) will be called.
  * If there is a ROM, the temperature will be read. An error upon reading the temperature will result
- * in a return value of 0, but \p ctx->slots[i].temperature will <b>not</b> be modified until the
+ * in a return value of 0, but \p ctx->temperature[i] will <b>not</b> be modified until the
  * temperature reading failed #DS1820_BANK_MAX_ERROR_COUNT times. Only then a new ROM will be
- * requested. Upon a failure, the temperature will be set to #NAN and #DS1820_BANK_SENSOR_ERROR(i)
+ * requested. Upon a failure, the temperature will be set to #TM_DS18B20_TEMP_INVALID and #DS1820_BANK_SENSOR_ERROR(i)
  * will be called.
  * @param ctx Context for the DS1820 sensor slots
  * @param i Number of the slot (Pxi of GPIOx)
@@ -171,64 +682,192 @@ int ds1820_bank_start_conversions(DS1820_Bank_Context *ctx) {
  * - 1 if the temperature got updated by a newer value
  */
 int ds1820_bank_update_temperature(DS1820_Bank_Context *ctx, uint32_t i) {
-	// if error_count exceeded
-	if (ctx->slots[i].error_count >= DS1820_BANK_MAX_ERROR_COUNT) {
-		// ask for (eventually new) rom
-		if (!ds1820_bank_check_rom(ctx, i, DS1820_BANK_REQUEST_NEW_ROM)) {
-			// error reading rom
-			ctx->slots[i].temperature = NAN;
-			DS1820_BANK_SENSOR_ERROR(i);
-			return 0;
+	ds1820_bank_set_converting(ctx, i, 0);
+
+	if (!ds1820_bank_prepare_read(ctx, i)) {
+		return 0;
+	}
+
+	// rom seems to be (still) valid - read temperature
+	TM_OneWire_t onewire;
+	int16_t previous = ctx->temperature[i];
+	int16_t temperature = TM_DS18B20_TEMP_INVALID;
+	uint8_t data[9];
+	uint8_t status;
+
+	ds1820_bank_onewire(ctx, i, &onewire);
+
+	if (!ds1820_bank_is_sensor(ctx->rom[i])) {
+		status = TM_DS18B20_ERR_WRONG_DEVICE_FAMILY;
+	} else if (!TM_OneWire_ReadBit(&onewire)) {
+		// a sensor still converting keeps the line low
+		status = TM_DS18B20_ERR_BUSY_CONVERTING;
+	} else {
+		TM_OneWire_Reset(&onewire);
+		ds1820_bank_select_slot(ctx, i, &onewire);
+		TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_RSCRATCHPAD);
+		TM_OneWire_ReadBytes(&onewire, data, 9);
+		TM_OneWire_Reset(&onewire);
+
+		status = ds1820_bank_decode(ctx, i, data, &temperature);
+	}
+
+	if (!ds1820_bank_store_result(ctx, i, status, temperature)) {
+		return 0;
+	}
+
+	if (ds1820_bank_adapt_resolution(ctx, i, previous, data)) {
+		TM_OneWire_Reset(&onewire);
+		ds1820_bank_select_slot(ctx, i, &onewire);
+		TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_WSCRATCHPAD);
+		TM_OneWire_WriteByte(&onewire, data[2]);
+		TM_OneWire_WriteByte(&onewire, data[3]);
+		TM_OneWire_WriteByte(&onewire, data[4]);
+		TM_OneWire_Reset(&onewire);
+	}
+
+	return 1;
+}
+
+/**
+ * Reads the scratchpads of all slots in \p slots with a valid ROM at once and stores the results
+ * like ds1820_bank_update_temperature().
+ * @param ctx Context for the DS1820 sensor slots
+ * @param slots Mask of the slots to read
+ * @return Mask of the slots whose temperature got updated
+ */
+static uint16_t ds1820_bank_read_slots(DS1820_Bank_Context *ctx,
+		uint16_t slots) {
+	uint16_t pins = 0;
+	uint16_t updated = 0;
+	uint16_t reconfigure = 0;
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (!(slots & (1 << i))) {
+			continue;
 		}
-	} else { // error_count not exceeded -> request rom only when existing rom is invalid
-		if (!ds1820_bank_check_rom(ctx, i, DS1820_BANK_KEEP_OLD_ROM)) {
-			// error reading rom
-			ctx->slots[i].temperature = NAN;
-			DS1820_BANK_SENSOR_ERROR(i);
-			return 0;
+
+		ds1820_bank_set_converting(ctx, i, 0);
+
+		if (ds1820_bank_prepare_read(ctx, i)) {
+			pins |= 1 << i;
 		}
 	}
 
-	// rom seems to be (still) valid - read temperature
-	int success = TM_DS18S20_Read(&(ctx->slots[i].onewire),
-			ctx->slots[i].onewire.ROM_NO,
-			&(ctx->slots[i].temperature)) == TM_DS18B20_SUCCESS;
+	if (!pins) {
+		return updated;
+	}
 
-	if (!success) {
-		// error reading temperature
-		if (ctx->slots[i].error_count < INT8_MAX) {
-			ctx->slots[i].error_count++;
+	TM_OneWire_t port = ctx->port;
+	port.GPIO_Pin = pins;
+
+	// a slot still converting keeps its line low
+	uint16_t done = onewire_port_read_bit(&port);
+
+	uint8_t data[ONEWIRE_PORT_PINS][9];
+	uint8_t bytes[ONEWIRE_PORT_PINS];
+
+	onewire_port_reset(&port);
+	ds1820_bank_select(ctx, &port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_RSCRATCHPAD);
+
+	for (int j = 0; j < 9; j++) {
+		onewire_port_read_bytes(&port, bytes);
+
+		for (int i = 0; i < ctx->n; i++) {
+			data[i][j] = bytes[i];
 		}
+	}
 
-		if (ctx->slots[i].error_count > DS1820_BANK_MAX_ERROR_COUNT) {
-			// rom is available, but temperature keeps being invalid
-			ctx->slots[i].temperature = NAN;
-			DS1820_BANK_SENSOR_ERROR(i);
+	onewire_port_reset(&port);
+
+	for (int i = 0; i < ctx->n; i++) {
+		if (!(pins & (1 << i))) {
+			continue;
+		}
+
+		int16_t previous = ctx->temperature[i];
+		int16_t temperature = TM_DS18B20_TEMP_INVALID;
+		uint8_t status;
+
+		if (!ds1820_bank_is_sensor(ctx->rom[i])) {
+			status = TM_DS18B20_ERR_WRONG_DEVICE_FAMILY;
+		} else if (!(done & (1 << i))) {
+			status = TM_DS18B20_ERR_BUSY_CONVERTING;
 		} else {
-			// error, but keep temperature until sensor is unreachable or error_count reaches maximum
+			status = ds1820_bank_decode(ctx, i, data[i], &temperature);
 		}
 
-		return 0;
+		if (ds1820_bank_store_result(ctx, i, status, temperature)) {
+			updated |= 1 << i;
+
+			if (ds1820_bank_adapt_resolution(ctx, i, previous, data[i])) {
+				reconfigure |= 1 << i;
+			}
+		}
 	}
 
-	// no error
-	ctx->slots[i].error_count = 0;
-	return success;
+	// before the next conversion is started
+	if (reconfigure) {
+		ds1820_bank_write_scratchpads(ctx, reconfigure, data);
+	}
+
+	return updated;
 }
 
 /**
- * Calls ds1820_bank_update_temperature() for every slot.
+ * Does the same as ds1820_bank_update_temperature() for every slot, but reads the scratchpads
+ * of all slots with a valid ROM at once.
  * @param ctx Context for the DS1820 sensor slots
  * @return
  * - 0 if at least one slot could not aquire a temperature
  * - 1 if every single slot could update its temperature
  */
 int ds1820_bank_update_temperatures(DS1820_Bank_Context *ctx) {
-	int succcess = 1;
+	uint16_t slots = (1 << ctx->n) - 1;
+
+	return ds1820_bank_read_slots(ctx, slots) == slots;
+}
+
+/**
+ * Keeps the bank sampling without any waiting in between: every slot whose conversion time
+ * has elapsed is read and immediately starts its next conversion. Slots that are not converting
+ * (right after ds1820_bank_init() or without a sensor) are started as soon as they are due.
+ * All slots due at the same time are read and started at once. Call this function as often as
+ * possible (e.g. from the main loop) instead of ds1820_bank_start_conversions() and
+ * ds1820_bank_update_temperatures().
+ * @param ctx Context for the DS1820 sensor slots
+ * @return Mask of the slots whose temperature got updated (0 if nothing was due)
+ */
+uint16_t ds1820_bank_poll(DS1820_Bank_Context *ctx) {
+	uint32_t now = HAL_GetTick();
+	uint16_t due = 0;
+	uint16_t converted = 0;
+	uint16_t updated = 0;
 
 	for (int i = 0; i < ctx->n; i++) {
-		succcess &= ds1820_bank_update_temperature(ctx, i);
+		if ((int32_t) (now - ctx->due[i]) >= 0) {
+			due |= 1 << i;
+
+			if (ctx->state[i] & DS1820_BANK_STATE_CONVERTING) {
+				converted |= 1 << i;
+			}
+		}
 	}
 
-	return succcess;
+	if (!due) {
+		return updated;
+	}
+
+	PROFILE_BEGIN(PROFILE_ONEWIRE);
+
+	if (converted) {
+		updated = ds1820_bank_read_slots(ctx, converted);
+	}
+
+	ds1820_bank_start_slots(ctx, due);
+
+	PROFILE_END(PROFILE_ONEWIRE);
+
+	return updated;
 }
@@ -42,9 +42,15 @@
 #include <string.h>
 #include "stm32f3xx_hal.h"
 #include "can.h"
+#include "can_bus.h"
+#include "can_filter.h"
+#include "can_stats.h"
+#include "telemetry.h"
 #include "usart.h"
 #include "gpio.h"
 #include "ds1820_bank.h"
+#include "timing.h"
+#include "profile.h"
 
 //#define CAN_MCP2551 1
 #define CAN_ID 100
@@ -55,6 +61,7 @@ void SystemClock_Config(void);
 int main(void) {
 	HAL_Init();
 	SystemClock_Config();
+	timing_init();
 	MX_GPIO_Init();
 	MX_USART1_Init();
 
@@ -74,40 +81,39 @@ int main(void) {
 	char str[] = "Hello World\n";
 	HAL_USART_Transmit(&husart1, (unsigned char*) str, sizeof(str) - 1, 1000);
 
-//	DS1820_Bank_Context ds1820_ctx;
+//	static DS1820_Bank_Context ds1820_ctx;
 //	ds1820_bank_init(&ds1820_ctx, 15, GPIOB);
+//	static Telemetry_Encoder telemetry;
+//	telemetry_init(&telemetry);
 //
 //	char buf[10] = { 0 };
 //	while (1) {
 //
 //		for (int j = 0; j < 6; j++) {
-//			ds1820_bank_start_conversions(&ds1820_ctx);
-//			//HAL_Delay(750);
-//			ds1820_bank_update_temperatures(&ds1820_ctx);
+//			// read and restart every slot as soon as its conversion is finished
+//			while (!ds1820_bank_poll(&ds1820_ctx))
+//				;
+//			// send the temperatures that changed (4 slots per frame)
+//			telemetry_send(&telemetry, &ds1820_ctx, 1);
+//			// bus load, error counters and transmit latencies of the last interval
+//			can_stats_sample();
+//			can_stats_send();
 //
 //			for (int i = 0; i < ds1820_ctx.n; i++) {
-//				sprintf(buf, "(%d) %d   ", i, ds1820_ctx.slots[i].rom_state);
+//				sprintf(buf, "(%d) %d   ", i, DS1820_BANK_ROM_STATE(&ds1820_ctx, i));
 //				HAL_USART_Transmit(&husart1, (uint8_t*) buf, strlen(buf), 1000);
 //			}
 //			HAL_USART_Transmit(&husart1, "\n", 1, 1000);
 //			for (int i = 0; i < ds1820_ctx.n; i++) {
-//				sprintf(buf, "(%d)%4.1f ", i, ds1820_ctx.slots[i].temperature);
+//				sprintf(buf, "(%d)%4.1f ", i,
+//						TM_DS18B20_TEMP_TO_FLOAT(ds1820_ctx.temperature[i]));
 //				HAL_USART_Transmit(&husart1, (uint8_t*) buf, strlen(buf), 1000);
 //			}
 //			HAL_USART_Transmit(&husart1, "\n", 1, 1000);
 //		}
-	//ds1820_bank_deinit(&ds1820_ctx);
 
 #ifdef hd44780
-	/* Define 6 custom characters to display bar graph*/
-	char STCustom[48] = {0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00, // Blank
-		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,// 1column  |
-		0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18,// 2columns ||
-		0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c,// 3columns |||
-		0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e,// 4columns ||||
-		0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f,// 5columns |||||
-	};
-	char bell[8] = {0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00};
+	const char bell[8] = {0x04, 0x0E, 0x0E, 0x0E, 0x1F, 0x00, 0x04, 0x00};
 
 	LCD_PWRON();
 	/* Min. delay to wait before initialization after LCD power ON */
@@ -118,16 +124,19 @@ int main(void) {
 
 	LCD_CLEAR_DISPLAY();
 
-	/* Loading 6 characters @CGRAM address from STCustom tab */
-	LCD_LOAD_CGRAM(bell, 0);
-	LCD_LOAD_CGRAM(STCustom+8, 1);
+	/* Upload the bell glyph to a free CGRAM slot */
+	uint8_t bell_char = LCD_GLYPH(LCD_GLYPH_USER, bell);
 
 	/* Set cursor to the chosen position*/
 	LCD_LOCATE(0, 0);
 	/* Print string on LCD (must be ended with \n)*/
 	LCD_printstring((unsigned char*) "STM32\nDiscovery");
 	LCD_LOCATE(2, 0);
-	LCD_printchar('\x0');	// custom char at slot 0x00
+	LCD_printchar(bell_char);
+
+	/* Bar graph drawn into the framebuffer, only the partial glyph is uploaded */
+	LCD_FB_BAR(3, 0, LCD_COLS, 42, 100);
+	LCD_FB_FLUSH();
 
 //	for (int i = 0; i < 256/(4*16); i++) {
 //		for (int row = 0; row < 4; row++) {
@@ -145,18 +154,16 @@ int main(void) {
 #define SENDER
 
 #ifdef CAN_MCP2551
-	CanTxMsgTypeDef msg;
-	msg.StdId = CAN_ID;
-	msg.ExtId = 0;
-	msg.IDE = CAN_ID_STD;
-	msg.RTR = CAN_RTR_DATA;
-	msg.DLC = 0x8;
-	strcpy(&(msg.Data), "Hallo Wo");
+	can_bus_init();
 
 #ifdef SENDER
-	hcan.pTxMsg = &msg;
-	volatile int result = HAL_CAN_Transmit(&hcan, 1000);
-	if (result != HAL_TIMEOUT) {
+	CAN_Bus_Frame msg = { .id = CAN_ID, .flags = 0, .dlc = 8 };
+	memcpy(msg.data, "Hallo Wo", 8);
+
+	PROFILE_BEGIN(PROFILE_CAN_TX);
+	int result = can_bus_send(&msg);
+	PROFILE_END(PROFILE_CAN_TX);
+	if (result) {
 		HAL_GPIO_WritePin(GPIOE, GPIO_PIN_11, 1); // green
 		while (1)
 			;
@@ -165,32 +172,18 @@ int main(void) {
 	}
 
 #else
-	CAN_FilterConfTypeDef sFilterConfig;
-	static CanTxMsgTypeDef TxMessage;
-	static CanRxMsgTypeDef RxMessage;
-
-//	/*##-2- Configure the CAN Filter ###########################################*/
-//	sFilterConfig.FilterNumber = 0;
-//	sFilterConfig.FilterMode = CAN_FILTERMODE_IDMASK;
-//	sFilterConfig.FilterScale = CAN_FILTERSCALE_32BIT;
-//	sFilterConfig.FilterIdHigh = 0x0000;
-//	sFilterConfig.FilterIdLow = 0x0000;
-//	sFilterConfig.FilterMaskIdHigh = 0x0000;
-//	sFilterConfig.FilterMaskIdLow = 0x0000;
-//	sFilterConfig.FilterFIFOAssignment = CAN_FIFO0;
-//	sFilterConfig.FilterActivation = ENABLE;
-//	sFilterConfig.BankNumber = 0;
-//
-//	if (HAL_CAN_ConfigFilter(&hcan, &sFilterConfig) != HAL_OK) {
-//		/* Filter configuration Error */
-//		Error_Handler();
-//	}
+	CAN_Bus_Frame msg;
+
+	// only receive the frames of CAN_ID, the filters drop everything else
+	can_filter_subscribe(CAN_ID, 0, CAN_FILTER_HIGH);
+	can_filter_apply();
 
 	while (1) {
 		HAL_GPIO_TogglePin(GPIOE, GPIO_PIN_8);
-		volatile int result = HAL_CAN_Receive(&hcan, CAN_FIFO0, 1000);
-		if (result != HAL_TIMEOUT) {
-			HAL_USART_Transmit(&husart1, hcan.pRxMsg->Data, 8, 1000);
+		if (can_bus_receive(&msg)) {
+			PROFILE_BEGIN(PROFILE_USART_TX);
+			HAL_USART_Transmit(&husart1, msg.data, msg.dlc, 1000);
+			PROFILE_END(PROFILE_USART_TX);
 			HAL_GPIO_WritePin(GPIOE, GPIO_PIN_11, 1); // green
 			while (1)
 			;
@@ -0,0 +1,353 @@
+/**
+ ******************************************************************************
+ * @file    onewire_async.c
+ * @brief  Non-blocking onewire transactions driven by a timer interrupt
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The TM onewire library busy-waits through every reset pulse and bit slot, so the CPU can't do
+ * anything else while talking to a sensor. This module runs whole transactions
+ * (#OneWire_Async_Transaction) in the background instead. Transactions are queued with
+ * onewire_async_submit() and processed one after another. Every edge on the bus is done by the
+ * state machine in onewire_async_step(), which returns the time until the next edge is due.
+ * TIM7 (one-pulse mode, 1us resolution) calls it again after exactly that time.
+ *
+ * onewire_async_transfer() is the blocking wrapper: it submits a transaction and waits until
+ * it is finished. Only whole transactions go through the engine. The bit level calls of the TM
+ * library (TM_OneWire_Reset(), TM_OneWire_WriteBit(), TM_OneWire_ReadBit() and everything built
+ * on them, e.g. the ROM search) keep their own busy-waiting slots: the search decides every bit
+ * from the two bits read before, which would cost one submission and interrupt round trip per
+ * bit, and the USART buses have no GPIO edges the engine could drive. They must not be used on a
+ * bus while a transaction is queued for it (see onewire_async_busy()).
+ *
+ * onewire_async_step() does not depend on the timer, so the state machine can also be driven
+ * by a simulated clock (e.g. on a host with a GPIO_TypeDef in RAM).
+ *
+ ******************************************************************************
+ */
+
+#include "onewire_async.h"
+
+/**
+ * The edges of a transaction. Every state describes the edge done when the state machine is
+ * stepped the next time.
+ */
+typedef enum {
+	ONEWIRE_ASYNC_IDLE,
+	ONEWIRE_ASYNC_RESET_LOW,
+	ONEWIRE_ASYNC_RESET_RELEASE,
+	ONEWIRE_ASYNC_RESET_SAMPLE,
+	ONEWIRE_ASYNC_RESET_DONE,
+	ONEWIRE_ASYNC_WRITE_LOW,
+	ONEWIRE_ASYNC_WRITE_RELEASE,
+	ONEWIRE_ASYNC_READ_LOW,
+	ONEWIRE_ASYNC_READ_RELEASE,
+	ONEWIRE_ASYNC_READ_SAMPLE,
+	ONEWIRE_ASYNC_COMPLETE
+} OneWire_Async_Phase;
+
+static OneWire_Async_Transaction *queue[ONEWIRE_ASYNC_QUEUE_LENGTH];
+static volatile uint8_t queue_head = 0;	// next transaction to run
+static volatile uint8_t queue_count = 0;
+
+static OneWire_Async_Transaction * volatile current = NULL;
+static OneWire_Async_Phase phase = ONEWIRE_ASYNC_IDLE;
+static uint16_t byte_index;		// index of the current byte (writes first, then reads)
+static uint8_t bit_index;		// 0..7, LSB first
+static uint8_t bit_value;		// bit currently written or read
+
+/**
+ * Returns the number of bytes written in the transaction (ROM command, ROM, command, tx).
+ */
+static uint16_t onewire_async_tx_count(OneWire_Async_Transaction *t) {
+	return 1 + (t->rom ? 8 : 0) + 1 + (t->tx ? t->tx_len : 0);
+}
+
+/**
+ * Returns the byte with index \p i of the bytes written in the transaction.
+ */
+static uint8_t onewire_async_tx_byte(OneWire_Async_Transaction *t, uint16_t i) {
+	if (i == 0) {
+		return t->rom ? ONEWIRE_CMD_MATCHROM : ONEWIRE_CMD_SKIPROM;
+	}
+	i--;
+
+	if (t->rom) {
+		if (i < 8) {
+			return t->rom[i];
+		}
+		i -= 8;
+	}
+
+	if (i == 0) {
+		return t->command;
+	}
+
+	return t->tx[i - 1];
+}
+
+/**
+ * Prepares the phase for the bit at the current byte_index/bit_index.
+ * @return 1 if there is a bit left, 0 if the transaction is complete
+ */
+static int onewire_async_next_bit(OneWire_Async_Transaction *t) {
+	uint16_t tx_count = onewire_async_tx_count(t);
+
+	if (byte_index < tx_count) {
+		bit_value = (onewire_async_tx_byte(t, byte_index) >> bit_index) & 0x01;
+		phase = ONEWIRE_ASYNC_WRITE_LOW;
+		return 1;
+	}
+
+	if (t->rx && byte_index < tx_count + t->rx_len) {
+		phase = ONEWIRE_ASYNC_READ_LOW;
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Moves on to the next bit after a bit slot was finished.
+ */
+static void onewire_async_advance(void) {
+	if (++bit_index == 8) {
+		bit_index = 0;
+		byte_index++;
+	}
+}
+
+/**
+ * Finishes the current transaction and fetches the next one from the queue. The next
+ * transaction is taken over before the callback runs, so a transaction submitted by the
+ * callback is queued behind it (or started, if the queue was empty).
+ * @param state Final state of the current transaction
+ */
+static void onewire_async_finish(OneWire_Async_State state) {
+	OneWire_Async_Transaction *t = current;
+
+	if (queue_count) {
+		current = queue[queue_head];
+		queue_head = (queue_head + 1) % ONEWIRE_ASYNC_QUEUE_LENGTH;
+		queue_count--;
+		phase = ONEWIRE_ASYNC_RESET_LOW;
+	} else {
+		current = NULL;
+		phase = ONEWIRE_ASYNC_IDLE;
+	}
+
+	t->state = state;
+
+	if (t->callback) {
+		t->callback(t);
+	}
+}
+
+/**
+ * Starts the timer to call onewire_async_irq_handler() after \p us microseconds.
+ */
+static void onewire_async_schedule(uint16_t us) {
+	TIM7->ARR = us - 1;
+	TIM7->CR1 |= TIM_CR1_CEN;
+}
+
+/**
+ * Initializes TIM7 for the onewire state machine (1MHz counter clock, one-pulse mode, update
+ * interrupt). Call this once before submitting any transactions.
+ */
+void onewire_async_init(void) {
+	uint32_t clock = HAL_RCC_GetPCLK1Freq();
+
+	// the timers run at twice the APB1 clock if APB1 is divided
+	if ((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_HCLK_DIV1) {
+		clock *= 2;
+	}
+
+	__HAL_RCC_TIM7_CLK_ENABLE();
+
+	TIM7->CR1 = TIM_CR1_OPM | TIM_CR1_URS;
+	TIM7->PSC = clock / 1000000 - 1;
+	TIM7->EGR = TIM_EGR_UG;	// load the prescaler
+	TIM7->SR = 0;
+	TIM7->DIER = TIM_DIER_UIE;
+
+	HAL_NVIC_SetPriority(TIM7_IRQn, ONEWIRE_ASYNC_IRQ_PRIORITY, 0);
+	HAL_NVIC_EnableIRQ(TIM7_IRQn);
+}
+
+/**
+ * Queues a transaction. If no other transaction is running, it is started right away.
+ * May be called from the callback of a finishing transaction.
+ * @param transaction Transaction to be processed (has to stay valid until it is finished)
+ * @return
+ * - 0 if the queue is full or the bus is no GPIO bus (see TM_OneWire_InitUSART())
+ * - 1 if the transaction got queued
+ */
+int onewire_async_submit(OneWire_Async_Transaction *transaction) {
+	int success = 1;
+	uint32_t primask = __get_PRIMASK();
+
+	transaction->state = ONEWIRE_ASYNC_PENDING;
+
+	// the state machine drives the pin, a USART bus has none
+	if (!transaction->onewire->GPIOx || transaction->onewire->USARTx) {
+		return 0;
+	}
+
+	__disable_irq();
+
+	if (!current) {
+		current = transaction;
+		phase = ONEWIRE_ASYNC_RESET_LOW;
+		onewire_async_schedule(2);
+	} else if (queue_count < ONEWIRE_ASYNC_QUEUE_LENGTH) {
+		queue[(queue_head + queue_count) % ONEWIRE_ASYNC_QUEUE_LENGTH] =
+				transaction;
+		queue_count++;
+	} else {
+		success = 0;
+	}
+
+	__set_PRIMASK(primask);
+
+	return success;
+}
+
+/**
+ * Blocking wrapper: submits a transaction and waits until it is finished.
+ * Must not be called from an interrupt with a priority higher than #ONEWIRE_ASYNC_IRQ_PRIORITY.
+ * @param transaction Transaction to be processed
+ * @return Final state of the transaction (#ONEWIRE_ASYNC_PENDING if it was not accepted, see
+ * onewire_async_submit())
+ */
+OneWire_Async_State onewire_async_transfer(
+		OneWire_Async_Transaction *transaction) {
+	if (!onewire_async_submit(transaction)) {
+		return ONEWIRE_ASYNC_PENDING;
+	}
+
+	while (transaction->state == ONEWIRE_ASYNC_PENDING)
+		;
+
+	return transaction->state;
+}
+
+/**
+ * @return
+ * - 0 if there is no transaction running or queued
+ * - 1 otherwise
+ */
+int onewire_async_busy(void) {
+	return current != NULL;
+}
+
+/**
+ * Performs the edge that is due now and prepares the next one.
+ * @return Time in us until onewire_async_step() has to be called again, 0 if there is nothing
+ * left to do
+ */
+uint16_t onewire_async_step(void) {
+	OneWire_Async_Transaction *t = current;
+
+	if (!t) {
+		return 0;
+	}
+
+	switch (phase) {
+	case ONEWIRE_ASYNC_RESET_LOW:
+		ONEWIRE_LOW(t->onewire);
+		ONEWIRE_OUTPUT(t->onewire);
+		phase = ONEWIRE_ASYNC_RESET_RELEASE;
+		return 480;
+
+	case ONEWIRE_ASYNC_RESET_RELEASE:
+		ONEWIRE_INPUT(t->onewire);
+		phase = ONEWIRE_ASYNC_RESET_SAMPLE;
+		return 70;
+
+	case ONEWIRE_ASYNC_RESET_SAMPLE:
+		// a device pulls the line low to signal its presence
+		bit_value = !ONEWIRE_READ(t->onewire);
+		phase = ONEWIRE_ASYNC_RESET_DONE;
+		return 410;
+
+	case ONEWIRE_ASYNC_RESET_DONE:
+		if (!bit_value) {
+			onewire_async_finish(ONEWIRE_ASYNC_NO_PRESENCE);
+			return current ? 2 : 0;
+		}
+
+		byte_index = 0;
+		bit_index = 0;
+		onewire_async_next_bit(t);
+		return 2;
+
+	case ONEWIRE_ASYNC_WRITE_LOW:
+		ONEWIRE_LOW(t->onewire);
+		ONEWIRE_OUTPUT(t->onewire);
+		phase = ONEWIRE_ASYNC_WRITE_RELEASE;
+		return bit_value ? 10 : 65;
+
+	case ONEWIRE_ASYNC_WRITE_RELEASE: {
+		// wait for the rest of the slot
+		uint16_t rest = bit_value ? 55 : 5;
+
+		ONEWIRE_INPUT(t->onewire);
+
+		onewire_async_advance();
+		if (!onewire_async_next_bit(t)) {
+			phase = ONEWIRE_ASYNC_COMPLETE;
+		}
+		return rest;
+	}
+
+	case ONEWIRE_ASYNC_READ_LOW:
+		ONEWIRE_LOW(t->onewire);
+		ONEWIRE_OUTPUT(t->onewire);
+		phase = ONEWIRE_ASYNC_READ_RELEASE;
+		return 3;
+
+	case ONEWIRE_ASYNC_READ_RELEASE:
+		ONEWIRE_INPUT(t->onewire);
+		phase = ONEWIRE_ASYNC_READ_SAMPLE;
+		return 10;
+
+	case ONEWIRE_ASYNC_READ_SAMPLE: {
+		uint8_t *byte = &(t->rx[byte_index - onewire_async_tx_count(t)]);
+
+		if (bit_index == 0) {
+			*byte = 0;
+		}
+		if (ONEWIRE_READ(t->onewire)) {
+			*byte |= 1 << bit_index;
+		}
+
+		onewire_async_advance();
+		if (!onewire_async_next_bit(t)) {
+			phase = ONEWIRE_ASYNC_COMPLETE;
+		}
+		return 50;
+	}
+
+	case ONEWIRE_ASYNC_COMPLETE:
+		// the last slot is over
+		onewire_async_finish(ONEWIRE_ASYNC_DONE);
+		return current ? 2 : 0;
+
+	default:
+		return 0;
+	}
+}
+
+/**
+ * Has to be called from TIM7_IRQHandler().
+ */
+void onewire_async_irq_handler(void) {
+	TIM7->SR = 0;
+
+	uint16_t us = onewire_async_step();
+
+	if (us) {
+		onewire_async_schedule(us);
+	}
+}
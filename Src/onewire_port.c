@@ -0,0 +1,249 @@
+/**
+ ******************************************************************************
+ * @file    onewire_port.c
+ * @brief  Port-parallel onewire engine (one independent onewire bus on every pin of a port)
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The TM onewire library drives exactly one bus per call. If every pin of a GPIO port carries
+ * its own bus (like the slots of a ds1820_bank), talking to all of them one after another
+ * multiplies the (busy waiting) bus time by the number of pins.
+ *
+ * This module drives a whole set of pins through every reset, write and read slot at once.
+ * A #TM_OneWire_t is used to describe the port: \p GPIOx is the port and \p GPIO_Pin is the
+ * <b>mask</b> of all pins taking part. The line level is set and sampled with whole-port
+ * accesses: in open drain mode (#ONEWIRE_OPEN_DRAIN) by writing BSRR/BRR, otherwise by switching
+ * the pins between input and output in MODER (ODR of the pins is kept low). One transaction
+ * therefore takes the same time for one bus as for sixteen.
+ *
+ * Bytes that differ from pin to pin (e.g. the ROM numbers of a MATCH ROM command) and read
+ * results are passed as arrays indexed by pin number (see #ONEWIRE_PORT_PINS).
+ *
+ * The module only touches the port through the GPIO_TypeDef registers, so it also runs on a
+ * GPIO_TypeDef located in plain RAM (e.g. a simulated port on a host).
+ *
+ ******************************************************************************
+ */
+
+#include "onewire_port.h"
+
+#if ONEWIRE_OPEN_DRAIN
+/**
+ * Returns the mask used by onewire_port_drive() and onewire_port_release() for \p pins. In open
+ * drain mode, the pins stay outputs and the line is set by the output level (ODR).
+ */
+static inline uint32_t onewire_port_mask(uint16_t pins) {
+	return pins;
+}
+
+/**
+ * Pulls the line of every pin selected by \p mask (see onewire_port_mask()) low.
+ */
+static inline void onewire_port_drive(GPIO_TypeDef *GPIOx, uint32_t mask) {
+	GPIOx->BRR = mask;
+}
+
+/**
+ * Releases the line of every pin selected by \p mask (the open drain output turns off, the
+ * pull-up takes over).
+ */
+static inline void onewire_port_release(GPIO_TypeDef *GPIOx, uint32_t mask) {
+	GPIOx->BSRR = mask;
+}
+#else
+/**
+ * Returns the mask used by onewire_port_drive() and onewire_port_release() for \p pins: the
+ * MODER bits switching the pins to output (see TM_OneWire_ModerOutput()).
+ */
+static inline uint32_t onewire_port_mask(uint16_t pins) {
+	return TM_OneWire_ModerOutput(pins);
+}
+
+/**
+ * Pulls the line of every pin selected by \p mask (see onewire_port_mask()) low
+ * (pins switch to output, ODR is low). The pins are always either inputs (00b) or outputs (01b),
+ * so setting the lower mode bit is enough.
+ */
+static inline void onewire_port_drive(GPIO_TypeDef *GPIOx, uint32_t mask) {
+	GPIOx->MODER |= mask;
+}
+
+/**
+ * Releases the line of every pin selected by \p mask (pins switch back to input, the pull-up
+ * takes over).
+ */
+static inline void onewire_port_release(GPIO_TypeDef *GPIOx, uint32_t mask) {
+	GPIOx->MODER &= ~mask;
+}
+#endif
+
+/**
+ * Initializes the pins \p pins of \p GPIOx for the port-parallel onewire engine and stores the
+ * port settings in \p port. Every pin is released: an open drain output at high level
+ * (#ONEWIRE_OPEN_DRAIN) or an input with its output level set to low.
+ * @param port Working struct describing the port (\p GPIO_Pin will hold the pin mask)
+ * @param GPIOx Port that holds the pins (like #GPIOA, #GPIOB, ..., #GPIOF)
+ * @param pins Mask of the pins (GPIO_PIN_x) taking part in the transactions
+ */
+void onewire_port_init(TM_OneWire_t *port, GPIO_TypeDef *GPIOx, uint16_t pins) {
+	GPIO_InitTypeDef GPIO_InitStruct;
+
+	timing_init();
+
+#if ONEWIRE_OPEN_DRAIN
+	GPIOx->BSRR = pins;	// released before the pins become outputs
+#endif
+
+	GPIO_InitStruct.Pin = pins;
+#if ONEWIRE_OPEN_DRAIN
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+#else
+	GPIO_InitStruct.Mode = GPIO_MODE_INPUT;
+#endif
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_MEDIUM;
+	HAL_GPIO_Init(GPIOx, &GPIO_InitStruct);
+
+#if !ONEWIRE_OPEN_DRAIN
+	GPIOx->BRR = pins;	// output level low while the pins are outputs
+#endif
+
+	port->GPIOx = GPIOx;
+	port->GPIO_Pin = pins;
+	port->USARTx = NULL;
+	port->MODER_Output = TM_OneWire_ModerOutput(pins);
+}
+
+/**
+ * Sends a reset pulse on every pin of \p port at the same time.
+ * @param port Port to reset
+ * @return Mask of all pins a device answered with a presence pulse on
+ */
+uint16_t onewire_port_reset(TM_OneWire_t *port) {
+	GPIO_TypeDef *GPIOx = port->GPIOx;
+	uint32_t mask = onewire_port_mask(port->GPIO_Pin);
+	uint16_t idr;
+
+	onewire_port_drive(GPIOx, mask);
+	ONEWIRE_DELAY(480);
+
+	onewire_port_release(GPIOx, mask);
+	ONEWIRE_DELAY(70);
+
+	idr = GPIOx->IDR;
+	ONEWIRE_DELAY(410);
+
+	// a device pulls the line low to signal its presence
+	return ~idr & port->GPIO_Pin;
+}
+
+/**
+ * Sends the bits of one write slot. Pins in \p mask_ones are released after 10us (bit 1), all
+ * other pins in \p mask_all are kept low for the whole slot (bit 0).
+ */
+static void onewire_port_write_slot(GPIO_TypeDef *GPIOx, uint32_t mask_all,
+		uint32_t mask_ones) {
+	onewire_port_drive(GPIOx, mask_all);
+	ONEWIRE_DELAY(10);
+
+	onewire_port_release(GPIOx, mask_ones);
+	ONEWIRE_DELAY(55);
+
+	onewire_port_release(GPIOx, mask_all);
+	ONEWIRE_DELAY(5);
+}
+
+/**
+ * Writes the same byte to every pin of \p port (LSB first).
+ * @param port Port to write to
+ * @param byte Byte to be written
+ */
+void onewire_port_write_byte(TM_OneWire_t *port, uint8_t byte) {
+	GPIO_TypeDef *GPIOx = port->GPIOx;
+	uint32_t mask = onewire_port_mask(port->GPIO_Pin);
+
+	for (int bit = 0; bit < 8; bit++) {
+		onewire_port_write_slot(GPIOx, mask, (byte & 0x01) ? mask : 0);
+		byte >>= 1;
+	}
+}
+
+/**
+ * Writes one byte per pin to \p port. All pins are written in the same eight bit slots.
+ * @param port Port to write to
+ * @param bytes Byte to be written for every pin, indexed by pin number (entries of pins not
+ * in \p port->GPIO_Pin are ignored)
+ */
+void onewire_port_write_bytes(TM_OneWire_t *port,
+		const uint8_t bytes[ONEWIRE_PORT_PINS]) {
+	GPIO_TypeDef *GPIOx = port->GPIOx;
+	uint32_t mask = onewire_port_mask(port->GPIO_Pin);
+	uint32_t ones[8];
+
+	// transpose the bytes into one pin mask per bit before the timing critical part
+	for (int bit = 0; bit < 8; bit++) {
+		uint16_t pins = 0;
+
+		for (int pin = 0; pin < ONEWIRE_PORT_PINS; pin++) {
+			if (bytes[pin] & (1 << bit)) {
+				pins |= 1 << pin;
+			}
+		}
+
+		ones[bit] = onewire_port_mask(pins & port->GPIO_Pin);
+	}
+
+	for (int bit = 0; bit < 8; bit++) {
+		onewire_port_write_slot(GPIOx, mask, ones[bit]);
+	}
+}
+
+/**
+ * Reads a single bit slot from every pin of \p port.
+ * @param port Port to read from
+ * @return Mask of all pins that read a 1
+ */
+uint16_t onewire_port_read_bit(TM_OneWire_t *port) {
+	GPIO_TypeDef *GPIOx = port->GPIOx;
+	uint32_t mask = onewire_port_mask(port->GPIO_Pin);
+	uint16_t idr;
+
+	onewire_port_drive(GPIOx, mask);
+	ONEWIRE_DELAY(3);
+
+	onewire_port_release(GPIOx, mask);
+	ONEWIRE_DELAY(10);
+
+	idr = GPIOx->IDR;
+	ONEWIRE_DELAY(50);
+
+	return idr & port->GPIO_Pin;
+}
+
+/**
+ * Reads one byte from every pin of \p port. All pins are read in the same eight bit slots.
+ * @param port Port to read from
+ * @param bytes Destination for the byte read on every pin, indexed by pin number
+ * (entries of pins not in \p port->GPIO_Pin are set to 0)
+ */
+void onewire_port_read_bytes(TM_OneWire_t *port,
+		uint8_t bytes[ONEWIRE_PORT_PINS]) {
+	uint16_t samples[8];
+
+	for (int bit = 0; bit < 8; bit++) {
+		samples[bit] = onewire_port_read_bit(port);
+	}
+
+	// transpose the samples back into one byte per pin (LSB first)
+	for (int pin = 0; pin < ONEWIRE_PORT_PINS; pin++) {
+		uint8_t byte = 0;
+
+		for (int bit = 0; bit < 8; bit++) {
+			if (samples[bit] & (1 << pin)) {
+				byte |= 1 << bit;
+			}
+		}
+
+		bytes[pin] = byte;
+	}
+}
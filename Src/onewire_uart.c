@@ -0,0 +1,260 @@
+/**
+ ******************************************************************************
+ * @file    onewire_uart.c
+ * @brief  Onewire bus on a half-duplex USART, bit slots transferred by DMA
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Instead of bit-banging a GPIO pin, the bus is connected to the TX pin of a USART in
+ * single-wire half-duplex mode (open-drain, pull-up to Vcc). Every USART frame is one onewire
+ * slot:
+ * - at #ONEWIRE_UART_BAUD_RESET, the frame #ONEWIRE_UART_RESET is the reset pulse. If a device
+ *   answers with its presence pulse, a different value is received.
+ * - at #ONEWIRE_UART_BAUD_DATA, the start bit is the low phase of a bit slot. The frame
+ *   #ONEWIRE_UART_SLOT_0 keeps the line low for the whole slot (writes a 0), the frame
+ *   #ONEWIRE_UART_SLOT_1 releases it right away (writes a 1 or reads a bit). A read bit is 1
+ *   if #ONEWIRE_UART_SLOT_1 is received unchanged.
+ *
+ * The slots of up to #ONEWIRE_UART_MAX_BYTES bytes are sent and received by one DMA transfer,
+ * so the timing of the slots does not depend on the CPU (interrupts may come in between). The
+ * functions still block until the transfer is finished: they poll the transfer complete flag,
+ * for at most twice the time the frames take. If the DMA does not finish in time (USART or DMA
+ * not set up, line stuck), the transfer is aborted and reported as an error.
+ * The byte encoding (onewire_uart_encode() and onewire_uart_decode()) does not touch the
+ * hardware.
+ *
+ * The USART pins and clocks have to be set up beforehand (see MX_USART2_OneWire_Init()).
+ * A bus is assigned to a USART with TM_OneWire_InitUSART().
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "onewire_uart.h"
+#include "timing.h"
+
+/* one slot per bit, used for sending and receiving (a slot is received after it was sent) */
+static uint8_t buffer[ONEWIRE_UART_MAX_BYTES * 8];
+
+/**
+ * Encodes bytes into one USART frame per bit (LSB first).
+ * @param bytes Bytes to be encoded
+ * @param len Number of bytes
+ * @param slots Destination for the 8 * \p len frames
+ */
+void onewire_uart_encode(const uint8_t *bytes, uint8_t len, uint8_t *slots) {
+	for (int i = 0; i < len; i++) {
+		for (int bit = 0; bit < 8; bit++) {
+			*slots++ = (bytes[i] & (1 << bit)) ?
+					ONEWIRE_UART_SLOT_1 : ONEWIRE_UART_SLOT_0;
+		}
+	}
+}
+
+/**
+ * Decodes the received USART frames back into bytes (LSB first).
+ * @param slots The 8 * \p len frames received
+ * @param len Number of bytes
+ * @param bytes Destination for the decoded bytes
+ */
+void onewire_uart_decode(const uint8_t *slots, uint8_t len, uint8_t *bytes) {
+	for (int i = 0; i < len; i++) {
+		uint8_t byte = 0;
+
+		for (int bit = 0; bit < 8; bit++) {
+			if (*slots++ == ONEWIRE_UART_SLOT_1) {
+				byte |= 1 << bit;
+			}
+		}
+
+		bytes[i] = byte;
+	}
+}
+
+/**
+ * Looks up the DMA1 channels serving \p USARTx.
+ * @return Number of the RX channel (1..7), the TX channel is written to \p tx
+ */
+static uint8_t onewire_uart_dma(USART_TypeDef *USARTx,
+		DMA_Channel_TypeDef **tx, DMA_Channel_TypeDef **rx) {
+	if (USARTx == USART1) {
+		*tx = DMA1_Channel4;
+		*rx = DMA1_Channel5;
+		return 5;
+	} else if (USARTx == USART2) {
+		*tx = DMA1_Channel7;
+		*rx = DMA1_Channel6;
+		return 6;
+	} else {
+		*tx = DMA1_Channel2;
+		*rx = DMA1_Channel3;
+		return 3;
+	}
+}
+
+/**
+ * Sets the baud rate of \p USARTx (the USART is disabled in between).
+ */
+static void onewire_uart_baud(USART_TypeDef *USARTx, uint32_t baud) {
+	uint32_t clock =
+			USARTx == USART1 ?
+					HAL_RCC_GetPCLK2Freq() : HAL_RCC_GetPCLK1Freq();
+
+	USARTx->CR1 &= ~USART_CR1_UE;
+	USARTx->BRR = (clock + baud / 2) / baud;
+	USARTx->CR1 |= USART_CR1_UE;
+}
+
+/**
+ * Sends and receives \p len frames from/to #buffer using DMA and waits until the last frame is
+ * received.
+ * @param baud Baud rate \p USARTx is set to (for the timeout)
+ * @return
+ * - 0 if all frames were received
+ * - 1 if the transfer timed out (#buffer is undefined then)
+ */
+static uint8_t onewire_uart_transfer(USART_TypeDef *USARTx, uint16_t len,
+		uint32_t baud) {
+	DMA_Channel_TypeDef *tx, *rx;
+	uint8_t channel = onewire_uart_dma(USARTx, &tx, &rx);
+	uint32_t tcif = DMA_ISR_TCIF1 << (4 * (channel - 1));
+	uint64_t deadline;
+	uint8_t error = 0;
+
+	// drop anything received before
+	USARTx->ICR = USART_ICR_ORECF | USART_ICR_FECF | USART_ICR_NCF;
+	(void) USARTx->RDR;
+
+	rx->CCR = 0;
+	rx->CPAR = (uint32_t) &(USARTx->RDR);
+	rx->CMAR = (uint32_t) buffer;
+	rx->CNDTR = len;
+	rx->CCR = DMA_CCR_MINC | DMA_CCR_EN;
+
+	tx->CCR = 0;
+	tx->CPAR = (uint32_t) &(USARTx->TDR);
+	tx->CMAR = (uint32_t) buffer;
+	tx->CNDTR = len;
+	DMA1->IFCR = DMA_IFCR_CGIF1 << (4 * (channel - 1));
+	tx->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_EN;
+
+	// 10 bits per frame, twice the time as a margin
+	deadline = timing_deadline_us(2 * 10 * 1000000 / baud * len + 100);
+
+	while (!(DMA1->ISR & tcif)) {
+		if (timing_deadline_reached(deadline)) {
+			error = 1;
+			break;
+		}
+	}
+
+	DMA1->IFCR = DMA_IFCR_CGIF1 << (4 * (channel - 1));
+	rx->CCR = 0;
+	tx->CCR = 0;
+
+	return error;
+}
+
+/**
+ * Configures \p USARTx for the onewire bus: single-wire half-duplex mode, 8N1,
+ * #ONEWIRE_UART_BAUD_DATA, DMA requests for sending and receiving.
+ * @param USARTx USART the bus is connected to (USART1, USART2 or USART3)
+ */
+void onewire_uart_init(USART_TypeDef *USARTx) {
+	__HAL_RCC_DMA1_CLK_ENABLE();
+
+	USARTx->CR1 = 0;
+	USARTx->CR2 = 0;
+	USARTx->CR3 = USART_CR3_HDSEL | USART_CR3_DMAR | USART_CR3_DMAT;
+	USARTx->CR1 = USART_CR1_TE | USART_CR1_RE;
+
+	onewire_uart_baud(USARTx, ONEWIRE_UART_BAUD_DATA);
+}
+
+/**
+ * Sends a reset pulse.
+ * @param USARTx USART the bus is connected to
+ * @return Value of the presence pulse, 0 = OK (device present), 1 = ERROR (no device or the
+ * transfer timed out, like TM_OneWire_Reset())
+ */
+uint8_t onewire_uart_reset(USART_TypeDef *USARTx) {
+	uint8_t error;
+
+	onewire_uart_baud(USARTx, ONEWIRE_UART_BAUD_RESET);
+
+	buffer[0] = ONEWIRE_UART_RESET;
+	error = onewire_uart_transfer(USARTx, 1, ONEWIRE_UART_BAUD_RESET);
+
+	onewire_uart_baud(USARTx, ONEWIRE_UART_BAUD_DATA);
+
+	return error || buffer[0] == ONEWIRE_UART_RESET;
+}
+
+/**
+ * Performs a single bit slot.
+ * @param USARTx USART the bus is connected to
+ * @param bit Bit to be written, 1 for a read slot
+ * @return Bit read from the bus, 1 if the transfer timed out (like an idle line)
+ */
+uint8_t onewire_uart_bit(USART_TypeDef *USARTx, uint8_t bit) {
+	buffer[0] = bit ? ONEWIRE_UART_SLOT_1 : ONEWIRE_UART_SLOT_0;
+	if (onewire_uart_transfer(USARTx, 1, ONEWIRE_UART_BAUD_DATA)) {
+		return 1;
+	}
+
+	return buffer[0] == ONEWIRE_UART_SLOT_1;
+}
+
+/**
+ * Writes bytes to the bus in a single DMA transfer per #ONEWIRE_UART_MAX_BYTES bytes.
+ * @param USARTx USART the bus is connected to
+ * @param bytes Bytes to be written
+ * @param len Number of bytes
+ * @return
+ * - 0 if all bytes were written
+ * - 1 if a transfer timed out (the remaining bytes are not written)
+ */
+uint8_t onewire_uart_write_bytes(USART_TypeDef *USARTx, const uint8_t *bytes,
+		uint8_t len) {
+	while (len) {
+		uint8_t n = len < ONEWIRE_UART_MAX_BYTES ? len : ONEWIRE_UART_MAX_BYTES;
+
+		onewire_uart_encode(bytes, n, buffer);
+		if (onewire_uart_transfer(USARTx, 8 * n, ONEWIRE_UART_BAUD_DATA)) {
+			return 1;
+		}
+
+		bytes += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/**
+ * Reads bytes from the bus in a single DMA transfer per #ONEWIRE_UART_MAX_BYTES bytes.
+ * @param USARTx USART the bus is connected to
+ * @param bytes Destination for the bytes read
+ * @param len Number of bytes
+ * @return
+ * - 0 if all bytes were read
+ * - 1 if a transfer timed out (the remaining bytes are set to 0xFF, as read from an idle line)
+ */
+uint8_t onewire_uart_read_bytes(USART_TypeDef *USARTx, uint8_t *bytes,
+		uint8_t len) {
+	while (len) {
+		uint8_t n = len < ONEWIRE_UART_MAX_BYTES ? len : ONEWIRE_UART_MAX_BYTES;
+
+		memset(buffer, ONEWIRE_UART_SLOT_1, 8 * n);
+		if (onewire_uart_transfer(USARTx, 8 * n, ONEWIRE_UART_BAUD_DATA)) {
+			memset(bytes, 0xFF, len);
+			return 1;
+		}
+		onewire_uart_decode(buffer, n, bytes);
+
+		bytes += n;
+		len -= n;
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * @file    profile.c
+ * @brief  Cycle counting profiler for the blocking hot paths
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * A piece of code is timed by enclosing it in PROFILE_BEGIN() and PROFILE_END() with one of the
+ * zones of #Profile_Zone. The cycles are taken from the cycle counter of the timing module, so
+ * a zone costs two counter reads and one call of profile_record(). Count, minimum, maximum and
+ * total are kept per zone in a static table, profile_dump() prints it over USART1.
+ *
+ * The LCD and CAN writes return as soon as the byte or frame is queued, so #PROFILE_LCD and
+ * #PROFILE_CAN_TX show the cost of the enqueue seen by the caller, not the time on the bus.
+ *
+ * Unless #PROFILE_ENABLED is set, the macros compile to nothing and this file is empty.
+ *
+ ******************************************************************************
+ */
+
+#include "profile.h"
+
+#if PROFILE_ENABLED
+
+#include <string.h>
+
+#if PROFILE_HOST
+#include <stdio.h>
+#include <time.h>
+#else
+#include "usart.h"
+#endif
+
+static Profile_Stats stats[PROFILE_ZONES];
+
+static const char * const names[PROFILE_ZONES] = { "onewire", "lcd", "can_tx",
+		"usart_tx" };
+
+/**
+ * Adds a measurement to the statistics of \p zone. Called by PROFILE_END().
+ * @param zone Zone measured
+ * @param cycles Cycles spent in the zone
+ */
+void profile_record(Profile_Zone zone, uint32_t cycles) {
+	Profile_Stats *s = &stats[zone];
+
+	if (!s->count || cycles < s->min) {
+		s->min = cycles;
+	}
+	if (cycles > s->max) {
+		s->max = cycles;
+	}
+	s->total += cycles;
+	s->count++;
+}
+
+/**
+ * @param zone Zone to look up
+ * @return Statistics of \p zone
+ */
+const Profile_Stats *profile_stats(Profile_Zone zone) {
+	return &stats[zone];
+}
+
+/**
+ * Clears the statistics of all zones.
+ */
+void profile_reset(void) {
+	memset(stats, 0, sizeof(stats));
+}
+
+#if PROFILE_HOST
+/**
+ * Host replacement of the cycle counter: the monotonic clock converted to cycles at
+ * #PROFILE_HOST_CLOCK. Like the cycle counter, the value wraps at 32 bits.
+ */
+uint32_t profile_host_cycles(void) {
+	struct timespec ts;
+	uint64_t ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	ns = (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	return (uint32_t) (ns * (PROFILE_HOST_CLOCK / 1000000) / 1000);
+}
+#endif
+
+/**
+ * Writes one line of the dump (also used by the dumps of other modules, e.g. can_stats_dump()).
+ * @param line Zero terminated text
+ */
+void profile_print(const char *line) {
+#if PROFILE_HOST
+	fputs(line, stdout);
+#else
+	HAL_USART_Transmit(&husart1, (uint8_t*) line, strlen(line), 1000);
+#endif
+}
+
+/**
+ * Appends a space and \p value, right-aligned in \p width characters, to a line of a dump. The
+ * dumps are put together with this instead of snprintf(), so the printf of the C library is not
+ * linked for them.
+ * @param pos End of the line so far
+ * @param value Number to append
+ * @param width Minimum number of characters of the number (more if it has more digits)
+ * @return New end of the line (zero terminated), at most 11 characters after \p pos plus the
+ * padding
+ */
+char *profile_number(char *pos, uint32_t value, uint8_t width) {
+	char digits[10];
+	uint8_t n = 0;
+
+	do {
+		digits[n++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	*pos++ = ' ';
+	for (; width > n; width--) {
+		*pos++ = ' ';
+	}
+	while (n) {
+		*pos++ = digits[--n];
+	}
+	*pos = '\0';
+
+	return pos;
+}
+
+/**
+ * Prints the statistics table (one line per zone, all times in cycles) over USART1.
+ */
+void profile_dump(void) {
+	char line[64];
+
+	profile_print("zone         count      min      max      avg\n");
+
+	for (int i = 0; i < PROFILE_ZONES; i++) {
+		Profile_Stats *s = &stats[i];
+		uint32_t avg = s->count ? s->total / s->count : 0;
+		size_t len = strlen(names[i]);
+		char *pos;
+
+		// the name left-aligned in 8 characters
+		memcpy(line, names[i], len);
+		memset(line + len, ' ', 8 - len);
+		pos = profile_number(line + 8, s->count, 9);
+		pos = profile_number(pos, s->min, 8);
+		pos = profile_number(pos, s->max, 8);
+		pos = profile_number(pos, avg, 8);
+		strcpy(pos, "\n");
+		profile_print(line);
+	}
+}
+
+#endif
@@ -36,6 +36,11 @@
 #include "stm32f3xx_it.h"
 
 /* USER CODE BEGIN 0 */
+#include "onewire_async.h"
+#include "timing.h"
+#include "HD44780.h"
+#include "can_bus.h"
+#include "can_stats.h"
 
 /* USER CODE END 0 */
 
@@ -56,6 +61,7 @@ void SysTick_Handler(void)
   HAL_IncTick();
   HAL_SYSTICK_IRQHandler();
   /* USER CODE BEGIN SysTick_IRQn 1 */
+  timing_cycles();	// keeps track of the cycle counter wraps
 
   /* USER CODE END SysTick_IRQn 1 */
 }
@@ -67,7 +73,56 @@ void SysTick_Handler(void)
 /* please refer to the startup file (startup_stm32f3xx.s).                    */
 /******************************************************************************/
 
+/**
+* @brief This function handles TIM7 global interrupt.
+*/
+void TIM7_IRQHandler(void)
+{
+  /* USER CODE BEGIN TIM7_IRQn 0 */
+  onewire_async_irq_handler();
+  /* USER CODE END TIM7_IRQn 0 */
+}
+
 /* USER CODE BEGIN 1 */
+/**
+* @brief This function handles USB high priority or CAN TX interrupts.
+*/
+void USB_HP_CAN_TX_IRQHandler(void)
+{
+  can_bus_tx_irq_handler();
+}
+
+/**
+* @brief This function handles USB low priority or CAN RX0 interrupts.
+*/
+void USB_LP_CAN_RX0_IRQHandler(void)
+{
+  can_bus_rx_irq_handler(0);
+}
+
+/**
+* @brief This function handles CAN RX1 interrupt.
+*/
+void CAN_RX1_IRQHandler(void)
+{
+  can_bus_rx_irq_handler(1);
+}
+
+/**
+* @brief This function handles CAN SCE interrupt.
+*/
+void CAN_SCE_IRQHandler(void)
+{
+  can_stats_sce_irq_handler();
+}
+
+/**
+* @brief This function handles TIM6 global and DAC underrun error interrupts.
+*/
+void TIM6_DAC_IRQHandler(void)
+{
+  LCD_IRQHandler();
+}
 
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
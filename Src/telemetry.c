@@ -0,0 +1,222 @@
+/**
+ ******************************************************************************
+ * @file    telemetry.c
+ * @brief  Packs the temperatures of a ds1820_bank into as few CAN frames as possible
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The slots of the bank are sent in groups of #TELEMETRY_SLOTS_PER_FRAME, one frame per group
+ * (16 slots take 4 frames instead of 16):
+ *
+ * | byte | content                                                                 |
+ * |------|-------------------------------------------------------------------------|
+ * | 0    | sequence number (the same for all frames of one telemetry_encode() call) |
+ * | 1    | bits 7..4: group (slots 4*group...), bits 3..0: validity of the slots    |
+ * | 2..7 | 12 bit values (LSB first), temperature in 1/16 degC - #TELEMETRY_OFFSET   |
+ *
+ * The last group of a bank with a slot count that is not a multiple of 4 uses a shorter DLC.
+ * Invalid slots are sent as 0 with their validity bit cleared.
+ *
+ * In delta mode, only the groups containing a slot that changed since it was sent last are
+ * encoded (every group is sent at least once). The receiver keeps the other values.
+ *
+ * Encoding does not change the encoder state: telemetry_commit() records a frame as sent once it
+ * is queued, so a group that didn't fit into the transmit queue is encoded again next time.
+ *
+ * telemetry_decode() only works on the raw payload bytes, so it can be used by host tools as
+ * well.
+ *
+ ******************************************************************************
+ */
+
+#include "telemetry.h"
+
+/**
+ * Resets the encoder: the sequence starts at 0 and every group will be sent by the next
+ * telemetry_encode() call, even in delta mode.
+ * @param enc Encoder state
+ */
+void telemetry_init(Telemetry_Encoder *enc) {
+	enc->seq = 0;
+	enc->sent_groups = 0;
+
+	for (int i = 0; i < DS1820_BANK_SLOTS; i++) {
+		enc->sent[i] = TM_DS18B20_TEMP_INVALID;
+	}
+}
+
+/**
+ * Converts a temperature to the 12 bit value sent (clamped to 0..#TELEMETRY_VALUE_MAX).
+ */
+static uint16_t telemetry_value(int16_t temperature) {
+	int32_t value = (int32_t) temperature - TELEMETRY_OFFSET;
+
+	if (value < 0) {
+		return 0;
+	}
+	if (value > TELEMETRY_VALUE_MAX) {
+		return TELEMETRY_VALUE_MAX;
+	}
+	return value;
+}
+
+/**
+ * Encodes the temperatures of the bank into frames. The encoder state is left as it is, the
+ * frames queued have to be passed to telemetry_commit().
+ * @param enc Encoder state (sequence number and values sent last)
+ * @param ctx Context of the bank
+ * @param delta If non-zero, only the groups that changed are encoded
+ * @param frames Destination for the frames
+ * @return Number of frames encoded (0 in delta mode if nothing changed)
+ */
+uint8_t telemetry_encode(const Telemetry_Encoder *enc, const DS1820_Bank_Context *ctx,
+		uint8_t delta, CAN_Bus_Frame frames[TELEMETRY_MAX_FRAMES]) {
+	uint8_t count = 0;
+
+	for (uint8_t first = 0; first < ctx->n; first += TELEMETRY_SLOTS_PER_FRAME) {
+		uint8_t group = first / TELEMETRY_SLOTS_PER_FRAME;
+		uint8_t slots = ctx->n - first;
+		uint8_t changed = !(enc->sent_groups & (1 << group));
+		CAN_Bus_Frame *frame = &frames[count];
+		uint64_t bits = 0;
+		uint8_t valid = 0;
+
+		if (slots > TELEMETRY_SLOTS_PER_FRAME) {
+			slots = TELEMETRY_SLOTS_PER_FRAME;
+		}
+
+		for (uint8_t k = 0; k < slots; k++) {
+			int16_t temperature = ctx->temperature[first + k];
+			int16_t value = TM_DS18B20_TEMP_INVALID;
+
+			if (temperature != TM_DS18B20_TEMP_INVALID) {
+				value = telemetry_value(temperature);
+				valid |= 1 << k;
+				bits |= (uint64_t) value << (12 * k);
+			}
+
+			if (value != enc->sent[first + k]) {
+				changed = 1;
+			}
+		}
+
+		if (delta && !changed) {
+			continue;
+		}
+
+		frame->id = TELEMETRY_CAN_ID;
+		frame->flags = 0;
+		frame->dlc = 2 + (12 * slots + 7) / 8;
+		frame->data[0] = enc->seq;
+		frame->data[1] = (group << 4) | valid;
+		for (uint8_t b = 0; b < 6; b++) {
+			frame->data[2 + b] = bits >> (8 * b);
+		}
+
+		count++;
+	}
+
+	return count;
+}
+
+/**
+ * Records a frame of telemetry_encode() as sent: its values count as sent for the delta mode and
+ * the next telemetry_encode() call uses the following sequence number.
+ * @param enc Encoder state
+ * @param frame Frame that was queued
+ */
+void telemetry_commit(Telemetry_Encoder *enc, const CAN_Bus_Frame *frame) {
+	uint8_t group = frame->data[1] >> 4;
+	uint8_t first = group * TELEMETRY_SLOTS_PER_FRAME;
+	uint8_t slots = (frame->dlc - 2) * 8 / 12;
+	uint64_t bits = 0;
+
+	for (uint8_t b = 0; b < 6; b++) {
+		bits |= (uint64_t) frame->data[2 + b] << (8 * b);
+	}
+
+	for (uint8_t k = 0; k < slots && first + k < DS1820_BANK_SLOTS; k++) {
+		enc->sent[first + k] = ((frame->data[1] >> k) & 0x01) ?
+				(int16_t) ((bits >> (12 * k)) & TELEMETRY_VALUE_MAX) :
+				TM_DS18B20_TEMP_INVALID;
+	}
+
+	enc->sent_groups |= 1 << group;
+	enc->seq = frame->data[0] + 1;
+}
+
+/**
+ * Encodes the temperatures of the bank and queues the frames with can_bus_send(). Only the
+ * frames that got queued are committed, the others are sent again by the next call.
+ * @param enc Encoder state
+ * @param ctx Context of the bank
+ * @param delta If non-zero, only the groups that changed are sent
+ * @return Number of frames queued
+ */
+uint8_t telemetry_send(Telemetry_Encoder *enc, const DS1820_Bank_Context *ctx,
+		uint8_t delta) {
+	CAN_Bus_Frame frames[TELEMETRY_MAX_FRAMES];
+	uint8_t count = telemetry_encode(enc, ctx, delta, frames);
+	uint8_t queued = 0;
+
+	for (uint8_t i = 0; i < count; i++) {
+		if (can_bus_send(&frames[i])) {
+			telemetry_commit(enc, &frames[i]);
+			queued++;
+		}
+	}
+
+	return queued;
+}
+
+/**
+ * Decodes a telemetry frame. Only the slots of the frame's group are updated.
+ * @param data Payload of the frame
+ * @param dlc Number of payload bytes
+ * @param seq Destination for the sequence number (may be NULL)
+ * @param temperatures Temperatures of all slots, the group's slots are updated (1/16 degC or
+ * #TM_DS18B20_TEMP_INVALID)
+ * @param valid Validity of all slots (bit per slot), the group's bits are updated (may be NULL)
+ * @return
+ * - 0 if the frame is malformed
+ * - 1 if the frame was decoded
+ */
+int telemetry_decode(const uint8_t *data, uint8_t dlc, uint8_t *seq,
+		int16_t temperatures[DS1820_BANK_SLOTS], uint16_t *valid) {
+	uint8_t first, slots;
+	uint64_t bits = 0;
+
+	if (dlc < 2 || dlc > 8) {
+		return 0;
+	}
+
+	first = (data[1] >> 4) * TELEMETRY_SLOTS_PER_FRAME;
+	slots = (dlc - 2) * 8 / 12;
+
+	if (first + slots > DS1820_BANK_SLOTS) {
+		return 0;
+	}
+
+	for (uint8_t b = 0; b < dlc - 2; b++) {
+		bits |= (uint64_t) data[2 + b] << (8 * b);
+	}
+
+	for (uint8_t k = 0; k < slots; k++) {
+		uint8_t is_valid = (data[1] >> k) & 0x01;
+
+		temperatures[first + k] = is_valid ?
+				(int16_t) (((bits >> (12 * k)) & TELEMETRY_VALUE_MAX)
+						+ TELEMETRY_OFFSET) :
+				TM_DS18B20_TEMP_INVALID;
+
+		if (valid) {
+			*valid = (*valid & ~(1 << (first + k))) | (is_valid << (first + k));
+		}
+	}
+
+	if (seq) {
+		*seq = data[0];
+	}
+
+	return 1;
+}
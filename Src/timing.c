@@ -7,15 +7,41 @@
 
 #include "timing.h"
 
+/*
+ * The 32 bit cycle counter wraps every 2^32 cycles (~89s at 48MHz). timing_cycles() extends it to
+ * 64 bits by counting the wraps, so it has to be called at least once per wrap (the SysTick
+ * interrupt does that).
+ */
+static uint32_t cycles_last = 0;	// counter value at the last call of timing_cycles()
+static uint32_t cycles_high = 0;	// number of wraps
+
+static uint32_t cycles_per_us = HSI_VALUE / 1000000;
+
 /**
  * Initializes the timing module capable of waiting for periods down to 1us.
  * If periods bigger than 1ms are needed, please use HAL_Delay() and HAL_GetTick().
+ * The counter is only reset by the first call, so the timebase stays monotonic if several
+ * modules call this.
  */
 void timing_init(void) {
-	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;	// enable
+#if TIMING_DWT
+	if (!(DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk)) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;	// enable
 
-	DWT->CYCCNT = 0; // reset the counter
-	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; // enable the counter
+		DWT->CYCCNT = 0; // reset the counter
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk; // enable the counter
+	}
+#endif
+
+	timing_update_clock();
+}
+
+/**
+ * Updates the number of cycles per us. Has to be called whenever the core clock
+ * (SystemCoreClock) was changed.
+ */
+void timing_update_clock(void) {
+	cycles_per_us = SystemCoreClock / 1000000;
 }
 
 /**
@@ -24,11 +50,68 @@ void timing_init(void) {
  * @param period of time in us
  */
 void timing_delay_us(unsigned int us) {
-	unsigned int start, ticks;
+	uint32_t start = TIMING_CYCCNT;
+	uint32_t ticks;
+
+	// long delays are split up, so the number of cycles always fits into 32 bits
+	while (us > 1000000) {
+		ticks = 1000000 * cycles_per_us;
+		while ((uint32_t) (TIMING_CYCCNT - start) < ticks);
+		start += ticks;
+		us -= 1000000;
+	}
+
+	// the unsigned difference stays correct across a wrap of the counter
+	ticks = us * cycles_per_us;
+	while ((uint32_t) (TIMING_CYCCNT - start) < ticks);
+}
+
+/**
+ * Returns the number of cycles since timing_init(), extended to 64 bits.
+ * May be called from interrupts.
+ * @return Monotonic cycle count
+ */
+uint64_t timing_cycles(void) {
+	uint32_t primask = __get_PRIMASK();
+	uint32_t now;
+	uint64_t cycles;
 
-	// TODO when does the CYCCNT overflow? is there an overflow flag to deal with it?
-	start = DWT->CYCCNT;
-	ticks = us * (SystemCoreClock/1000000);
+	__disable_irq();
 
-	while ((DWT->CYCCNT - start) < ticks);
+	now = TIMING_CYCCNT;
+	if (now < cycles_last) {
+		cycles_high++;
+	}
+	cycles_last = now;
+	cycles = ((uint64_t) cycles_high << 32) | now;
+
+	__set_PRIMASK(primask);
+
+	return cycles;
+}
+
+/**
+ * @return Microseconds since timing_init()
+ */
+uint64_t timing_now_us(void) {
+	return timing_cycles() / cycles_per_us;
+}
+
+/**
+ * Calculates a deadline for timing_deadline_reached().
+ * @param us Time from now in us
+ * @return Cycle count (see timing_cycles()) of the deadline
+ */
+uint64_t timing_deadline_us(uint32_t us) {
+	return timing_cycles() + (uint64_t) us * cycles_per_us;
+}
+
+/**
+ * @param deadline Deadline returned by timing_deadline_us()
+ * @return
+ * - 0 if the deadline is still ahead
+ * - 1 if it has been reached
+ */
+int timing_deadline_reached(uint64_t deadline) {
+	return timing_cycles() >= deadline;
 }
@@ -68,11 +68,48 @@ void TM_DS18B20_StartAll(TM_OneWire_t* OneWire) {
 	TM_OneWire_WriteByte(OneWire, DS18B20_CMD_CONVERTTEMP);
 }
 
+/* Checks the CRC and the content of a scratchpad read from a DS18S20 or DS18B20,
+ * data0/data1 are the power-on values of the temperature register of the family */
+static uint8_t TM_DS18x20_CheckScratchpad(uint8_t *data, uint8_t data0, uint8_t data1) {
+	/* Check if CRC is ok */
+	if (TM_OneWire_CRC8(data, 8) != data[8]) {
+		/* CRC invalid */
+		return TM_DS18B20_ERR_CRC_INVALID;
+	}
+
+	if (memcmp(data, empty, 9) == 0) {
+		/* CRC is technically ok, but there obviously is a transmission problem */
+		return TM_DS18B20_ERR_CRC_INVALID;
+	}
+
+	if (data[0] == data0 && data[1] == data1) {
+		/* there was no conversion requested yet, hence the temperature register is at its default value */
+		return TM_DS18B20_ERR_NO_CONVERSION_YET;
+	}
+
+	return TM_DS18B20_SUCCESS;
+}
+
+uint8_t TM_DS18S20_Decode(uint8_t *data, int16_t *temperature) {
+	uint8_t status;
+
+	status = TM_DS18x20_CheckScratchpad(data, TM_DS18S20_DATA0_DEFAULT, TM_DS18S20_DATA1_DEFAULT);
+	if (status != TM_DS18B20_SUCCESS) {
+		return status;
+	}
+
+	/* First two bytes of scratchpad are temperature values (two's complement, 0.5C per LSB) */
+	/* Scale to 1/16C by multiplying, the right shift is implementation-defined for signed variables */
+	*temperature = (int16_t) (data[0] | (data[1] << 8)) * 8;
+
+	/* Return 1, temperature valid */
+	return TM_DS18B20_SUCCESS;
+}
+
 //TODO acknowledges a incomplete coversion as SUCCESS (T=19.5C) if ROM is asked in between conversion start and temperature reading
-uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, float *temperature) {
-	uint8_t i = 0;
+uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, int16_t *temperature) {
 	uint8_t data[9];
-	uint8_t crc;
+	uint8_t status;
 
 	/* Check if device is DS18S20 */
 	if (!TM_DS18S20_Is(ROM)) {
@@ -93,36 +130,14 @@ uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, float *temperature)
 	TM_OneWire_WriteByte(OneWire, ONEWIRE_CMD_RSCRATCHPAD);
 
 	/* Get data */
-	for (i = 0; i < 9; i++) {
-		/* Read byte by byte */
-		data[i] = TM_OneWire_ReadByte(OneWire);
-	}
-
-	/* Calculate CRC */
-	crc = TM_OneWire_CRC8(data, 8);
-
-	/* Check if CRC is ok */
-	if (crc != data[8]) {
-		/* CRC invalid */
-		return TM_DS18B20_ERR_CRC_INVALID;
-	}
-
-	if (memcmp(data, empty, 9) == 0) {
-		/* CRC is technically ok, but there obviously is a transmission problem */
-		return TM_DS18B20_ERR_CRC_INVALID;
-	}
+	TM_OneWire_ReadBytes(OneWire, data, 9);
 
-	if (data[0] == TM_DS18B20_DATA0_DEFAULT && data[1] == TM_DS18B20_DATA1_DEFAULT) {
-		/* there was no conversion requested yet, hence the temperature register is at its default value */
-		return TM_DS18B20_ERR_NO_CONVERSION_YET;
+	/* Decode scratchpad */
+	status = TM_DS18S20_Decode(data, temperature);
+	if (status != TM_DS18B20_SUCCESS) {
+		return status;
 	}
 
-	/* First two bytes of scratchpad are temperature values */
-	/* if the temp is negative, we have to manually decode the two's complenent */
-	/* (since the right shift operation is implementation-defined for signed variables) */
-	*temperature = -0x80 * (data[1] & 0x01) + (data[0] >> 1)
-			+ 0.5 * (data[0] & 0x1);
-
 	/* Reset line */
 	TM_OneWire_Reset(OneWire);
 
@@ -130,14 +145,9 @@ uint8_t TM_DS18S20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, float *temperature)
 	return TM_DS18B20_SUCCESS;
 }
 
-uint8_t TM_DS18B20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, float *destination) {
-	uint16_t temperature;
-	uint8_t resolution;
-	int8_t digit, minus = 0;
-	float decimal;
-	uint8_t i = 0;
+uint8_t TM_DS18B20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, int16_t *destination) {
 	uint8_t data[9];
-	uint8_t crc;
+	uint8_t status;
 
 	/* Check if device is DS18B20 */
 	if (!TM_DS18B20_Is(ROM)) {
@@ -158,86 +168,42 @@ uint8_t TM_DS18B20_Read(TM_OneWire_t* OneWire, uint8_t *ROM, float *destination)
 	TM_OneWire_WriteByte(OneWire, ONEWIRE_CMD_RSCRATCHPAD);
 
 	/* Get data */
-	for (i = 0; i < 9; i++) {
-		/* Read byte by byte */
-		data[i] = TM_OneWire_ReadByte(OneWire);
+	TM_OneWire_ReadBytes(OneWire, data, 9);
+
+	/* Decode scratchpad */
+	status = TM_DS18B20_Decode(data, destination);
+	if (status != TM_DS18B20_SUCCESS) {
+		return status;
 	}
 
-	/* Calculate CRC */
-	crc = TM_OneWire_CRC8(data, 8);
+	/* Reset line */
+	TM_OneWire_Reset(OneWire);
 
-	/* Check if CRC is ok */
-	if (crc != data[8]) {
-		/* CRC invalid */
-		return TM_DS18B20_ERR_CRC_INVALID;
-	}
+	/* Return 1, temperature valid */
+	return TM_DS18B20_SUCCESS;
+}
 
-	if (memcmp(data, empty, 9) == 0) {
-		/* CRC is technically ok, but there obviously is a transmission problem */
-		return TM_DS18B20_ERR_CRC_INVALID;
-	}
+uint8_t TM_DS18B20_Decode(uint8_t *data, int16_t *destination) {
+	uint16_t temperature;
+	uint8_t resolution;
+	uint8_t status;
 
-	if (data[0] == TM_DS18B20_DATA0_DEFAULT && data[1] == TM_DS18B20_DATA1_DEFAULT) {
-		/* there was no conversion requested yet, hence the temperature register is at its default value */
-		return TM_DS18B20_ERR_NO_CONVERSION_YET;
+	status = TM_DS18x20_CheckScratchpad(data, TM_DS18B20_DATA0_DEFAULT, TM_DS18B20_DATA1_DEFAULT);
+	if (status != TM_DS18B20_SUCCESS) {
+		return status;
 	}
 
-	/* First two bytes of scratchpad are temperature values */
+	/* First two bytes of scratchpad are temperature values (two's complement, 1/16C per LSB) */
 	temperature = data[0] | (data[1] << 8);
 
-	/* Reset line */
-	TM_OneWire_Reset(OneWire);
-
-	/* Check if temperature is negative */
-	if (temperature & 0x8000) {
-		/* Two's complement, temperature is negative */
-		temperature = ~temperature + 1;
-		minus = 1;
-	}
-
 	/* Get sensor resolution */
 	resolution = ((data[4] & 0x60) >> 5) + 9;
 
-	/* Store temperature integer digits and decimal digits */
-	digit = temperature >> 4;
-	digit |= ((temperature >> 8) & 0x7) << 4;
-
-	/* Store decimal digits */
-	switch (resolution) {
-	case 9: {
-		decimal = (temperature >> 3) & 0x01;
-		decimal *= (float) DS18B20_DECIMAL_STEPS_9BIT;
-	}
-		break;
-	case 10: {
-		decimal = (temperature >> 2) & 0x03;
-		decimal *= (float) DS18B20_DECIMAL_STEPS_10BIT;
-	}
-		break;
-	case 11: {
-		decimal = (temperature >> 1) & 0x07;
-		decimal *= (float) DS18B20_DECIMAL_STEPS_11BIT;
-	}
-		break;
-	case 12: {
-		decimal = temperature & 0x0F;
-		decimal *= (float) DS18B20_DECIMAL_STEPS_12BIT;
-	}
-		break;
-	default: {
-		decimal = 0xFF;
-		digit = 0;
-	}
-	}
-
-	/* Check for negative part */
-	decimal = digit + decimal;
-	if (minus) {
-		decimal = 0 - decimal;
-	}
+	/* The lowest 12 - resolution bits are undefined */
+	temperature &= ~((1 << (12 - resolution)) - 1);
 
 	/* Set to pointer */
-	*destination = decimal;
+	*destination = (int16_t) temperature;
 
 	/* Return 1, temperature valid */
 	return TM_DS18B20_SUCCESS;
@@ -498,7 +464,6 @@ uint8_t TM_DS18B20_AlarmSearch(TM_OneWire_t* OneWire) {
 
 uint8_t TM_DS18B20_AllDone(TM_OneWire_t* OneWire) {
 	/* If read bit is low, then device is not finished yet with calculation temperature */
-	ONEWIRE_INPUT(OneWire);
 	return TM_OneWire_ReadBit(OneWire);
 }
 
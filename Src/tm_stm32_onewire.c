@@ -24,6 +24,7 @@
  * |----------------------------------------------------------------------
  */
 #include "tm_stm32_onewire.h"
+#include "onewire_uart.h"
 
 void TM_GPIO_SetPinAsInput(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin) {
 	uint8_t i;
@@ -58,8 +59,14 @@ void TM_OneWire_Init(TM_OneWire_t* OneWireStruct, GPIO_TypeDef* GPIOx,
 
 	/* Init GPIO pin */
 	GPIO_InitTypeDef GPIO_InitStruct;
-	GPIO_InitStruct.Pin = 1 << GPIO_Pin;
+	GPIO_InitStruct.Pin = GPIO_Pin;
+#if ONEWIRE_OPEN_DRAIN
+	/* Release the line before the pin becomes an output */
+	GPIOx->BSRR = GPIO_Pin;
+	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+#else
 	GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_PP;
+#endif
 	GPIO_InitStruct.Pull = GPIO_PULLUP;
 	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_MEDIUM;
 	HAL_GPIO_Init(GPIOx, &GPIO_InitStruct);
@@ -67,11 +74,43 @@ void TM_OneWire_Init(TM_OneWire_t* OneWireStruct, GPIO_TypeDef* GPIOx,
 	/* Save settings */
 	OneWireStruct->GPIOx = GPIOx;
 	OneWireStruct->GPIO_Pin = GPIO_Pin;
+	OneWireStruct->USARTx = NULL;
+	OneWireStruct->MODER_Output = TM_OneWire_ModerOutput(GPIO_Pin);
+}
+
+uint32_t TM_OneWire_ModerOutput(uint16_t GPIO_Pin) {
+	uint32_t x = GPIO_Pin;
+
+	/* Spread the 16 pin bits to the 2-bit fields of MODER */
+	x = (x | (x << 8)) & 0x00FF00FF;
+	x = (x | (x << 4)) & 0x0F0F0F0F;
+	x = (x | (x << 2)) & 0x33333333;
+	x = (x | (x << 1)) & 0x55555555;
+
+	return x;
+}
+
+void TM_OneWire_InitUSART(TM_OneWire_t* OneWireStruct, USART_TypeDef* USARTx) {
+	/* Initialize delay for the transfer timeout if it was not already */
+	timing_init();
+
+	/* Init USART and DMA */
+	onewire_uart_init(USARTx);
+
+	/* Save settings */
+	OneWireStruct->GPIOx = NULL;
+	OneWireStruct->GPIO_Pin = 0;
+	OneWireStruct->USARTx = USARTx;
+	OneWireStruct->MODER_Output = 0;
 }
 
 uint8_t TM_OneWire_Reset(TM_OneWire_t* OneWireStruct) {
 	uint8_t i;
 
+	if (OneWireStruct->USARTx) {
+		return onewire_uart_reset(OneWireStruct->USARTx);
+	}
+
 	/* Line low, and wait 480us */
 	ONEWIRE_LOW(OneWireStruct);
 	ONEWIRE_OUTPUT(OneWireStruct);
@@ -92,7 +131,9 @@ uint8_t TM_OneWire_Reset(TM_OneWire_t* OneWireStruct) {
 }
 
 void TM_OneWire_WriteBit(TM_OneWire_t* OneWireStruct, uint8_t bit) {
-	if (bit) {
+	if (OneWireStruct->USARTx) {
+		onewire_uart_bit(OneWireStruct->USARTx, bit);
+	} else if (bit) {
 		/* Set line low */
 		ONEWIRE_LOW(OneWireStruct);
 		ONEWIRE_OUTPUT(OneWireStruct);
@@ -122,6 +163,10 @@ void TM_OneWire_WriteBit(TM_OneWire_t* OneWireStruct, uint8_t bit) {
 uint8_t TM_OneWire_ReadBit(TM_OneWire_t* OneWireStruct) {
 	uint8_t bit = 0;
 
+	if (OneWireStruct->USARTx) {
+		return onewire_uart_bit(OneWireStruct->USARTx, 1);
+	}
+
 	/* Line low */
 	ONEWIRE_LOW(OneWireStruct);
 	ONEWIRE_OUTPUT(OneWireStruct);
@@ -146,6 +191,13 @@ uint8_t TM_OneWire_ReadBit(TM_OneWire_t* OneWireStruct) {
 
 void TM_OneWire_WriteByte(TM_OneWire_t* OneWireStruct, uint8_t byte) {
 	uint8_t i = 8;
+
+	if (OneWireStruct->USARTx) {
+		/* All 8 bit slots in one DMA transfer */
+		onewire_uart_write_bytes(OneWireStruct->USARTx, &byte, 1);
+		return;
+	}
+
 	/* Write 8 bits */
 	while (i--) {
 		/* LSB bit is first */
@@ -156,6 +208,13 @@ void TM_OneWire_WriteByte(TM_OneWire_t* OneWireStruct, uint8_t byte) {
 
 uint8_t TM_OneWire_ReadByte(TM_OneWire_t* OneWireStruct) {
 	uint8_t i = 8, byte = 0;
+
+	if (OneWireStruct->USARTx) {
+		/* All 8 bit slots in one DMA transfer */
+		onewire_uart_read_bytes(OneWireStruct->USARTx, &byte, 1);
+		return byte;
+	}
+
 	while (i--) {
 		byte >>= 1;
 		byte |= (TM_OneWire_ReadBit(OneWireStruct) << 7);
@@ -164,6 +223,18 @@ uint8_t TM_OneWire_ReadByte(TM_OneWire_t* OneWireStruct) {
 	return byte;
 }
 
+void TM_OneWire_ReadBytes(TM_OneWire_t* OneWireStruct, uint8_t* bytes, uint8_t len) {
+	if (OneWireStruct->USARTx) {
+		/* Up to ONEWIRE_UART_MAX_BYTES bytes in one DMA transfer */
+		onewire_uart_read_bytes(OneWireStruct->USARTx, bytes, len);
+		return;
+	}
+
+	while (len--) {
+		*bytes++ = TM_OneWire_ReadByte(OneWireStruct);
+	}
+}
+
 uint8_t TM_OneWire_First(TM_OneWire_t* OneWireStruct) {
 	/* Reset search values */
 	TM_OneWire_ResetSearch(OneWireStruct);
@@ -390,8 +461,50 @@ void TM_OneWire_GetFullROM(TM_OneWire_t* OneWireStruct, uint8_t *firstIndex) {
 	}
 }
 
+#if ONEWIRE_CRC8 == ONEWIRE_CRC8_TABLE
+/* CRC of every byte value (Dallas polynomial x^8 + x^5 + x^4 + 1, reflected: 0x8C) */
+static const uint8_t TM_OneWire_CRC8_Table[256] = {
+	0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41,
+	0x9D, 0xC3, 0x21, 0x7F, 0xFC, 0xA2, 0x40, 0x1E, 0x5F, 0x01, 0xE3, 0xBD, 0x3E, 0x60, 0x82, 0xDC,
+	0x23, 0x7D, 0x9F, 0xC1, 0x42, 0x1C, 0xFE, 0xA0, 0xE1, 0xBF, 0x5D, 0x03, 0x80, 0xDE, 0x3C, 0x62,
+	0xBE, 0xE0, 0x02, 0x5C, 0xDF, 0x81, 0x63, 0x3D, 0x7C, 0x22, 0xC0, 0x9E, 0x1D, 0x43, 0xA1, 0xFF,
+	0x46, 0x18, 0xFA, 0xA4, 0x27, 0x79, 0x9B, 0xC5, 0x84, 0xDA, 0x38, 0x66, 0xE5, 0xBB, 0x59, 0x07,
+	0xDB, 0x85, 0x67, 0x39, 0xBA, 0xE4, 0x06, 0x58, 0x19, 0x47, 0xA5, 0xFB, 0x78, 0x26, 0xC4, 0x9A,
+	0x65, 0x3B, 0xD9, 0x87, 0x04, 0x5A, 0xB8, 0xE6, 0xA7, 0xF9, 0x1B, 0x45, 0xC6, 0x98, 0x7A, 0x24,
+	0xF8, 0xA6, 0x44, 0x1A, 0x99, 0xC7, 0x25, 0x7B, 0x3A, 0x64, 0x86, 0xD8, 0x5B, 0x05, 0xE7, 0xB9,
+	0x8C, 0xD2, 0x30, 0x6E, 0xED, 0xB3, 0x51, 0x0F, 0x4E, 0x10, 0xF2, 0xAC, 0x2F, 0x71, 0x93, 0xCD,
+	0x11, 0x4F, 0xAD, 0xF3, 0x70, 0x2E, 0xCC, 0x92, 0xD3, 0x8D, 0x6F, 0x31, 0xB2, 0xEC, 0x0E, 0x50,
+	0xAF, 0xF1, 0x13, 0x4D, 0xCE, 0x90, 0x72, 0x2C, 0x6D, 0x33, 0xD1, 0x8F, 0x0C, 0x52, 0xB0, 0xEE,
+	0x32, 0x6C, 0x8E, 0xD0, 0x53, 0x0D, 0xEF, 0xB1, 0xF0, 0xAE, 0x4C, 0x12, 0x91, 0xCF, 0x2D, 0x73,
+	0xCA, 0x94, 0x76, 0x28, 0xAB, 0xF5, 0x17, 0x49, 0x08, 0x56, 0xB4, 0xEA, 0x69, 0x37, 0xD5, 0x8B,
+	0x57, 0x09, 0xEB, 0xB5, 0x36, 0x68, 0x8A, 0xD4, 0x95, 0xCB, 0x29, 0x77, 0xF4, 0xAA, 0x48, 0x16,
+	0xE9, 0xB7, 0x55, 0x0B, 0x88, 0xD6, 0x34, 0x6A, 0x2B, 0x75, 0x97, 0xC9, 0x4A, 0x14, 0xF6, 0xA8,
+	0x74, 0x2A, 0xC8, 0x96, 0x15, 0x4B, 0xA9, 0xF7, 0xB6, 0xE8, 0x0A, 0x54, 0xD7, 0x89, 0x6B, 0x35
+};
+#elif ONEWIRE_CRC8 == ONEWIRE_CRC8_NIBBLE
+/* CRC of the low and high nibble values, the CRC of a byte is the XOR of both */
+static const uint8_t TM_OneWire_CRC8_Low[16] = {
+	0x00, 0x5E, 0xBC, 0xE2, 0x61, 0x3F, 0xDD, 0x83, 0xC2, 0x9C, 0x7E, 0x20, 0xA3, 0xFD, 0x1F, 0x41
+};
+static const uint8_t TM_OneWire_CRC8_High[16] = {
+	0x00, 0x9D, 0x23, 0xBE, 0x46, 0xDB, 0x65, 0xF8, 0x8C, 0x11, 0xAF, 0x32, 0xCA, 0x57, 0xE9, 0x74
+};
+#endif
+
 uint8_t TM_OneWire_CRC8(uint8_t *addr, uint8_t len) {
-	uint8_t crc = 0, inbyte, i, mix;
+	uint8_t crc = 0;
+
+#if ONEWIRE_CRC8 == ONEWIRE_CRC8_TABLE
+	while (len--) {
+		crc = TM_OneWire_CRC8_Table[crc ^ *addr++];
+	}
+#elif ONEWIRE_CRC8 == ONEWIRE_CRC8_NIBBLE
+	while (len--) {
+		crc ^= *addr++;
+		crc = TM_OneWire_CRC8_Low[crc & 0x0F] ^ TM_OneWire_CRC8_High[crc >> 4];
+	}
+#else
+	uint8_t inbyte, i, mix;
 
 	while (len--) {
 		inbyte = *addr++;
@@ -404,6 +517,7 @@ uint8_t TM_OneWire_CRC8(uint8_t *addr, uint8_t len) {
 			inbyte >>= 1;
 		}
 	}
+#endif
 
 	/* Return calculated CRC */
 	return crc;
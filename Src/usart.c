@@ -133,6 +133,27 @@ void HAL_USART_MspDeInit(USART_HandleTypeDef* usartHandle)
 
 /* USER CODE BEGIN 1 */
 
+/* USART2 as onewire bus (see onewire_uart.c), the USART itself is configured by onewire_uart_init() */
+void MX_USART2_OneWire_Init(void)
+{
+
+  GPIO_InitTypeDef GPIO_InitStruct;
+
+  __HAL_RCC_USART2_CLK_ENABLE();
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /**USART2 GPIO Configuration    
+  PA2     ------> USART2_TX (half-duplex, onewire data line)
+  */
+  GPIO_InitStruct.Pin = GPIO_PIN_2;
+  GPIO_InitStruct.Mode = GPIO_MODE_AF_OD;
+  GPIO_InitStruct.Pull = GPIO_PULLUP;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_HIGH;
+  GPIO_InitStruct.Alternate = GPIO_AF7_USART2;
+  HAL_GPIO_Init(GPIOA, &GPIO_InitStruct);
+
+}
+
 /* USER CODE END 1 */
 
 /**
@@ -0,0 +1,124 @@
+/**
+ ******************************************************************************
+ * @file    bench_lcd_format.c
+ * @brief  LCD_FORMAT() of LCD_printf() against the former vsprintf path
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Both write the same rows into the framebuffer: the integer formatter of HD44780.c through
+ * LCD_FB_printf(), and vsprintf into a buffer followed by a character loop like LCD_printf()
+ * before (the temperatures as float with "%.1f"). The rows have to match on the display, then
+ * the host time per row is printed. "make bench" reports the code size of both next to it.
+ *
+ * The host times only show the relation, the target runs the code from flash at 48MHz and
+ * newlib's vsprintf with its float support.
+ *
+ ******************************************************************************
+ */
+
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "HD44780.h"
+#include "lcd_sim.h"
+#include "tm_stm32_ds18b20.h"
+
+#define RUNS		1000000
+
+/**
+ * LCD_printf() before LCD_FORMAT(), writing into the framebuffer.
+ */
+static void vsprintf_printf(const char *fmt, ...) {
+	static char text_buffer[32];
+	int text_size;
+	va_list args;
+
+	va_start(args, fmt);
+	text_size = vsprintf(text_buffer, fmt, args);
+	va_end(args);
+
+	for (int i = 0; i < text_size; i++) {
+		if (text_buffer[i] == '\n') {
+			LCD_FB_LOCATE(1, 0);
+		} else if ((text_buffer[i] > 0x1F) && (text_buffer[i] < 0x80)) {
+			LCD_FB_printchar(text_buffer[i]);
+		}
+	}
+}
+
+/**
+ * The row of a sensor: number, temperature, error count.
+ */
+static void lcd_row(uint32_t slot, int16_t temperature) {
+	LCD_FB_LOCATE(0, 0);
+	LCD_FB_printf("%2u:%6.1T %3d%%", slot, temperature, -7);
+}
+
+static void vsprintf_row(uint32_t slot, int16_t temperature) {
+	LCD_FB_LOCATE(0, 0);
+	vsprintf_printf("%2u:%6.1f %3d%%", slot, TM_DS18B20_TEMP_TO_FLOAT(temperature),
+			-7);
+}
+
+/**
+ * @return Row 0 of the display after the framebuffer was sent
+ */
+static void shown(char row[LCD_COLS + 1]) {
+	LCD_FB_FLUSH();
+	CHECK(lcd_sim_wait(1000));
+	for (int i = 0; i < LCD_COLS; i++) {
+		row[i] = lcd_sim_char(0, i);
+	}
+	row[LCD_COLS] = '\0';
+}
+
+static double ns_since(const struct timespec *start) {
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+int main(void) {
+	static const int16_t temperatures[] = { 345, -1, -88, 0, 85 * 16, -55 * 16, 401 };
+	const int count = sizeof(temperatures) / sizeof(temperatures[0]);
+	struct timespec start;
+	double lcd_ns, vsprintf_ns;
+	char lcd[LCD_COLS + 1], libc[LCD_COLS + 1];
+
+	lcd_sim_init();
+	LCD_INIT();
+	CHECK(lcd_sim_wait(1000));
+
+	// the same rows
+	for (int i = 0; i < count; i++) {
+		LCD_FB_CLEAR();
+		lcd_row(i, temperatures[i]);
+		shown(lcd);
+		LCD_FB_CLEAR();
+		vsprintf_row(i, temperatures[i]);
+		shown(libc);
+		CHECK(strcmp(lcd, libc) == 0);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < RUNS; i++) {
+		lcd_row(i & 0x0F, temperatures[i % count]);
+	}
+	lcd_ns = ns_since(&start) / RUNS;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < RUNS; i++) {
+		vsprintf_row(i & 0x0F, temperatures[i % count]);
+	}
+	vsprintf_ns = ns_since(&start) / RUNS;
+
+	printf("row \"%s\": LCD_FORMAT %.1f ns, vsprintf %.1f ns (host)\n", lcd, lcd_ns,
+			vsprintf_ns);
+	CHECK(lcd_ns < vsprintf_ns);
+
+	lcd_sim_stop();
+
+	return host_report("lcd_format");
+}
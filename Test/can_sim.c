@@ -0,0 +1,471 @@
+/**
+ ******************************************************************************
+ * @file    can_sim.c
+ * @brief  Simulated bxCAN (mailboxes, receive FIFOs, filters) in host_can
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The test build points CAN at can_sim_regs() (see Makefile), so every register access of the
+ * modules first applies the writes of the previous access, like lcd_sim_port() does for the
+ * display. The registers with hardware semantics are compared with the value the simulation left
+ * in them, a different value is a write:
+ * - TSR: RQCPx written 1 clears RQCP, TXOK, ALST and TERR of mailbox x
+ * - TIR of a mailbox: TXRQ requests the transmission, TME and CODE follow the requests
+ * - RF0R/RF1R: RFOM releases the oldest frame, FULL and FOVR written 1 are cleared. The output
+ *   mailbox (sFIFOMailBox) always holds the oldest frame.
+ * - MSR: ERRI written 1 is cleared. RX (the recessive bus) stays set, so a write of ERRI never
+ *   looks like the value left in the register (unless the bus is stuck dominant).
+ * - INAK follows INRQ right away, unless the bus is stuck dominant (#CAN_Sim.dominant): then
+ *   INAK keeps its state and RX is cleared
+ *
+ * can_bus_rx_irq_handler() keeps a pointer to RFxR, its loop only sees the release of a frame
+ * with the next call. The simulation raises the interrupt again as long as a FIFO has frames,
+ * like the NVIC does with the pending FMP interrupt.
+ *
+ * The bus is idle unless the test moves frames: can_sim_transmit() sends the request with the
+ * highest priority (in chronological order with TXFP, which MX_CAN_Init() sets), lets the bus
+ * time of the frame pass and raises the transmit interrupt. can_sim_receive() puts a frame from
+ * another node through the filter banks into a FIFO. With LBKM (loop back mode) the sent frames
+ * are received, too. The interrupts are delivered at once unless PRIMASK is set, then
+ * can_sim_interrupts() delivers them later.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "can_sim.h"
+#include "can_stats.h"
+
+#define CAN_SIM_FIFO_DEPTH	3
+#define CAN_SIM_BANKS		14
+
+CAN_Sim can_sim;
+
+/* values the simulation left in the registers */
+static uint32_t tsr_last;
+static uint32_t rfr_last[2];
+static uint32_t msr_last;
+
+static uint8_t pending[3];			// transmission requested
+static uint32_t requested[3];		// order of the requests (TXFP)
+static uint32_t requests;
+
+static CAN_FIFOMailBox_TypeDef fifo[2][CAN_SIM_FIFO_DEPTH];
+static uint8_t fifo_count[2];
+static uint8_t fifo_full[2];
+static uint8_t fifo_overrun[2];
+
+static uint8_t delivering = 0;
+
+/**
+ * Sets TME, CODE, FMP, FULL, FOVR and the output mailboxes from the state of the simulation.
+ */
+static void can_sim_publish(void) {
+	uint32_t tsr = tsr_last & ~(CAN_TSR_TME | CAN_TSR_CODE);
+	int code = -1;
+
+	for (int m = 0; m < 3; m++) {
+		if (!pending[m]) {
+			tsr |= CAN_TSR_TME0 << m;
+			if (code < 0) {
+				code = m;
+			}
+		}
+	}
+	host_can.TSR = tsr_last = tsr | ((uint32_t) (code < 0 ? 0 : code) << CAN_TSR_CODE_Pos);
+
+	for (int f = 0; f < 2; f++) {
+		volatile uint32_t *rfr = f ? &host_can.RF1R : &host_can.RF0R;
+
+		*rfr = rfr_last[f] = fifo_count[f]
+				| (fifo_full[f] ? CAN_RF0R_FULL0 : 0)
+				| (fifo_overrun[f] ? CAN_RF0R_FOVR0 : 0);
+		if (fifo_count[f]) {
+			host_can.sFIFOMailBox[f] = fifo[f][0];
+		}
+	}
+
+	if (can_sim.dominant) {
+		host_can.MSR = msr_last &= ~CAN_MSR_RX;
+	} else {
+		host_can.MSR = msr_last = (msr_last & ~CAN_MSR_INAK) | CAN_MSR_RX
+				| ((host_can.MCR & CAN_MCR_INRQ) ? CAN_MSR_INAK : 0);
+	}
+}
+
+/**
+ * Applies the writes since the last access.
+ */
+static void can_sim_sync(void) {
+	uint32_t written;
+
+	if (host_can.TSR != tsr_last) {
+		written = host_can.TSR;
+		for (int m = 0; m < 3; m++) {
+			if (written & (CAN_TSR_RQCP0 << (8 * m))) {
+				tsr_last &= ~((CAN_TSR_RQCP0 | CAN_TSR_TXOK0 | CAN_TSR_ALST0
+						| CAN_TSR_TERR0) << (8 * m));
+			}
+		}
+	}
+
+	for (int m = 0; m < 3; m++) {
+		if ((host_can.sTxMailBox[m].TIR & CAN_TI0R_TXRQ) && !pending[m]) {
+			pending[m] = 1;
+			requested[m] = requests++;
+		}
+	}
+
+	for (int f = 0; f < 2; f++) {
+		volatile uint32_t *rfr = f ? &host_can.RF1R : &host_can.RF0R;
+
+		if (*rfr == rfr_last[f]) {
+			continue;
+		}
+		written = *rfr;
+		if ((written & CAN_RF0R_RFOM0) && fifo_count[f]) {
+			memmove(&fifo[f][0], &fifo[f][1],
+					(CAN_SIM_FIFO_DEPTH - 1) * sizeof(fifo[f][0]));
+			fifo_count[f]--;
+		}
+		if (written & CAN_RF0R_FULL0) {
+			fifo_full[f] = 0;
+		}
+		if (written & CAN_RF0R_FOVR0) {
+			fifo_overrun[f] = 0;
+		}
+	}
+
+	if (host_can.MSR != msr_last && (host_can.MSR & CAN_MSR_ERRI)) {
+		msr_last &= ~CAN_MSR_ERRI;
+	}
+
+	can_sim_publish();
+}
+
+/**
+ * Resets the peripheral as MX_CAN_Init() leaves it: 500kbit/s at the 24MHz PCLK1, chronological
+ * transmit order, no loop back, no frames logged.
+ */
+void can_sim_init(void) {
+	memset(&can_sim, 0, sizeof(can_sim));
+	memset(&host_can, 0, sizeof(host_can));
+	memset(pending, 0, sizeof(pending));
+	memset(fifo_count, 0, sizeof(fifo_count));
+	memset(fifo_full, 0, sizeof(fifo_full));
+	memset(fifo_overrun, 0, sizeof(fifo_overrun));
+	tsr_last = 0;
+	msr_last = 0;
+	requests = 0;
+	delivering = 0;
+	can_sim.tx_status = CAN_TSR_TXOK0;
+
+	host_can.MCR = CAN_MCR_TXFP;
+	host_can.BTR = (1 << CAN_BTR_TS2_Pos) | (12 << CAN_BTR_TS1_Pos) | 2;
+	can_sim_publish();
+}
+
+/**
+ * CAN of the test build: applies the previous accesses first.
+ * @return Register block of the simulation
+ */
+CAN_TypeDef *can_sim_regs(void) {
+	can_sim_sync();
+
+	return &host_can;
+}
+
+/**
+ * Calls the interrupt handlers as long as an enabled interrupt is pending. Does nothing while
+ * PRIMASK is set or from within a handler.
+ */
+void can_sim_interrupts(void) {
+	int raised;
+
+	if (host_primask || delivering) {
+		return;
+	}
+	delivering = 1;
+
+	do {
+		uint32_t ier = host_can.IER;
+
+		raised = 0;
+		can_sim_sync();
+		if ((ier & CAN_IER_TMEIE) && (tsr_last
+				& (CAN_TSR_RQCP0 | CAN_TSR_RQCP1 | CAN_TSR_RQCP2))) {
+			can_bus_tx_irq_handler();
+			raised = 1;
+		}
+		for (int f = 0; f < 2; f++) {
+			uint32_t fmpie = f ? CAN_IER_FMPIE1 : CAN_IER_FMPIE0;
+			uint32_t fovie = f ? CAN_IER_FOVIE1 : CAN_IER_FOVIE0;
+
+			can_sim_sync();
+			if (((ier & fmpie) && fifo_count[f])
+					|| ((ier & fovie) && fifo_overrun[f])) {
+				can_bus_rx_irq_handler(f);
+				raised = 1;
+			}
+		}
+		can_sim_sync();
+		if ((ier & CAN_IER_ERRIE) && (msr_last & CAN_MSR_ERRI)) {
+			can_stats_sce_irq_handler();
+			raised = 1;
+		}
+	} while (raised);
+
+	can_sim_sync();
+	delivering = 0;
+}
+
+/**
+ * Runs a frame through the filter banks like the hardware: 32 bit filters before 16 bit
+ * filters, identifier lists before masks, then the lower bank. The filter numbers (FMI) count
+ * per FIFO through the active and inactive banks.
+ * @param id Identifier
+ * @param flags CAN_BUS_FLAG_* of the frame
+ * @param fifo Destination for the FIFO of the matching filter
+ * @param fmi Destination for the number of the matching filter
+ * @return
+ * - 0 if no filter accepts the frame
+ * - 1 if the frame is accepted
+ */
+int can_sim_match(uint32_t id, uint8_t flags, uint8_t *fifo, uint8_t *fmi) {
+	uint8_t first[CAN_SIM_BANKS];
+	uint8_t number[2] = { 0, 0 };
+	uint32_t v32;
+	uint16_t v16;
+
+	for (int b = 0; b < CAN_SIM_BANKS; b++) {
+		uint8_t f = (host_can.FFA1R >> b) & 1;
+
+		first[b] = number[f];
+		number[f] += (((host_can.FS1R >> b) & 1) ? 1 : 2)
+				* (((host_can.FM1R >> b) & 1) ? 2 : 1);
+	}
+
+	if (flags & CAN_BUS_FLAG_EXT) {
+		v32 = (id << 3) | CAN_TI0R_IDE;
+		v16 = (((id >> 18) & 0x7FF) << 5) | 0x08 | ((id >> 15) & 0x07);
+	} else {
+		v32 = id << 21;
+		v16 = id << 5;
+	}
+	if (flags & CAN_BUS_FLAG_RTR) {
+		v32 |= CAN_TI0R_RTR;
+		v16 |= 0x10;
+	}
+
+	// 0: 32 bit list, 1: 32 bit mask, 2: 16 bit list, 3: 16 bit mask
+	for (int pass = 0; pass < 4; pass++) {
+		for (int b = 0; b < CAN_SIM_BANKS; b++) {
+			uint32_t r1 = host_can.sFilterRegister[b].FR1;
+			uint32_t r2 = host_can.sFilterRegister[b].FR2;
+			int scale32 = (host_can.FS1R >> b) & 1;
+			int list = (host_can.FM1R >> b) & 1;
+			int k = -1;
+
+			if (!((host_can.FA1R >> b) & 1)
+					|| pass != (scale32 ? 0 : 2) + (list ? 0 : 1)) {
+				continue;
+			}
+
+			if (scale32 && list) {
+				k = v32 == r1 ? 0 : v32 == r2 ? 1 : -1;
+			} else if (scale32) {
+				k = ((v32 ^ r1) & r2) == 0 ? 0 : -1;
+			} else {
+				uint16_t half[4] = { r1, r1 >> 16, r2, r2 >> 16 };
+
+				for (int i = 0; i < (list ? 4 : 2) && k < 0; i++) {
+					if (list ? v16 == half[i]
+							: ((v16 ^ half[2 * i]) & half[2 * i + 1]) == 0) {
+						k = i;
+					}
+				}
+			}
+
+			if (k >= 0) {
+				*fifo = (host_can.FFA1R >> b) & 1;
+				*fmi = first[b] + k;
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Stores a frame that passed the filters. A full FIFO sets FOVR and loses a frame: the new one
+ * with RFLM (locked mode), the last one stored otherwise.
+ */
+static void can_sim_store(const CAN_Bus_Frame *frame) {
+	CAN_FIFOMailBox_TypeDef *mb;
+	uint8_t f, fmi;
+
+	if (!can_sim_match(frame->id, frame->flags, &f, &fmi)) {
+		can_sim.rejected++;
+		return;
+	}
+
+	if (fifo_count[f] == CAN_SIM_FIFO_DEPTH) {
+		can_sim.lost[f]++;
+		fifo_overrun[f] = 1;
+		if (host_can.MCR & CAN_MCR_RFLM) {
+			return;
+		}
+		fifo_count[f]--;
+	}
+
+	mb = &fifo[f][fifo_count[f]++];
+	if (frame->flags & CAN_BUS_FLAG_EXT) {
+		mb->RIR = (frame->id << CAN_RI0R_EXID_Pos) | CAN_RI0R_IDE;
+	} else {
+		mb->RIR = frame->id << CAN_RI0R_STID_Pos;
+	}
+	if (frame->flags & CAN_BUS_FLAG_RTR) {
+		mb->RIR |= CAN_RI0R_RTR;
+	}
+	mb->RDTR = (frame->dlc & CAN_RDT0R_DLC) | ((uint32_t) fmi << CAN_RDT0R_FMI_Pos);
+	mb->RDLR = frame->data[0] | (frame->data[1] << 8) | (frame->data[2] << 16)
+			| ((uint32_t) frame->data[3] << 24);
+	mb->RDHR = frame->data[4] | (frame->data[5] << 8) | (frame->data[6] << 16)
+			| ((uint32_t) frame->data[7] << 24);
+	fifo_full[f] = fifo_count[f] == CAN_SIM_FIFO_DEPTH;
+	can_sim.received++;
+}
+
+/**
+ * A frame of another node reaches the filters.
+ * @param frame Frame on the bus
+ */
+void can_sim_receive(const CAN_Bus_Frame *frame) {
+	can_sim_sync();
+	can_sim_store(frame);
+	can_sim_publish();
+	can_sim_interrupts();
+}
+
+/**
+ * Sends the requested frame with the highest priority: the frame is logged, its bus time passes
+ * and the mailbox reports #CAN_Sim.tx_status.
+ * @return
+ * - 0 if no transmission is requested
+ * - 1 if a frame was sent
+ */
+int can_sim_transmit(void) {
+	CAN_TxMailBox_TypeDef *mb;
+	CAN_Bus_Frame *frame;
+	uint32_t btr = host_can.BTR;
+	uint32_t bitrate;
+	int next = -1;
+
+	can_sim_sync();
+	for (int m = 0; m < 3; m++) {
+		if (!pending[m]) {
+			continue;
+		}
+		if (next < 0 || ((host_can.MCR & CAN_MCR_TXFP)
+				? requested[m] < requested[next]
+				: (host_can.sTxMailBox[m].TIR & ~0x07)
+						< (host_can.sTxMailBox[next].TIR & ~0x07))) {
+			next = m;
+		}
+	}
+	if (next < 0) {
+		return 0;
+	}
+
+	mb = &host_can.sTxMailBox[next];
+	frame = &can_sim.sent[can_sim.sent_count++ & (CAN_SIM_LOG_LENGTH - 1)];
+	memset(frame, 0, sizeof(*frame));
+	if (mb->TIR & CAN_TI0R_IDE) {
+		frame->id = mb->TIR >> CAN_TI0R_EXID_Pos;
+		frame->flags = CAN_BUS_FLAG_EXT;
+	} else {
+		frame->id = mb->TIR >> CAN_TI0R_STID_Pos;
+	}
+	if (mb->TIR & CAN_TI0R_RTR) {
+		frame->flags |= CAN_BUS_FLAG_RTR;
+	}
+	frame->dlc = mb->TDTR & CAN_TDT0R_DLC;
+	for (int i = 0; i < 4; i++) {
+		frame->data[i] = mb->TDLR >> (8 * i);
+		frame->data[4 + i] = mb->TDHR >> (8 * i);
+	}
+
+	bitrate = HAL_RCC_GetPCLK1Freq() / (((btr & CAN_BTR_BRP) + 1)
+			* (3 + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos)
+					+ ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos)));
+	host_advance(can_stats_frame_bits(frame->flags, frame->dlc)
+			* (SystemCoreClock / bitrate));
+
+	mb->TIR &= ~CAN_TI0R_TXRQ;
+	pending[next] = 0;
+	tsr_last |= (CAN_TSR_RQCP0 | can_sim.tx_status) << (8 * next);
+	if (host_can.BTR & CAN_BTR_LBKM) {
+		can_sim_store(frame);
+	}
+	can_sim_publish();
+
+	if (can_sim.tx_hook) {
+		can_sim.tx_hook(frame);
+	}
+	can_sim_interrupts();
+
+	return 1;
+}
+
+/**
+ * Sends until no transmission is requested any more (interrupts enabled, the transmit interrupt
+ * refills the mailboxes).
+ * @return Number of frames sent
+ */
+uint32_t can_sim_run(void) {
+	uint32_t sent = 0;
+
+	while (can_sim_transmit()) {
+		sent++;
+	}
+
+	return sent;
+}
+
+/**
+ * Sets the error counters (ESR) and the flags derived from them: error warning from 96, error
+ * passive from 128, bus-off above 255 (TEC shows 255 then). A flag getting set or an error code
+ * sets ERRI if its interrupt is enabled and raises the status change interrupt.
+ * @param tec Transmit error counter
+ * @param rec Receive error counter
+ * @param lec Error code of the last error detected (LEC, 0 for none)
+ */
+void can_sim_errors(uint16_t tec, uint8_t rec, uint8_t lec) {
+	uint32_t esr, raised;
+
+	can_sim_sync();
+	esr = ((uint32_t) lec << CAN_ESR_LEC_Pos) & CAN_ESR_LEC;
+	esr |= (uint32_t) (tec > 255 ? 255 : tec) << CAN_ESR_TEC_Pos;
+	esr |= (uint32_t) rec << CAN_ESR_REC_Pos;
+	if (tec >= 96 || rec >= 96) {
+		esr |= CAN_ESR_EWGF;
+	}
+	if (tec >= 128 || rec >= 128) {
+		esr |= CAN_ESR_EPVF;
+	}
+	if (tec > 255) {
+		esr |= CAN_ESR_BOFF;
+	}
+
+	raised = esr & ~host_can.ESR;
+	host_can.ESR = esr;
+	if (((raised & CAN_ESR_EWGF) && (host_can.IER & CAN_IER_EWGIE))
+			|| ((raised & CAN_ESR_EPVF) && (host_can.IER & CAN_IER_EPVIE))
+			|| ((raised & CAN_ESR_BOFF) && (host_can.IER & CAN_IER_BOFIE))
+			|| (lec && (host_can.IER & CAN_IER_LECIE))) {
+		msr_last |= CAN_MSR_ERRI;
+	}
+	can_sim_publish();
+	can_sim_interrupts();
+}
@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * @file    can_sim.h
+ * @brief  Simulated bxCAN (mailboxes, receive FIFOs, filters) in host_can
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef CAN_SIM_H_
+#define CAN_SIM_H_
+
+#include "stm32f3xx_hal.h"
+#include "can_bus.h"
+
+/** Number of transmitted frames kept in #CAN_Sim.sent (power of two) */
+#define CAN_SIM_LOG_LENGTH		256
+
+/**
+ * State of the simulation visible to the tests.
+ */
+typedef struct {
+	CAN_Bus_Frame sent[CAN_SIM_LOG_LENGTH];	// transmitted frames, the last one at sent_count - 1
+	uint32_t sent_count;
+	uint32_t received;						// frames stored in a FIFO
+	uint32_t rejected;						// frames no filter accepted
+	uint32_t lost[2];						// frames lost because the FIFO was full
+	uint32_t tx_status;						// TSR bits (mailbox 0 positions) of the next transmission
+	void (*tx_hook)(const CAN_Bus_Frame *frame);	// called for every transmitted frame
+	uint8_t dominant;						// bus stuck dominant: RX low, INAK ignores INRQ
+} CAN_Sim;
+
+extern CAN_Sim can_sim;
+
+void can_sim_init(void);
+CAN_TypeDef *can_sim_regs(void);
+int can_sim_transmit(void);
+uint32_t can_sim_run(void);
+void can_sim_receive(const CAN_Bus_Frame *frame);
+void can_sim_errors(uint16_t tec, uint8_t rec, uint8_t lec);
+void can_sim_interrupts(void);
+int can_sim_match(uint32_t id, uint8_t flags, uint8_t *fifo, uint8_t *fmi);
+
+/* every register access of the modules goes through the simulation */
+#undef CAN
+#define CAN					can_sim_regs()
+
+#endif /* CAN_SIM_H_ */
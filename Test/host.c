@@ -0,0 +1,169 @@
+/**
+ ******************************************************************************
+ * @file    host.c
+ * @brief  RAM peripherals, cycle counter and HAL stubs of the host tests
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * See host.h. Only the HAL functions called by the modules under test are provided, and only
+ * as far as the tests need them (e.g. HAL_GPIO_Init() just sets the mode and output type bits).
+ *
+ ******************************************************************************
+ */
+
+#include "stm32f3xx_hal.h"
+
+uint32_t host_primask = 0;
+
+uint32_t host_cycle_count = 0;
+uint64_t host_time = 0;
+uint32_t host_cycle_step = 48;	// 1us at 48MHz
+void (*host_tick_hook)(void) = NULL;
+
+GPIO_TypeDef host_gpio[6];
+RCC_TypeDef host_rcc;
+CAN_TypeDef host_can;
+TIM_TypeDef host_tim6, host_tim7;
+DMA_TypeDef host_dma1;
+DMA_Channel_TypeDef host_dma1_channel[7];
+USART_TypeDef host_usart[3];
+
+uint32_t SystemCoreClock = 48000000;
+
+int host_failures = 0;
+
+/**
+ * Lets the simulated time pass and calls #host_tick_hook.
+ * @param cycles Number of core cycles
+ */
+void host_advance(uint32_t cycles) {
+	host_cycle_count += cycles;
+	host_time += cycles;
+
+	if (host_tick_hook) {
+		host_tick_hook();
+	}
+}
+
+/**
+ * Lets the simulated time pass in steps of 1ms.
+ * @param ms Time in ms
+ */
+void host_advance_ms(uint32_t ms) {
+	while (ms--) {
+		host_advance(SystemCoreClock / 1000);
+	}
+}
+
+/**
+ * @return Simulated time in us
+ */
+uint64_t host_now_us(void) {
+	return host_time / (SystemCoreClock / 1000000);
+}
+
+/**
+ * Cycle counter read by TIMING_CYCCNT: advances by #host_cycle_step on every read.
+ */
+uint32_t host_cycles(void) {
+	host_advance(host_cycle_step);
+
+	return host_cycle_count;
+}
+
+/**
+ * Prints the result of a test program.
+ * @param name Name of the test
+ * @return Exit code of the test program (0 if all checks passed)
+ */
+int host_report(const char *name) {
+	if (host_failures) {
+		printf("%s: %d check(s) failed\n", name, host_failures);
+		return 1;
+	}
+
+	printf("%s: passed\n", name);
+	return 0;
+}
+
+uint32_t HAL_GetTick(void) {
+	return host_time / (SystemCoreClock / 1000);
+}
+
+void HAL_Delay(uint32_t Delay) {
+	host_advance_ms(Delay);
+}
+
+uint32_t HAL_RCC_GetHCLKFreq(void) {
+	return SystemCoreClock;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+	return SystemCoreClock / 2;
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void) {
+	return SystemCoreClock;
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority,
+		uint32_t SubPriority) {
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+}
+
+void HAL_NVIC_DisableIRQ(IRQn_Type IRQn) {
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init) {
+	for (int pin = 0; pin < 16; pin++) {
+		if (!(GPIO_Init->Pin & (1 << pin))) {
+			continue;
+		}
+
+		GPIOx->MODER = (GPIOx->MODER & ~(0x03 << (2 * pin)))
+				| ((GPIO_Init->Mode & 0x03) << (2 * pin));
+		GPIOx->OTYPER = (GPIOx->OTYPER & ~(1 << pin))
+				| (((GPIO_Init->Mode >> 4) & 0x01) << pin);
+	}
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin) {
+	for (int pin = 0; pin < 16; pin++) {
+		if (GPIO_Pin & (1 << pin)) {
+			GPIOx->MODER &= ~(0x03 << (2 * pin));
+		}
+	}
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin,
+		GPIO_PinState PinState) {
+	if (PinState) {
+		GPIOx->ODR |= GPIO_Pin;
+	} else {
+		GPIOx->ODR &= ~GPIO_Pin;
+	}
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	return (GPIOx->IDR & GPIO_Pin) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_TogglePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin) {
+	GPIOx->ODR ^= GPIO_Pin;
+}
+
+/**
+ * Leaves the registers as the HAL does: the options in MCR and the bit timing in BTR.
+ */
+HAL_StatusTypeDef HAL_CAN_Init(CAN_HandleTypeDef *hcan) {
+	hcan->Instance->MCR = (hcan->Init.TXFP == ENABLE ? CAN_MCR_TXFP : 0)
+			| (hcan->Init.RFLM == ENABLE ? CAN_MCR_RFLM : 0)
+			| (hcan->Init.NART == ENABLE ? CAN_MCR_NART : 0)
+			| (hcan->Init.ABOM == ENABLE ? CAN_MCR_ABOM : 0);
+	hcan->Instance->BTR = hcan->Init.Mode | hcan->Init.SJW | hcan->Init.BS1
+			| hcan->Init.BS2 | (hcan->Init.Prescaler - 1);
+
+	return HAL_OK;
+}
@@ -0,0 +1,148 @@
+/**
+ ******************************************************************************
+ * @file    host.h
+ * @brief  Host shim for building the modules with the system gcc
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Force-included into every translation unit of the host tests (see Makefile):
+ * - the Cortex-M intrinsics of cmsis_gcc.h are replaced by plain C (PRIMASK is a variable,
+ *   barriers are compiler barriers)
+ * - the cycle counter of the timing module is host_cycles(), which advances on every read and
+ *   calls #host_tick_hook, so busy waits make progress and simulations can follow the bus.
+ *   HAL_GetTick() is derived from the same simulated time.
+ * - the peripherals used by the modules are mapped to register blocks in RAM (host.c)
+ *
+ * The HAL functions the modules call are stubbed in host.c.
+ *
+ ******************************************************************************
+ */
+
+#ifndef HOST_H_
+#define HOST_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* keep the ARM inline assembly of cmsis_gcc.h out, the intrinsics follow below */
+#define __CMSIS_GCC_H
+
+extern uint32_t host_primask;
+
+static inline void __disable_irq(void) {
+	host_primask = 1;
+}
+
+static inline void __enable_irq(void) {
+	host_primask = 0;
+}
+
+static inline uint32_t __get_PRIMASK(void) {
+	return host_primask;
+}
+
+static inline void __set_PRIMASK(uint32_t primask) {
+	host_primask = primask;
+}
+
+static inline void __DMB(void) {
+	__asm__ volatile ("" ::: "memory");
+}
+
+static inline void __DSB(void) {
+	__asm__ volatile ("" ::: "memory");
+}
+
+static inline void __ISB(void) {
+	__asm__ volatile ("" ::: "memory");
+}
+
+static inline void __NOP(void) {
+}
+
+static inline uint32_t __get_IPSR(void) {
+	return 0;
+}
+
+/* cycle counter: advances by host_cycle_step on every read, HAL_GetTick() follows it */
+extern uint32_t host_cycle_count;
+extern uint64_t host_time;			// cycles since the start, never wraps
+extern uint32_t host_cycle_step;
+extern void (*host_tick_hook)(void);
+uint32_t host_cycles(void);
+void host_advance(uint32_t cycles);
+void host_advance_ms(uint32_t ms);
+uint64_t host_now_us(void);
+
+#define TIMING_CYCCNT		host_cycles()
+
+#include "stm32f3xx.h"
+
+/* peripherals in RAM */
+extern GPIO_TypeDef host_gpio[6];
+extern RCC_TypeDef host_rcc;
+extern CAN_TypeDef host_can;
+extern TIM_TypeDef host_tim6, host_tim7;
+extern DMA_TypeDef host_dma1;
+extern DMA_Channel_TypeDef host_dma1_channel[7];
+extern USART_TypeDef host_usart[3];
+
+#undef GPIOA
+#undef GPIOB
+#undef GPIOC
+#undef GPIOD
+#undef GPIOE
+#undef GPIOF
+#define GPIOA				(&host_gpio[0])
+#define GPIOB				(&host_gpio[1])
+#define GPIOC				(&host_gpio[2])
+#define GPIOD				(&host_gpio[3])
+#define GPIOE				(&host_gpio[4])
+#define GPIOF				(&host_gpio[5])
+
+#undef RCC
+#define RCC					(&host_rcc)
+#undef CAN
+#define CAN					(&host_can)
+#undef TIM6
+#define TIM6				(&host_tim6)
+#undef TIM7
+#define TIM7				(&host_tim7)
+
+#undef DMA1
+#undef DMA1_Channel1
+#undef DMA1_Channel2
+#undef DMA1_Channel3
+#undef DMA1_Channel4
+#undef DMA1_Channel5
+#undef DMA1_Channel6
+#undef DMA1_Channel7
+#define DMA1				(&host_dma1)
+#define DMA1_Channel1		(&host_dma1_channel[0])
+#define DMA1_Channel2		(&host_dma1_channel[1])
+#define DMA1_Channel3		(&host_dma1_channel[2])
+#define DMA1_Channel4		(&host_dma1_channel[3])
+#define DMA1_Channel5		(&host_dma1_channel[4])
+#define DMA1_Channel6		(&host_dma1_channel[5])
+#define DMA1_Channel7		(&host_dma1_channel[6])
+
+#undef USART1
+#undef USART2
+#undef USART3
+#define USART1				(&host_usart[0])
+#define USART2				(&host_usart[1])
+#define USART3				(&host_usart[2])
+
+/* checks used by the tests */
+extern int host_failures;
+
+#define CHECK(condition)	do { \
+		if (!(condition)) { \
+			printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			host_failures++; \
+		} \
+	} while (0)
+
+int host_report(const char *name);
+
+#endif /* HOST_H_ */
@@ -0,0 +1,265 @@
+/**
+ ******************************************************************************
+ * @file    lcd_sim.c
+ * @brief  Simulated HD44780 on the pins of HD44780.c and TIM6 as a host interrupt
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The test build points LCDPort and LCDControlPort at lcd_sim_port() (see Makefile), so every
+ * register access of the driver first applies the BSRR and BRR writes of the previous access to
+ * ODR. The simulation sees each pin change in the order the driver makes it:
+ * - a rising edge of E with R/W high puts the next nibble of the busy flag and address counter
+ *   on D4-D7 (IDR), a falling edge of E with R/W low latches the nibble on D4-D7
+ * - until the function set selects the 4 bit interface, every nibble is an instruction of its
+ *   own, afterwards two nibbles make up a byte
+ * - a byte written before the previous instruction is executed counts as a violation, a read
+ *   while the data pins are outputs or a write while they are inputs as a conflict
+ *
+ * TIM6 is emulated by SIGALRM, which interrupts the test like the update interrupt interrupts
+ * the main loop: every signal that finds the counter enabled lets the period (ARR + 1 counter
+ * clocks) pass and calls LCD_IRQHandler(). Like on the target, the counter does not run while
+ * ARR is 0. So LCD_WAIT() and the wait for a free queue entry
+ * work as on the target.
+ *
+ ******************************************************************************
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "HD44780.h"
+#include "lcd_sim.h"
+
+/* real time between two emulated timer interrupts */
+#define LCD_SIM_SIGNAL_US	10
+/* execution time of clear display and return home */
+#define LCD_SIM_SLOW_US		1520
+
+LCD_Sim lcd_sim;
+
+static volatile sig_atomic_t lcd_sim_busy = 0;	// the simulation runs, the interrupt has to wait
+static uint32_t control_last;
+
+static void lcd_sim_apply(GPIO_TypeDef *GPIOx) {
+	GPIOx->ODR = (GPIOx->ODR & ~(GPIOx->BSRR >> 16) & ~GPIOx->BRR)
+			| (GPIOx->BSRR & 0xFFFF);
+	GPIOx->BSRR = 0;
+	GPIOx->BRR = 0;
+}
+
+/**
+ * Executes an instruction (\p rs 0) or writes a data byte (\p rs 1).
+ */
+static void lcd_sim_execute(uint8_t byte, uint8_t rs) {
+	uint64_t now = host_now_us();
+	uint32_t exec_us = lcd_sim.exec_us;
+
+	// the instructions of the initialization by instruction are not checked, the busy flag
+	// cannot be read before the function set either
+	if (lcd_sim.four_bit && now < lcd_sim.busy_until) {
+		lcd_sim.violations++;
+	}
+
+	if (rs) {
+		lcd_sim.characters++;
+		if (lcd_sim.cgram_selected) {
+			lcd_sim.cgram[lcd_sim.address] = byte;
+			lcd_sim.address = (lcd_sim.address + 1) & 0x3F;
+		} else {
+			lcd_sim.ddram[lcd_sim.address] = byte;
+			lcd_sim.address = (lcd_sim.address + 1) & 0x7F;
+		}
+		lcd_sim.busy_until = now + exec_us;
+		return;
+	}
+
+	lcd_sim.commands++;
+	if (byte & 0x80) {			// set DDRAM address
+		lcd_sim.address = byte & 0x7F;
+		lcd_sim.cgram_selected = 0;
+	} else if (byte & 0x40) {	// set CGRAM address
+		lcd_sim.address = byte & 0x3F;
+		lcd_sim.cgram_selected = 1;
+	} else if (byte & 0x20) {	// function set
+		lcd_sim.four_bit = !(byte & 0x10);
+		lcd_sim.upper_received = 0;
+	} else if (byte & 0x1C) {	// cursor/display shift, display control, entry mode
+	} else if (byte & 0x02) {	// return home
+		lcd_sim.address = 0;
+		lcd_sim.cgram_selected = 0;
+		exec_us = LCD_SIM_SLOW_US;
+	} else if (byte & 0x01) {	// clear display
+		memset(lcd_sim.ddram, ' ', sizeof(lcd_sim.ddram));
+		lcd_sim.address = 0;
+		lcd_sim.cgram_selected = 0;
+		exec_us = LCD_SIM_SLOW_US;
+	}
+	lcd_sim.busy_until = now + exec_us;
+}
+
+static void lcd_sim_read(uint8_t rs) {
+	uint8_t value;
+
+	if (GPIOB->MODER & 0xFF) {
+		lcd_sim.conflicts++;
+	}
+
+	if (rs) {
+		value = lcd_sim.ddram[lcd_sim.address];
+	} else {
+		value = lcd_sim.address | (host_now_us() < lcd_sim.busy_until ? 0x80 : 0);
+	}
+
+	if (!lcd_sim.read_lower) {
+		lcd_sim.reads++;
+	}
+	GPIOB->IDR = (GPIOB->IDR & ~0x0F)
+			| (lcd_sim.read_lower ? value & 0x0F : value >> 4);
+	lcd_sim.read_lower = lcd_sim.four_bit && !lcd_sim.read_lower;
+}
+
+static void lcd_sim_write(uint8_t rs) {
+	uint8_t nibble = GPIOB->ODR & 0x0F;
+
+	if ((GPIOB->MODER & 0xFF) != 0x55) {
+		lcd_sim.conflicts++;
+	}
+
+	if (!lcd_sim.four_bit) {
+		lcd_sim_execute(nibble << 4, rs);
+	} else if (!lcd_sim.upper_received) {
+		lcd_sim.upper = nibble;
+		lcd_sim.upper_received = 1;
+	} else {
+		lcd_sim.upper_received = 0;
+		lcd_sim_execute((lcd_sim.upper << 4) | nibble, rs);
+	}
+}
+
+/**
+ * Applies the pending writes to both ports and follows the edges of E.
+ */
+static void lcd_sim_update(void) {
+	uint32_t control;
+
+	lcd_sim_apply(GPIOB);
+	lcd_sim_apply(GPIOC);
+
+	control = GPIOC->ODR;
+	if ((control & ~control_last) & LCD_Enable) {
+		if (control & LCD_RW) {
+			lcd_sim_read((control & LCD_RS) != 0);
+		}
+	} else if ((~control & control_last) & LCD_Enable) {
+		if (!(control & LCD_RW)) {
+			lcd_sim_write((control & LCD_RS) != 0);
+		}
+	}
+	control_last = control;
+}
+
+/**
+ * TIM6 update interrupt (SIGALRM handler).
+ */
+static void lcd_sim_interrupt(int signal) {
+	(void) signal;
+
+	if (lcd_sim_busy || !(TIM6->CR1 & TIM_CR1_CEN)) {
+		return;
+	}
+	// the counter is blocked while ARR is 0
+	if (TIM6->ARR == 0) {
+		lcd_sim.stalls++;
+		return;
+	}
+	lcd_sim_busy = 1;
+
+	// one-pulse mode: the counter stops at the update event
+	TIM6->CR1 &= ~TIM_CR1_CEN;
+	host_advance((TIM6->ARR + 1) * (TIM6->PSC + 1)
+			* (SystemCoreClock / HAL_RCC_GetPCLK1Freq()));
+	TIM6->SR |= TIM_SR_UIF;
+	lcd_sim.interrupts++;
+
+	LCD_IRQHandler();
+	lcd_sim_update();
+	lcd_sim_busy = 0;
+}
+
+/**
+ * Resets the display (8 bit interface, DDRAM filled with '?') and the ports and starts
+ * interrupting.
+ */
+void lcd_sim_init(void) {
+	struct sigaction action;
+	struct itimerval interval = { { 0, LCD_SIM_SIGNAL_US }, { 0, LCD_SIM_SIGNAL_US } };
+
+	lcd_sim_stop();
+
+	memset(&lcd_sim, 0, sizeof(lcd_sim));
+	memset(lcd_sim.ddram, '?', sizeof(lcd_sim.ddram));
+	lcd_sim.exec_us = 37;
+
+	memset(GPIOB, 0, sizeof(*GPIOB));
+	memset(GPIOC, 0, sizeof(*GPIOC));
+	memset(TIM6, 0, sizeof(*TIM6));
+	control_last = 0;
+
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = lcd_sim_interrupt;
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGALRM, &action, NULL);
+	setitimer(ITIMER_REAL, &interval, NULL);
+}
+
+void lcd_sim_stop(void) {
+	struct itimerval off = { { 0, 0 }, { 0, 0 } };
+
+	setitimer(ITIMER_REAL, &off, NULL);
+}
+
+/**
+ * LCDPort and LCDControlPort of the test build: applies the previous accesses first.
+ * @return \p GPIOx
+ */
+GPIO_TypeDef *lcd_sim_port(GPIO_TypeDef *GPIOx) {
+	sig_atomic_t busy = lcd_sim_busy;
+
+	lcd_sim_busy = 1;
+	lcd_sim_update();
+	lcd_sim_busy = busy;
+
+	return GPIOx;
+}
+
+/**
+ * Waits until the queue of the driver is empty, like LCD_WAIT(), but gives up.
+ * @param timeout_ms Real time to wait at most
+ * @return
+ * - 0 if the driver is still sending
+ * - 1 if the queue is empty
+ */
+int lcd_sim_wait(uint32_t timeout_ms) {
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		if (!LCD_BUSY()) {
+			return 1;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000
+			+ (now.tv_nsec - start.tv_nsec) / 1000000 < timeout_ms);
+
+	return 0;
+}
+
+/**
+ * @return Character shown at \p row, \p column of the 4x16 display
+ */
+uint8_t lcd_sim_char(uint8_t row, uint8_t column) {
+	static const uint8_t row_address[4] = { 0x00, 0x40, 0x10, 0x50 };
+
+	return lcd_sim.ddram[row_address[row] + column];
+}
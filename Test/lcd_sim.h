@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * @file    lcd_sim.h
+ * @brief  Simulated HD44780 on the pins of HD44780.c and TIM6 as a host interrupt
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef LCD_SIM_H_
+#define LCD_SIM_H_
+
+#include "stm32f3xx_hal.h"
+
+/**
+ * State of the simulated display. The test may set \p exec_us, everything else is kept by the
+ * simulation.
+ */
+typedef struct {
+	uint8_t ddram[128];
+	uint8_t cgram[64];
+	uint8_t address;				// address counter
+	uint8_t cgram_selected;			// the address counter points to the CGRAM
+	uint8_t four_bit;				// 4 bit interface set by the function set
+	uint8_t upper;					// upper nibble of the byte being written
+	uint8_t upper_received;
+	uint8_t read_lower;				// the next read returns the lower nibble
+	uint64_t busy_until;			// end of the running instruction in us
+	uint32_t exec_us;				// execution time of all but clear display and return home
+
+	uint32_t commands;				// instructions written
+	uint32_t characters;			// data bytes written
+	uint32_t reads;					// busy flag / address reads
+	uint32_t violations;			// bytes written while the display was busy
+	uint32_t conflicts;				// reads while the data pins drive, writes while they float
+	uint32_t interrupts;			// TIM6 update interrupts run
+	uint32_t stalls;				// signals that found the counter enabled with ARR 0
+} LCD_Sim;
+
+extern LCD_Sim lcd_sim;
+
+void lcd_sim_init(void);
+void lcd_sim_stop(void);
+GPIO_TypeDef *lcd_sim_port(GPIO_TypeDef *GPIOx);
+int lcd_sim_wait(uint32_t timeout_ms);
+uint8_t lcd_sim_char(uint8_t row, uint8_t column);
+
+#endif /* LCD_SIM_H_ */
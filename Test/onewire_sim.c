@@ -0,0 +1,379 @@
+/**
+ ******************************************************************************
+ * @file    onewire_sim.c
+ * @brief  Simulated DS18x20 sensors on the pins of a GPIO port in RAM
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Every pin of the simulated port can carry one sensor. onewire_sim_update() is called on every
+ * read of the cycle counter (#host_tick_hook), so it sees every change the master makes to the
+ * port registers within 1us:
+ * - BSRR and BRR writes are applied to ODR, a pin pulls the line low while it is an output
+ *   (MODER 01b) with its ODR bit cleared. This covers the open drain and the MODER switching
+ *   mode of the onewire modules.
+ * - The sensor measures how long the master kept the line low: 400us or more is a reset pulse
+ *   (answered by a presence pulse), less than 15us is a 1 bit or a read slot, anything else a
+ *   0 bit. A 0 bit is sent by pulling the line low for 30us from the falling edge on.
+ * - IDR shows the line levels (pulled up unless the master or a sensor pulls it low).
+ *
+ * The sensors understand SKIP ROM, MATCH ROM, READ ROM, SEARCH ROM, CONVERT T (busy until the
+ * conversion time of the resolution elapsed, the temperature register is updated at the end),
+ * READ SCRATCHPAD and WRITE SCRATCHPAD.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "onewire_sim.h"
+
+enum {
+	SIM_IDLE,				// waits for a reset pulse
+	SIM_ROM_CMD,
+	SIM_MATCH,
+	SIM_SEARCH,
+	SIM_FUNCTION,
+	SIM_SEND,				// sends tx, goes on to SIM_FUNCTION or SIM_IDLE afterwards
+	SIM_WRITE_SCRATCHPAD,
+	SIM_CONVERTING			// read slots return 1 once the conversion is done
+};
+
+OneWire_Sim_Device onewire_sim[16];
+
+static GPIO_TypeDef *port;
+static uint16_t master_low_last;
+static uint64_t falling_edge[16];
+static uint8_t send_then[16];
+static uint8_t latch[16];
+
+/**
+ * Dallas CRC8, bit by bit (independent of the implementation under test).
+ */
+static uint8_t onewire_sim_crc8(const uint8_t *data, int len) {
+	uint8_t crc = 0;
+
+	while (len--) {
+		uint8_t byte = *data++;
+
+		for (int bit = 0; bit < 8; bit++) {
+			uint8_t mix = (crc ^ byte) & 0x01;
+
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			byte >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+/**
+ * Copies the current temperature into the temperature register of the scratchpad.
+ */
+static void onewire_sim_latch(OneWire_Sim_Device *dev) {
+	int16_t raw = dev->temperature;
+
+	if (dev->rom[0] == 0x10) {
+		// DS18S20: 0.5 degC per LSB
+		raw = (int16_t) (dev->temperature >= 0 ?
+				dev->temperature / 8 : -((-dev->temperature + 7) / 8));
+	}
+
+	dev->scratchpad[0] = raw;
+	dev->scratchpad[1] = (uint16_t) raw >> 8;
+	dev->scratchpad[8] = onewire_sim_crc8(dev->scratchpad, 8);
+}
+
+/**
+ * Prepares the simulation for the pins of \p GPIOx (no sensors attached) and hooks it into the
+ * cycle counter.
+ */
+void onewire_sim_init(GPIO_TypeDef *GPIOx) {
+	port = GPIOx;
+	memset(port, 0, sizeof(*port));
+	memset(onewire_sim, 0, sizeof(onewire_sim));
+	master_low_last = 0;
+	port->IDR = 0xFFFF;
+
+	host_tick_hook = onewire_sim_update;
+}
+
+/**
+ * Connects a sensor to \p pin. The scratchpad holds the power-on values.
+ * @param pin Pin number
+ * @param family 0x28 (DS18B20) or 0x10 (DS18S20)
+ * @param serial First byte of the serial number (makes the ROM unique)
+ * @param temperature Temperature in 1/16 degC
+ */
+void onewire_sim_attach(uint8_t pin, uint8_t family, uint8_t serial,
+		int16_t temperature) {
+	OneWire_Sim_Device *dev = &onewire_sim[pin];
+	const uint8_t ds18b20[8] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10 };
+	const uint8_t ds18s20[8] = { 0xAA, 0x00, 0x4B, 0x46, 0xFF, 0xFF, 0x0C, 0x10 };
+
+	memset(dev, 0, sizeof(*dev));
+	dev->present = 1;
+	dev->rom[0] = family;
+	dev->rom[1] = serial;
+	for (int i = 2; i < 7; i++) {
+		dev->rom[i] = 0x10 * i + pin;
+	}
+	dev->rom[7] = onewire_sim_crc8(dev->rom, 7);
+
+	memcpy(dev->scratchpad, family == 0x28 ? ds18b20 : ds18s20, 8);
+	dev->scratchpad[8] = onewire_sim_crc8(dev->scratchpad, 8);
+	dev->temperature = temperature;
+	dev->state = SIM_IDLE;
+}
+
+/**
+ * Starts sending \p len bytes, followed by \p then.
+ */
+static void onewire_sim_send(OneWire_Sim_Device *dev, uint8_t pin,
+		const uint8_t *data, uint8_t len, uint8_t then) {
+	memcpy(dev->tx, data, len);
+	dev->tx_len = len;
+	dev->count = 0;
+	dev->state = SIM_SEND;
+	send_then[pin] = then;
+}
+
+/**
+ * Handles a byte written by the master.
+ */
+static void onewire_sim_byte(OneWire_Sim_Device *dev, uint8_t pin,
+		uint8_t byte, uint64_t now) {
+	if (dev->received_count < sizeof(dev->received)) {
+		dev->received[dev->received_count++] = byte;
+	}
+
+	switch (dev->state) {
+	case SIM_ROM_CMD:
+		dev->count = 0;
+		if (byte == 0xCC) {
+			dev->state = SIM_FUNCTION;
+		} else if (byte == 0x55) {
+			dev->state = SIM_MATCH;
+		} else if (byte == 0x33) {
+			onewire_sim_send(dev, pin, dev->rom, 8, SIM_FUNCTION);
+		} else if (byte == 0xF0) {
+			dev->searches++;
+			dev->state = SIM_SEARCH;
+		} else {
+			dev->state = SIM_IDLE;
+		}
+		break;
+
+	case SIM_MATCH:
+		if (byte != dev->rom[dev->count]) {
+			dev->state = SIM_IDLE;
+		} else if (++dev->count == 8) {
+			dev->state = SIM_FUNCTION;
+		}
+		break;
+
+	case SIM_FUNCTION:
+		dev->count = 0;
+		if (byte == 0x44) {
+			uint32_t us = 750000;
+
+			if (dev->rom[0] == 0x28) {
+				us >>= 3 - ((dev->scratchpad[4] >> 5) & 0x03);
+			}
+			dev->busy_until = now + us;
+			dev->conversions++;
+			latch[pin] = 1;
+			dev->state = SIM_CONVERTING;
+		} else if (byte == 0xBE) {
+			onewire_sim_send(dev, pin, dev->scratchpad, 9, SIM_IDLE);
+		} else if (byte == 0x4E) {
+			dev->state = SIM_WRITE_SCRATCHPAD;
+		} else {
+			dev->state = SIM_IDLE;
+		}
+		break;
+
+	case SIM_WRITE_SCRATCHPAD:
+		if (dev->count == 2 && dev->rom[0] == 0x28) {
+			byte = (byte & 0x60) | 0x1F;
+		}
+		if (dev->count < 2 || dev->rom[0] == 0x28) {
+			dev->scratchpad[2 + dev->count] = byte;
+		}
+		dev->scratchpad[8] = onewire_sim_crc8(dev->scratchpad, 8);
+		if (++dev->count == 3) {
+			dev->state = SIM_IDLE;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+/**
+ * @return Bit the sensor sends in the current read slot (1 = it keeps the line released)
+ */
+static uint8_t onewire_sim_tx_bit(OneWire_Sim_Device *dev, uint64_t now) {
+	switch (dev->state) {
+	case SIM_SEND:
+		return (dev->tx[dev->count / 8] >> (dev->count % 8)) & 0x01;
+
+	case SIM_SEARCH: {
+		uint8_t bit = (dev->rom[dev->count / 3 / 8] >> (dev->count / 3 % 8)) & 0x01;
+
+		// bit of the ROM, then its complement
+		return dev->count % 3 == 0 ? bit : !bit;
+	}
+
+	case SIM_CONVERTING:
+		return now >= dev->busy_until;
+
+	default:
+		return 1;
+	}
+}
+
+/**
+ * @return
+ * - 0 if the sensor takes the current slot as a write slot
+ * - 1 if it sends a bit in the current slot
+ */
+static int onewire_sim_sending(OneWire_Sim_Device *dev) {
+	return dev->state == SIM_SEND || dev->state == SIM_CONVERTING
+			|| (dev->state == SIM_SEARCH && dev->count % 3 != 2);
+}
+
+/**
+ * The master pulled the line low.
+ */
+static void onewire_sim_fall(OneWire_Sim_Device *dev, uint64_t now) {
+	if (onewire_sim_sending(dev) && !onewire_sim_tx_bit(dev, now)) {
+		dev->drive_from = now;
+		dev->drive_until = now + 30;
+	}
+}
+
+/**
+ * The master released the line after \p low us.
+ */
+static void onewire_sim_rise(OneWire_Sim_Device *dev, uint8_t pin,
+		uint64_t low, uint64_t now) {
+	if (low >= 400) {
+		dev->resets++;
+		if (latch[pin]) {
+			dev->disturbed++;
+		}
+		dev->received_count = 0;
+		dev->shift = 0;
+		dev->byte = 0;
+		dev->count = 0;
+		dev->state = SIM_ROM_CMD;
+
+		// presence pulse
+		dev->drive_from = now + 30;
+		dev->drive_until = now + 150;
+		return;
+	}
+
+	switch (dev->state) {
+	case SIM_IDLE:
+	case SIM_CONVERTING:
+		break;
+
+	case SIM_SEND:
+		if (++dev->count == dev->tx_len * 8) {
+			dev->count = 0;
+			dev->state = send_then[pin];
+		}
+		break;
+
+	case SIM_SEARCH:
+		if (dev->count % 3 == 2) {
+			uint8_t bit = (dev->rom[dev->count / 3 / 8] >> (dev->count / 3 % 8)) & 0x01;
+
+			// the master chose the other branch
+			if ((low < 15) != bit) {
+				dev->state = SIM_IDLE;
+				break;
+			}
+		}
+		if (++dev->count == 64 * 3) {
+			dev->count = 0;
+			dev->state = SIM_FUNCTION;
+		}
+		break;
+
+	default:
+		dev->byte |= (low < 15) << dev->shift;
+		if (++dev->shift == 8) {
+			uint8_t byte = dev->byte;
+
+			dev->shift = 0;
+			dev->byte = 0;
+			onewire_sim_byte(dev, pin, byte, now);
+		}
+		break;
+	}
+}
+
+/**
+ * @return Mask of the pins the master pulls low
+ */
+uint16_t onewire_sim_master_low(void) {
+	uint16_t low = 0;
+
+	// the set/reset registers are write only on the target
+	port->ODR |= port->BSRR & 0xFFFF;
+	port->ODR &= ~(port->BSRR >> 16);
+	port->ODR &= ~port->BRR;
+	port->BSRR = 0;
+	port->BRR = 0;
+
+	for (int pin = 0; pin < 16; pin++) {
+		if (((port->MODER >> (2 * pin)) & 0x03) == 0x01
+				&& !(port->ODR & (1 << pin))) {
+			low |= 1 << pin;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * Follows the changes on the port and updates IDR. Called on every cycle counter read.
+ */
+void onewire_sim_update(void) {
+	uint64_t now = host_now_us();
+	uint16_t low = onewire_sim_master_low();
+	uint16_t idr = ~low;
+
+	for (int pin = 0; pin < 16; pin++) {
+		OneWire_Sim_Device *dev = &onewire_sim[pin];
+		uint16_t bit = 1 << pin;
+
+		if (!dev->present) {
+			continue;
+		}
+
+		if (latch[pin] && now >= dev->busy_until) {
+			latch[pin] = 0;
+			onewire_sim_latch(dev);
+		}
+
+		if ((low & bit) && !(master_low_last & bit)) {
+			falling_edge[pin] = now;
+			onewire_sim_fall(dev, now);
+		} else if (!(low & bit) && (master_low_last & bit)) {
+			onewire_sim_rise(dev, pin, now - falling_edge[pin], now);
+		}
+
+		if (now >= dev->drive_from && now < dev->drive_until) {
+			idr &= ~bit;
+		}
+	}
+
+	master_low_last = low;
+	port->IDR = idr;
+}
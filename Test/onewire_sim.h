@@ -0,0 +1,51 @@
+/**
+ ******************************************************************************
+ * @file    onewire_sim.h
+ * @brief  Simulated DS18x20 sensors on the pins of a GPIO port in RAM
+ * @author  MemAllox
+ ******************************************************************************
+ */
+
+#ifndef ONEWIRE_SIM_H_
+#define ONEWIRE_SIM_H_
+
+#include "stm32f3xx_hal.h"
+
+/**
+ * State of the sensor on one pin. The test sets \p rom and \p temperature, everything else is
+ * kept by the simulation.
+ */
+typedef struct {
+	uint8_t present;
+	uint8_t rom[8];					// family code 0x28 (DS18B20) or 0x10 (DS18S20)
+	int16_t temperature;			// current temperature in 1/16 degC
+	uint8_t scratchpad[9];
+	uint64_t busy_until;			// end of the running conversion in us
+	uint32_t conversions;			// conversions started
+	uint32_t resets;				// reset pulses seen
+	uint32_t disturbed;				// reset pulses seen while a conversion was running
+	uint32_t searches;				// SEARCH ROM commands received
+	uint8_t received[64];			// bytes written by the master since the last reset
+	uint8_t received_count;
+
+	// protocol state
+	uint8_t state;
+	uint8_t shift;					// bits received of the current byte
+	uint8_t byte;
+	uint8_t count;					// bytes received or bits sent in the current state
+	uint8_t tx[9];
+	uint8_t tx_len;					// bytes to send from tx
+	uint8_t tx_bit;					// bit sent in the current read slot
+	uint64_t drive_from;			// the sensor pulls the line low in [drive_from, drive_until)
+	uint64_t drive_until;
+} OneWire_Sim_Device;
+
+extern OneWire_Sim_Device onewire_sim[16];
+
+void onewire_sim_init(GPIO_TypeDef *GPIOx);
+void onewire_sim_attach(uint8_t pin, uint8_t family, uint8_t serial,
+		int16_t temperature);
+void onewire_sim_update(void);
+uint16_t onewire_sim_master_low(void);
+
+#endif /* ONEWIRE_SIM_H_ */
@@ -0,0 +1,152 @@
+/**
+ ******************************************************************************
+ * @file    test_can_bit_timing.c
+ * @brief  Bit timing solver of can.c and the bit rate of the simulated bxCAN
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * can_bit_timing() at the 24MHz PCLK1 of the board has to give the settings of the usual
+ * tables (1Mbit/s: prescaler 3, BS1 6, BS2 1, 500kbit/s: prescaler 3, BS1 13, BS2 2). For all
+ * CiA bit rates the segments have to be in range, hit the bit rate exactly and put the sample
+ * point close to 87.5 %. Bit rates that can't be derived from the clock are refused.
+ *
+ * MX_CAN_Init() and can_set_bitrate() have to program BTR accordingly (through the HAL stub and
+ * the simulated peripheral, which acknowledges the initialization request). On a bus stuck
+ * dominant the request is never acknowledged, can_set_bitrate() has to give up after
+ * #CAN_INIT_TIMEOUT_US. The timing it sets has to survive a later HAL_CAN_Init().
+ *
+ ******************************************************************************
+ */
+
+#include "can.h"
+#include "can_sim.h"
+#include "timing.h"
+
+#define PCLK1		24000000
+
+static int errors = 0;
+
+void _Error_Handler(char *file, int line) {
+	errors++;
+}
+
+/**
+ * @return Bit rate BTR is set to at the 24MHz PCLK1
+ */
+static uint32_t btr_bitrate(void) {
+	uint32_t btr = CAN->BTR;
+
+	return HAL_RCC_GetPCLK1Freq() / (((btr & CAN_BTR_BRP) + 1)
+			* (3 + ((btr & CAN_BTR_TS1) >> CAN_BTR_TS1_Pos)
+					+ ((btr & CAN_BTR_TS2) >> CAN_BTR_TS2_Pos)));
+}
+
+static void test_table(void) {
+	CAN_Bit_Timing timing;
+
+	CHECK(can_bit_timing(PCLK1, 1000000, 875, &timing));
+	CHECK(timing.prescaler == 3 && timing.bs1 == 6 && timing.bs2 == 1);
+	CHECK(timing.sjw == 1);
+
+	CHECK(can_bit_timing(PCLK1, 500000, 875, &timing));
+	CHECK(timing.prescaler == 3 && timing.bs1 == 13 && timing.bs2 == 2);
+	CHECK(timing.sjw == 2);
+}
+
+static void test_bitrates(void) {
+	static const uint32_t bitrates[] = { 10000, 20000, 50000, 100000, 125000, 250000,
+			500000, 800000, 1000000 };
+	CAN_Bit_Timing timing;
+
+	for (unsigned i = 0; i < sizeof(bitrates) / sizeof(bitrates[0]); i++) {
+		uint32_t tq;
+		int32_t sample_point;
+
+		CHECK(can_bit_timing(PCLK1, bitrates[i], 875, &timing));
+		tq = 1 + timing.bs1 + timing.bs2;
+		sample_point = (1 + timing.bs1) * 1000 / tq;
+
+		CHECK(timing.prescaler >= 1 && timing.prescaler <= 1024);
+		CHECK(timing.bs1 >= 1 && timing.bs1 <= 16);
+		CHECK(timing.bs2 >= 1 && timing.bs2 <= 8);
+		CHECK(timing.sjw == (timing.bs2 < 4 ? timing.bs2 : 4));
+		CHECK(timing.prescaler * tq * bitrates[i] == PCLK1);
+		CHECK(sample_point >= 850 && sample_point <= 900);
+		printf("%7u bit/s: prescaler %4u, BS1 %2u, BS2 %u, SJW %u, sample point %.1f %%\n",
+				bitrates[i], timing.prescaler, timing.bs1, timing.bs2, timing.sjw,
+				sample_point / 10.0);
+	}
+
+	// no exact divider, no bit rate
+	CHECK(!can_bit_timing(PCLK1, 33333, 875, &timing));
+	CHECK(!can_bit_timing(PCLK1, 0, 875, &timing));
+	CHECK(!can_bit_timing(PCLK1, 5000000, 875, &timing));
+}
+
+static void test_registers(void) {
+	can_sim_init();
+	CAN->BTR = 0;
+
+	MX_CAN_Init();
+	CHECK(errors == 0);
+	CHECK(btr_bitrate() == CAN_BITRATE);
+	CHECK(CAN->MCR & CAN_MCR_TXFP);
+
+	// the loop back mode is kept, initialization mode is left
+	CAN->BTR |= CAN_BTR_LBKM;
+	CHECK(can_set_bitrate(125000));
+	CHECK(btr_bitrate() == 125000);
+	CHECK(CAN->BTR & CAN_BTR_LBKM);
+	CHECK(!(CAN->MSR & CAN_MSR_INAK));
+
+	// out of range: nothing changes
+	CHECK(!can_set_bitrate(2000000));
+	CHECK(!can_set_bitrate(33333));
+	CHECK(btr_bitrate() == 125000);
+
+	// the timing is kept by a later HAL_CAN_Init()
+	CHECK(can_set_bitrate(250000) == 1);
+	CHECK(HAL_CAN_Init(&hcan) == HAL_OK);
+	CHECK(btr_bitrate() == 250000);
+}
+
+/**
+ * A bus that is never recessive: the waits for INAK time out instead of hanging.
+ */
+static void test_stuck_bus(void) {
+	uint64_t start;
+
+	can_sim_init();
+	MX_CAN_Init();
+
+	// the initialization mode is not entered: nothing changes
+	can_sim.dominant = 1;
+	start = timing_now_us();
+	CHECK(can_set_bitrate(125000) == -1);
+	CHECK(timing_now_us() - start >= CAN_INIT_TIMEOUT_US);
+	CHECK(timing_now_us() - start < 2 * CAN_INIT_TIMEOUT_US);
+	CHECK(!(CAN->MCR & CAN_MCR_INRQ));
+	CHECK(btr_bitrate() == CAN_BITRATE);
+	CHECK(hcan.Init.Prescaler == 3);
+
+	// entered, but not left again: the bit rate is set, the CAN joins once the bus is free
+	can_sim.dominant = 0;
+	CAN->MCR |= CAN_MCR_INRQ;
+	CHECK(CAN->MSR & CAN_MSR_INAK);
+	can_sim.dominant = 1;
+	CHECK(can_set_bitrate(125000) == -1);
+	CHECK(btr_bitrate() == 125000);
+	CHECK(hcan.Init.Prescaler == 12);
+	CHECK(!(CAN->MCR & CAN_MCR_INRQ));
+	can_sim.dominant = 0;
+	CHECK(!(CAN->MSR & CAN_MSR_INAK));
+}
+
+int main(void) {
+	test_table();
+	test_bitrates();
+	test_registers();
+	test_stuck_bus();
+
+	return host_report("can_bit_timing");
+}
@@ -0,0 +1,211 @@
+/**
+ ******************************************************************************
+ * @file    test_can_bus.c
+ * @brief  CAN transmit and receive queues on the simulated bxCAN of can_sim.c
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Frame streams longer than 65536 frames run through both queues, so the 16 bit indices wrap
+ * several times while the queues fill up and run empty again:
+ * - transmit: the application queues bursts of frames, the bus sends a varying number of them.
+ *   can_bus_send() has to refuse a frame exactly when the three mailboxes and the queue are
+ *   occupied, and the frames have to reach the bus complete and in order.
+ * - receive: frames of other nodes arrive in bursts, the application takes a varying number of
+ *   them. A frame has to be dropped (and counted) exactly when the queue is full, all others
+ *   have to come out complete and in order.
+ *
+ * With the interrupts held off, the 3 slots of a hardware FIFO overflow: the overrun is counted
+ * once and the frames left in the FIFO are received.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "can_bus.h"
+#include "can_stats.h"
+#include "can_sim.h"
+
+/* more than the 16 bit indices count */
+#define STREAM_FRAMES	100000
+
+/**
+ * @return Frame \p seq of a stream: standard and extended identifiers, remote frames, all DLCs
+ */
+static CAN_Bus_Frame stream_frame(uint32_t seq) {
+	CAN_Bus_Frame frame;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.flags = (seq % 5 == 0 ? CAN_BUS_FLAG_EXT : 0)
+			| (seq % 11 == 0 ? CAN_BUS_FLAG_RTR : 0);
+	frame.id = (frame.flags & CAN_BUS_FLAG_EXT) ?
+			(seq * 2654435761u) & 0x1FFFFFFF : seq & 0x7FF;
+	frame.dlc = seq % 9;
+	for (int i = 0; i < frame.dlc; i++) {
+		frame.data[i] = seq >> (8 * (i % 4));
+	}
+
+	return frame;
+}
+
+/**
+ * @return 1 if \p frame is frame \p seq of the stream
+ */
+static int is_frame(const CAN_Bus_Frame *frame, uint32_t seq) {
+	CAN_Bus_Frame expected = stream_frame(seq);
+
+	return frame->id == expected.id && frame->flags == expected.flags
+			&& frame->dlc == expected.dlc
+			&& memcmp(frame->data, expected.data, expected.dlc) == 0;
+}
+
+static void setup(void) {
+	can_sim_init();
+	can_bus_init();
+}
+
+static void test_tx_stream(void) {
+	uint32_t queued = 0, sent = 0;
+	uint32_t full = 0, empty = 0;
+
+	setup();
+
+	while (sent < STREAM_FRAMES) {
+		uint32_t burst = 1 + (queued * 7) % 23;
+		uint32_t frames = (sent % 7 == 0) ? 40 : 1 + (sent * 13) % 19;
+
+		// the application: a burst of frames until the queue is full
+		while (burst-- && queued < STREAM_FRAMES) {
+			uint32_t in_flight = queued - sent;
+			CAN_Bus_Frame frame = stream_frame(queued);
+
+			// three mailboxes, then the queue
+			CHECK(can_bus_tx_pending() == (in_flight > 3 ? in_flight - 3 : 0));
+			if (!can_bus_send(&frame)) {
+				CHECK(in_flight == 3 + CAN_BUS_TX_QUEUE_LENGTH);
+				full++;
+				break;
+			}
+			CHECK(in_flight < 3 + CAN_BUS_TX_QUEUE_LENGTH);
+			queued++;
+		}
+
+		// the bus: some of them, all that are left at the end
+		while ((frames-- || queued == STREAM_FRAMES) && can_sim_transmit()) {
+			CHECK(is_frame(&can_sim.sent[(can_sim.sent_count - 1)
+					& (CAN_SIM_LOG_LENGTH - 1)], sent));
+			sent++;
+		}
+		if (queued == sent) {
+			empty++;
+		}
+	}
+
+	CHECK(can_sim.sent_count == STREAM_FRAMES);
+	CHECK(can_bus_tx_pending() == 0);
+	CHECK(can_stats()->tx_frames == STREAM_FRAMES);
+	CHECK(full > 0);
+	CHECK(empty > 0);
+	printf("tx stream: %u frames, queue full %u times, empty %u times\n",
+			STREAM_FRAMES, full, empty);
+}
+
+static void test_rx_stream(void) {
+	static uint32_t expected[CAN_BUS_RX_QUEUE_LENGTH];	// sequence numbers in the queue
+	uint16_t head = 0, tail = 0;
+	uint32_t arrived = 0, dropped = 0;
+	CAN_Bus_Counters before = *can_bus_counters();
+	CAN_Bus_Frame frame;
+
+	setup();
+
+	while (arrived < STREAM_FRAMES || tail != head) {
+		uint32_t burst = 1 + (arrived * 7) % 41;
+		uint32_t frames = (arrived % 5 == 0) ? 64 : 1 + (arrived * 3) % 37;
+
+		// the other nodes: a burst of frames, interrupts enabled
+		while (burst-- && arrived < STREAM_FRAMES) {
+			int full = can_bus_rx_pending() == CAN_BUS_RX_QUEUE_LENGTH;
+
+			frame = stream_frame(arrived);
+			can_sim_receive(&frame);
+			if (full) {
+				dropped++;
+			} else {
+				expected[tail++ & (CAN_BUS_RX_QUEUE_LENGTH - 1)] = arrived;
+			}
+			CHECK(can_bus_counters()->dropped[0] - before.dropped[0] == dropped);
+			CHECK(can_bus_rx_pending() == (uint16_t) (tail - head));
+			arrived++;
+		}
+
+		// the application: some of them, all that are left at the end
+		while ((frames-- || arrived == STREAM_FRAMES) && can_bus_receive(&frame)) {
+			CHECK(tail != head);
+			CHECK(is_frame(&frame, expected[head++ & (CAN_BUS_RX_QUEUE_LENGTH - 1)]));
+			CHECK(frame.fifo == 0 && frame.filter == 0);
+		}
+	}
+
+	CHECK(can_bus_rx_pending() == 0);
+	CHECK(dropped > 0);
+	CHECK(can_stats()->rx_frames == STREAM_FRAMES - dropped);
+	CHECK(can_bus_counters()->overrun[0] == before.overrun[0]);
+	printf("rx stream: %u frames, %u dropped\n", STREAM_FRAMES, dropped);
+}
+
+/**
+ * Five frames arrive while the interrupts are held off.
+ * @param received Destination for the sequence numbers of the frames received
+ * @return Number of frames received
+ */
+static int overflow(uint32_t received[5]) {
+	uint32_t overrun = can_bus_counters()->overrun[0];
+	CAN_Bus_Frame frame;
+	int count = 0;
+
+	__disable_irq();
+	for (uint32_t seq = 0; seq < 5; seq++) {
+		frame = stream_frame(seq);
+		can_sim_receive(&frame);
+	}
+	CHECK(can_sim.lost[0] == 2);
+	CHECK(can_bus_rx_pending() == 0);
+	__enable_irq();
+	can_sim_interrupts();
+
+	CHECK(can_bus_counters()->overrun[0] == overrun + 1);
+	while (count < 5 && can_bus_receive(&frame)) {
+		received[count] = 5;
+		for (uint32_t seq = 0; seq < 5; seq++) {
+			if (is_frame(&frame, seq)) {
+				received[count] = seq;
+			}
+		}
+		count++;
+	}
+
+	return count;
+}
+
+static void test_fifo_overrun(void) {
+	uint32_t received[5];
+
+	// the last frame stored is overwritten
+	setup();
+	CHECK(overflow(received) == 3);
+	CHECK(received[0] == 0 && received[1] == 1 && received[2] == 4);
+
+	// locked mode (RFLM): the new frames are discarded
+	setup();
+	host_can.MCR |= CAN_MCR_RFLM;
+	CHECK(overflow(received) == 3);
+	CHECK(received[0] == 0 && received[1] == 1 && received[2] == 2);
+}
+
+int main(void) {
+	test_tx_stream();
+	test_rx_stream();
+	test_fifo_overrun();
+
+	return host_report("can_bus");
+}
@@ -0,0 +1,173 @@
+/**
+ ******************************************************************************
+ * @file    test_can_filter.c
+ * @brief  Packing of the CAN subscriptions into the filter banks of the simulated bxCAN
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The filter banks programmed by can_filter_apply() are run by the acceptance filter of
+ * can_sim.c (scales, modes, FIFO assignment and filter numbers as in the reference manual):
+ * - every standard identifier and a set of extended identifiers has to be accepted exactly if
+ *   it was subscribed, into the FIFO of its priority, and remote frames never
+ * - the subscriptions have to take the minimal number of banks of each kind
+ * - subscriptions that need more than the 14 banks must leave the filters as they are
+ *
+ ******************************************************************************
+ */
+
+#include "can_bus.h"
+#include "can_filter.h"
+#include "can_sim.h"
+
+static void setup(void) {
+	can_sim_init();
+	can_bus_init();
+	can_filter_clear();
+}
+
+/**
+ * @return Number of active filter banks
+ */
+static int banks(void) {
+	return __builtin_popcount(host_can.FA1R);
+}
+
+static void test_packing(void) {
+	static const struct {
+		uint32_t id;
+		int accepted;
+		uint8_t fifo;
+	} ext[] = { { 0x1234567, 1, 0 }, { 0x1234566, 0, 0 }, { 0x18FF0000, 1, 1 },
+			{ 0x18FF00FF, 1, 1 }, { 0x18FF0080, 1, 1 }, { 0x18FF0100, 0, 0 },
+			{ 0x18FEFFFF, 0, 0 }, { 100, 0, 0 } };
+	uint8_t fifo, fmi;
+	int wrong = 0;
+
+	setup();
+	CHECK(can_filter_subscribe(100, 0, CAN_FILTER_HIGH));
+	CHECK(can_filter_subscribe(5, 0, CAN_FILTER_HIGH));
+	CHECK(can_filter_subscribe(7, 0, CAN_FILTER_LOW));
+	CHECK(can_filter_subscribe_range(0x200, 0x27A, 0, CAN_FILTER_LOW));
+	CHECK(can_filter_subscribe_range(0x700, 0x7FF, 0, CAN_FILTER_HIGH));
+	CHECK(can_filter_subscribe(0x1234567, CAN_BUS_FLAG_EXT, CAN_FILTER_HIGH));
+	CHECK(can_filter_subscribe_range(0x18FF0000, 0x18FF00FF, CAN_BUS_FLAG_EXT,
+			CAN_FILTER_LOW));
+	CHECK(can_filter_apply());
+
+	// FIFO0: 16 bit list (100, 5), 16 bit mask (0x700-0x7FF), 32 bit list (0x1234567)
+	// FIFO1: 16 bit list (7, 0x27A), 3 x 16 bit mask (5 blocks of 0x200-0x279), 32 bit mask
+	// (0x18FF0000-0x18FF00FF)
+	CHECK(banks() == 3 + 5);
+	CHECK(host_can.FFA1R == 0xF8);
+
+	for (uint32_t id = 0; id <= 0x7FF; id++) {
+		int high = id == 100 || id == 5 || id >= 0x700;
+		int low = id == 7 || (id >= 0x200 && id <= 0x27A);
+		int accepted = can_sim_match(id, 0, &fifo, &fmi);
+
+		if (accepted != (high || low) || (accepted && fifo != low)
+				|| can_sim_match(id, CAN_BUS_FLAG_RTR, &fifo, &fmi)) {
+			wrong++;
+		}
+	}
+	CHECK(wrong == 0);
+
+	for (unsigned i = 0; i < sizeof(ext) / sizeof(ext[0]); i++) {
+		int accepted = can_sim_match(ext[i].id, CAN_BUS_FLAG_EXT, &fifo, &fmi);
+
+		CHECK(accepted == ext[i].accepted);
+		CHECK(!accepted || fifo == ext[i].fifo);
+		CHECK(!can_sim_match(ext[i].id, CAN_BUS_FLAG_EXT | CAN_BUS_FLAG_RTR, &fifo,
+				&fmi));
+	}
+}
+
+static void test_receive(void) {
+	static const struct {
+		uint32_t id;
+		uint8_t fifo;
+		uint8_t filter;
+	} frames[] = {
+			// bank 0 (FIFO0, list 100, 5, 5, 5): filters 0-3
+			{ 100, 0, 0 }, { 5, 0, 1 },
+			// bank 1 (FIFO1, list 7, 7, 7, 7): filters 0-3, bank 2 (FIFO1, mask 0x300-0x3FF): 4-5
+			{ 7, 1, 0 }, { 0x3AB, 1, 4 } };
+	CAN_Bus_Frame frame = { .dlc = 8 };
+	uint32_t rejected;
+
+	setup();
+	can_filter_subscribe(100, 0, CAN_FILTER_HIGH);
+	can_filter_subscribe(5, 0, CAN_FILTER_HIGH);
+	can_filter_subscribe(7, 0, CAN_FILTER_LOW);
+	can_filter_subscribe_range(0x300, 0x3FF, 0, CAN_FILTER_LOW);
+	CHECK(can_filter_apply());
+
+	// the frames come with the FIFO and the number of the filter they matched
+	for (unsigned i = 0; i < sizeof(frames) / sizeof(frames[0]); i++) {
+		frame.id = frames[i].id;
+		can_sim_receive(&frame);
+		CHECK(can_bus_receive(&frame));
+		CHECK(frame.id == frames[i].id);
+		CHECK(frame.fifo == frames[i].fifo);
+		CHECK(frame.filter == frames[i].filter);
+	}
+
+	// everything else is dropped by the hardware
+	rejected = can_sim.rejected;
+	frame.id = 0x400;
+	can_sim_receive(&frame);
+	CHECK(can_sim.rejected == rejected + 1);
+	CHECK(!can_bus_receive(&frame));
+}
+
+static void test_bank_limit(void) {
+	uint32_t fr1;
+
+	// 32 single standard identifiers take 8 banks, the table is full then
+	setup();
+	for (uint32_t id = 0; id < CAN_FILTER_MAX_SUBSCRIPTIONS; id++) {
+		CHECK(can_filter_subscribe(0x100 + 3 * id, 0, id & 1));
+	}
+	CHECK(!can_filter_subscribe(0x7FF, 0, CAN_FILTER_HIGH));
+	CHECK(can_filter_apply());
+	CHECK(banks() == 8);
+
+	// a range split into 20 blocks doesn't fit behind 16 entries
+	can_filter_clear();
+	for (uint32_t id = 0; id < 16; id++) {
+		can_filter_subscribe(id, 0, CAN_FILTER_HIGH);
+	}
+	CHECK(!can_filter_subscribe_range(1, 0x7FE, 0, CAN_FILTER_HIGH));
+
+	// one bank per extended block: 14 fit
+	can_filter_clear();
+	for (uint32_t i = 0; i < CAN_FILTER_BANKS; i++) {
+		CHECK(can_filter_subscribe_range(i << 8, (i << 8) + 0xFF, CAN_BUS_FLAG_EXT,
+				CAN_FILTER_HIGH));
+	}
+	CHECK(can_filter_apply());
+	CHECK(banks() == CAN_FILTER_BANKS);
+
+	// the 15th doesn't, the filters stay as they are
+	fr1 = host_can.sFilterRegister[0].FR1;
+	CHECK(can_filter_subscribe_range(0x10000, 0x100FF, CAN_BUS_FLAG_EXT, CAN_FILTER_LOW));
+	CHECK(!can_filter_apply());
+	CHECK(banks() == CAN_FILTER_BANKS);
+	CHECK(host_can.FFA1R == 0);
+	CHECK(host_can.sFilterRegister[0].FR1 == fr1);
+	CHECK(!(host_can.FMR & CAN_FMR_FINIT));
+
+	// the whole standard range is a single mask entry
+	can_filter_clear();
+	CHECK(can_filter_subscribe_range(0, 0x7FF, 0, CAN_FILTER_HIGH));
+	CHECK(can_filter_apply());
+	CHECK(banks() == 1);
+}
+
+int main(void) {
+	test_packing();
+	test_receive();
+	test_bank_limit();
+
+	return host_report("can_filter");
+}
@@ -0,0 +1,117 @@
+/**
+ ******************************************************************************
+ * @file    test_can_stats.c
+ * @brief  CAN statistics on the simulated bxCAN of can_sim.c
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * - bus-off: the error counters of the simulated peripheral go up and down. Every entry into
+ *   bus-off has to be counted once, also when the status change interrupt comes again while
+ *   the node stays off (with the last error code interrupt enabled as well).
+ * - the mailbox status of the frames sent (arbitration lost, transmit error) and the rates of
+ *   can_stats_sample()
+ *
+ * Built with the profiler on the host clock (see the Makefile), so the dump is printed as well.
+ *
+ ******************************************************************************
+ */
+
+#include "can_bus.h"
+#include "can_stats.h"
+#include "can_sim.h"
+
+/* LEC of a form error */
+#define FORM_ERROR		3
+
+static void setup(void) {
+	can_sim_init();
+	can_bus_init();
+}
+
+static void test_bus_off(void) {
+	setup();
+
+	// error warning and error passive are not counted
+	can_sim_errors(100, 0, 0);
+	can_sim_errors(200, 0, 0);
+	CHECK(can_stats()->bus_off == 0);
+
+	can_sim_errors(256, 0, 0);
+	CHECK(host_can.ESR & CAN_ESR_BOFF);
+	CHECK(can_stats()->bus_off == 1);
+	CHECK(!(host_can.MSR & CAN_MSR_ERRI));
+
+	// more interrupts while the node stays off
+	CAN->IER |= CAN_IER_LECIE;
+	for (int i = 0; i < 5; i++) {
+		can_sim_errors(256, 0, FORM_ERROR);
+	}
+	CHECK(can_stats()->bus_off == 1);
+
+	// recovered, then off again
+	can_sim_errors(0, 0, FORM_ERROR);
+	CHECK(can_stats()->bus_off == 1);
+	can_sim_errors(256, 0, 0);
+	CHECK(can_stats()->bus_off == 2);
+
+	can_stats_sample();
+	CHECK(can_stats()->tec == 255);
+}
+
+static void test_tx_status(void) {
+	CAN_Bus_Frame frame = { .id = 0x123, .dlc = 8 };
+
+	setup();
+
+	can_sim.tx_status = CAN_TSR_TXOK0 | CAN_TSR_ALST0;
+	can_bus_send(&frame);
+	can_sim_run();
+	can_sim.tx_status = CAN_TSR_TXOK0 | CAN_TSR_TERR0;
+	can_bus_send(&frame);
+	can_sim_run();
+	// aborted: no frame sent
+	can_sim.tx_status = CAN_TSR_TERR0;
+	can_bus_send(&frame);
+	can_sim_run();
+
+	CHECK(can_stats()->arbitration_lost == 1);
+	CHECK(can_stats()->tx_errors == 2);
+	CHECK(can_stats()->tx_frames == 2);
+	CHECK(can_stats()->tx_bits == 2 * can_stats_frame_bits(0, 8));
+}
+
+static void test_rates(void) {
+	CAN_Bus_Frame frame = { .id = 0x123, .dlc = 8 };
+	uint32_t bits;
+
+	setup();
+	can_stats_sample();
+
+	// 100 frames sent and 100 received within a second
+	for (int i = 0; i < 100; i++) {
+		can_bus_send(&frame);
+		can_sim_run();
+		can_sim_receive(&frame);
+		CHECK(can_bus_receive(&frame));
+	}
+	host_advance_ms(1000 - HAL_GetTick() % 1000);
+	can_stats_sample();
+
+	bits = 200 * can_stats_frame_bits(0, 8);
+	CHECK(can_stats()->tx_fps >= 99 && can_stats()->tx_fps <= 100);
+	CHECK(can_stats()->rx_fps == can_stats()->tx_fps);
+	CHECK(can_stats()->load == (uint64_t) can_stats()->bps * 1000 / 500000);
+	CHECK(can_stats()->bps <= bits && can_stats()->bps >= bits * 99 / 100);
+
+#if PROFILE_ENABLED
+	can_stats_dump();
+#endif
+}
+
+int main(void) {
+	test_bus_off();
+	test_tx_status();
+	test_rates();
+
+	return host_report("can_stats");
+}
@@ -0,0 +1,222 @@
+/**
+ ******************************************************************************
+ * @file    test_can_tp.c
+ * @brief  Two segmented transfer endpoints talking over the simulated bxCAN of can_sim.c
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The peripheral runs in loop back mode, so every frame sent comes back through the filters and
+ * the receive queue. The main loop hands each frame to the endpoint it is addressed to, like the
+ * example in can_tp.c, and polls both endpoints. The bus time of every frame passes, so the
+ * timeouts and separation times are those of a 500kbit/s bus.
+ *
+ * - a long message in both directions, with the receive queue and the transmit queue limiting
+ *   the pace, and a single frame message
+ * - a message longer than the receive buffer is refused with an overflow on both sides
+ * - while a complete message isn't collected, the next one is ignored (single frame) or refused
+ *   with an overflow (first frame), the first one stays intact
+ * - a sender without a receiver gives up after #CAN_TP_TIMEOUT_MS
+ *
+ * Built once with the defaults (no flow control after the first frame, no separation time) and
+ * once with blocks of 8 frames and 500us STmin (see the Makefile): the number of flow control
+ * frames and the time of the transfer have to follow.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "can_tp.h"
+#include "can_sim.h"
+#include "timing.h"
+
+#define ID_A		0x700
+#define ID_B		0x701
+#define MESSAGE		3000
+
+static uint8_t message[MESSAGE];
+static uint8_t buffer_a[100];
+static uint8_t buffer_b[CAN_TP_MAX_LENGTH];
+static CAN_TP_Context a, b;
+static uint32_t flow_controls;
+
+/**
+ * Counts the flow control frames on the bus.
+ */
+static void count_flow_control(const CAN_Bus_Frame *frame) {
+	if ((frame->data[0] & 0xF0) == 0x30) {
+		flow_controls++;
+	}
+}
+
+static void setup(void) {
+	can_sim_init();
+	can_sim.tx_hook = count_flow_control;
+	host_can.BTR |= CAN_BTR_LBKM;
+	can_bus_init();
+	timing_init();
+
+	can_tp_init(&a, ID_A, ID_B, buffer_a, sizeof(buffer_a));
+	can_tp_init(&b, ID_B, ID_A, buffer_b, sizeof(buffer_b));
+	flow_controls = 0;
+
+	for (int i = 0; i < MESSAGE; i++) {
+		message[i] = i * 7 + (i >> 8);
+	}
+}
+
+/**
+ * The main loop of both nodes: sends the queued frames, hands the frames received to the
+ * endpoints and polls them until \p receiver has a message or failed, or \p ms passed. A pass
+ * of the loop takes 10us.
+ * @return State of the message received by \p receiver
+ */
+static CAN_TP_State run(CAN_TP_Context *receiver, uint16_t *len, uint32_t ms) {
+	uint32_t start = HAL_GetTick();
+	CAN_Bus_Frame frame;
+	CAN_TP_State state;
+
+	do {
+		can_sim_transmit();
+		while (can_bus_receive(&frame)) {
+			if (frame.id == a.rx_id) {
+				can_tp_on_frame(&a, &frame);
+			} else if (frame.id == b.rx_id) {
+				can_tp_on_frame(&b, &frame);
+			}
+		}
+		can_tp_poll(&a);
+		can_tp_poll(&b);
+
+		state = can_tp_receive(receiver, len);
+		if (state == CAN_TP_DONE || state == CAN_TP_ERROR) {
+			break;
+		}
+
+		// the rest of the main loop
+		host_advance(SystemCoreClock / 100000);
+	} while (HAL_GetTick() - start < ms);
+
+	// the frames still queued
+	can_sim_run();
+
+	return state;
+}
+
+static void test_long_message(void) {
+	uint16_t len = 0;
+	uint64_t start;
+	uint32_t us;
+	uint32_t consecutive = (MESSAGE - 6 + 6) / 7;
+
+	setup();
+	start = host_now_us();
+	CHECK(can_tp_send(&a, message, MESSAGE));
+	CHECK(can_tp_tx_state(&a) == CAN_TP_BUSY);
+	CHECK(!can_tp_send(&a, message, 10));
+
+	CHECK(run(&b, &len, 2 * CAN_TP_TIMEOUT_MS) == CAN_TP_DONE);
+	us = host_now_us() - start;
+	CHECK(len == MESSAGE);
+	CHECK(memcmp(buffer_b, message, MESSAGE) == 0);
+	CHECK(can_tp_tx_state(&a) == CAN_TP_DONE);
+
+	// first frame, consecutive frames, flow control after the first frame and every block
+	CHECK(can_sim.sent_count == 1 + consecutive + flow_controls);
+	CHECK(flow_controls == 1 + (CAN_TP_BLOCK_SIZE ?
+			(consecutive - 1) / CAN_TP_BLOCK_SIZE : 0));
+#if CAN_TP_STMIN >= 0xF1 && CAN_TP_STMIN <= 0xF9
+	// STmin between the consecutive frames, except the first one after a flow control
+	CHECK(us >= (consecutive - flow_controls) * (CAN_TP_STMIN - 0xF0) * 100);
+#endif
+	CHECK(can_bus_counters()->dropped[0] == 0);
+	printf("%u bytes in %u frames (%u flow control), %u us: %u byte/s\n", MESSAGE,
+			can_sim.sent_count, flow_controls, us,
+			(uint32_t) ((uint64_t) MESSAGE * 1000000 / us));
+
+	// the other way round, and a single frame
+	CHECK(can_tp_send(&b, message + 1, 99));
+	CHECK(run(&a, &len, 2 * CAN_TP_TIMEOUT_MS) == CAN_TP_DONE);
+	CHECK(len == 99 && memcmp(buffer_a, message + 1, 99) == 0);
+	CHECK(can_tp_send(&a, message + 2, 5));
+	CHECK(can_tp_tx_state(&a) == CAN_TP_DONE);
+	CHECK(run(&b, &len, 10) == CAN_TP_DONE);
+	CHECK(len == 5 && memcmp(buffer_b, message + 2, 5) == 0);
+
+	// nothing left
+	CHECK(run(&b, &len, 10) == CAN_TP_IDLE);
+	CHECK(can_tp_receive(&a, &len) == CAN_TP_IDLE);
+}
+
+static void test_overflow(void) {
+	uint16_t len;
+
+	setup();
+
+	// 500 bytes don't fit into the 100 bytes of a
+	CHECK(can_tp_send(&b, message, 500));
+	CHECK(run(&a, &len, 2 * CAN_TP_TIMEOUT_MS) == CAN_TP_ERROR);
+	run(&b, &len, 10);
+	CHECK(can_tp_tx_state(&b) == CAN_TP_ERROR);
+	CHECK(flow_controls == 1);
+
+	// both are ready for the next message
+	CHECK(can_tp_send(&b, message, 100));
+	CHECK(run(&a, &len, 2 * CAN_TP_TIMEOUT_MS) == CAN_TP_DONE);
+	CHECK(len == 100 && memcmp(buffer_a, message, 100) == 0);
+}
+
+static void test_not_collected(void) {
+	uint16_t len;
+
+	setup();
+
+	// b doesn't collect the first message
+	CHECK(can_tp_send(&a, message + 2, 5));
+	CHECK(run(&a, &len, 10) == CAN_TP_IDLE);
+
+	// a single frame is ignored, a first frame refused with an overflow
+	CHECK(can_tp_send(&a, message + 3, 3));
+	CHECK(run(&a, &len, 10) == CAN_TP_IDLE);
+	CHECK(can_tp_send(&a, message, 100));
+	CHECK(run(&a, &len, 10) == CAN_TP_IDLE);
+	CHECK(can_tp_tx_state(&a) == CAN_TP_ERROR);
+	CHECK(flow_controls == 1);
+
+	// the first message is intact, then the next one is received
+	CHECK(can_tp_receive(&b, &len) == CAN_TP_DONE);
+	CHECK(len == 5 && memcmp(buffer_b, message + 2, 5) == 0);
+	CHECK(can_tp_send(&a, message, 100));
+	CHECK(run(&b, &len, 2 * CAN_TP_TIMEOUT_MS) == CAN_TP_DONE);
+	CHECK(len == 100 && memcmp(buffer_b, message, 100) == 0);
+}
+
+static void test_timeout(void) {
+	CAN_Bus_Frame frame;
+	uint32_t start;
+
+	setup();
+
+	// nobody answers the first frame
+	start = HAL_GetTick();
+	CHECK(can_tp_send(&a, message, 100));
+	can_sim_run();
+	while (can_tp_tx_state(&a) == CAN_TP_BUSY
+			&& HAL_GetTick() - start < 2 * CAN_TP_TIMEOUT_MS) {
+		while (can_bus_receive(&frame)) {
+		}
+		can_tp_poll(&a);
+		host_advance_ms(1);
+	}
+	CHECK(can_tp_tx_state(&a) == CAN_TP_ERROR);
+	CHECK(HAL_GetTick() - start >= CAN_TP_TIMEOUT_MS);
+	CHECK(HAL_GetTick() - start <= CAN_TP_TIMEOUT_MS + 2);
+}
+
+int main(void) {
+	test_long_message();
+	test_overflow();
+	test_not_collected();
+	test_timeout();
+
+	return host_report("can_tp");
+}
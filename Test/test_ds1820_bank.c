@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ * @file    test_ds1820_bank.c
+ * @brief  Sensor bank driven by ds1820_bank_poll() on simulated sensors
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The bank runs on the simulated sensors of onewire_sim.c for a minute of simulated time, polled
+ * every millisecond like from the main loop. The slots do not all become due at the same time
+ * (the families differ in their conversion times), so the ROM verification finds some of them
+ * converting.
+ *
+ * The samples per second each slot gets from ds1820_bank_poll() are printed next to those of the
+ * fixed start/wait 750ms/read cycle.
+ *
+ * The sensors are addressed by SKIP ROM, so once every slot has its ROM there must not be any
+ * SEARCH ROM until a slot fails: the bus time of a refresh cycle (read and start of the due
+ * slots) has to stay below the time of a single ROM search.
+ *
+ * The slots are read and started in parallel, so a refresh cycle of 16 slots has to take the
+ * same bus time as one of a single slot.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "ds1820_bank.h"
+#include "onewire_sim.h"
+
+#define SLOTS	4
+
+static DS1820_Bank_Context ctx;
+static uint64_t bus_us;			// time spent in ds1820_bank_poll() talking to the sensors
+static uint32_t cycles;			// calls of ds1820_bank_poll() that talked to the sensors
+
+static void setup(void) {
+	onewire_sim_init(GPIOB);
+	onewire_sim_attach(0, 0x28, 0x01, 20 * 16);
+	onewire_sim_attach(1, 0x28, 0x02, 40 * 16);
+	onewire_sim_attach(2, 0x10, 0x03, 60 * 16);
+	onewire_sim_attach(3, 0x28, 0x04, -5 * 16);
+
+	CHECK(ds1820_bank_init(&ctx, SLOTS, GPIOB));
+	bus_us = 0;
+	cycles = 0;
+}
+
+/**
+ * @return Number of SEARCH ROM commands all sensors received
+ */
+static uint32_t searches(void) {
+	uint32_t count = 0;
+
+	for (int i = 0; i < 16; i++) {
+		count += onewire_sim[i].searches;
+	}
+
+	return count;
+}
+
+/**
+ * Polls the bank every ms for \p ms.
+ * @param samples Incremented for every temperature update of a slot (may be NULL)
+ */
+static void run(uint32_t ms, uint32_t *samples) {
+	uint32_t start = HAL_GetTick();
+
+	while (HAL_GetTick() - start < ms) {
+		uint64_t before = host_now_us();
+		uint16_t updated = ds1820_bank_poll(&ctx);
+
+		if (host_now_us() != before) {
+			bus_us += host_now_us() - before;
+			cycles++;
+		}
+
+		for (int i = 0; samples && i < SLOTS; i++) {
+			samples[i] += (updated >> i) & 0x01;
+		}
+		host_advance_ms(1);
+	}
+}
+
+/**
+ * The fixed cycle of the main loop before ds1820_bank_poll(): start all, wait, read all.
+ * @param samples Incremented for every temperature update of a slot
+ */
+static void run_blocking(uint32_t ms, uint32_t *samples) {
+	uint32_t start = HAL_GetTick();
+
+	while (HAL_GetTick() - start < ms) {
+		ds1820_bank_start_conversions(&ctx);
+		HAL_Delay(750);
+
+		for (int i = 0; i < SLOTS; i++) {
+			samples[i] += ds1820_bank_update_temperature(&ctx, i);
+		}
+	}
+}
+
+static void test_samples_per_second(void) {
+	uint32_t polled[SLOTS] = { 0 };
+	uint32_t blocking[SLOTS] = { 0 };
+
+	setup();
+	ds1820_bank_request_precision(&ctx, 1, 1);
+	run(60000, polled);
+
+	setup();
+	ds1820_bank_request_precision(&ctx, 1, 1);
+	run_blocking(60000, blocking);
+
+	printf("samples/s per slot (60s):");
+	for (int i = 0; i < SLOTS; i++) {
+		printf("  %u: %.2f (blocking %.2f)", i, polled[i] / 60.0,
+				blocking[i] / 60.0);
+
+		CHECK(polled[i] >= blocking[i]);
+		CHECK(ctx.temperature[i] == onewire_sim[i].temperature);
+	}
+	printf("\n");
+}
+
+static void test_rate_of_change(void) {
+	uint32_t start;
+
+	setup();
+
+	// slot 0 warms up by 9/16 degC/s (just above DS1820_BANK_FAST_CHANGE), the others are constant
+	start = HAL_GetTick();
+	while (HAL_GetTick() - start < 30000) {
+		onewire_sim[0].temperature = 20 * 16 + (HAL_GetTick() - start) * 9 / 1000;
+		ds1820_bank_poll(&ctx);
+		host_advance_ms(1);
+	}
+
+	// at 12 bit, the readings are 0.8s apart and differ by less than DS1820_BANK_FAST_CHANGE
+	CHECK((ctx.adapt[0] & DS1820_BANK_ADAPT_RESOLUTION_MASK) + 9
+			== DS1820_BANK_RESOLUTION_HIGH);
+	CHECK((onewire_sim[0].scratchpad[4] & 0x60) == 0x60);
+	CHECK((ctx.adapt[1] & DS1820_BANK_ADAPT_RESOLUTION_MASK) + 9
+			== DS1820_BANK_RESOLUTION_LOW);
+	CHECK((ctx.adapt[3] & DS1820_BANK_ADAPT_RESOLUTION_MASK) + 9
+			== DS1820_BANK_RESOLUTION_LOW);
+	CHECK(ctx.temperature[0] > 20 * 16 + 29 * 9);
+}
+
+static void test_verify_roms(void) {
+	setup();
+	ds1820_bank_request_precision(&ctx, 1, 1);
+
+	// more than DS1820_BANK_ROM_CHECK_INTERVAL conversion requests
+	run(30000, NULL);
+
+	CHECK(ctx.temperature[0] == 20 * 16);
+	CHECK(ctx.temperature[1] == 40 * 16);
+	CHECK(ctx.temperature[2] == 60 * 16);
+	CHECK(ctx.temperature[3] == -5 * 16);
+
+	// the verification never resets a converting sensor
+	for (int i = 0; i < SLOTS; i++) {
+		CHECK(onewire_sim[i].disturbed == 0);
+	}
+
+	// a replaced sensor is noticed, although its slot is converting most of the time
+	onewire_sim_attach(1, 0x28, 0x22, 30 * 16);
+	CHECK(memcmp(ctx.rom[1], onewire_sim[1].rom, 8) != 0);
+	run(30000, NULL);
+
+	CHECK(memcmp(ctx.rom[1], onewire_sim[1].rom, 8) == 0);
+	CHECK(ctx.temperature[1] == 30 * 16);
+	for (int i = 0; i < SLOTS; i++) {
+		CHECK(onewire_sim[i].disturbed == 0);
+	}
+}
+
+static void test_rom_searches(void) {
+	uint64_t start;
+	uint32_t search_us;
+	uint32_t count;
+
+	setup();
+
+	// ds1820_bank_init() searches every slot once
+	CHECK(searches() == SLOTS);
+
+	run(30000, NULL);
+	CHECK(searches() == SLOTS);
+	CHECK(cycles > 0);
+
+	// a single search for comparison
+	start = host_now_us();
+	CHECK(ds1820_bank_check_rom(&ctx, 0, DS1820_BANK_REQUEST_NEW_ROM));
+	search_us = host_now_us() - start;
+	CHECK(searches() == SLOTS + 1);
+
+	printf("refresh cycle: %u us on the bus (ROM search: %u us)\n",
+			(uint32_t) (bus_us / cycles), search_us);
+	CHECK(bus_us / cycles < search_us);
+
+	// a slot without its sensor is searched until it is back, the others are not
+	onewire_sim[2].present = 0;
+	run(3000, NULL);
+	CHECK(onewire_sim[0].searches + onewire_sim[1].searches + onewire_sim[3].searches == 4);
+	CHECK(DS1820_BANK_ROM_STATE(&ctx, 2) == DS1820_STATE_ABSENT);
+	CHECK(ctx.temperature[2] == TM_DS18B20_TEMP_INVALID);
+
+	onewire_sim[2].present = 1;
+	run(3000, NULL);
+	CHECK(DS1820_BANK_ROM_STATE(&ctx, 2) == DS1820_STATE_OK);
+	CHECK(ctx.temperature[2] == 60 * 16);
+
+	count = searches();
+	run(30000, NULL);
+	CHECK(searches() == count);
+}
+
+/**
+ * Runs a bank of \p n DS18B20 slots for 10s.
+ * @return Average bus time of a refresh cycle in us
+ */
+static uint32_t refresh_time(uint8_t n) {
+	onewire_sim_init(GPIOB);
+	for (int i = 0; i < n; i++) {
+		onewire_sim_attach(i, 0x28, i, (20 + i) * 16);
+	}
+	CHECK(ds1820_bank_init(&ctx, n, GPIOB));
+	bus_us = 0;
+	cycles = 0;
+
+	run(10000, NULL);
+
+	CHECK(searches() == n);
+	for (int i = 0; i < n; i++) {
+		CHECK(ctx.temperature[i] == (20 + i) * 16);
+	}
+
+	return bus_us / cycles;
+}
+
+static void test_bank_size(void) {
+	uint32_t single = refresh_time(1);
+	uint32_t all = refresh_time(16);
+
+	printf("refresh cycle: %u us for 1 slot, %u us for 16 slots\n", single, all);
+	CHECK(all <= single + single / 100);
+}
+
+int main(void) {
+	timing_init();
+
+	test_samples_per_second();
+	test_rate_of_change();
+	test_verify_roms();
+	test_rom_searches();
+	test_bank_size();
+
+	return host_report("ds1820_bank");
+}
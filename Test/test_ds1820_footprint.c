@@ -0,0 +1,42 @@
+/**
+ ******************************************************************************
+ * @file    test_ds1820_footprint.c
+ * @brief  RAM taken by a DS1820_Bank_Context per slot
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Every slot has to take exactly #DS1820_BANK_SLOT_BYTES in the arrays of the context, without
+ * padding between or after them, and the part in front of the slots may only hold the counters
+ * and the port. The sizes are those of the host (64 bit pointers in the port), the slot arrays
+ * are the same on the target.
+ *
+ ******************************************************************************
+ */
+
+#include <stddef.h>
+#include "ds1820_bank.h"
+
+static DS1820_Bank_Context ctx;
+
+int main(void) {
+	size_t slots = sizeof(ctx) - offsetof(DS1820_Bank_Context, temperature);
+
+	// the members of a slot
+	CHECK(sizeof(ctx.temperature[0]) + sizeof(ctx.rom[0]) + sizeof(ctx.state[0])
+			+ sizeof(ctx.adapt[0]) + sizeof(ctx.due[0]) == DS1820_BANK_SLOT_BYTES);
+
+	// the slot arrays are packed
+	CHECK(slots == DS1820_BANK_SLOTS * DS1820_BANK_SLOT_BYTES);
+	CHECK(slots / DS1820_BANK_SLOTS == DS1820_BANK_SLOT_BYTES);
+
+	// n, the counters and the port in front of them
+	CHECK(offsetof(DS1820_Bank_Context, port) <= 8);
+	CHECK(offsetof(DS1820_Bank_Context, temperature)
+			== offsetof(DS1820_Bank_Context, port) + sizeof(TM_OneWire_t));
+
+	printf("DS1820_Bank_Context: %zu bytes (%zu in front of %u slots of %zu bytes)\n",
+			sizeof(ctx), sizeof(ctx) - slots, DS1820_BANK_SLOTS,
+			slots / DS1820_BANK_SLOTS);
+
+	return host_report("ds1820_footprint");
+}
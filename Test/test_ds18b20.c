@@ -0,0 +1,95 @@
+/**
+ ******************************************************************************
+ * @file    test_ds18b20.c
+ * @brief  Scratchpad decoding of the DS18S20 and DS18B20
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Every family has its own power-on value of the temperature register (85 degC), which is
+ * reported as #TM_DS18B20_ERR_NO_CONVERSION_YET. The power-on value of one family is a valid
+ * temperature of the other one.
+ *
+ ******************************************************************************
+ */
+
+#include "tm_stm32_ds18b20.h"
+
+/**
+ * Builds a scratchpad with the temperature register \p t, the configuration register
+ * \p config and a valid CRC.
+ */
+static void scratchpad(uint8_t *data, uint16_t t, uint8_t config) {
+	uint8_t rest[6] = { 0x4B, 0x46, config, 0xFF, 0x0C, 0x10 };
+
+	data[0] = t;
+	data[1] = t >> 8;
+	for (int i = 0; i < 6; i++) {
+		data[2 + i] = rest[i];
+	}
+	data[8] = TM_OneWire_CRC8(data, 8);
+}
+
+static void test_power_on(void) {
+	uint8_t data[9];
+	int16_t t = 0;
+
+	// DS18S20: 0x00AA, 0.5 degC per LSB
+	scratchpad(data, 0x00AA, 0xFF);
+	CHECK(TM_DS18S20_Decode(data, &t) == TM_DS18B20_ERR_NO_CONVERSION_YET);
+
+	// DS18B20: 0x0550, 1/16 degC per LSB
+	scratchpad(data, 0x0550, 0x7F);
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_ERR_NO_CONVERSION_YET);
+}
+
+static void test_other_family_default(void) {
+	uint8_t data[9];
+	int16_t t = 0;
+
+	// 10.625 degC on a DS18B20
+	scratchpad(data, 0x00AA, 0x7F);
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_SUCCESS);
+	CHECK(t == 0x00AA);
+
+	// 680 degC cannot be measured by a DS18S20, but it is no power-on value either
+	scratchpad(data, 0x0550, 0xFF);
+	CHECK(TM_DS18S20_Decode(data, &t) == TM_DS18B20_SUCCESS);
+	CHECK(t == 0x0550 * 8);
+}
+
+static void test_errors(void) {
+	uint8_t data[9] = { 0 };
+	int16_t t = 0;
+
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_ERR_CRC_INVALID);
+
+	scratchpad(data, 0x0191, 0x7F);		// 25.0625 degC
+	data[8] ^= 0x01;
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_ERR_CRC_INVALID);
+}
+
+static void test_temperatures(void) {
+	uint8_t data[9];
+	int16_t t = 0;
+
+	scratchpad(data, 0x0191, 0x7F);
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_SUCCESS);
+	CHECK(t == 25 * 16 + 1);
+
+	scratchpad(data, 0xFF5E, 0x7F);		// -10.125 degC
+	CHECK(TM_DS18B20_Decode(data, &t) == TM_DS18B20_SUCCESS);
+	CHECK(t == -162);
+
+	scratchpad(data, 0xFFF3, 0xFF);		// -6.5 degC on a DS18S20
+	CHECK(TM_DS18S20_Decode(data, &t) == TM_DS18B20_SUCCESS);
+	CHECK(t == -13 * 8);
+}
+
+int main(void) {
+	test_power_on();
+	test_other_family_default();
+	test_errors();
+	test_temperatures();
+
+	return host_report("ds18b20");
+}
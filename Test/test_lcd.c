@@ -0,0 +1,293 @@
+/**
+ ******************************************************************************
+ * @file    test_lcd.c
+ * @brief  HD44780 driver on the simulated display of lcd_sim.c
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The bytes queued by the driver are sent by the emulated TIM6 interrupt, the simulated display
+ * counts the instructions and characters it receives. The timer has to keep running for the
+ * shortest steps, too.
+ *
+ * Built once with the fixed delays and once with the busy flag polling (LCD_BUSY_FLAG, see the
+ * Makefile): with polling, no byte may reach the display before it finished the previous one,
+ * however long it takes, and the data pins have to be outputs again afterwards.
+ *
+ * The conversions of LCD_FB_printf() are checked on the display as well, and LCD_printf() has
+ * to pass the CGRAM characters of %c. LCD_FB_FLUSH() has to send no more than
+ * the changed cells (plus a cursor command where a run of them begins), and the display has to
+ * show the framebuffer afterwards.
+ *
+ ******************************************************************************
+ */
+
+#include "HD44780.h"
+#include "lcd_sim.h"
+
+#define WAIT_MS		2000
+
+static void setup(void) {
+	lcd_sim_init();
+	LCD_INIT();
+	CHECK(lcd_sim_wait(WAIT_MS));
+	CHECK(lcd_sim.four_bit);
+}
+
+/**
+ * @return Number of bytes the display received since the last call
+ */
+static uint32_t bus_writes(void) {
+	static uint32_t last;
+	uint32_t writes = lcd_sim.commands + lcd_sim.characters;
+	uint32_t delta = writes - last;
+
+	last = writes;
+
+	return delta;
+}
+
+/**
+ * Sends the framebuffer.
+ * @return Bus writes counted by LCD_FB_FLUSH(), checked against the display
+ */
+static uint16_t flush(void) {
+	uint16_t writes;
+
+	bus_writes();
+	writes = LCD_FB_FLUSH();
+	CHECK(lcd_sim_wait(WAIT_MS));
+	CHECK(bus_writes() == writes);
+
+	return writes;
+}
+
+/**
+ * @return 1 if the display shows \p text at \p row, \p column
+ */
+static int shows(uint8_t row, uint8_t column, const char *text) {
+	while (*text) {
+		if (lcd_sim_char(row, column++) != (uint8_t) *text++) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void test_schedule(void) {
+	uint64_t start;
+
+	// before LCD_INIT(), which waits for the queue: no busy flag polling, 1MHz counter clock
+	lcd_sim_init();
+	TIM6->PSC = HAL_RCC_GetPCLK1Freq() / 1000000 - 1;
+	start = host_now_us();
+	LCD_CMD(0x0C);
+
+	// 1us steps would leave ARR 0, the shortest step is 2us
+	CHECK(lcd_sim_wait(WAIT_MS));
+	CHECK(lcd_sim.stalls == 0);
+	CHECK(lcd_sim.interrupts == 5);
+	CHECK(host_now_us() - start == 4 * 2 + 40);
+}
+
+static void test_framebuffer_diff(void) {
+	uint16_t full, diff;
+
+	setup();
+
+	// blank after the initialization, nothing to send
+	CHECK(shows(0, 0, "                "));
+	CHECK(flush() == 0);
+
+	// one run per row, the cursor is at home already for the first one
+	LCD_FB_LOCATE(0, 0);
+	LCD_FB_printstring("Kessel:62.5");
+	LCD_FB_LOCATE(1, 0);
+	LCD_FB_printstring("Vorlauf:48.0");
+	CHECK(flush() == 11 + 1 + 12);
+	CHECK(shows(0, 0, "Kessel:62.5     "));
+	CHECK(shows(1, 0, "Vorlauf:48.0    "));
+
+	// the same content again: nothing changed
+	LCD_FB_LOCATE(0, 0);
+	LCD_FB_printstring("Kessel:62.5");
+	CHECK(flush() == 0);
+
+	// a single digit: cursor command + 1 character
+	LCD_FB_LOCATE(0, 10);
+	LCD_FB_printchar('7');
+	CHECK(flush() == 2);
+	CHECK(shows(0, 0, "Kessel:62.7     "));
+
+	// two separate runs of the same row need a cursor command each
+	LCD_FB_LOCATE(1, 9);
+	LCD_FB_printstring("7.5");
+	CHECK(flush() == 2 + 2);
+	CHECK(shows(1, 0, "Vorlauf:47.5    "));
+
+	// every row needs a cursor command of its own
+	LCD_FB_LOCATE(2, 0);
+	LCD_FB_printstring("ab");
+	LCD_FB_LOCATE(3, 0);
+	LCD_FB_printstring("cd");
+	CHECK(flush() == 2 + 2 + 2);
+
+	// full repaint: more bytes than the queue holds
+	LCD_FB_INVALIDATE();
+	full = flush();
+	CHECK(full == LCD_ROWS * (LCD_COLS + 1));
+	CHECK(shows(0, 0, "Kessel:62.7     "));
+	CHECK(shows(3, 0, "cd              "));
+
+	LCD_FB_LOCATE(0, 10);
+	LCD_FB_printchar('8');
+	diff = flush();
+
+	printf("bus writes per flush: full %u, one changed cell %u\n", full, diff);
+	CHECK(lcd_sim.violations == 0);
+	CHECK(lcd_sim.conflicts == 0);
+}
+
+/**
+ * Repaints the whole display with a display taking \p exec_us per instruction.
+ * @return Time in us
+ */
+static uint32_t repaint(uint32_t exec_us) {
+	uint64_t start;
+
+	// the previous instruction is done
+	host_advance_ms(2);
+	lcd_sim.exec_us = exec_us;
+	lcd_sim.violations = 0;
+	lcd_sim.reads = 0;
+
+	start = host_now_us();
+	LCD_FB_INVALIDATE();
+	flush();
+
+	return host_now_us() - start;
+}
+
+static void test_busy_flag(void) {
+	uint32_t slow_us, fast_us;
+
+	setup();
+	LCD_FB_printstring("Busy flag");
+
+	slow_us = repaint(100);
+#if LCD_BUSY_FLAG
+	// the writes wait for the display, one read per byte at least
+	CHECK(lcd_sim.violations == 0);
+	CHECK(lcd_sim.reads >= LCD_ROWS * (LCD_COLS + 1));
+#else
+	// the fixed LCD_EXEC_TIME is too short for this display
+	CHECK(lcd_sim.violations > 0);
+	CHECK(lcd_sim.reads == 0);
+#endif
+
+	fast_us = repaint(10);
+	CHECK(lcd_sim.violations == 0);
+
+	// R/W and the data pins are back to writing
+	CHECK(!(GPIOC->ODR & LCD_RW));
+	CHECK((GPIOB->MODER & 0xFF) == 0x55);
+	CHECK(lcd_sim.conflicts == 0);
+	CHECK(shows(0, 0, "Busy flag       "));
+
+	printf("full repaint (%s): %u us with a 100us display, %u us with a 10us display\n",
+			LCD_BUSY_FLAG ? "busy flag" : "fixed delays", slow_us, fast_us);
+}
+
+/**
+ * @return 1 if row \p row of the display shows \p text, padded with spaces
+ */
+static int row_shows(uint8_t row, const char *text) {
+	char padded[LCD_COLS + 1];
+
+	snprintf(padded, sizeof(padded), "%-16s", text);
+
+	return shows(row, 0, padded);
+}
+
+/* LCD_FB_printf() into a cleared framebuffer, sent to the display */
+#define FB_PRINTF(...)	do { \
+		LCD_FB_CLEAR(); \
+		LCD_FB_printf(__VA_ARGS__); \
+		flush(); \
+	} while (0)
+
+static void test_printf(void) {
+	char longer[] = "0123456789abcdefghij";
+
+	setup();
+
+	FB_PRINTF("%d|%i|%d", 0, -1, 12345);
+	CHECK(row_shows(0, "0|-1|12345"));
+	FB_PRINTF("%d", (int) INT32_MIN);
+	CHECK(row_shows(0, "-2147483648"));
+	FB_PRINTF("%u|%x|%X", 4294967295u, 0xbeef, 0xBEEF);
+	CHECK(row_shows(0, "4294967295|beef|BEEF"));
+
+	// field widths and flags, widths are limited to a row
+	FB_PRINTF("%4d|%-4d|%04d|", -42, -42, -42);
+	CHECK(row_shows(0, " -42|-42 |-042|"));
+	FB_PRINTF("%20d", 7);
+	CHECK(row_shows(0, "               7"));
+	FB_PRINTF("%s|%-4s|%3s", "ab", "cd", "e");
+	CHECK(row_shows(0, "ab|cd  |  e"));
+	FB_PRINTF("%s", longer);
+	CHECK(row_shows(0, "0123456789abcdef"));
+
+	// characters, '%%', unsupported conversions and a '%' at the end
+	FB_PRINTF("%c%c%%%q", 'o', 'k');
+	CHECK(row_shows(0, "ok%q"));
+	FB_PRINTF("end%");
+	CHECK(row_shows(0, "end"));
+	FB_PRINTF("a\nb");
+	CHECK(row_shows(0, "a"));
+	CHECK(row_shows(1, "b"));
+
+	// fixed-point values in 1/16: 21.5625, -0.0625, -5.5, rounded to the precision
+	FB_PRINTF("%T|%.2T|%.0T", 345, 345, 345);
+	CHECK(row_shows(0, "21.6|21.56|22"));
+	FB_PRINTF("%T|%.0T|%T", -1, -1, 0);
+	CHECK(row_shows(0, "-0.1|0|0.0"));
+	FB_PRINTF("%6.1T|%06.1T|", -88, -88);
+	CHECK(row_shows(0, "  -5.5|-005.5|"));
+	FB_PRINTF("%-6T|", -88);
+	CHECK(row_shows(0, "-5.5  |"));
+
+	// the whole int32_t range, rounding up to the next integer
+	FB_PRINTF("%.4T", (int) INT32_MAX);
+	CHECK(row_shows(0, "134217727.9375"));
+	FB_PRINTF("%.4T", (int) INT32_MIN);
+	CHECK(row_shows(0, "-134217728.0000"));
+	FB_PRINTF("%.0T", (int) INT32_MAX);
+	CHECK(row_shows(0, "134217728"));
+	FB_PRINTF("%.2T\n%.0T", -0x7FFFFFF, -0x7FFFFFF);
+	CHECK(row_shows(0, "-8388607.94"));
+	CHECK(row_shows(1, "-8388608"));
+
+	// LCD_printf(): %c passes the CGRAM characters, other control characters are dropped
+	LCD_LOCATE(1, 0);
+	LCD_printf("%c%c%c|", 0, 7, 0x1B);
+	CHECK(lcd_sim_wait(WAIT_MS));
+	CHECK(lcd_sim_char(1, 0) == 0);
+	CHECK(lcd_sim_char(1, 1) == 7);
+	CHECK(lcd_sim_char(1, 2) == '|');
+}
+
+int main(void) {
+	test_schedule();
+	if (lcd_sim.stalls) {
+		// LCD_INIT() would wait forever
+		return host_report("lcd");
+	}
+	test_framebuffer_diff();
+	test_busy_flag();
+	test_printf();
+
+	lcd_sim_stop();
+
+	return host_report("lcd");
+}
@@ -0,0 +1,242 @@
+/**
+ ******************************************************************************
+ * @file    test_onewire_async.c
+ * @brief  Timer driven onewire state machine on a simulated clock
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Instead of TIM7, run() calls onewire_async_step() and lets exactly the returned time pass
+ * on the simulated clock. The sensors of onewire_sim.c answer on the simulated port, so the
+ * queue order, the results, the callbacks and the bus time of the transactions can be checked.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "onewire_async.h"
+#include "tm_stm32_ds18b20.h"
+#include "onewire_sim.h"
+
+static TM_OneWire_t bus[4];
+
+static OneWire_Async_Transaction *finished[8];
+static int finished_count;
+
+static OneWire_Async_Transaction resubmitted;
+
+static void record(OneWire_Async_Transaction *t) {
+	finished[finished_count++] = t;
+}
+
+static void record_and_resubmit(OneWire_Async_Transaction *t) {
+	record(t);
+	CHECK(onewire_async_submit(&resubmitted));
+}
+
+/**
+ * Drives the state machine like the timer interrupt until there is nothing left to do.
+ * @return Time taken in us
+ */
+static uint64_t run(void) {
+	uint64_t start = host_now_us();
+	uint16_t us;
+
+	while ((us = onewire_async_step()) != 0) {
+		onewire_sim_update();	// the edge just done happens now
+		host_advance(us * (SystemCoreClock / 1000000));
+	}
+
+	return host_now_us() - start;
+}
+
+static void setup(void) {
+	onewire_sim_init(GPIOB);
+	onewire_sim_attach(0, 0x28, 0x01, 25 * 16);
+	onewire_sim_attach(1, 0x28, 0x02, -10 * 16);
+	onewire_sim_attach(2, 0x10, 0x03, 85 * 16);
+	// nothing on pin 3
+
+	for (int pin = 0; pin < 4; pin++) {
+		TM_OneWire_Init(&bus[pin], GPIOB, 1 << pin);
+	}
+
+	finished_count = 0;
+}
+
+/**
+ * @return Time in us to write \p byte: 65us per 1 bit, 70us per 0 bit
+ */
+static uint64_t write_time(uint8_t byte) {
+	uint64_t us = 0;
+
+	for (int bit = 0; bit < 8; bit++) {
+		us += byte & (1 << bit) ? 65 : 70;
+	}
+
+	return us;
+}
+
+/**
+ * Bus time of a transaction: reset and presence, the bytes written, then 63us per bit read.
+ */
+static uint64_t duration(OneWire_Async_Transaction *t) {
+	uint64_t us = 480 + 70 + 410 + 2;
+
+	if (t->rom) {
+		us += write_time(ONEWIRE_CMD_MATCHROM);
+		for (int i = 0; i < 8; i++) {
+			us += write_time(t->rom[i]);
+		}
+	} else {
+		us += write_time(ONEWIRE_CMD_SKIPROM);
+	}
+
+	us += write_time(t->command);
+	for (int i = 0; i < t->tx_len; i++) {
+		us += write_time(t->tx[i]);
+	}
+
+	return us + 8 * t->rx_len * 63;
+}
+
+static void test_transaction(void) {
+	uint8_t data[9];
+	OneWire_Async_Transaction read = { .onewire = &bus[0], .command =
+			ONEWIRE_CMD_RSCRATCHPAD, .rx = data, .rx_len = 9 };
+
+	setup();
+	CHECK(onewire_async_submit(&read));
+	CHECK(onewire_async_busy());
+	CHECK(run() == duration(&read));
+
+	CHECK(read.state == ONEWIRE_ASYNC_DONE);
+	CHECK(!onewire_async_busy());
+	CHECK(memcmp(data, onewire_sim[0].scratchpad, 9) == 0);
+	CHECK(onewire_sim[0].received[0] == ONEWIRE_CMD_SKIPROM);
+	CHECK(onewire_sim[0].received[1] == ONEWIRE_CMD_RSCRATCHPAD);
+}
+
+static void test_match_rom_and_tx(void) {
+	uint8_t config[3] = { 0x11, 0x22, 0x1F };
+	OneWire_Async_Transaction write = { .onewire = &bus[1], .rom =
+			onewire_sim[1].rom, .command = ONEWIRE_CMD_WSCRATCHPAD, .tx = config,
+			.tx_len = 3 };
+
+	setup();
+	write.rom = onewire_sim[1].rom;
+	CHECK(onewire_async_submit(&write));
+	CHECK(run() == duration(&write));
+
+	CHECK(write.state == ONEWIRE_ASYNC_DONE);
+	CHECK(onewire_sim[1].received_count == 1 + 8 + 1 + 3);
+	CHECK(onewire_sim[1].received[0] == ONEWIRE_CMD_MATCHROM);
+	CHECK(memcmp(&onewire_sim[1].scratchpad[2], config, 3) == 0);
+}
+
+static void test_queue_order(void) {
+	uint8_t data[9];
+	uint8_t other[9];
+	OneWire_Async_Transaction convert = { .onewire = &bus[1], .command =
+			DS18B20_CMD_CONVERTTEMP, .callback = record_and_resubmit };
+	OneWire_Async_Transaction absent = { .onewire = &bus[3], .command =
+			ONEWIRE_CMD_RSCRATCHPAD, .rx = data, .rx_len = 9, .callback = record };
+	OneWire_Async_Transaction read = { .onewire = &bus[2], .command =
+			ONEWIRE_CMD_RSCRATCHPAD, .rx = data, .rx_len = 9, .callback = record };
+	uint64_t expected;
+
+	setup();
+
+	resubmitted = (OneWire_Async_Transaction ) { .onewire = &bus[0], .command =
+					ONEWIRE_CMD_RSCRATCHPAD, .rx = other, .rx_len = 9, .callback = record };
+
+	CHECK(onewire_async_submit(&convert));
+	CHECK(onewire_async_submit(&absent));
+	CHECK(onewire_async_submit(&read));
+
+	// no presence: the transaction ends after the reset
+	expected = duration(&convert) + 2 + 960 + 2 + duration(&read) + 2
+			+ duration(&resubmitted);
+	CHECK(run() == expected);
+
+	// the callback of the first one submitted the last one, while the others were queued
+	CHECK(finished_count == 4);
+	CHECK(finished[0] == &convert);
+	CHECK(finished[1] == &absent);
+	CHECK(finished[2] == &read);
+	CHECK(finished[3] == &resubmitted);
+
+	CHECK(convert.state == ONEWIRE_ASYNC_DONE);
+	CHECK(absent.state == ONEWIRE_ASYNC_NO_PRESENCE);
+	CHECK(read.state == ONEWIRE_ASYNC_DONE);
+	CHECK(resubmitted.state == ONEWIRE_ASYNC_DONE);
+
+	CHECK(onewire_sim[1].conversions == 1);
+	CHECK(onewire_sim[0].resets == 1);
+	CHECK(memcmp(data, onewire_sim[2].scratchpad, 9) == 0);
+	CHECK(memcmp(other, onewire_sim[0].scratchpad, 9) == 0);
+}
+
+static void test_resubmit_from_last(void) {
+	uint8_t other[9];
+	OneWire_Async_Transaction convert = { .onewire = &bus[1], .command =
+			DS18B20_CMD_CONVERTTEMP, .callback = record_and_resubmit };
+
+	setup();
+	resubmitted = (OneWire_Async_Transaction ) { .onewire = &bus[0], .command =
+					ONEWIRE_CMD_RSCRATCHPAD, .rx = other, .rx_len = 9, .callback = record };
+
+	// the queue is empty when the callback submits
+	CHECK(onewire_async_submit(&convert));
+	CHECK(run() == duration(&convert) + 2 + duration(&resubmitted));
+
+	CHECK(finished_count == 2);
+	CHECK(finished[1] == &resubmitted);
+	CHECK(onewire_sim[0].resets == 1);
+	CHECK(!onewire_async_busy());
+}
+
+static void test_queue_full(void) {
+	OneWire_Async_Transaction t[ONEWIRE_ASYNC_QUEUE_LENGTH + 2];
+
+	setup();
+	for (int i = 0; i < ONEWIRE_ASYNC_QUEUE_LENGTH + 2; i++) {
+		t[i] = (OneWire_Async_Transaction ) { .onewire = &bus[3], .command =
+						ONEWIRE_CMD_SKIPROM };
+	}
+
+	// one running, ONEWIRE_ASYNC_QUEUE_LENGTH waiting
+	for (int i = 0; i < ONEWIRE_ASYNC_QUEUE_LENGTH + 1; i++) {
+		CHECK(onewire_async_submit(&t[i]));
+	}
+	CHECK(!onewire_async_submit(&t[ONEWIRE_ASYNC_QUEUE_LENGTH + 1]));
+
+	run();
+	for (int i = 0; i < ONEWIRE_ASYNC_QUEUE_LENGTH + 1; i++) {
+		CHECK(t[i].state == ONEWIRE_ASYNC_NO_PRESENCE);
+	}
+}
+
+static void test_usart_bus_rejected(void) {
+	TM_OneWire_t usart_bus = { .GPIOx = NULL, .USARTx = USART2 };
+	OneWire_Async_Transaction t = { .onewire = &usart_bus, .command =
+			ONEWIRE_CMD_SKIPROM };
+
+	setup();
+	CHECK(!onewire_async_submit(&t));
+	CHECK(!onewire_async_busy());
+	CHECK(onewire_async_transfer(&t) == ONEWIRE_ASYNC_PENDING);
+}
+
+int main(void) {
+	timing_init();
+	onewire_async_init();
+
+	test_transaction();
+	test_match_rom_and_tx();
+	test_queue_order();
+	test_resubmit_from_last();
+	test_queue_full();
+	test_usart_bus_rejected();
+
+	return host_report("onewire_async");
+}
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * @file    test_onewire_crc.c
+ * @brief  CRC8 variants against the bitwise reference, with a micro-benchmark
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Built once per ONEWIRE_CRC8 setting (see the Makefile). TM_OneWire_CRC8() is compared with a
+ * bitwise reference for every input of up to 2 bytes, which covers every (CRC, byte) pair of a
+ * single step, and for every 3 byte input. The benchmark prints the host time per scratchpad,
+ * run all variants to compare them.
+ *
+ ******************************************************************************
+ */
+
+#include <time.h>
+#include "tm_stm32_onewire.h"
+
+#define BENCHMARK_RUNS	2000000
+
+static const char *variant[] = { "bitwise", "nibble", "table" };
+
+static uint8_t reference(const uint8_t *data, int len) {
+	uint8_t crc = 0;
+
+	while (len--) {
+		uint8_t byte = *data++;
+
+		for (int bit = 0; bit < 8; bit++) {
+			uint8_t mix = (crc ^ byte) & 0x01;
+
+			crc >>= 1;
+			if (mix) {
+				crc ^= 0x8C;
+			}
+			byte >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+static void test_exhaustive(void) {
+	uint8_t data[3];
+	uint32_t mismatches = 0;
+
+	CHECK(TM_OneWire_CRC8(data, 0) == 0);
+
+	for (uint32_t i = 0; i < 0x100; i++) {
+		data[0] = i;
+		mismatches += TM_OneWire_CRC8(data, 1) != reference(data, 1);
+	}
+
+	for (uint32_t i = 0; i < 0x10000; i++) {
+		data[0] = i;
+		data[1] = i >> 8;
+		mismatches += TM_OneWire_CRC8(data, 2) != reference(data, 2);
+	}
+
+	for (uint32_t i = 0; i < 0x1000000; i++) {
+		data[0] = i;
+		data[1] = i >> 8;
+		data[2] = i >> 16;
+		mismatches += TM_OneWire_CRC8(data, 3) != reference(data, 3);
+	}
+
+	CHECK(mismatches == 0);
+}
+
+static void test_rom(void) {
+	// ROM of a DS18B20, the last byte is the CRC of the others
+	uint8_t rom[8] = { 0x28, 0xFF, 0x4B, 0x6A, 0x61, 0x16, 0x04, 0x00 };
+
+	rom[7] = reference(rom, 7);
+	CHECK(TM_OneWire_CRC8(rom, 7) == rom[7]);
+	CHECK(TM_OneWire_CRC8(rom, 8) == 0);
+
+	rom[3] ^= 0x10;
+	CHECK(TM_OneWire_CRC8(rom, 8) != 0);
+}
+
+static void benchmark(void) {
+	uint8_t scratchpad[9] = { 0x50, 0x05, 0x4B, 0x46, 0x7F, 0xFF, 0x0C, 0x10, 0x1C };
+	volatile uint8_t sink = 0;
+	struct timespec start, end;
+	double ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < BENCHMARK_RUNS; i++) {
+		scratchpad[0] = i;
+		sink ^= TM_OneWire_CRC8(scratchpad, 8);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+	printf("CRC8 %s: %.1f ns per scratchpad (host)\n", variant[ONEWIRE_CRC8],
+			ns / BENCHMARK_RUNS);
+	(void) sink;
+}
+
+int main(void) {
+	test_exhaustive();
+	test_rom();
+	benchmark();
+
+	return host_report("onewire_crc");
+}
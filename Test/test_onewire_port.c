@@ -0,0 +1,203 @@
+/**
+ ******************************************************************************
+ * @file    test_onewire_port.c
+ * @brief  Port-parallel onewire engine against the serial TM onewire path
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Runs the same transactions once through onewire_port.c for all pins at once and once through
+ * tm_stm32_onewire.c pin by pin, both on the simulated sensors of onewire_sim.c, and compares
+ * the results. Also checks that a parallel transaction takes as long for one pin as for 16.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "onewire_port.h"
+#include "tm_stm32_ds18b20.h"
+#include "onewire_sim.h"
+
+#define PINS_ATTACHED	0xFFDF	// every pin but Px5 carries a sensor
+
+static void attach_all(void) {
+	onewire_sim_init(GPIOB);
+
+	for (int pin = 0; pin < 16; pin++) {
+		if (PINS_ATTACHED & (1 << pin)) {
+			onewire_sim_attach(pin, pin & 1 ? 0x10 : 0x28, 0x40 + pin,
+					16 * pin - 100);
+		}
+	}
+}
+
+/**
+ * Reads the ROM (READ ROM) of every pin, all pins at once.
+ */
+static uint16_t read_roms_parallel(uint8_t rom[16][8]) {
+	TM_OneWire_t port;
+	uint8_t bytes[ONEWIRE_PORT_PINS];
+	uint16_t present;
+
+	onewire_port_init(&port, GPIOB, 0xFFFF);
+	present = onewire_port_reset(&port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_READROM);
+
+	for (int j = 0; j < 8; j++) {
+		onewire_port_read_bytes(&port, bytes);
+
+		for (int pin = 0; pin < 16; pin++) {
+			rom[pin][j] = bytes[pin];
+		}
+	}
+
+	return present;
+}
+
+/**
+ * Reads the ROM of every pin one after another with the TM onewire library.
+ */
+static uint16_t read_roms_serial(uint8_t rom[16][8]) {
+	uint16_t present = 0;
+
+	for (int pin = 0; pin < 16; pin++) {
+		TM_OneWire_t onewire;
+
+		TM_OneWire_Init(&onewire, GPIOB, 1 << pin);
+		if (TM_OneWire_Reset(&onewire) == 0) {
+			present |= 1 << pin;
+		}
+		TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_READROM);
+		TM_OneWire_ReadBytes(&onewire, rom[pin], 8);
+	}
+
+	return present;
+}
+
+/**
+ * Reads the scratchpads of the pins in \p pins at once.
+ * @return Time taken in us
+ */
+static uint64_t read_scratchpads_parallel(uint16_t pins, uint8_t data[16][9]) {
+	TM_OneWire_t port;
+	uint8_t bytes[ONEWIRE_PORT_PINS];
+	uint64_t start;
+
+	onewire_port_init(&port, GPIOB, pins);
+
+	start = host_now_us();
+	onewire_port_reset(&port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_SKIPROM);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_RSCRATCHPAD);
+
+	for (int j = 0; j < 9; j++) {
+		onewire_port_read_bytes(&port, bytes);
+
+		for (int pin = 0; pin < 16; pin++) {
+			data[pin][j] = bytes[pin];
+		}
+	}
+
+	return host_now_us() - start;
+}
+
+static void test_roms(void) {
+	uint8_t parallel[16][8];
+	uint8_t serial[16][8];
+	uint16_t present;
+
+	attach_all();
+	present = read_roms_parallel(parallel);
+	CHECK(present == PINS_ATTACHED);
+
+	CHECK(read_roms_serial(serial) == present);
+
+	for (int pin = 0; pin < 16; pin++) {
+		if (present & (1 << pin)) {
+			CHECK(memcmp(parallel[pin], onewire_sim[pin].rom, 8) == 0);
+			CHECK(memcmp(parallel[pin], serial[pin], 8) == 0);
+		} else {
+			// nobody pulls the line low: all ones
+			CHECK(parallel[pin][0] == 0xFF && serial[pin][0] == 0xFF);
+		}
+	}
+}
+
+static void test_write_bytes(void) {
+	TM_OneWire_t port;
+	uint8_t bytes[ONEWIRE_PORT_PINS];
+
+	attach_all();
+	for (int pin = 0; pin < 16; pin++) {
+		bytes[pin] = 0x11 * pin ^ 0xA5;
+	}
+
+	onewire_port_init(&port, GPIOB, PINS_ATTACHED);
+	onewire_port_reset(&port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_SKIPROM);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_WSCRATCHPAD);
+	onewire_port_write_bytes(&port, bytes);
+
+	for (int pin = 0; pin < 16; pin++) {
+		OneWire_Sim_Device *dev = &onewire_sim[pin];
+
+		if (!(PINS_ATTACHED & (1 << pin))) {
+			continue;
+		}
+
+		CHECK(dev->received_count == 3);
+		CHECK(dev->received[0] == ONEWIRE_CMD_SKIPROM);
+		CHECK(dev->received[1] == ONEWIRE_CMD_WSCRATCHPAD);
+		CHECK(dev->received[2] == bytes[pin]);
+		CHECK(dev->scratchpad[2] == bytes[pin]);	// TH
+	}
+}
+
+static void test_scratchpads(void) {
+	uint8_t parallel[16][9];
+	uint8_t serial[9];
+	TM_OneWire_t port;
+	uint64_t one, all;
+
+	attach_all();
+	onewire_port_init(&port, GPIOB, PINS_ATTACHED);
+	onewire_port_reset(&port);
+	onewire_port_write_byte(&port, ONEWIRE_CMD_SKIPROM);
+	onewire_port_write_byte(&port, DS18B20_CMD_CONVERTTEMP);
+	HAL_Delay(800);
+
+	all = read_scratchpads_parallel(PINS_ATTACHED, parallel);
+
+	for (int pin = 0; pin < 16; pin++) {
+		TM_OneWire_t onewire;
+
+		if (!(PINS_ATTACHED & (1 << pin))) {
+			continue;
+		}
+
+		TM_OneWire_Init(&onewire, GPIOB, 1 << pin);
+		TM_OneWire_Reset(&onewire);
+		TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_SKIPROM);
+		TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_RSCRATCHPAD);
+		TM_OneWire_ReadBytes(&onewire, serial, 9);
+
+		CHECK(memcmp(parallel[pin], onewire_sim[pin].scratchpad, 9) == 0);
+		CHECK(memcmp(parallel[pin], serial, 9) == 0);
+		CHECK(TM_OneWire_CRC8(serial, 8) == serial[8]);
+	}
+
+	// one transaction costs the same for one slot as for all of them
+	one = read_scratchpads_parallel(0x0001, parallel);
+	CHECK(one == all);
+	printf("scratchpad read: %llu us for 1 slot, %llu us for 15 slots\n",
+			(unsigned long long) one, (unsigned long long) all);
+}
+
+int main(void) {
+	timing_init();
+
+	test_roms();
+	test_write_bytes();
+	test_scratchpads();
+
+	return host_report("onewire_port");
+}
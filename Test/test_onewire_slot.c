@@ -0,0 +1,134 @@
+/**
+ ******************************************************************************
+ * @file    test_onewire_slot.c
+ * @brief  Overhead of the ONEWIRE_* pin macros within a bit slot
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * Compares the register macros of tm_stm32_onewire.h with the former HAL path
+ * (HAL_GPIO_WritePin(), HAL_GPIO_ReadPin() and the MODER loops of TM_GPIO_SetPinAsInput() and
+ * TM_GPIO_SetPinAsOutput()):
+ * - both have to leave the port in the same state after every step of a slot
+ * - the time of the pin accesses of a read slot (delays left out) is measured on the host and
+ *   printed next to the number of GPIO register accesses of the macros
+ *
+ * The host times only show the relation, the target runs the code from flash at 48MHz.
+ *
+ ******************************************************************************
+ */
+
+#include <time.h>
+#include "tm_stm32_onewire.h"
+
+#define RUNS		2000000
+
+/* the pin macros before they accessed the registers directly */
+#define OLD_LOW(s)			HAL_GPIO_WritePin((s)->GPIOx, (s)->GPIO_Pin, GPIO_PIN_RESET)
+#define OLD_INPUT(s)		TM_GPIO_SetPinAsInput((s)->GPIOx, (s)->GPIO_Pin)
+#define OLD_OUTPUT(s)		TM_GPIO_SetPinAsOutput((s)->GPIOx, (s)->GPIO_Pin)
+#define OLD_READ(s)			HAL_GPIO_ReadPin((s)->GPIOx, (s)->GPIO_Pin)
+
+/**
+ * @return 1 if the pin pulls the line low: output mode (MODER 01b) and the output bit cleared
+ */
+static int driven_low(GPIO_TypeDef *GPIOx, int pin) {
+	// the set/reset registers are write only on the target
+	GPIOx->ODR |= GPIOx->BSRR & 0xFFFF;
+	GPIOx->ODR &= ~(GPIOx->BSRR >> 16);
+	GPIOx->ODR &= ~GPIOx->BRR;
+	GPIOx->BSRR = 0;
+	GPIOx->BRR = 0;
+
+	return ((GPIOx->MODER >> (2 * pin)) & 0x03) == 0x01 && !(GPIOx->ODR & (1 << pin));
+}
+
+static void test_same_effect(void) {
+	for (int pin = 0; pin < 16; pin++) {
+		TM_OneWire_t onewire;
+		GPIO_TypeDef initial;
+		int low_old, low_new, released_old, released_new;
+
+		GPIOC->MODER = 0x5A5A5A5A;
+		GPIOC->ODR = 0xA5A5;
+		TM_OneWire_Init(&onewire, GPIOC, 1 << pin);
+		(void) driven_low(GPIOC, pin);	// applies the release of TM_OneWire_Init()
+		initial = *GPIOC;
+
+		OLD_LOW(&onewire);
+		OLD_OUTPUT(&onewire);
+		low_old = driven_low(GPIOC, pin);
+		OLD_INPUT(&onewire);
+		released_old = !driven_low(GPIOC, pin);
+
+		*GPIOC = initial;
+		ONEWIRE_LOW(&onewire);
+		ONEWIRE_OUTPUT(&onewire);
+		low_new = driven_low(GPIOC, pin);
+		ONEWIRE_INPUT(&onewire);
+		released_new = !driven_low(GPIOC, pin);
+
+		CHECK(low_old && low_new);
+		CHECK(released_old && released_new);
+
+		// the other pins keep their mode
+		CHECK((GPIOC->MODER & ~(0x03 << (2 * pin)))
+				== (initial.MODER & ~(0x03 << (2 * pin))));
+
+		GPIOC->IDR = 1 << pin;
+		CHECK(ONEWIRE_READ(&onewire) == OLD_READ(&onewire));
+		GPIOC->IDR = ~(1 << pin);
+		CHECK(ONEWIRE_READ(&onewire) == OLD_READ(&onewire));
+	}
+}
+
+static double ns_since(const struct timespec *start) {
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	return (end.tv_sec - start->tv_sec) * 1e9 + (end.tv_nsec - start->tv_nsec);
+}
+
+static void benchmark(void) {
+	TM_OneWire_t onewire;
+	struct timespec start;
+	volatile uint32_t bits = 0;
+	double old_ns, new_ns;
+
+	TM_OneWire_Init(&onewire, GPIOC, 1 << 13);
+
+	// read slot: low, output, input, read
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < RUNS; i++) {
+		OLD_LOW(&onewire);
+		OLD_OUTPUT(&onewire);
+		OLD_INPUT(&onewire);
+		bits += OLD_READ(&onewire);
+	}
+	old_ns = ns_since(&start) / RUNS;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (int i = 0; i < RUNS; i++) {
+		ONEWIRE_LOW(&onewire);
+		ONEWIRE_OUTPUT(&onewire);
+		ONEWIRE_INPUT(&onewire);
+		bits += ONEWIRE_READ(&onewire);
+	}
+	new_ns = ns_since(&start) / RUNS;
+
+	// the loops test all 16 pins, the macros access each register once (MODER read-modify-write)
+	printf("pin accesses per read slot: HAL path %.1f ns (4 calls, 2 loops of 16), "
+			"registers %.1f ns (%d accesses)\n", old_ns, new_ns,
+			ONEWIRE_OPEN_DRAIN ? 3 : 6);
+	CHECK(new_ns < old_ns);
+	(void) bits;
+}
+
+int main(void) {
+	timing_init();
+
+	test_same_effect();
+	benchmark();
+
+	return host_report("onewire_slot");
+}
@@ -0,0 +1,231 @@
+/**
+ ******************************************************************************
+ * @file    test_onewire_uart.c
+ * @brief  USART/DMA onewire transport against the bit-level protocol
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The USART and its DMA channels are emulated on the pin PA2 of the simulated sensors: every
+ * frame the DMA hands to USART2 is shifted out bit by bit (start bit, 8 data bits LSB first,
+ * stop bit) at the baud rate set in BRR, and every bit is sampled in its middle. The frames thus
+ * have to produce reset pulses and bit slots the sensors of onewire_sim.c understand, and the
+ * frames received have to decode to what the sensors sent.
+ *
+ * With the DMA stuck, the transfers have to time out instead of hanging.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "onewire_uart.h"
+#include "tm_stm32_ds18b20.h"
+#include "onewire_sim.h"
+
+#define PIN		2		// PA2 is USART2_TX
+
+static int dma_stuck;
+static int transferring;
+static uint32_t frames;
+
+/**
+ * Drives the line for one bit time and samples it in the middle.
+ * @return Line level
+ */
+static uint8_t line_bit(uint8_t level, uint32_t cycles) {
+	uint8_t sampled;
+
+	if (level) {
+		GPIOA->BSRR = 1 << PIN;
+	} else {
+		GPIOA->BRR = 1 << PIN;
+	}
+
+	host_advance(cycles / 2);
+	onewire_sim_update();
+	sampled = (GPIOA->IDR >> PIN) & 0x01;
+	host_advance(cycles - cycles / 2);
+	onewire_sim_update();
+
+	return sampled;
+}
+
+/**
+ * USART2 with DMA1 channel 7 (TX) and 6 (RX): performs a transfer as soon as it is started.
+ */
+static void usart_dma(void) {
+	DMA_Channel_TypeDef *tx = DMA1_Channel7;
+	DMA_Channel_TypeDef *rx = DMA1_Channel6;
+	uint32_t cycles;
+	uint8_t *buffer;
+
+	// the flag clear register is write only on the target, CGIFx clears all flags of channel x
+	for (int channel = 0; channel < 7; channel++) {
+		if (DMA1->IFCR & (DMA_IFCR_CGIF1 << (4 * channel))) {
+			DMA1->IFCR |= 0x0F << (4 * channel);
+		}
+	}
+	DMA1->ISR &= ~DMA1->IFCR;
+	DMA1->IFCR = 0;
+
+	if (transferring) {
+		// the time passing within the transfer
+		onewire_sim_update();
+		return;
+	}
+	onewire_sim_update();
+
+	if (dma_stuck || !(tx->CCR & DMA_CCR_EN) || !tx->CNDTR) {
+		return;
+	}
+
+	transferring = 1;
+
+	// the address registers are 32 bit wide, the test is linked without PIE
+	buffer = (uint8_t *) (uintptr_t) tx->CMAR;
+	cycles = USART2->BRR * (SystemCoreClock / HAL_RCC_GetPCLK1Freq());
+
+	for (uint32_t i = 0; i < tx->CNDTR; i++) {
+		uint8_t received = 0;
+
+		line_bit(0, cycles);	// start bit
+		for (int bit = 0; bit < 8; bit++) {
+			received |= line_bit((buffer[i] >> bit) & 0x01, cycles) << bit;
+		}
+		line_bit(1, cycles);	// stop bit
+
+		// RX writes to the same buffer, one frame behind TX
+		((uint8_t *) (uintptr_t) rx->CMAR)[i] = received;
+		frames++;
+	}
+
+	tx->CNDTR = 0;
+	rx->CNDTR = 0;
+	DMA1->ISR |= DMA_ISR_TCIF6 | DMA_ISR_TCIF7;
+	transferring = 0;
+}
+
+static void setup(TM_OneWire_t *onewire) {
+	onewire_sim_init(GPIOA);
+	onewire_sim_attach(PIN, 0x28, 0x77, 21 * 16 + 4);
+	host_tick_hook = usart_dma;
+
+	// the TX pin in open-drain mode, released
+	GPIOA->MODER |= 0x01 << (2 * PIN);
+	GPIOA->ODR |= 1 << PIN;
+
+	dma_stuck = 0;
+	frames = 0;
+	TM_OneWire_InitUSART(onewire, USART2);
+}
+
+static void test_encoding(void) {
+	uint8_t bytes[ONEWIRE_UART_MAX_BYTES] = { 0x00, 0xFF, 0xA5, 0x5A, 0x01, 0x80,
+			0x3C, 0xC3, 0x44 };
+	uint8_t slots[8 * ONEWIRE_UART_MAX_BYTES];
+	uint8_t decoded[ONEWIRE_UART_MAX_BYTES];
+
+	onewire_uart_encode(bytes, ONEWIRE_UART_MAX_BYTES, slots);
+	for (int i = 0; i < 8 * ONEWIRE_UART_MAX_BYTES; i++) {
+		uint8_t bit = (bytes[i / 8] >> (i % 8)) & 0x01;
+
+		CHECK(slots[i] == (bit ? ONEWIRE_UART_SLOT_1 : ONEWIRE_UART_SLOT_0));
+	}
+
+	onewire_uart_decode(slots, ONEWIRE_UART_MAX_BYTES, decoded);
+	CHECK(memcmp(decoded, bytes, sizeof(bytes)) == 0);
+
+	// a sensor pulling a read slot low changes the frame received, whatever bits it hits
+	slots[8] = ONEWIRE_UART_SLOT_1 & 0xFC;
+	onewire_uart_decode(&slots[8], 1, decoded);
+	CHECK(decoded[0] == 0xFE);
+}
+
+static void test_presence(void) {
+	TM_OneWire_t onewire;
+
+	setup(&onewire);
+	CHECK(TM_OneWire_Reset(&onewire) == 0);
+	CHECK(onewire_sim[PIN].resets == 1);
+	CHECK(USART2->BRR == HAL_RCC_GetPCLK1Freq() / ONEWIRE_UART_BAUD_DATA);
+
+	onewire_sim[PIN].present = 0;
+	CHECK(TM_OneWire_Reset(&onewire) == 1);
+}
+
+static void test_transfers(void) {
+	TM_OneWire_t onewire;
+	uint8_t data[9];
+	uint8_t config[3] = { 0x12, 0x34, 0x3F };
+
+	setup(&onewire);
+
+	// the ROM by the search, bit by bit
+	CHECK(TM_OneWire_First(&onewire));
+	CHECK(memcmp(onewire.ROM_NO, onewire_sim[PIN].rom, 8) == 0);
+	CHECK(!TM_OneWire_Next(&onewire));
+
+	// bytes written in one transfer each
+	TM_OneWire_Reset(&onewire);
+	TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_SKIPROM);
+	TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_WSCRATCHPAD);
+	frames = 0;
+	CHECK(onewire_uart_write_bytes(USART2, config, 3) == 0);
+	CHECK(frames == 24);
+	CHECK(memcmp(&onewire_sim[PIN].scratchpad[2], config, 3) == 0);
+
+	// a conversion and the scratchpad in one transfer
+	TM_OneWire_Reset(&onewire);
+	TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_SKIPROM);
+	TM_OneWire_WriteByte(&onewire, DS18B20_CMD_CONVERTTEMP);
+	HAL_Delay(200);		// 10 bit resolution
+	CHECK(TM_OneWire_ReadBit(&onewire) == 1);
+
+	TM_OneWire_Reset(&onewire);
+	TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_SKIPROM);
+	TM_OneWire_WriteByte(&onewire, ONEWIRE_CMD_RSCRATCHPAD);
+	frames = 0;
+	TM_OneWire_ReadBytes(&onewire, data, 9);
+	CHECK(frames == 72);
+	CHECK(memcmp(data, onewire_sim[PIN].scratchpad, 9) == 0);
+	CHECK(TM_OneWire_CRC8(data, 8) == data[8]);
+	CHECK(data[0] == (uint8_t ) (21 * 16 + 4));
+}
+
+static void test_timeout(void) {
+	TM_OneWire_t onewire;
+	uint8_t data[9];
+	uint64_t start;
+
+	setup(&onewire);
+	dma_stuck = 1;
+
+	start = host_now_us();
+	CHECK(onewire_uart_reset(USART2) == 1);
+	CHECK(host_now_us() - start < 3000);
+
+	start = host_now_us();
+	CHECK(onewire_uart_write_bytes(USART2, data, 9) == 1);
+	CHECK(onewire_uart_read_bytes(USART2, data, 9) == 1);
+	CHECK(host_now_us() - start < 2 * 20000);
+	for (int i = 0; i < 9; i++) {
+		CHECK(data[i] == 0xFF);
+	}
+
+	CHECK(onewire_uart_bit(USART2, 0) == 1);
+	CHECK(onewire_sim[PIN].resets == 0);
+
+	// the next transfer works again
+	dma_stuck = 0;
+	CHECK(onewire_uart_reset(USART2) == 0);
+}
+
+int main(void) {
+	timing_init();
+
+	test_encoding();
+	test_presence();
+	test_transfers();
+	test_timeout();
+
+	return host_report("onewire_uart");
+}
@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * @file    test_profile.c
+ * @brief  Profiler statistics on the host clock (PROFILE_ENABLED and PROFILE_HOST)
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The zones are timed with clock_gettime() converted to #PROFILE_HOST_CLOCK cycles. Busy waits
+ * of a known length run inside the zones:
+ * - a zone entered repeatedly with two lengths has to count every pass, keep the shorter as
+ *   minimum, the longer as maximum and their sum as total
+ * - nested zones are timed independently, the outer one includes the inner ones
+ *
+ * The host can be preempted, so the times are only checked as lower bounds and against each
+ * other.
+ *
+ * The columns of the dumps are put together by profile_number() (no printf), it has to give the
+ * same text as " %*lu".
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include <time.h>
+#include "profile.h"
+
+/* cycles of a busy wait of us */
+#define CYCLES(us)		((us) * (PROFILE_HOST_CLOCK / 1000000))
+
+static void spin_us(uint32_t us) {
+	struct timespec start, now;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+	} while ((now.tv_sec - start.tv_sec) * 1000000000L + (now.tv_nsec - start.tv_nsec)
+			< us * 1000L);
+}
+
+static void test_repeated(void) {
+	const Profile_Stats *s = profile_stats(PROFILE_USART_TX);
+
+	profile_reset();
+
+	for (int i = 0; i < 100; i++) {
+		PROFILE_BEGIN(PROFILE_USART_TX);
+		spin_us(i & 1 ? 200 : 20);
+		PROFILE_END(PROFILE_USART_TX);
+	}
+
+	CHECK(s->count == 100);
+	CHECK(s->min >= CYCLES(20) && s->min < CYCLES(200));
+	CHECK(s->max >= CYCLES(200));
+	CHECK(s->total >= 50 * CYCLES(20) + 50 * CYCLES(200));
+	CHECK(s->total >= (uint64_t) s->count * s->min);
+	CHECK(s->total <= (uint64_t) s->count * s->max);
+
+	// the other zones are untouched
+	CHECK(profile_stats(PROFILE_ONEWIRE)->count == 0);
+	CHECK(profile_stats(PROFILE_LCD)->total == 0);
+
+	profile_reset();
+	CHECK(s->count == 0 && s->max == 0 && s->total == 0);
+}
+
+static void test_nested(void) {
+	const Profile_Stats *outer = profile_stats(PROFILE_ONEWIRE);
+	const Profile_Stats *inner = profile_stats(PROFILE_LCD);
+
+	profile_reset();
+
+	for (int i = 0; i < 10; i++) {
+		PROFILE_BEGIN(PROFILE_ONEWIRE);
+		for (int j = 0; j < 3; j++) {
+			PROFILE_BEGIN(PROFILE_LCD);
+			spin_us(50);
+			PROFILE_END(PROFILE_LCD);
+		}
+		spin_us(100);
+		PROFILE_END(PROFILE_ONEWIRE);
+	}
+
+	CHECK(inner->count == 30);
+	CHECK(inner->min >= CYCLES(50));
+	CHECK(outer->count == 10);
+	CHECK(outer->min >= CYCLES(3 * 50 + 100));
+	CHECK(outer->total >= inner->total + 10 * CYCLES(100));
+	CHECK(outer->min >= 3 * inner->min);
+
+	profile_dump();
+}
+
+static void test_number(void) {
+	static const uint32_t values[] = { 0, 7, 42, 99999, 100000, 123456789, 4294967295u };
+	char line[32], expected[32];
+
+	for (unsigned i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+		for (uint8_t width = 0; width <= 12; width += 3) {
+			char *end = profile_number(line, values[i], width);
+
+			snprintf(expected, sizeof(expected), " %*lu", width, (unsigned long) values[i]);
+			CHECK(strcmp(line, expected) == 0);
+			CHECK(end == line + strlen(expected));
+		}
+	}
+
+	// columns one after the other
+	strcpy(line, "x");
+	profile_number(profile_number(line + 1, 12, 4), 3, 2);
+	CHECK(strcmp(line, "x   12  3") == 0);
+}
+
+int main(void) {
+	test_number();
+	test_repeated();
+	test_nested();
+
+	return host_report("profile");
+}
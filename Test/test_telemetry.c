@@ -0,0 +1,220 @@
+/**
+ ******************************************************************************
+ * @file    test_telemetry.c
+ * @brief  Telemetry frames through the queues and the simulated bxCAN of can_sim.c
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * A receiver on the simulated bus decodes every telemetry frame sent with telemetry_decode():
+ * - the values have to arrive as they were read (clamped to the 12 bit range), invalid slots
+ *   as invalid, for banks with and without a short last group
+ * - in delta mode, only the changed groups may be sent. A group that didn't fit into the
+ *   transmit queue must not count as sent, the next call has to send it.
+ *
+ * The bits on the bus per update are printed for a full update, a delta update and one frame
+ * per slot.
+ *
+ ******************************************************************************
+ */
+
+#include <string.h>
+#include "telemetry.h"
+#include "can_stats.h"
+#include "can_sim.h"
+
+static DS1820_Bank_Context ctx;
+static Telemetry_Encoder enc;
+
+/* the receiver */
+static int16_t received[DS1820_BANK_SLOTS];
+static uint16_t received_valid;
+static uint32_t received_frames;
+static uint32_t received_bits;
+static uint8_t received_seq;
+static int malformed;
+
+static void receive(const CAN_Bus_Frame *frame) {
+	if (frame->id != TELEMETRY_CAN_ID) {
+		return;
+	}
+	if (!telemetry_decode(frame->data, frame->dlc, &received_seq, received,
+			&received_valid)) {
+		malformed++;
+	}
+	received_frames++;
+	received_bits += can_stats_frame_bits(frame->flags, frame->dlc);
+}
+
+static void setup(uint8_t n) {
+	can_sim_init();
+	can_sim.tx_hook = receive;
+	can_bus_init();
+	telemetry_init(&enc);
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.n = n;
+	for (int i = 0; i < DS1820_BANK_SLOTS; i++) {
+		ctx.temperature[i] = TM_DS18B20_TEMP_INVALID;
+		received[i] = TM_DS18B20_TEMP_INVALID;
+	}
+	received_valid = 0;
+	received_frames = 0;
+	received_bits = 0;
+	malformed = 0;
+}
+
+/**
+ * Queues the frames of an update and sends them.
+ * @return Number of frames queued
+ */
+static uint8_t update(uint8_t delta) {
+	uint8_t queued = telemetry_send(&enc, &ctx, delta);
+
+	can_sim_run();
+
+	return queued;
+}
+
+/**
+ * @return 1 if the receiver has the values of all slots of the bank
+ */
+static int in_sync(void) {
+	for (int i = 0; i < ctx.n; i++) {
+		int16_t expected = ctx.temperature[i];
+
+		if (expected != TM_DS18B20_TEMP_INVALID) {
+			if (expected < TELEMETRY_OFFSET) {
+				expected = TELEMETRY_OFFSET;
+			} else if (expected > TELEMETRY_OFFSET + TELEMETRY_VALUE_MAX) {
+				expected = TELEMETRY_OFFSET + TELEMETRY_VALUE_MAX;
+			}
+		}
+		if (received[i] != expected
+				|| ((received_valid >> i) & 1) != (expected != TM_DS18B20_TEMP_INVALID)) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+static void test_round_trip(void) {
+	static const uint8_t banks[] = { DS1820_BANK_SLOTS, 13, 1 };
+
+	for (unsigned b = 0; b < sizeof(banks); b++) {
+		uint8_t n = banks[b];
+
+		setup(n);
+		// -60 degC and 250 degC are clamped, 0 degC, fractions and invalid slots
+		for (int i = 0; i < n; i++) {
+			ctx.temperature[i] = (i % 5 == 3) ? TM_DS18B20_TEMP_INVALID : -60 * 16 + i * 311;
+		}
+		ctx.temperature[0] = 0;
+		ctx.temperature[n - 1] = 250 * 16;
+
+		CHECK(update(0) == (n + TELEMETRY_SLOTS_PER_FRAME - 1) / TELEMETRY_SLOTS_PER_FRAME);
+		CHECK(malformed == 0);
+		CHECK(in_sync());
+		// the last group of 13 slots is a single 12 bit value
+		if (n % TELEMETRY_SLOTS_PER_FRAME) {
+			CHECK(can_sim.sent[(can_sim.sent_count - 1) & (CAN_SIM_LOG_LENGTH - 1)].dlc
+					== 2 + (12 * (n % TELEMETRY_SLOTS_PER_FRAME) + 7) / 8);
+		}
+	}
+}
+
+/**
+ * Fills the transmit mailboxes and the queue, leaving \p free entries.
+ */
+static void fill_queue(uint8_t free) {
+	CAN_Bus_Frame frame = { .id = 0x7FF, .dlc = 0 };
+
+	while (can_bus_tx_pending() < CAN_BUS_TX_QUEUE_LENGTH - free) {
+		CHECK(can_bus_send(&frame));
+	}
+}
+
+static void test_delta(void) {
+	uint8_t seq;
+
+	setup(DS1820_BANK_SLOTS);
+	for (int i = 0; i < DS1820_BANK_SLOTS; i++) {
+		ctx.temperature[i] = 20 * 16 + i;
+	}
+
+	// every group once, then nothing
+	CHECK(update(1) == 4);
+	CHECK(in_sync());
+	CHECK(update(1) == 0);
+
+	// a changed slot and a slot that became invalid: their groups
+	ctx.temperature[5]++;
+	ctx.temperature[14] = TM_DS18B20_TEMP_INVALID;
+	received_frames = 0;
+	CHECK(update(1) == 2);
+	CHECK(received_frames == 2);
+	CHECK(in_sync());
+
+	// beyond the 12 bit range nothing changes on the bus
+	ctx.temperature[0] = 300 * 16;
+	CHECK(update(1) == 1);
+	ctx.temperature[0] = 301 * 16;
+	CHECK(update(1) == 0);
+
+	// the queue is full: nothing is sent, nothing counts as sent
+	seq = received_seq;
+	ctx.temperature[1]++;
+	ctx.temperature[13]++;
+	fill_queue(0);
+	CHECK(telemetry_send(&enc, &ctx, 1) == 0);
+	can_sim_run();
+	CHECK(!in_sync());
+
+	// room for one frame: the first group, the sequence number advances by one
+	fill_queue(1);
+	CHECK(telemetry_send(&enc, &ctx, 1) == 1);
+	can_sim_run();
+	CHECK(received_seq == (uint8_t) (seq + 1));
+
+	// the group that didn't fit follows with the next call
+	received_frames = 0;
+	CHECK(update(1) == 1);
+	CHECK(received_frames == 1);
+	CHECK(received_seq == (uint8_t) (seq + 2));
+	CHECK(in_sync());
+	CHECK(update(1) == 0);
+	CHECK(malformed == 0);
+}
+
+static void test_bandwidth(void) {
+	uint32_t full, delta, single;
+
+	setup(DS1820_BANK_SLOTS);
+	for (int i = 0; i < DS1820_BANK_SLOTS; i++) {
+		ctx.temperature[i] = 45 * 16 + 3 * i;
+	}
+
+	update(0);
+	full = received_bits;
+
+	received_bits = 0;
+	ctx.temperature[7] += 2;
+	update(1);
+	delta = received_bits;
+
+	// one frame per slot: a 16 bit value each
+	single = DS1820_BANK_SLOTS * can_stats_frame_bits(0, 2);
+
+	CHECK(full < single);
+	CHECK(delta * 4 == full);
+	printf("bits per update of %d slots: %u packed, %u delta (one slot changed), "
+			"%u one frame per slot\n", DS1820_BANK_SLOTS, full, delta, single);
+}
+
+int main(void) {
+	test_round_trip();
+	test_delta();
+	test_bandwidth();
+
+	return host_report("telemetry");
+}
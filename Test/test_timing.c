@@ -0,0 +1,103 @@
+/**
+ ******************************************************************************
+ * @file    test_timing.c
+ * @brief  64 bit timebase of timing.c across wraps of the 32 bit cycle counter
+ * @author  MemAllox
+ ******************************************************************************
+ *
+ * The host cycle counter is started just below its wrap. timing_cycles() has to follow the
+ * simulated time (which does not wrap) over several wraps, deadlines and delays have to span a
+ * wrap without ending early or late.
+ *
+ ******************************************************************************
+ */
+
+#include "timing.h"
+
+#define NEAR_WRAP	0xFFFFF000
+
+static void start_near_wrap(void) {
+	host_cycle_count = NEAR_WRAP;
+	timing_cycles();
+}
+
+static void test_monotonic(void) {
+	uint64_t offset, last;
+	uint32_t mismatches = 0;
+
+	start_near_wrap();
+	offset = timing_cycles() - host_time;
+	last = timing_cycles();
+
+	// about 5 wraps, with steps below and above the distance to the next wrap
+	for (int i = 0; i < 20000; i++) {
+		uint64_t now;
+
+		host_advance(1000000 + (i % 7) * 100003);
+		now = timing_cycles();
+
+		mismatches += now <= last;
+		mismatches += now - host_time != offset;
+		last = now;
+	}
+
+	CHECK(mismatches == 0);
+	CHECK(host_time + offset > 4 * 0x100000000ULL);
+}
+
+static void test_now_us(void) {
+	uint64_t before, after;
+
+	start_near_wrap();
+	before = timing_now_us();
+	host_advance_ms(10);
+	after = timing_now_us();
+
+	CHECK(after - before >= 10000);
+	CHECK(after - before <= 10001);
+}
+
+static void test_deadline(void) {
+	uint64_t deadline;
+	uint64_t start;
+
+	start_near_wrap();
+	start = host_time;
+	deadline = timing_deadline_us(1000);		// the counter wraps after ~85us
+
+	// bounded, a lost wrap would put the deadline out of reach
+	while (!timing_deadline_reached(deadline) && host_time - start < 2000 * 48);
+
+	CHECK(host_time - start >= 1000 * 48);
+	CHECK(host_time - start <= 1002 * 48);
+}
+
+static void test_delay(void) {
+	uint64_t start;
+
+	start_near_wrap();
+	start = host_time;
+	timing_delay_us(500);
+
+	CHECK(host_time - start >= 500 * 48);
+	CHECK(host_time - start <= 502 * 48);
+
+	// split into several waits of 1s
+	start_near_wrap();
+	start = host_time;
+	timing_delay_us(2500000);
+
+	CHECK(host_time - start >= 2500000ULL * 48);
+	CHECK(host_time - start <= 2500002ULL * 48);
+}
+
+int main(void) {
+	timing_init();
+
+	test_monotonic();
+	test_now_us();
+	test_deadline();
+	test_delay();
+
+	return host_report("timing");
+}